@@ -12,9 +12,11 @@ QMAKE_QDBUSXML2CPP = $$[QT_INSTALL_BINS]/qdbusxml2cpp -i mabstractappinterface.h
 
 publicHeaders.files = mabstractdecorator.h mrmiclient.h mrmiserver.h \
 		      mabstractappinterface.h mdecorator_dbus_interface.h
-HEADERS += $${publicHeaders.files} mrmiclient_p.h mrmiserver_p.h
+HEADERS += $${publicHeaders.files} mrmiclient_p.h mrmiserver_p.h \
+           mrmiprotocol_p.h mdecoratorchannel.h
 SOURCES += mabstractdecorator.cpp mrmiclient.cpp mrmiserver.cpp \
-           mabstractappinterface.cpp
+           mabstractappinterface.cpp mdecoratorchannel.cpp
+LIBS += -lrt
 PRE_TARGETDEPS += mdecorator_dbus_interface.h
 
 publicHeaders.path = $$M_INSTALL_HEADERS/libdecorator
@@ -22,6 +22,7 @@
 #include "mabstractdecorator.h"
 #include <mrmiserver.h>
 #include <mrmiclient.h>
+#include "mdecoratorchannel.h"
 #include <QX11Info>
 #include <QRect>
 #include <QRegion>
@@ -40,6 +41,12 @@ public:
     Qt::HANDLE client;
     MRmiClient* remote_compositor;
     QRect clientGeometry;
+
+    // The state is exchanged through @channel if it's valid, and also
+    // with RMI unless the compositor has attached to it.  @peer is what
+    // we last got from the compositor and @own is what we've told it.
+    MDecoratorChannel* channel;
+    MDecoratorChannel::State peer, own;
     MAbstractDecorator* q_ptr;
 };
 
@@ -52,6 +59,15 @@ MAbstractDecorator::MAbstractDecorator(QObject *parent)
     MRmiServer *s = new MRmiServer(".mabstractdecorator", this);
     s->exportObject(this);
     d->remote_compositor = new MRmiClient(".mcompositor", this);
+
+    memset(&d->peer, 0, sizeof(d->peer));
+    memset(&d->own, 0, sizeof(d->own));
+    d->channel = new MDecoratorChannel(MDecoratorChannel::DecoratorSide,
+                                       this);
+    if (d->channel->isValid()) {
+        connect(d->channel, SIGNAL(changed()), SLOT(channelChanged()));
+        d->channel->start();
+    }
 }
 
 MAbstractDecorator::~MAbstractDecorator()
@@ -134,9 +150,34 @@ void MAbstractDecorator::setAvailableGeometry(const QRect& rect)
 {
     Q_D(MAbstractDecorator);
 
+    if (d->channel->isValid()) {
+        MDecoratorChannel::fromRect(d->own.available_rect, rect);
+        d->channel->publish(d->own);
+        if (d->channel->peerAttached())
+            return;
+    }
     d->remote_compositor->invoke("MCompositeManager", "decoratorRectChanged", rect);
 }
 
+void MAbstractDecorator::channelChanged()
+{
+    Q_D(MAbstractDecorator);
+    MDecoratorChannel::State s = d->channel->peerState();
+
+    // Act on what has changed since the last time, in the order
+    // the compositor used to send it over RMI.
+    d->clientGeometry = MDecoratorChannel::toRect(s.client_geometry);
+    if (s.auto_rotation != d->peer.auto_rotation)
+        setAutoRotation(s.auto_rotation);
+    if (s.managed_serial != d->peer.managed_serial) {
+        d->client = s.managed_window;
+        manageEvent(d->client);
+    }
+    if (s.only_statusbar != d->peer.only_statusbar)
+        setOnlyStatusbar(s.only_statusbar);
+    d->peer = s;
+}
+
 void MAbstractDecorator::queryDialogAnswer(unsigned int w, bool a)
 {
     Q_D(MAbstractDecorator);
@@ -112,6 +112,9 @@ protected:
       */
     virtual void showQueryDialog(bool visible) = 0;
 
+private slots:
+    void channelChanged();
+
 private:
     
     Q_DECLARE_PRIVATE(MAbstractDecorator)
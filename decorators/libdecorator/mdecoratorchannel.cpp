@@ -0,0 +1,205 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "mdecoratorchannel.h"
+
+#include <QtDebug>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <string.h>
+#include <sched.h>
+#include <signal.h>
+
+// The version is bumped whenever the layout changes, so that sides of
+// different versions don't share a segment and use RMI instead.
+#define SEGMENT_PREFIX "/mcompositor-decorator-2"
+
+// Returns the name of the segment of our user on our display, so that
+// the compositors of other displays or users don't interfere:
+// SEGMENT_PREFIX-<uid>-<display>, the display without the screen number.
+static QByteArray segmentName()
+{
+    QByteArray display(getenv("DISPLAY"));
+    int colon = display.lastIndexOf(':');
+    int dot = display.indexOf('.', colon < 0 ? 0 : colon);
+    if (dot >= 0)
+        display.truncate(dot);
+    // shm_open() doesn't take further slashes
+    display.replace('/', '_');
+    return SEGMENT_PREFIX "-" + QByteArray::number(getuid())
+        + '-' + display;
+}
+
+// What one side publishes.  @seq is odd while @state is being written,
+// the reader retries until it reads the same even @seq before and after
+// copying the state.  @doorbell is incremented after every publication.
+// @pid is the owner of the slot, or 0 if it has detached.
+struct Slot {
+    volatile quint32 seq;
+    volatile int doorbell;
+    volatile qint32 pid;
+    MDecoratorChannel::State state;
+};
+
+struct MDecoratorChannel::Shared {
+    Slot sides[2];
+};
+
+static int futex(volatile int *addr, int op, int val,
+                 const struct timespec *timeout)
+{
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+MDecoratorChannel::MDecoratorChannel(Side side, QObject *parent)
+    : QThread(parent), side(side), shared(0), quit(false)
+{
+    // Whichever side comes first creates the segment, zero-filled.
+    // It's not unlinked so that either side can be restarted.
+    QByteArray name = segmentName();
+    int fd = shm_open(name.constData(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        qWarning("%s: shm_open: %s", __func__, strerror(errno));
+        return;
+    }
+
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, sizeof(Shared)) == 0)
+        p = mmap(NULL, sizeof(Shared), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+    if (p != MAP_FAILED)
+        shared = (Shared *)p;
+    else
+        qWarning("%s: couldn't map %s: %s", __func__, name.constData(),
+                 strerror(errno));
+    close(fd);
+    if (!shared)
+        return;
+
+    // Forget what a previous instance of our side has left behind and
+    // announce ourselves.  The other side is not woken up, it has no
+    // news until we publish something.
+    Slot &out = shared->sides[side];
+    quint32 seq = out.seq | 1;
+    out.seq = seq;
+    __sync_synchronize();
+    memset((void *)&out.state, 0, sizeof(out.state));
+    out.pid = getpid();
+    __sync_synchronize();
+    out.seq = seq + 1;
+}
+
+MDecoratorChannel::~MDecoratorChannel()
+{
+    if (!shared)
+        return;
+    if (isRunning()) {
+        // Wake up run() without telling the other side anything.
+        Slot &in = shared->sides[side == CompositorSide ? DecoratorSide
+                                                        : CompositorSide];
+        quit = true;
+        __sync_fetch_and_add(&in.doorbell, 1);
+        futex(&in.doorbell, FUTEX_WAKE, INT_MAX, NULL);
+        wait();
+    }
+    // unless another instance of our side has taken over since
+    __sync_bool_compare_and_swap(&shared->sides[side].pid, getpid(), 0);
+    munmap(shared, sizeof(Shared));
+}
+
+bool MDecoratorChannel::peerAttached() const
+{
+    if (!shared)
+        return false;
+    pid_t pid = shared->sides[side == CompositorSide ? DecoratorSide
+                                                     : CompositorSide].pid;
+    // the slot of a crashed process keeps its PID
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+MDecoratorChannel::State MDecoratorChannel::peerState() const
+{
+    const Slot &in = shared->sides[side == CompositorSide ? DecoratorSide
+                                                          : CompositorSide];
+    State state;
+    quint32 seq;
+
+    if (!peerAttached()) {
+        memset(&state, 0, sizeof(state));
+        return state;
+    }
+
+    // If the other side died while publishing don't wait forever,
+    // what we read is as good as anything.
+    int tries = 1000;
+    do {
+        while (((seq = in.seq) & 1) && --tries > 0)
+            sched_yield();
+        __sync_synchronize();
+        state = in.state;
+        __sync_synchronize();
+    } while (in.seq != seq && tries > 0);
+    return state;
+}
+
+void MDecoratorChannel::publish(const State &state)
+{
+    Slot &out = shared->sides[side];
+    // @seq is left odd if our predecessor died while publishing.
+    quint32 seq = out.seq | 1;
+
+    out.seq = seq;
+    __sync_synchronize();
+    out.state = state;
+    __sync_synchronize();
+    out.seq = seq + 1;
+
+    __sync_fetch_and_add(&out.doorbell, 1);
+    futex(&out.doorbell, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+void MDecoratorChannel::run()
+{
+    Slot &in = shared->sides[side == CompositorSide ? DecoratorSide
+                                                    : CompositorSide];
+
+    // Start from 0, so if the other side has published anything before
+    // we're started we'll tell about it.
+    quint32 last = 0;
+    while (!quit) {
+        int bell = in.doorbell;
+        quint32 seq = in.seq;
+
+        if (seq != last && !(seq & 1)) {
+            last = seq;
+            // don't replay the state of a dead predecessor
+            if (peerAttached())
+                emit changed();
+        } else
+            // Returns immediately if @bell is outdated.
+            futex(&in.doorbell, FUTEX_WAIT, bell, NULL);
+    }
+}
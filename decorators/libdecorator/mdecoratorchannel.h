@@ -0,0 +1,118 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef MDECORATORCHANNEL_H
+#define MDECORATORCHANNEL_H
+
+#include <QThread>
+#include <QRect>
+
+/*!
+ * Shared memory channel between the compositor and the decorator for
+ * the state they keep telling each other: the managed window, its
+ * geometry, the area left to it by the decorator and the decorator's
+ * modes.  Each side publishes its latest state in its own slot of a
+ * segment both processes map, one per user and display, and rings the
+ * other side's doorbell,
+ * a futex in the same segment.  A thread waits on the doorbell and
+ * emits changed(), then the receiver reads the latest state without
+ * any marshalling.  Intermediate states may be skipped.
+ *
+ * Each slot is stamped with the PID of its owner, which announces that
+ * the owner follows the channel.  A slot of a process which has gone
+ * away is ignored, and the slot is reset when a side attaches again.
+ * Until the other side has attached the state needs to be sent some
+ * other way as well.
+ */
+class MDecoratorChannel: public QThread
+{
+    Q_OBJECT
+
+public:
+    enum Side {
+        CompositorSide,
+        DecoratorSide
+    };
+
+    //! What a side publishes.  Each side fills in the fields it owns.
+    struct State {
+        //! Set by the compositor.  @managed_serial is incremented every
+        //! time the managed window is (re)sent.
+        quint32 managed_window, managed_serial;
+        qint32 client_geometry[4];
+        quint8 only_statusbar, auto_rotation;
+
+        //! Set by the decorator.
+        qint32 available_rect[4];
+    };
+
+    static QRect toRect(const qint32 *r)
+        { return QRect(r[0], r[1], r[2], r[3]); }
+    static void fromRect(qint32 *r, const QRect &rect)
+        { r[0] = rect.x(); r[1] = rect.y();
+          r[2] = rect.width(); r[3] = rect.height(); }
+
+    /*!
+     * Maps the shared segment, creating it if necessary.  The thread
+     * needs to be start()ed to receive changed() signals.
+     */
+    explicit MDecoratorChannel(Side side, QObject *parent = 0);
+    ~MDecoratorChannel();
+
+    /*!
+     * Returns whether the shared segment could be mapped.  If not the
+     * state needs to be exchanged some other way.
+     */
+    bool isValid() const { return shared != 0; }
+
+    /*!
+     * Returns whether the other side is alive and follows the channel.
+     */
+    bool peerAttached() const;
+
+    /*!
+     * Returns the latest state published by the other side, or a zeroed
+     * state if it's not attached.
+     */
+    State peerState() const;
+
+    /*!
+     * Publishes \a state to the other side.
+     */
+    void publish(const State &state);
+
+signals:
+    /*!
+     * Emitted from the channel's thread when the other side has
+     * published a new state.
+     */
+    void changed();
+
+protected:
+    void run();
+
+private:
+    struct Shared;
+
+    Side side;
+    Shared *shared;
+    volatile bool quit;
+};
+
+#endif
@@ -18,8 +18,13 @@
 ****************************************************************************/
 #include "mrmiclient_p.h"
 #include "mrmiclient.h"
+#include "mrmiprotocol_p.h"
 #include <QDataStream>
 #include <QByteArray>
+#include <QVariant>
+#include <QDebug>
+
+using namespace MRmiProtocol;
 
 MRmiClientPrivate:: MRmiClientPrivate(const QString& key)
         : q_ptr(0)
@@ -31,16 +36,6 @@ MRmiClientPrivate::~MRmiClientPrivate()
 {
 }
 
-void MRmiClientPrivate::initConnection()
-{
-    //unused
-}
-
-void MRmiClientPrivate::finalizeConnection()
-{
-    // unused
-}
-
 QString MRmiClientPrivate::key() const
 {
     return _key;
@@ -48,75 +43,114 @@ QString MRmiClientPrivate::key() const
 
 MRmiClientPrivateSocket::MRmiClientPrivateSocket(const QString& key, MRmiClient *q)
         : MRmiClientPrivate(key),
-        _stream(0),
-        return_sz(0)
+        flush_pending(false)
 {
     q_ptr = q;
     QObject::connect(&_socket, SIGNAL(readyRead()), q_ptr, SLOT(_q_readyRead()));
+    QObject::connect(&_socket, SIGNAL(connected()), q_ptr, SLOT(_q_flush()));
 }
 
-
-void MRmiClientPrivateSocket::initConnection()
+void MRmiClientPrivateSocket::connectToServer()
 {
-    _buf.clear();
-    _stream = new QDataStream(&_buf, QIODevice::WriteOnly);
-    _stream->setVersion(QDataStream::Qt_4_0);
-
-    connectToServer();
-    if (!_socket.waitForConnected())
-        qDebug() << "MRmiClientPrivateSocket" << _socket.errorString() << key();
+    if (_socket.state() == QLocalSocket::UnconnectedState) {
+        // The server may have been restarted and have a different
+        // method table.
+        methods.clear();
+        _in.clear();
+        _socket.connectToServer(key());
+    }
 }
 
-void MRmiClientPrivateSocket::finalizeConnection()
+void MRmiClientPrivateSocket::invoke(const char* method,
+                                     const QVariant* const* args, int argc)
 {
-    uint sz = _buf.size();
-    _stream->device()->seek(0);
-    *_stream << (quint16)(sz - sizeof(quint16));
+    Q_Q(MRmiClient);
+    connectToServer();
 
-    if (_socket.state() == QLocalSocket::ConnectedState) {
-        writeData(_buf);
+    int start = _out.size();
+    QDataStream stream(&_out, QIODevice::WriteOnly | QIODevice::Append);
+    QHash<QByteArray, quint16>::const_iterator it =
+        methods.constFind(methodKey(method, argc));
+    if (it != methods.constEnd()) {
+        beginMessage(stream, CallById);
+        stream << *it;
+    } else {
+        beginMessage(stream, CallByName);
+        stream << QByteArray(method);
+    }
+    stream << (quint8)argc;
+    for (int i = 0; i < argc; ++i)
+        stream << *args[i];
+    endMessage(_out, start);
+
+    // Send everything we're asked in this iteration of the main loop
+    // in a single write.
+    if (!flush_pending) {
+        flush_pending = true;
+        QMetaObject::invokeMethod(q, "_q_flush", Qt::QueuedConnection);
     }
-
-    _socket.close();
-    delete _stream;
-}
-
-QDataStream& MRmiClientPrivateSocket::stream()
-{
-    return *_stream;
 }
 
-void MRmiClientPrivateSocket::writeData(const QByteArray& buffer)
+void MRmiClientPrivateSocket::_q_flush()
 {
-    _socket.write(buffer);
-    _socket.waitForBytesWritten();
-    // _socket.disconnect();
-}
+    flush_pending = false;
+    if (_out.isEmpty())
+        return;
 
-void MRmiClientPrivateSocket::connectToServer()
-{
-    if (_socket.state() == QLocalSocket::UnconnectedState)
-        _socket.connectToServer(key());
+    switch (_socket.state()) {
+    case QLocalSocket::ConnectedState:
+        // QLocalSocket buffers what it can't write right away.
+        _socket.write(_out);
+        _out.clear();
+        break;
+    case QLocalSocket::UnconnectedState:
+        qDebug() << "MRmiClientPrivateSocket" << _socket.errorString() << key();
+        _out.clear();
+        break;
+    default:
+        // wait for connected()
+        break;
+    }
 }
 
-void MRmiClientPrivateSocket::_q_readyRead()
+void MRmiClientPrivateSocket::processMessage(const QByteArray& msg)
 {
     Q_Q(MRmiClient);
-    QDataStream stream(&_socket);
+    QDataStream stream(msg);
     stream.setVersion(QDataStream::Qt_4_0);
 
-    if (return_sz == 0) {
-        if (_socket.bytesAvailable() < (int)sizeof(quint16))
-            return;
-        stream >> return_sz;
+    quint32 sz;
+    quint8 type;
+    stream >> sz >> type;
+    if (type == MethodTable) {
+        quint16 n, index;
+        QByteArray name;
+        quint8 argc;
+
+        stream >> n;
+        methods.clear();
+        while (n-- > 0) {
+            stream >> name >> argc >> index;
+            methods.insert(methodKey(name, argc), index);
+        }
+    } else if (type == ReturnValue) {
+        QVariant v;
+        stream >> v;
+        emit q->returnValue(v);
     }
+}
 
-    if (_socket.bytesAvailable() < return_sz)
-        return;
+void MRmiClientPrivateSocket::_q_readyRead()
+{
+    _in.append(_socket.readAll());
 
-    QVariant v;
-    stream >> v;
-    emit q->returnValue(v);
+    // Process all complete messages.
+    int pos = 0, len;
+    while ((len = messageLength(_in, pos)) > 0) {
+        processMessage(QByteArray::fromRawData(_in.constData() + pos, len));
+        pos += len;
+    }
+    _in.remove(0, pos);
 }
 
 MRmiClient::MRmiClient(const QString& key, QObject* p)
@@ -129,27 +163,11 @@ MRmiClient::~MRmiClient()
     delete d_ptr;
 }
 
-void MRmiClient::initConnection()
-{
-    Q_D(MRmiClient);
-    d->initConnection();
-}
-
-void MRmiClient::finalizeConnection()
-{
-    Q_D(MRmiClient);
-    d->finalizeConnection();
-}
-
 void MRmiClient::invoke(const char* objectName, const char* method)
 {
     Q_D(MRmiClient);
-    initConnection();
-
-    /* packet is composed of |block size|argument length|arguments...| */
-    d->stream() << (quint16)0 << (quint16)0 << objectName << method;
-
-    finalizeConnection();
+    Q_UNUSED(objectName);
+    d->invoke(method, 0, 0);
 }
 
 
@@ -157,19 +175,18 @@ void MRmiClient::invoke(const char* objectName, const char* method,
                           const QVariant& arg0)
 {
     Q_D(MRmiClient);
-    initConnection();
-    d->stream() << (quint16)0 << (quint16)1 << objectName << method << arg0;
-    finalizeConnection();
+    const QVariant* args[] = { &arg0 };
+    Q_UNUSED(objectName);
+    d->invoke(method, args, 1);
 }
 
 void MRmiClient::invoke(const char* objectName, const char* method,
                           const QVariant& arg0, const QVariant& arg1)
 {
     Q_D(MRmiClient);
-    initConnection();
-    d->stream() << (quint16)0 << (quint16)2 << objectName << method << arg0
-    << arg1;
-    finalizeConnection();
+    const QVariant* args[] = { &arg0, &arg1 };
+    Q_UNUSED(objectName);
+    d->invoke(method, args, 2);
 }
 
 void MRmiClient::invoke(const char* objectName, const char* method,
@@ -177,10 +194,9 @@ void MRmiClient::invoke(const char* objectName, const char* method,
                           const QVariant& arg2)
 {
     Q_D(MRmiClient);
-    initConnection();
-    d->stream() << (quint16)0 << (quint16)3 << objectName << method << arg0
-    << arg1 << arg2;
-    finalizeConnection();
+    const QVariant* args[] = { &arg0, &arg1, &arg2 };
+    Q_UNUSED(objectName);
+    d->invoke(method, args, 3);
 }
 
 void MRmiClient::invoke(const char* objectName, const char* method,
@@ -188,10 +204,9 @@ void MRmiClient::invoke(const char* objectName, const char* method,
                           const QVariant& arg2,   const QVariant& arg3)
 {
     Q_D(MRmiClient);
-    initConnection();
-    d->stream() << (quint16)0 << (quint16)4 << objectName << method << arg0
-    << arg1 << arg2 << arg3;
-    finalizeConnection();
+    const QVariant* args[] = { &arg0, &arg1, &arg2, &arg3 };
+    Q_UNUSED(objectName);
+    d->invoke(method, args, 4);
 }
 
 void MRmiClient::invoke(const char* objectName, const char* method,
@@ -200,10 +215,9 @@ void MRmiClient::invoke(const char* objectName, const char* method,
                           const QVariant& arg4)
 {
     Q_D(MRmiClient);
-    initConnection();
-    d->stream() << (quint16)0 << (quint16)5 << objectName << method << arg0
-    << arg1 << arg2 << arg3 << arg4;
-    finalizeConnection();
+    const QVariant* args[] = { &arg0, &arg1, &arg2, &arg3, &arg4 };
+    Q_UNUSED(objectName);
+    d->invoke(method, args, 5);
 }
 
 void MRmiClient::invoke(const char* objectName, const char* method,
@@ -212,11 +226,9 @@ void MRmiClient::invoke(const char* objectName, const char* method,
                           const QVariant& arg4,   const QVariant& arg5)
 {
     Q_D(MRmiClient);
-    initConnection();
-    d->stream() << (quint16)0 << (quint16)6 << objectName << method << arg0
-    << arg1 << arg2 << arg3 << arg4 << arg5;
-    finalizeConnection();
-
+    const QVariant* args[] = { &arg0, &arg1, &arg2, &arg3, &arg4, &arg5 };
+    Q_UNUSED(objectName);
+    d->invoke(method, args, 6);
 }
 
 void MRmiClient::invoke(const char* objectName, const char* method,
@@ -226,10 +238,10 @@ void MRmiClient::invoke(const char* objectName, const char* method,
                           const QVariant& arg6)
 {
     Q_D(MRmiClient);
-    initConnection();
-    d->stream() << (quint16)0 << (quint16)7 << objectName << method << arg0
-    << arg1 << arg2 << arg3 << arg4 << arg5 << arg6;
-    finalizeConnection();
+    const QVariant* args[] = { &arg0, &arg1, &arg2, &arg3, &arg4,
+                               &arg5, &arg6 };
+    Q_UNUSED(objectName);
+    d->invoke(method, args, 7);
 }
 
 void MRmiClient::invoke(const char* objectName, const char* method,
@@ -239,11 +251,10 @@ void MRmiClient::invoke(const char* objectName, const char* method,
                           const QVariant& arg6,   const QVariant& arg7)
 {
     Q_D(MRmiClient);
-    initConnection();
-    d->stream() << (quint16)0 << (quint16)8 << objectName << method << arg0
-    << arg1 << arg2 << arg3 << arg4 << arg5 << arg6 << arg7;
-    finalizeConnection();
-
+    const QVariant* args[] = { &arg0, &arg1, &arg2, &arg3, &arg4,
+                               &arg5, &arg6, &arg7 };
+    Q_UNUSED(objectName);
+    d->invoke(method, args, 8);
 }
 
 void MRmiClient::invoke(const char* objectName, const char* method,
@@ -254,10 +265,10 @@ void MRmiClient::invoke(const char* objectName, const char* method,
                           const QVariant& arg8)
 {
     Q_D(MRmiClient);
-    initConnection();
-    d->stream() << (quint16)0 << (quint16)9 << objectName << method << arg0
-    << arg1 << arg2 << arg3 << arg4 << arg5 << arg6 << arg7 << arg8;
-    finalizeConnection();
+    const QVariant* args[] = { &arg0, &arg1, &arg2, &arg3, &arg4,
+                               &arg5, &arg6, &arg7, &arg8 };
+    Q_UNUSED(objectName);
+    d->invoke(method, args, 9);
 }
 
 void MRmiClient::invoke(const char* objectName, const char* method,
@@ -268,11 +279,10 @@ void MRmiClient::invoke(const char* objectName, const char* method,
                           const QVariant& arg8,   const QVariant& arg9)
 {
     Q_D(MRmiClient);
-    initConnection();
-    d->stream() << (quint16)0 << (quint16)10 << objectName << method << arg0
-    << arg1 << arg2 << arg3 << arg4 << arg5 << arg6 << arg7 << arg8
-    << arg9;
-    finalizeConnection();
+    const QVariant* args[] = { &arg0, &arg1, &arg2, &arg3, &arg4,
+                               &arg5, &arg6, &arg7, &arg8, &arg9 };
+    Q_UNUSED(objectName);
+    d->invoke(method, args, 10);
 }
 
 #include "moc_mrmiclient.cpp"
@@ -52,7 +52,9 @@ public:
     virtual ~MRmiClient();
 
     /*!
-     * Invoked the remote function
+     * Invokes the remote function.  The call is queued and sent together
+     * with the others made in the same iteration of the event loop,
+     * without waiting for the server.
      *
      * \param objectName the name of the remote object. Currently unused
      * \param method literal string of the method name of the remote object
@@ -112,13 +114,11 @@ private:
     Q_DISABLE_COPY(MRmiClient)
     Q_DECLARE_PRIVATE(MRmiClient)
 
-    void initConnection();
-    void finalizeConnection();
-
     MRmiClientPrivate * const d_ptr;
     friend class MRmiClientPrivateSocket;
 
     Q_PRIVATE_SLOT(d_func(), void _q_readyRead())
+    Q_PRIVATE_SLOT(d_func(), void _q_flush())
 };
 
 #endif // QRMICLIENT_H
@@ -21,8 +21,9 @@
 
 #include <QLocalSocket>
 #include <QByteArray>
+#include <QHash>
 
-class QDataStream;
+class QVariant;
 class MRmiClient;
 
 class MRmiClientPrivate
@@ -31,20 +32,17 @@ class MRmiClientPrivate
 public:
     MRmiClientPrivate(const QString& key);
 	virtual ~MRmiClientPrivate();
-    virtual void writeData(const QByteArray&) = 0;
-    virtual void connectToServer() = 0;
-    virtual QDataStream& stream() = 0;
 
-    virtual void initConnection();
-    virtual void finalizeConnection();
+    // Queues a call of @method with @argc arguments.
+    virtual void invoke(const char* method,
+                        const QVariant* const* args, int argc) = 0;
 
     QString key() const;
 
-    void returnValue(const QVariant& v);
-
     MRmiClient * q_ptr;
 
     virtual void _q_readyRead() = 0;
+    virtual void _q_flush() = 0;
 private:
     QString _key;
 };
@@ -56,19 +54,24 @@ public:
 
     MRmiClientPrivateSocket(const QString& key, MRmiClient *q);
 
-    void writeData(const QByteArray&);
+    void invoke(const char* method, const QVariant* const* args, int argc);
     void connectToServer();
-    void initConnection();
-    void finalizeConnection();
-    QDataStream& stream();
 
     virtual void _q_readyRead();
+    virtual void _q_flush();
 
 private:
+    void processMessage(const QByteArray& msg);
+
     QLocalSocket _socket;
-    QByteArray   _buf;
-    QDataStream* _stream;
-    quint16 return_sz;
+    // @_out: calls not written to the socket yet
+    // @_in:  what we've read but not processed because it's incomplete
+    QByteArray   _out, _in;
+    // Whether a _q_flush() is scheduled.
+    bool flush_pending;
+    // methodKey() -> index of the method on the other side, learnt
+    // from the server's MethodTable on every connection.
+    QHash<QByteArray, quint16> methods;
 };
 
 #endif //MRMICLIENT_P_H
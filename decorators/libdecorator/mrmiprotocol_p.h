@@ -0,0 +1,91 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef MRMIPROTOCOL_P_H
+#define MRMIPROTOCOL_P_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QtEndian>
+
+/*
+ * Wire format of MRmiClient and MRmiServer.  Every message is
+ * |quint32 size|quint8 type|payload| where size doesn't include itself.
+ * When a client connects the server sends a MethodTable listing the
+ * remotely callable methods of the exported object, then the client
+ * calls them by their index with CallById.  Calls made before the table
+ * arrives are sent as CallByName, like the calls of overloads with the
+ * same number of arguments, which the table leaves out; the server picks
+ * the one whose parameter types match the arguments.
+ *
+ *   CallById:    |quint16 index|quint8 argc|QVariant args...|
+ *   CallByName:  |QByteArray name|quint8 argc|QVariant args...|
+ *   MethodTable: |quint16 count|{QByteArray name, quint8 argc,
+ *                 quint16 index}...|
+ *   ReturnValue: |QVariant value|
+ */
+namespace MRmiProtocol
+{
+    enum MessageType {
+        CallById = 1,
+        CallByName,
+        MethodTable,
+        ReturnValue
+    };
+
+    // QMetaMethod::invoke() can't take more.
+    enum { MaxArgs = 10 };
+
+    // Identifies a method by its name and number of arguments.
+    inline QByteArray methodKey(const QByteArray &name, int argc)
+    {
+        return name + '/' + QByteArray::number(argc);
+    }
+
+    // Sets up @s to append a message to its buffer.  Note the buffer's
+    // current size, write the type and the payload to @s, then call
+    // endMessage() to fill in the size.
+    inline void beginMessage(QDataStream &s, quint8 type)
+    {
+        s.setVersion(QDataStream::Qt_4_0);
+        s << (quint32)0 << type;
+    }
+
+    // Fills in the size of the message which started at @start of @buf.
+    inline void endMessage(QByteArray &buf, int start)
+    {
+        qToBigEndian<quint32>(buf.size() - start - sizeof(quint32),
+                              (uchar *)buf.data() + start);
+    }
+
+    // If @buf has a complete message at @pos returns its length
+    // (including the size field), otherwise 0.
+    inline int messageLength(const QByteArray &buf, int pos)
+    {
+        if (buf.size() - pos < (int)sizeof(quint32))
+            return 0;
+        quint32 sz = qFromBigEndian<quint32>((const uchar *)buf.constData()
+                                             + pos);
+        if ((quint32)(buf.size() - pos) - sizeof(quint32) < sz)
+            return 0;
+        return sz + sizeof(quint32);
+    }
+}
+
+#endif //MRMIPROTOCOL_P_H
@@ -25,11 +25,10 @@
 #include <QGenericArgument>
 #include <QFile>
 #include <QTextStream>
+#include <QDebug>
+#include "mrmiprotocol_p.h"
 
-QGenericArgument unmarshall(const char*name, const void* data)
-{
-    return QGenericArgument(name, data);
-}
+using namespace MRmiProtocol;
 
 MRmiServerPrivate::MRmiServerPrivate(const QString& key)
         : q_ptr(0), _obj(0)
@@ -58,7 +57,7 @@ QString MRmiServerPrivate::key() const
 }
 
 MRmiServerPrivateSocket::MRmiServerPrivateSocket(const QString& key)
-        : MRmiServerPrivate(key), method_size(0)
+        : MRmiServerPrivate(key)
 {
 }
 
@@ -71,6 +70,45 @@ void MRmiServerPrivateSocket::exportObject(QObject* p)
     Q_Q(MRmiServer);
     MRmiServerPrivate::exportObject(p);
 
+    // Build the table of the methods of @p once, so that clients can call
+    // them by index instead of name.  Like with invokeMethod() signals
+    // can be emitted too.  The overloads with the same number of
+    // arguments are left out of the table, the client can't tell which
+    // one it means, so they are called by name and resolved by the types
+    // of the arguments.
+    const QMetaObject *mo = p->metaObject();
+    methods.clear();
+    methodsByName.clear();
+    for (int i = QObject::staticMetaObject.methodCount();
+         i < mo->methodCount(); ++i) {
+        QMetaMethod m = mo->method(i);
+        QByteArray name(m.signature());
+        name.truncate(name.indexOf('('));
+        int argc = m.parameterTypes().count();
+        if (argc > MaxArgs)
+            continue;
+        methodsByName[methodKey(name, argc)].append(methods.count());
+        methods.append(m);
+    }
+
+    QList<int> unique;
+    for (QHash<QByteArray, QList<int> >::const_iterator it =
+         methodsByName.constBegin(); it != methodsByName.constEnd(); ++it)
+        if (it->count() == 1)
+            unique.append(it->first());
+
+    method_table.clear();
+    QDataStream stream(&method_table, QIODevice::WriteOnly);
+    beginMessage(stream, MethodTable);
+    stream << (quint16)unique.count();
+    foreach (int i, unique) {
+        QByteArray name(methods[i].signature());
+        name.truncate(name.indexOf('('));
+        stream << name << (quint8)methods[i].parameterTypes().count()
+               << (quint16)i;
+    }
+    endMessage(method_table, 0);
+
     q->connect(&_serv, SIGNAL(newConnection()), q, SLOT(_q_incoming()));
 
     if (QFile::exists(key()))
@@ -85,217 +123,136 @@ void MRmiServerPrivateSocket::_q_incoming()
 {
     Q_Q(MRmiServer);
     QLocalSocket* s = _serv.nextPendingConnection();
-    q->connect(s, SIGNAL(disconnected()), s, SLOT(deleteLater()));
     if (!s)
         return;
+    q->connect(s, SIGNAL(disconnected()), s, SLOT(deleteLater()));
+    q->connect(s, SIGNAL(disconnected()), this, SLOT(_q_disconnected()));
     q->connect(s, SIGNAL(readyRead()), this, SLOT(_q_readData()));
+
+    // Tell the client how to call us.
+    s->write(method_table);
+}
+
+void MRmiServerPrivateSocket::_q_disconnected()
+{
+    _bufs.remove((QLocalSocket*) sender());
 }
 
 void MRmiServerPrivateSocket::_q_readData()
 {
     QLocalSocket* socket = (QLocalSocket*) sender();
-    uint sz = socket->bytesAvailable();
+    QByteArray buf = _bufs.take(socket);
+    buf.append(socket->readAll());
+
+    // The client may have sent any number of calls in one go,
+    // process all the complete ones.
+    int pos = 0, len;
+    while ((len = messageLength(buf, pos)) > 0) {
+        processMessage(QByteArray::fromRawData(buf.constData() + pos, len));
+        pos += len;
+    }
+    if (pos < buf.size())
+        _bufs.insert(socket, buf.mid(pos));
+}
 
-    QDataStream stream(socket);
+void MRmiServerPrivateSocket::processMessage(const QByteArray& msg)
+{
+    QDataStream stream(msg);
     stream.setVersion(QDataStream::Qt_4_0);
 
-    if (method_size == 0) {
-        if (sz < (int)sizeof(quint16))
-            return;
-        stream >> method_size;
-    }
+    quint32 sz;
+    quint8 type;
+    QByteArray name;
+    int index = -1;
+    stream >> sz >> type;
+    if (type == CallById) {
+        quint16 i;
+        stream >> i;
+        if (i < methods.count())
+            index = i;
+    } else if (type == CallByName)
+        stream >> name;
+    else
+        return;
 
-    if (sz < method_size)
+    QVariant args[MaxArgs];
+    quint8 argc;
+    stream >> argc;
+    if (argc > MaxArgs)
+        return;
+    for (int i = 0; i < argc; ++i)
+        stream >> args[i];
+    if (stream.status() != QDataStream::Ok)
         return;
 
-    invoke(stream);
+    if (type == CallByName)
+        index = findMethod(name, args, argc);
+    if (index >= 0)
+        invoke(index, args, argc);
 }
 
-void MRmiServerPrivateSocket::invoke(QDataStream& stream)
+// Returns the index of the overload of @name to call with @args, or -1.
+// The one taking exactly the types of @args wins, otherwise @args must
+// be convertible to the parameters of only one of them.
+int MRmiServerPrivateSocket::findMethod(const QByteArray& name,
+                                        const QVariant* args, int argc) const
 {
-    char* className   = 0;
-    char* methodName  = 0;
-    quint16 arglength = 0;
-
-    QVariant arg0, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9;
-
-    stream >> arglength >> className >> methodName;
-    switch (arglength) {
-    case 0:
-        QMetaObject::invokeMethod(currentObject(),
-                                  methodName);
-        break;
-    case 1:
-        stream >> arg0;
-        QMetaObject::invokeMethod(currentObject(),
-                                  methodName,
-                                  unmarshall(arg0.typeName(),
-                                             arg0.data()));
-
-        break;
-    case 2:
-        stream >> arg0 >> arg1;
-        QMetaObject::invokeMethod(currentObject(),
-                                  methodName,
-                                  unmarshall(arg0.typeName(),
-                                             arg0.data()),
-                                  unmarshall(arg1.typeName(),
-                                             arg1.data()));
-        break;
-    case 3:
-        stream >> arg0 >> arg1 >> arg2;
-        QMetaObject::invokeMethod(currentObject(),
-                                  methodName,
-                                  unmarshall(arg0.typeName(),
-                                             arg0.data()),
-                                  unmarshall(arg1.typeName(),
-                                             arg1.data()),
-                                  unmarshall(arg2.typeName(),
-                                             arg2.data()));
-        break;
-    case 4:
-        stream >> arg0 >> arg1 >> arg2 >> arg3;
-        QMetaObject::invokeMethod(currentObject(),
-                                  methodName,
-                                  unmarshall(arg0.typeName(),
-                                             arg0.data()),
-                                  unmarshall(arg1.typeName(),
-                                             arg1.data()),
-                                  unmarshall(arg2.typeName(),
-                                             arg2.data()),
-                                  unmarshall(arg3.typeName(),
-                                             arg3.data()));
-        break;
-    case 5:
-        stream >> arg0 >> arg1 >> arg2 >> arg3 >> arg4;
-        QMetaObject::invokeMethod(currentObject(),
-                                  methodName,
-                                  unmarshall(arg0.typeName(),
-                                             arg0.data()),
-                                  unmarshall(arg1.typeName(),
-                                             arg1.data()),
-                                  unmarshall(arg2.typeName(),
-                                             arg2.data()),
-                                  unmarshall(arg3.typeName(),
-                                             arg3.data()),
-                                  unmarshall(arg4.typeName(),
-                                             arg4.data()));
-        break;
-    case 6:
-        stream >> arg0 >> arg1 >> arg2 >> arg3 >> arg4 >> arg5;
-        QMetaObject::invokeMethod(currentObject(),
-                                  methodName,
-                                  unmarshall(arg0.typeName(),
-                                             arg0.data()),
-                                  unmarshall(arg1.typeName(),
-                                             arg1.data()),
-                                  unmarshall(arg2.typeName(),
-                                             arg2.data()),
-                                  unmarshall(arg3.typeName(),
-                                             arg3.data()),
-                                  unmarshall(arg4.typeName(),
-                                             arg4.data()),
-                                  unmarshall(arg5.typeName(),
-                                             arg5.data()));
-        break;
-    case 7:
-        stream >> arg0 >> arg1 >> arg2 >> arg3 >> arg4 >> arg5 >> arg6;
-        QMetaObject::invokeMethod(currentObject(),
-                                  methodName,
-                                  unmarshall(arg0.typeName(),
-                                             arg0.data()),
-                                  unmarshall(arg1.typeName(),
-                                             arg1.data()),
-                                  unmarshall(arg2.typeName(),
-                                             arg2.data()),
-                                  unmarshall(arg3.typeName(),
-                                             arg3.data()),
-                                  unmarshall(arg4.typeName(),
-                                             arg4.data()),
-                                  unmarshall(arg5.typeName(),
-                                             arg5.data()),
-                                  unmarshall(arg6.typeName(),
-                                             arg6.data()));
-        break;
-    case 8:
-        stream >> arg0 >> arg1 >> arg2 >> arg3 >> arg4 >> arg5 >> arg6 >> arg7;
-        QMetaObject::invokeMethod(currentObject(),
-                                  methodName,
-                                  unmarshall(arg0.typeName(),
-                                             arg0.data()),
-                                  unmarshall(arg1.typeName(),
-                                             arg1.data()),
-                                  unmarshall(arg2.typeName(),
-                                             arg2.data()),
-                                  unmarshall(arg3.typeName(),
-                                             arg3.data()),
-                                  unmarshall(arg4.typeName(),
-                                             arg4.data()),
-                                  unmarshall(arg5.typeName(),
-                                             arg5.data()),
-                                  unmarshall(arg6.typeName(),
-                                             arg6.data()),
-                                  unmarshall(arg7.typeName(),
-                                             arg7.data()));
-        break;
-    case 9:
-        stream >> arg0 >> arg1 >> arg2 >> arg3 >> arg4 >> arg5 >> arg6 >> arg7
-        >> arg8;
-        QMetaObject::invokeMethod(currentObject(),
-                                  methodName,
-                                  unmarshall(arg0.typeName(),
-                                             arg0.data()),
-                                  unmarshall(arg1.typeName(),
-                                             arg1.data()),
-                                  unmarshall(arg2.typeName(),
-                                             arg2.data()),
-                                  unmarshall(arg3.typeName(),
-                                             arg3.data()),
-                                  unmarshall(arg4.typeName(),
-                                             arg4.data()),
-                                  unmarshall(arg5.typeName(),
-                                             arg5.data()),
-                                  unmarshall(arg6.typeName(),
-                                             arg6.data()),
-                                  unmarshall(arg7.typeName(),
-                                             arg7.data()),
-                                  unmarshall(arg8.typeName(),
-                                             arg8.data()));
-        break;
-    case 10:
-        stream >> arg0 >> arg1 >> arg2 >> arg3 >> arg4 >> arg5 >> arg6 >> arg7
-        >> arg8 >> arg9;
-        QMetaObject::invokeMethod(currentObject(),
-                                  methodName,
-                                  unmarshall(arg0.typeName(),
-                                             arg0.data()),
-                                  unmarshall(arg1.typeName(),
-                                             arg1.data()),
-                                  unmarshall(arg2.typeName(),
-                                             arg2.data()),
-                                  unmarshall(arg3.typeName(),
-                                             arg3.data()),
-                                  unmarshall(arg4.typeName(),
-                                             arg4.data()),
-                                  unmarshall(arg5.typeName(),
-                                             arg5.data()),
-                                  unmarshall(arg6.typeName(),
-                                             arg6.data()),
-                                  unmarshall(arg7.typeName(),
-                                             arg7.data()),
-                                  unmarshall(arg8.typeName(),
-                                             arg8.data()),
-                                  unmarshall(arg9.typeName(),
-                                             arg9.data()));
-        break;
-    default:
-        break;
+    const QList<int> candidates = methodsByName.value(methodKey(name, argc));
+    if (candidates.count() == 1)
+        // invoke() complains if the arguments don't fit
+        return candidates.first();
+
+    int found = -1, nconvertible = 0;
+    foreach (int index, candidates) {
+        QList<QByteArray> types = methods[index].parameterTypes();
+        bool exact = true, convertible = true;
+        for (int i = 0; i < argc && convertible; ++i) {
+            int t = QMetaType::type(types[i].constData());
+            if (!t || args[i].userType() != t) {
+                exact = false;
+                convertible = t && args[i].canConvert((QVariant::Type)t);
+            }
+        }
+        if (exact)
+            return index;
+        if (convertible) {
+            found = index;
+            nconvertible++;
+        }
+    }
+    if (nconvertible == 1)
+        return found;
 
+    qDebug() << "MRmiServerPrivateSocket"
+             << (nconvertible ? "ambiguous call of" : "no such method")
+             << name << argc;
+    return -1;
+}
+
+void MRmiServerPrivateSocket::invoke(int index, QVariant* args, int argc)
+{
+    const QMetaMethod &method = methods[index];
+    QList<QByteArray> types = method.parameterTypes();
+    QGenericArgument gargs[MaxArgs];
+
+    if (argc != types.count())
+        return;
+    for (int i = 0; i < argc; ++i) {
+        // Convert the argument to what the method expects, otherwise
+        // it would be passed a pointer to something else.
+        int t = QMetaType::type(types[i].constData());
+        if (t && args[i].userType() != t
+            && !args[i].convert((QVariant::Type)t)) {
+            qDebug() << "MRmiServerPrivateSocket" << method.signature()
+                     << "invalid argument" << i << args[i].typeName();
+            return;
+        }
+        gargs[i] = QGenericArgument(types[i].constData(), args[i].data());
     }
 
-    delete[] className;
-    delete[] methodName;
-    method_size = 0;
+    method.invoke(currentObject(), Qt::DirectConnection,
+                  gargs[0], gargs[1], gargs[2], gargs[3], gargs[4],
+                  gargs[5], gargs[6], gargs[7], gargs[8], gargs[9]);
 }
 
 
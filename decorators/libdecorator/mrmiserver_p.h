@@ -24,8 +24,12 @@
 #include <QVariant>
 #include <QLocalServer>
 #include <QObject>
+#include <QHash>
+#include <QVector>
+#include <QMetaMethod>
 
 class QDataStream;
+class QLocalSocket;
 class MRmiServer;
 
 class MRmiServerPrivate
@@ -62,12 +66,23 @@ public:
 public slots:
     virtual void _q_incoming();
     virtual void _q_readData();
+    void _q_disconnected();
 
 private:
-    void invoke(QDataStream&);
+    void processMessage(const QByteArray& msg);
+    int findMethod(const QByteArray& name, const QVariant* args,
+                   int argc) const;
+    void invoke(int index, QVariant* args, int argc);
 
     QLocalServer  _serv;
-    quint16 method_size;
+    // What we've read from each client but not processed yet because
+    // it's an incomplete message.
+    QHash<QLocalSocket*, QByteArray> _bufs;
+    // The callable methods of the exported object.  A method's index
+    // in the MethodTable is its position in @methods.  @methodsByName
+    // maps methodKey()s to the indices of their overloads.
+    QVector<QMetaMethod> methods;
+    QHash<QByteArray, QList<int> > methodsByName;
+    // The MethodTable message sent to every new client.
+    QByteArray method_table;
 };
-
-#endif //MRMISERVER_P_H
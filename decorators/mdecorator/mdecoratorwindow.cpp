@@ -248,7 +248,10 @@ MDecoratorWindow::MDecoratorWindow(QWidget *parent)
       statusBarHeight(0),
       messageBox(0),
       managed_window(0),
-      menuVisible(false)
+      menuVisible(false),
+      inputRegionValid(false),
+      shapeRegion(None),
+      shapeUpdatePending(false)
 {
     locale.addTranslationPath(TRANSLATION_INSTALLDIR);
     locale.installTrCatalog("recovery");
@@ -358,6 +361,8 @@ void MDecoratorWindow::setWindowTitle(const QString& title)
 
 MDecoratorWindow::~MDecoratorWindow()
 {
+    if (shapeRegion != None)
+        XFixesDestroyRegion(QX11Info::display(), shapeRegion);
 }
 
 bool MDecoratorWindow::x11Event(XEvent *e)
@@ -510,32 +515,47 @@ void MDecoratorWindow::screenRotated(const M::Orientation &orientation)
 
 void MDecoratorWindow::setInputRegion()
 {
-    static QRegion prev_region;
+    InputRegionKey key;
+
+    key.angle = sceneManager()->orientationAngle();
+    key.only_statusbar = only_statusbar;
+    key.fullscreen = messageBox || menuVisible;
+    key.screen = QApplication::desktop()->screenGeometry();
+    key.statusbar = statusBar->geometry().toRect();
+    key.navigationbar = navigationBar->geometry().toRect();
+    key.homebutton = homeButtonPanel->geometry().toRect();
+    if (escapeButtonPanel)
+        key.escapebutton = escapeButtonPanel->geometry().toRect();
+    if (inputRegionValid && key == inputRegionKey)
+        // nothing has changed
+        return;
+    inputRegionKey = key;
+    inputRegionValid = true;
+
     QRegion region;
-    const QRegion fs(QApplication::desktop()->screenGeometry());
     // region := decoration region
-    if (messageBox || menuVisible) {
+    if (key.fullscreen) {
         // Occupy all space.
-        region = fs;
+        region = key.screen;
     } else {
         // Decoration includes the status bar, and possibly other elements.
-        QRect sbrect = statusBar->geometry().toRect();
+        QRect sbrect = key.statusbar;
         if (statusBarHeight)
             sbrect.setHeight(statusBarHeight);
         region = sbrect;
         if (!only_statusbar) {
-            region += navigationBar->geometry().toRect();
-            region += homeButtonPanel->geometry().toRect();
+            region += key.navigationbar;
+            region += key.homebutton;
             if (escapeButtonPanel)
-                region += escapeButtonPanel->geometry().toRect();
+                region += key.escapebutton;
         }
 
         // The coordinates we receive from libmeegotouch are rotated
         // by @angle.  Map @retion back to screen coordinates.
-        int angle = sceneManager()->orientationAngle();
+        int angle = key.angle;
         if (angle != 0) {
             QTransform trans;
-            const QRect fs(QApplication::desktop()->screenGeometry());
+            const QRect &fs = key.screen;
 
             trans.rotate(angle);
             if (angle == 270)
@@ -547,31 +567,14 @@ void MDecoratorWindow::setInputRegion()
             region = trans.map(region);
         }
     }
-
-    // Set our input and bounding shape to @region if changed.
-    if (prev_region != region) {
-        prev_region = region;
-
-        // Convert @region to @xrects.
-        const QVector<QRect> rects = region.rects();
-        int nxrects = rects.count();
-        XRectangle *xrects = new XRectangle[nxrects];
-        for (int i = 0; i < nxrects; ++i) {
-            xrects[i].x = rects[i].x();
-            xrects[i].y = rects[i].y();
-            xrects[i].width = rects[i].width();
-            xrects[i].height = rects[i].height();
-        }
-
-        Display *dpy = QX11Info::display();
-        XserverRegion shapeRegion = XFixesCreateRegion(dpy, xrects, nxrects);
-        XFixesSetWindowShapeRegion(dpy, winId(), ShapeInput,
-                                   0, 0, shapeRegion);
-        XFixesSetWindowShapeRegion(dpy, winId(), ShapeBounding,
-                                   0, 0, shapeRegion);
-
-        XFixesDestroyRegion(dpy, shapeRegion);
-        delete[] xrects;
+    decorRegion = region;
+
+    // Every shape change makes the compositor restack, so set the shape
+    // only once even if we're called many times in a row.
+    if (decorRegion != shapedRegion && !shapeUpdatePending) {
+        shapeUpdatePending = true;
+        QMetaObject::invokeMethod(this, "applyInputRegion",
+                                  Qt::QueuedConnection);
     }
 
     // The rectangle available for the application is the largest square
@@ -579,6 +582,37 @@ void MDecoratorWindow::setInputRegion()
     availableRect = (fs - region).boundingRect();
 }
 
+// Set our input and bounding shape to @decorRegion if changed.
+void MDecoratorWindow::applyInputRegion()
+{
+    shapeUpdatePending = false;
+    if (shapedRegion == decorRegion)
+        return;
+    shapedRegion = decorRegion;
+
+    // Convert @shapedRegion to @xrects.
+    const QVector<QRect> rects = shapedRegion.rects();
+    int nxrects = rects.count();
+    XRectangle *xrects = new XRectangle[nxrects];
+    for (int i = 0; i < nxrects; ++i) {
+        xrects[i].x = rects[i].x();
+        xrects[i].y = rects[i].y();
+        xrects[i].width = rects[i].width();
+        xrects[i].height = rects[i].height();
+    }
+
+    Display *dpy = QX11Info::display();
+    if (shapeRegion == None)
+        shapeRegion = XFixesCreateRegion(dpy, xrects, nxrects);
+    else
+        XFixesSetRegion(dpy, shapeRegion, xrects, nxrects);
+    XFixesSetWindowShapeRegion(dpy, winId(), ShapeInput,
+                               0, 0, shapeRegion);
+    XFixesSetWindowShapeRegion(dpy, winId(), ShapeBounding,
+                               0, 0, shapeRegion);
+    delete[] xrects;
+}
+
 void MDecoratorWindow::setSceneSize()
 {
     // always keep landscape size
@@ -75,6 +75,7 @@ private slots:
     void noButtonClicked();
     void menuAppearing();
     void menuDisappeared();
+    void applyInputRegion();
 
 signals:
 
@@ -101,6 +102,31 @@ private:
     MLocale locale;
     bool menuVisible;
 
+    // What the decoration region depends on.  setInputRegion() only
+    // recomputes @decorRegion if this changes.
+    struct InputRegionKey {
+        int angle;
+        bool only_statusbar, fullscreen;
+        // changes with the RandR mode
+        QRect screen;
+        QRect statusbar, navigationbar, homebutton, escapebutton;
+        bool operator==(const InputRegionKey &o) const {
+            return angle == o.angle && only_statusbar == o.only_statusbar
+                && fullscreen == o.fullscreen && screen == o.screen
+                && statusbar == o.statusbar
+                && navigationbar == o.navigationbar
+                && homebutton == o.homebutton
+                && escapebutton == o.escapebutton;
+        }
+    } inputRegionKey;
+    bool inputRegionValid;
+    // @decorRegion is what the shape should be, @shapedRegion is what
+    // we've set it to.  @shapeRegion is reused for every update, which
+    // is done by applyInputRegion() once per main loop iteration.
+    QRegion decorRegion, shapedRegion;
+    XID shapeRegion;
+    bool shapeUpdatePending;
+
 
     Q_DISABLE_COPY(MDecoratorWindow);
 };
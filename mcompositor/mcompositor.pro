@@ -13,9 +13,4 @@ INSTALLS += target
 # Input
 SOURCES += main.cpp
 
-contains(DEFINES, WINDOW_DEBUG_ALOT) {
-    HEADERS += xserverpinger.h
-    SOURCES += xserverpinger.cpp
-}
-
 QT = core gui opengl
@@ -0,0 +1,74 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef MCAPTURERING_H
+#define MCAPTURERING_H
+
+/*
+ * Layout of the shared memory ring the compositor captures the composited
+ * frames into (see the "capture" remote control command).  Plain C, so
+ * that recorders needn't link against anything.
+ *
+ * The ring starts with a struct mcapture_header, followed by @nslots
+ * slots of @slot_size bytes each.  Frame number @seq (counting from 1)
+ * is in slot @seq % @nslots, which is a struct mcapture_slot followed by
+ * the @width x @height area of the screen it covers, in RGBA with the
+ * rows bottom-up, as GL reads them.
+ *
+ * Keyframes cover the whole screen.  The other frames only cover the
+ * area which changed since the previous frame, and must be applied over
+ * it.  There is at least one keyframe in every @nslots consecutive frames,
+ * so a reader can always start from the ring.
+ *
+ * A slot's @sequence is 0 while it's being written.  Readers should
+ * check that it's unchanged after copying the pixels, or the frame was
+ * overwritten meanwhile.  The header's @sequence is that of the last
+ * complete frame, 0 if there is none yet.
+ */
+
+#include <stdint.h>
+
+#define MCAPTURE_MAGIC      0x4d434150 /* MCAP */
+#define MCAPTURE_VERSION    1
+
+struct mcapture_header {
+    uint32_t magic, version;
+    uint32_t width, height;
+    uint32_t nslots, slot_size;
+    volatile uint32_t sequence;
+    uint32_t reserved;
+};
+
+struct mcapture_slot {
+    volatile uint32_t sequence;
+    uint32_t keyframe;
+    /* covered area, in screen coordinates */
+    uint32_t x, y, width, height;
+    /* CLOCK_MONOTONIC time the frame was drawn */
+    uint64_t usecs;
+};
+
+static inline struct mcapture_slot *
+mcapture_get_slot(struct mcapture_header *ring, uint32_t seq)
+{
+    return (struct mcapture_slot *) ((char *) (ring + 1)
+        + (seq % ring->nslots) * ring->slot_size);
+}
+
+#endif
@@ -120,30 +120,45 @@ public:
         RROUTPUT_GRAPHICS_ALPHA,
         RROUTPUT_VIDEO_ALPHA,
 
+        // root window properties
+        _MEEGOTOUCH_COMPOSITOR_ROTATION,
+
         ATOMS_TOTAL
     };
-    static MCompAtoms *instance();
-    Type windowType(Window w);
-    bool isDecorator(Window w);
-    int getPid(Window w);
-    bool hasState(Window w, Atom a);
-    QVector<Atom> getAtomArray(Window w, Atom array_atom);
-    unsigned int get_opacity_prop(Display *dpy, Window w, unsigned int def);
-    double get_opacity_percent(Display *dpy, Window w, double def);
-    int globalAlphaFromWindow(Window w);
-
-    Atom getAtom(const unsigned int name);
+    // What the change of a property of a client window can invalidate.
+    enum PropertyEffect {
+        // Nothing we care about.
+        NoEffect        = 0,
+        // The value cached by MWindowPropertyCache.
+        CachedValue     = 1 << 0,
+        // The stacking order of the windows.
+        Stacking        = 1 << 1,
+        // The visibility of the windows (through their opacity).
+        Visibility      = 1 << 2,
+    };
+
+    // The window properties are read through MWindowPropertyCache,
+    // which doesn't wait for the X server unless it has to.
+    static MCompAtoms *instance()
+    {
+        if (!d)
+            d = new MCompAtoms();
+        return d;
+    }
+
+    Atom getAtom(const unsigned int name) const { return atoms[name]; }
+    //! Returns the PropertyEffect:s of the change of property @a.
+    unsigned propertyEffects(Atom a) const
+        { return property_effects.value(a, NoEffect); }
 
     static Atom atoms[ATOMS_TOTAL];
-    int cardValueProperty(Window w, Atom property);
 
 private:
     explicit MCompAtoms();
     static MCompAtoms *d;
 
-    Atom getAtom(Window w, Atoms atomtype);
-
     Display *dpy;
+    QHash<Atom, unsigned> property_effects;
 };
 
 #define ATOM(t) MCompAtoms::instance()->getAtom(MCompAtoms::t)
@@ -28,11 +28,20 @@
 #include "mcompositemanagerextension.h"
 #include "mcompmgrextensionfactory.h"
 #include "mcompositordebug.h"
+#include "mwindowpingscheduler.h"
+#include "xserverpinger.h"
+#include "mstackingtrace.h"
+#include "mscreencapture.h"
+#include "mscreenlayout.h"
+#include "mscreenrotation.h"
+#include "mresourceaccountant.h"
 #include <mrmiserver.h>
 
 #include <QX11Info>
 #include <QByteArray>
 #include <QVector>
+#include <QFile>
+#include <QDataStream>
 #include <QtPlugin>
 
 #include <X11/Xutil.h>
@@ -48,10 +57,14 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <stdio.h>
+#include <time.h>
 
 #define TRANSLUCENT 0xe0000000
 #define OPAQUE      0xffffffff
@@ -86,9 +99,7 @@ static KeyCode switcher_key = 0;
 // temporary launch indicator. will get replaced later
 static QGraphicsTextItem *launchIndicator = 0;
 
-static Window transient_for(Window window);
 static bool should_be_pinged(MCompositeWindow *cw);
-static bool compareWindows(Window w_a, Window w_b);
 
 #ifdef WINDOW_DEBUG
 static QTime overhead_measure;
@@ -115,18 +126,6 @@ static QString dumpWindows(const QList<Window> &wins);
 # define STACKING_MOVE(...)                         /* NOP */
 #endif
 
-// Enable to see the decisions of compareWindows().
-#if 0
-# define SORTING(isLess)                            \
-    do {                                            \
-        STACKING("0x%lx %s 0x%lx",                  \
-               w_a, isLess ? "<" : "\\<", w_b);     \
-        return isLess;                              \
-    } while (0)
-#else
-# define SORTING(isLess)                            return isLess
-#endif
-
 // Enable to see what and why getTopmostApp() chooses
 // as a toplevel window.
 #if 0
@@ -135,13 +134,6 @@ static QString dumpWindows(const QList<Window> &wins);
 # define GTA(...)                                   /* NOP */
 #endif
 
-MCompAtoms *MCompAtoms::instance()
-{
-    if (!d)
-        d = new MCompAtoms();
-    return d;
-}
-
 MCompAtoms::MCompAtoms()
 {
     static const char *atom_names[] = {
@@ -219,183 +211,127 @@ MCompAtoms::MCompAtoms()
         "AlphaMode",
         "GraphicsAlpha",
         "VideoAlpha",
+
+        // root window properties
+        "_MEEGOTOUCH_COMPOSITOR_ROTATION",
     };
 
     Q_ASSERT((sizeof(atom_names) / sizeof(atom_names[0])) == ATOMS_TOTAL);
 
-    dpy = QX11Info::display();
-
-    if (!XInternAtoms(dpy, (char **)atom_names, ATOMS_TOTAL, False, atoms))
-        qCritical("XInternAtoms failed");
-
-    XChangeProperty(dpy, QX11Info::appRootWindow(), atoms[_NET_SUPPORTED],
-                    XA_ATOM, 32, PropModeReplace, (unsigned char *)atoms,
-                    END_OF_NET_SUPPORTED);
-}
-
-MCompAtoms::Type MCompAtoms::windowType(Window w)
-{
-    // freedesktop.org window type
-    QVector<Atom> a = getAtomArray(w, atoms[_NET_WM_WINDOW_TYPE]);
-    if (!a.size())
-        return NORMAL;
-    if (a[0] == atoms[_NET_WM_WINDOW_TYPE_DESKTOP])
-        return DESKTOP;
-    else if (a[0] == atoms[_NET_WM_WINDOW_TYPE_NORMAL])
-        return NORMAL;
-    else if (a[0] == atoms[_NET_WM_WINDOW_TYPE_DIALOG]) {
-        if (a.indexOf(atoms[_KDE_NET_WM_WINDOW_TYPE_OVERRIDE]) != -1)
-            return NO_DECOR_DIALOG;
-        else
-            return DIALOG;
-    }
-    else if (a[0] == atoms[_NET_WM_WINDOW_TYPE_DOCK])
-        return DOCK;
-    else if (a[0] == atoms[_NET_WM_WINDOW_TYPE_INPUT])
-        return INPUT;
-    else if (a[0] == atoms[_NET_WM_WINDOW_TYPE_NOTIFICATION])
-        return NOTIFICATION;
-    else if (a[0] == atoms[_KDE_NET_WM_WINDOW_TYPE_OVERRIDE] ||
-             a[0] == atoms[_NET_WM_WINDOW_TYPE_MENU])
-        return FRAMELESS;
-
-    if (transient_for(w))
-        return UNKNOWN;
-    else // fdo spec suggests unknown non-transients must be normal
-        return NORMAL;
-}
-
-bool MCompAtoms::isDecorator(Window w)
-{
-    return (cardValueProperty(w, atoms[_MEEGOTOUCH_DECORATOR_WINDOW]) == 1);
-}
-
-int MCompAtoms::getPid(Window w)
-{
-    return cardValueProperty(w, atoms[_NET_WM_PID]);
-}
-
-bool MCompAtoms::hasState(Window w, Atom a)
-{
-    QVector<Atom> states = getAtomArray(w, atoms[_NET_WM_STATE]);
-    return states.indexOf(a) != -1;
-}
-
-QVector<Atom> MCompAtoms::getAtomArray(Window w, Atom array_atom)
-{
-    QVector<Atom> ret;
-
-    Atom actual;
-    int format;
-    unsigned long n, left;
-    unsigned char *data = 0;
-    int result = XGetWindowProperty(QX11Info::display(), w, array_atom, 0, 0,
-                                    False, XA_ATOM, &actual, &format,
-                                    &n, &left, &data);
-    if (data && result == Success && actual == XA_ATOM && format == 32) {
-        ret.resize(left / 4);
-        XFree((void *) data);
-        data = 0;
-
-        if (XGetWindowProperty(QX11Info::display(), w, array_atom, 0,
-                               ret.size(), False, XA_ATOM, &actual, &format,
-                               &n, &left, &data) != Success) {
-            ret.clear();
-        } else if (n != (ulong)ret.size())
-            ret.resize(n);
-
-        if (!ret.isEmpty())
-            memcpy(ret.data(), data, ret.size() * sizeof(Atom));
-    }
-    if (data) XFree(data);
-
-    return ret;
-}
-
-unsigned int MCompAtoms::get_opacity_prop(Display *dpy, Window w, unsigned int def)
-{
-    Q_UNUSED(dpy);
-    Atom actual;
-    int format;
-    unsigned long n, left;
-
-    unsigned char *data = 0;
-    int result = XGetWindowProperty(QX11Info::display(), w, atoms[_NET_WM_WINDOW_OPACITY], 0L, 1L, False,
-                                    XA_CARDINAL, &actual, &format,
-                                    &n, &left, &data);
-    if (result == Success && data != NULL) {
-        unsigned int i;
-        memcpy(&i, data, sizeof(unsigned int));
-        XFree((void *) data);
-        return i;
-    }
-    return def;
-}
-
-double MCompAtoms::get_opacity_percent(Display *dpy, Window w, double def)
-{
-    unsigned int opacity = get_opacity_prop(dpy, w,
-                                            (unsigned int)(OPAQUE * def));
-    return opacity * 1.0 / OPAQUE;
-}
+    // What MCompositeManagerPrivate::propertyEvent() needs to do when
+    // the property of a client window changes, in the order of @atom_names.
+    // Atoms which are not window properties or which we don't follow
+    // are NoEffect.
+    static const unsigned effects[] = {
+        CachedValue,                    // WM_PROTOCOLS
+        NoEffect,                       // WM_DELETE_WINDOW
+        NoEffect,                       // WM_TAKE_FOCUS
+        CachedValue | Stacking,         // WM_TRANSIENT_FOR
+        CachedValue | Stacking,         // WM_HINTS
+
+        NoEffect,                       // _NET_SUPPORTED
+        NoEffect,                       // _NET_SUPPORTING_WM_CHECK
+        NoEffect,                       // _NET_WM_NAME
+        // changes are picked up by the next stacking check
+        CachedValue,                    // _NET_WM_WINDOW_TYPE
+        NoEffect,                       // _NET_WM_WINDOW_TYPE_DESKTOP
+        NoEffect,                       // _NET_WM_WINDOW_TYPE_NORMAL
+        NoEffect,                       // _NET_WM_WINDOW_TYPE_DOCK
+        NoEffect,                       // _NET_WM_WINDOW_TYPE_INPUT
+        NoEffect,                       // _NET_WM_WINDOW_TYPE_NOTIFICATION
+        NoEffect,                       // _NET_WM_WINDOW_TYPE_DIALOG
+        NoEffect,                       // _NET_WM_WINDOW_TYPE_MENU
+
+        NoEffect,                       // _NET_WM_STATE_ABOVE
+        NoEffect,                       // _NET_WM_STATE_SKIP_TASKBAR
+        NoEffect,                       // _NET_WM_STATE_FULLSCREEN
+        NoEffect,                       // _NET_WM_STATE_MODAL
+        NoEffect,                       // _KDE_NET_WM_WINDOW_TYPE_OVERRIDE
+
+        NoEffect,                       // _NET_WM_WINDOW_OPACITY
+        // the client messages changing it restack themselves
+        CachedValue,                    // _NET_WM_STATE
+        CachedValue,                    // _NET_WM_ICON_GEOMETRY
+        NoEffect,                       // _NET_WM_USER_TIME_WINDOW
+        CachedValue | Stacking,         // WM_STATE
+        CachedValue,                    // WM_NAME
+
+        NoEffect,                       // _NET_WM_PID
+        NoEffect,                       // _NET_WM_PING
+
+        NoEffect,                       // _NET_ACTIVE_WINDOW
+        NoEffect,                       // _NET_CLOSE_WINDOW
+        NoEffect,                       // _NET_CLIENT_LIST
+        NoEffect,                       // _NET_CLIENT_LIST_STACKING
+        NoEffect,                       // WM_CHANGE_STATE
+
+        NoEffect,                       // _MEEGOTOUCH_DECORATOR_WINDOW
+        CachedValue | Visibility,       // _MEEGOTOUCH_GLOBAL_ALPHA
+        CachedValue | Visibility,       // _MEEGOTOUCH_VIDEO_ALPHA
+        CachedValue | Stacking,         // _MEEGO_STACKING_LAYER
+        CachedValue,                    // _MEEGOTOUCH_DECORATOR_BUTTONS
+        NoEffect,                       // _MEEGOTOUCH_CURRENT_APP_WINDOW
+        CachedValue,                    // _MEEGOTOUCH_ALWAYS_MAPPED
+        CachedValue,                    // _MEEGOTOUCH_DESKTOP_VIEW
+        CachedValue,                    // _MEEGOTOUCH_CANNOT_MINIMIZE
+        CachedValue,                    // _MEEGOTOUCH_MSTATUSBAR_GEOMETRY
+        CachedValue,                    // _MEEGOTOUCH_CUSTOM_REGION
+        CachedValue,                    // _MEEGOTOUCH_ORIENTATION_ANGLE
 
-Atom MCompAtoms::getAtom(const unsigned int name)
-{
-    return atoms[name];
-}
+#ifdef WINDOW_DEBUG
+        NoEffect,                       // _M_WM_INFO
+        NoEffect,                       // _M_WM_WINDOW_ZVALUE
+        NoEffect,                       // _M_WM_WINDOW_COMPOSITED_VISIBLE
+        NoEffect,                       // _M_WM_WINDOW_COMPOSITED_INVISIBLE
+        NoEffect,                       // _M_WM_WINDOW_DIRECT_VISIBLE
+        NoEffect,                       // _M_WM_WINDOW_DIRECT_INVISIBLE
+#endif
 
-int MCompAtoms::cardValueProperty(Window w, Atom property)
-{
-    Atom actual;
-    int format;
-    unsigned long n, left;
-    unsigned char *data = 0;
+        NoEffect,                       // RR_PROPERTY_CONNECTOR_TYPE
+        NoEffect,                       // Panel
+        NoEffect,                       // AlphaMode
+        NoEffect,                       // GraphicsAlpha
+        NoEffect,                       // VideoAlpha
 
-    int result = XGetWindowProperty(QX11Info::display(), w, property, 0L, 1L, False,
-                                    XA_CARDINAL, &actual, &format,
-                                    &n, &left, &data);
-    if (result == Success && data) {
-        int p = *((unsigned long *)data);
-        XFree((void *)data);
-        return p;
-    }
+        NoEffect,                       // _MEEGOTOUCH_COMPOSITOR_ROTATION
+    };
 
-    return 0;
-}
+    Q_ASSERT((sizeof(effects) / sizeof(effects[0])) == ATOMS_TOTAL);
 
-Atom MCompAtoms::getAtom(Window w, Atoms atomtype)
-{
-    Atom actual;
-    int format;
-    unsigned long n, left;
-    unsigned char *data = 0;
+    dpy = QX11Info::display();
 
-    int result = XGetWindowProperty(QX11Info::display(), w, atoms[atomtype], 0L, 1L, False,
-                                    XA_ATOM, &actual, &format,
-                                    &n, &left, &data);
-    if (result == Success && data) {
-        Atom a;
-        memcpy(&a, data, sizeof(Atom));
-        XFree((void *) data);
-        return a;
+    // Send all the InternAtom requests before waiting for the first reply,
+    // so that they only cost us one round trip.
+    xcb_connection_t *xcb_conn = XGetXCBConnection(dpy);
+    xcb_intern_atom_cookie_t cookies[ATOMS_TOTAL];
+    for (int i = 0; i < ATOMS_TOTAL; ++i)
+        cookies[i] = xcb_intern_atom(xcb_conn, 0, strlen(atom_names[i]),
+                                     atom_names[i]);
+    for (int i = 0; i < ATOMS_TOTAL; ++i) {
+        xcb_intern_atom_reply_t *r;
+        r = xcb_intern_atom_reply(xcb_conn, cookies[i], 0);
+        if (r) {
+            atoms[i] = r->atom;
+            free(r);
+        } else {
+            atoms[i] = None;
+            qCritical("couldn't intern %s", atom_names[i]);
+        }
     }
-    return 0;
-}
+    for (int i = 0; i < ATOMS_TOTAL; ++i)
+        if (effects[i] != NoEffect)
+            property_effects.insert(atoms[i], effects[i]);
 
-static Window transient_for(Window window)
-{
-    Window transient_for = 0;
-    XGetTransientForHint(QX11Info::display(), window, &transient_for);
-    if (transient_for == window)
-        transient_for = 0;
-    return transient_for;
+    XChangeProperty(dpy, QX11Info::appRootWindow(), atoms[_NET_SUPPORTED],
+                    XA_ATOM, 32, PropModeReplace, (unsigned char *)atoms,
+                    END_OF_NET_SUPPORTED);
 }
 
-static void skiptaskbar_wm_state(int toggle, Window window)
+static void skiptaskbar_wm_state(int toggle, MWindowPropertyCache *pc)
 {
     Atom skip = ATOM(_NET_WM_STATE_SKIP_TASKBAR);
-    MCompAtoms *atom = MCompAtoms::instance();
-    QVector<Atom> states = atom->getAtomArray(window, ATOM(_NET_WM_STATE));
+    Window window = pc->winId();
+    QVector<Atom> states = pc->netWmState().toVector();
     bool update_root = false;
     int i = states.indexOf(skip);
 
@@ -423,14 +359,16 @@ static void skiptaskbar_wm_state(int toggle, Window window)
     } break;
     case 2: {
         if (i == -1)
-            skiptaskbar_wm_state(1, window);
+            skiptaskbar_wm_state(1, pc);
         else
-            skiptaskbar_wm_state(0, window);
+            skiptaskbar_wm_state(0, pc);
     } break;
     default: break;
     }
 
     if (update_root) {
+        pc->setNetWmState(states.toList());
+
         XPropertyEvent p;
         p.send_event = True;
         p.display = QX11Info::display();
@@ -450,12 +388,16 @@ static void fullscreen_wm_state(MCompositeManagerPrivate *priv,
 {
     Atom fullscreen = ATOM(_NET_WM_STATE_FULLSCREEN);
     Display *dpy = QX11Info::display();
-    MCompAtoms *atom = MCompAtoms::instance();
     QVector<Atom> states;
     if (net_wm_state)
         states = *net_wm_state;
-    else
-        states = atom->getAtomArray(window, ATOM(_NET_WM_STATE));
+    else {
+        MWindowPropertyCache *pc = priv->prop_caches.value(window, 0);
+        if (!pc)
+            // we haven't seen it mapped, it can set the property itself
+            return;
+        states = pc->netWmState().toVector();
+    }
     int i = states.indexOf(fullscreen);
 
     switch (toggle) {
@@ -473,7 +415,7 @@ static void fullscreen_wm_state(MCompositeManagerPrivate *priv,
         MCompositeWindow *win = MCompositeWindow::compositeWindow(window);
         if (win)
             win->propertyCache()->setNetWmState(states.toList());
-        if (win && priv->needDecoration(window, win->propertyCache()))
+        if (win && priv->needDecoration(win->propertyCache()))
             win->setDecorated(true);
         if (win && !MDecoratorFrame::instance()->managedWindow()
             && win->needDecoration()) {
@@ -492,13 +434,16 @@ static void fullscreen_wm_state(MCompositeManagerPrivate *priv,
                             (unsigned char *) states.data(), states.size());
         }
 
-        int xres = ScreenOfDisplay(dpy, DefaultScreen(dpy))->width;
-        int yres = ScreenOfDisplay(dpy, DefaultScreen(dpy))->height;
-        XMoveResizeWindow(dpy, window, 0, 0, xres, yres);
-        MOVE_RESIZE(window, 0, 0, xres, yres);
+        // cover the output the window is on
         MCompositeWindow *win = priv->windows.value(window, 0);
+        MWindowPropertyCache *pc = priv->prop_caches.value(window, 0);
+        QRect fs = priv->screen_layout->outputAt(
+                            pc ? pc->realGeometry() : QRect()).geometry;
+        XMoveResizeWindow(dpy, window, fs.x(), fs.y(),
+                          fs.width(), fs.height());
+        MOVE_RESIZE(window, fs.x(), fs.y(), fs.width(), fs.height());
         if (win) {
-            win->propertyCache()->setRequestedGeometry(QRect(0, 0, xres, yres));
+            win->propertyCache()->setRequestedGeometry(fs);
             win->propertyCache()->setNetWmState(states.toList());
         }
         if (win && !priv->device_state->ongoingCall())
@@ -521,85 +466,28 @@ static void fullscreen_wm_state(MCompositeManagerPrivate *priv,
     }
 }
 
-/* Finds, caches and returns the primary (Panel) RROutput.
- * Returns None if it cannot be found or it doesn't support
- * alpha blending. */
-static RROutput find_primary_output()
-{
-    static bool been_here = false;
-    static RROutput primary = None;
-    int i;
-    Display *dpy;
-    int major, minor;
-    bool has_alpha_mode;
-    XRRScreenResources *scres;
-
-    /* Initialize only once. */
-    if (been_here != None)
-        return primary;
-    been_here = true;
-
-    /* Check RandR, who knows what kind of X server we ride. */
-    dpy = QX11Info::display();
-    if (!XRRQueryVersion(dpy, &major, &minor)
-        || !(major > 1 || (major == 1 && minor >= 3)))
-      return None;
-
-    /* Enumerate all the outputs X knows about and find the one
-     * whose connector type is "Panel". */
-    if (!(scres = XRRGetScreenResources(dpy, DefaultRootWindow(dpy))))
-        return None;
-
-    has_alpha_mode = false;
-    for (i = 0, primary = None; i < scres->noutput && primary == None; i++) {
-        Atom t;
-        int fmt;
-        unsigned char *contype;
-        unsigned long nitems, rem;
-
-        if (XRRGetOutputProperty(dpy, scres->outputs[i], ATOM(RROUTPUT_CTYPE),
-                                 0, 1, False, False, AnyPropertyType, &t,
-                                 &fmt, &nitems, &rem, &contype) == Success) {
-            if (t == XA_ATOM && fmt == 32 && nitems == 1
-                && *(Atom *)contype == ATOM(RROUTPUT_PANEL)) {
-                unsigned char *alpha_mode;
-
-                /* Does the primary output support alpha blending? */
-                primary = scres->outputs[i];
-                if (XRRGetOutputProperty(dpy, primary,
-                          ATOM(RROUTPUT_ALPHA_MODE), 0, 1, False, False,
-                          AnyPropertyType, &t, &fmt, &nitems, &rem,
-                          &alpha_mode) == Success) {
-                    has_alpha_mode = t == XA_INTEGER && fmt == 32
-                      && nitems == 1;
-                    XFree(alpha_mode);
-                }
-            }
-            XFree(contype);
-        }
-    }
-    XRRFreeScreenResources(scres);
-
-    /* If the primary output doesn't support alpha blending, don't bother. */
-    if (!has_alpha_mode)
-        primary = None;
-
-    return primary;
-}
-
 /* Set GraphicsAlpha and/or VideoAlpha of the primary output
  * and enable/disable alpha blending if necessary. */
-static void set_global_alpha(int new_gralpha, int new_vidalpha)
+static void set_global_alpha(const MScreenLayout *layout,
+                             int new_gralpha, int new_vidalpha)
 {
     static int blending = -1, gralpha = -1, vidalpha = -1;
+    static RROutput prev_output = None;
+    const MScreenLayout::Output *panel;
     RROutput output;
     Display *dpy;
     int blend;
 
     Q_ASSERT(-1 <= new_gralpha  && new_gralpha  <= 255);
     Q_ASSERT(-1 <= new_vidalpha && new_vidalpha <= 255);
-    if ((output = find_primary_output()) == None)
+    /* If the primary output doesn't support alpha blending, don't bother. */
+    if (!(panel = layout->alphaPanel()))
         return;
+    if ((output = panel->id) != prev_output) {
+        /* The panel was replaced, forget what we set. */
+        blending = gralpha = vidalpha = -1;
+        prev_output = output;
+    }
     dpy = QX11Info::display();
 
     /* Only set changed properties. */
@@ -642,9 +530,19 @@ static void set_global_alpha(int new_gralpha, int new_vidalpha)
 }
 
 /* Turn off global alpha blending on both planes. */
-static void reset_global_alpha()
+static void reset_global_alpha(const MScreenLayout *layout)
+{
+    set_global_alpha(layout, 255, 255);
+}
+
+// Returns the shape of @pc's window in screen coordinates.
+static QRegion screen_shape(MWindowPropertyCache *pc)
 {
-    set_global_alpha(255, 255);
+    const QRegion &shape = pc->shapeRegion();
+    QRect g = pc->realGeometry();
+    // the shape of unshaped windows is their geometry already,
+    // otherwise it's relative to the window
+    return shape == QRegion(g) ? shape : shape.translated(g.topLeft());
 }
 
 static Bool map_predicate(Display *display, XEvent *xevent, XPointer arg)
@@ -656,9 +554,10 @@ static Bool map_predicate(Display *display, XEvent *xevent, XPointer arg)
     return False;
 }
 
-static void kill_window(Window window)
+static void kill_window(MCompositeWindow *cw)
 {
-    int pid = MCompAtoms::instance()->getPid(window);
+    Window window = cw->window();
+    int pid = cw->propertyCache()->pid();
     if (pid != 0) {
         // negative PID to kill the whole process group
         ::kill(-pid, SIGKILL);
@@ -686,14 +585,31 @@ MCompositeManagerPrivate::MCompositeManagerPrivate(QObject *p)
       changed_properties(false),
       prepared(false),
       stacking_timeout_check_visibility(false),
-      stacking_timeout_timestamp(CurrentTime)
-{
+      stacking_timeout_timestamp(CurrentTime),
+      refresh_backing_stores(false),
+      handoff(0),
+      handoff_xfd(-1),
+      stacking_trace(0),
+      rotation_mode(false),
+      xserver_pinger(0)
+{
+    last_export.tv_sec = last_export.tv_nsec = 0;
     xcb_conn = XGetXCBConnection(QX11Info::display());
     MWindowPropertyCache::set_xcb_connection(xcb_conn);
 
     watch = new MCompositeScene(this);
     atom = MCompAtoms::instance();
 
+    screen_layout = new MScreenLayout(this);
+    watch->setSceneRect(screen_layout->screen());
+    connect(screen_layout, SIGNAL(changed()), SLOT(screenLayoutChanged()));
+    connect(watch, SIGNAL(rotationFinished()), SLOT(rotationFinished()));
+    pending_rotation.window = None;
+    pending_rotation_timer.setSingleShot(true);
+    pending_rotation_timer.setInterval(MScreenRotation::ReadyTimeout);
+    connect(&pending_rotation_timer, SIGNAL(timeout()),
+            SLOT(pendingRotationTimeout()));
+
     device_state = new MDeviceState(this);
     connect(device_state, SIGNAL(displayStateChange(bool)),
             this, SLOT(displayOff(bool)));
@@ -703,15 +619,23 @@ MCompositeManagerPrivate::MCompositeManagerPrivate(QObject *p)
     connect(&stacking_timer, SIGNAL(timeout()), this, SLOT(stackingTimeout()));
     connect(this, SIGNAL(currentAppChanged(Window)), this,
             SLOT(setupButtonWindows(Window)));
+    connect(MResourceAccountant::instance(), SIGNAL(budgetExceeded()),
+            this, SLOT(enforceResourceBudget()), Qt::QueuedConnection);
 }
 
 MCompositeManagerPrivate::~MCompositeManagerPrivate()
 {
-    if (prepared)
+    if (prepared) {
         // Advertise the world we're gone.
         XDeleteProperty(QX11Info::display(), QX11Info::appRootWindow(),
                         ATOM(_NET_SUPPORTING_WM_CHECK));
+        if (rotation_mode)
+            XDeleteProperty(QX11Info::display(), QX11Info::appRootWindow(),
+                            ATOM(_MEEGOTOUCH_COMPOSITOR_ROTATION));
+    }
 
+    delete stacking_trace;
+    qDeleteAll(extension_stats);
     delete watch;
     delete atom;
     watch   = 0;
@@ -774,6 +698,13 @@ void MCompositeManagerPrivate::prepare()
                     PropModeReplace, (unsigned char *)&w, 1);
     XChangeProperty(QX11Info::display(), w, ATOM(_NET_SUPPORTING_WM_CHECK),
                     XA_WINDOW, 32, PropModeReplace, (unsigned char *)&w, 1);
+    if (rotation_mode) {
+        // tell the applications not to animate their orientation changes
+        long on = 1;
+        XChangeProperty(QX11Info::display(), RootWindow(QX11Info::display(), 0),
+                        ATOM(_MEEGOTOUCH_COMPOSITOR_ROTATION), XA_CARDINAL,
+                        32, PropModeReplace, (unsigned char *)&on, 1);
+    }
     XChangeProperty(QX11Info::display(), w, ATOM(_NET_WM_NAME),
                     XInternAtom(QX11Info::display(), "UTF8_STRING", 0), 8,
                     PropModeReplace, (unsigned char *) wm_name.toUtf8().data(),
@@ -845,44 +776,22 @@ int MCompositeManagerPrivate::loadPlugins(const QDir &dir)
     return nloaded;
 }
 
-bool MCompositeManagerPrivate::needDecoration(Window window,
-                                              MWindowPropertyCache *pc)
+bool MCompositeManagerPrivate::needDecoration(MWindowPropertyCache *pc)
 {
-    bool fs;
-    if (pc && pc->isInputOnly())
+    if (pc->isInputOnly())
         return false;
-    if (!pc)
-        fs = atom->hasState(window, ATOM(_NET_WM_STATE_FULLSCREEN));
-    else
-        fs = pc->netWmState().indexOf(ATOM(_NET_WM_STATE_FULLSCREEN)) != -1;
-    if (device_state->ongoingCall() && fs && ((pc &&
+    bool fs = pc->netWmState().indexOf(ATOM(_NET_WM_STATE_FULLSCREEN)) != -1;
+    if (device_state->ongoingCall() && fs &&
         pc->windowTypeAtom() != ATOM(_KDE_NET_WM_WINDOW_TYPE_OVERRIDE) &&
-        pc->windowTypeAtom() != ATOM(_NET_WM_WINDOW_TYPE_MENU)) ||
-        (!pc && atom->windowType(window) != MCompAtoms::FRAMELESS)))
+        pc->windowTypeAtom() != ATOM(_NET_WM_WINDOW_TYPE_MENU))
         // fullscreen window is decorated during call
         return true;
     if (fs)
         return false;
-    bool transient;
-    if (!pc)
-        transient = transient_for(window);
-    else
-        transient = (getLastVisibleParent(pc) ? true : false);
-    if (!pc && atom->isDecorator(window))
-        return false;
-    else if (pc && (pc->isDecorator() || pc->isOverrideRedirect()))
+    bool transient = (getLastVisibleParent(pc) ? true : false);
+    if (pc->isDecorator() || pc->isOverrideRedirect())
         return false;
-    else if (!pc) {
-        XWindowAttributes a;
-        if (!XGetWindowAttributes(QX11Info::display(), window, &a)
-            || a.override_redirect || a.c_class == InputOnly)
-            return false;
-    }
-    MCompAtoms::Type t;
-    if (!pc)
-        t = atom->windowType(window);
-    else
-        t = pc->windowType();
+    MCompAtoms::Type t = pc->windowType();
     return (t != MCompAtoms::FRAMELESS
             && t != MCompAtoms::DESKTOP
             && t != MCompAtoms::NOTIFICATION
@@ -898,13 +807,22 @@ void MCompositeManagerPrivate::damageEvent(XDamageNotifyEvent *e)
 
     MCompositeWindow *item = COMPOSITE_WINDOW(e->drawable);
     if (item) {
+        item->countDamage();
         /* partial updates disabled for now, does not always work, unless we
          * check for EGL_BUFFER_PRESERVED or GLX_SWAP_COPY_OML first, see
          * http://www.khronos.org/registry/egl/specs/EGLTechNote0001.html and
          * http://www.opengl.org/registry/specs/OML/glx_swap_method.txt */
         item->updateWindowPixmap(0, 0, e->timestamp);
+        if (watch->hasFrameListeners())
+            watch->addDamage(item->sceneBoundingRect().toAlignedRect());
+        if (watch->screenRotation())
+            watch->rotationDamage(e->drawable, QRect(e->area.x, e->area.y,
+                                                     e->area.width,
+                                                     e->area.height));
         if (item->waitingForDamage())
             item->damageReceived(false);
+        if (e->drawable == pending_rotation.window)
+            startPendingRotation();
     }
 }
 
@@ -938,31 +856,35 @@ void MCompositeManagerPrivate::destroyEvent(XDestroyWindowEvent *e)
 void MCompositeManagerPrivate::propertyEvent(XPropertyEvent *e)
 {
     MWindowPropertyCache *pc;
+    unsigned effects;
 
-    if (!prop_caches.contains(e->window))
+    // Most property changes, like WM_NAME, don't concern the stacking.
+    effects = atom->propertyEffects(e->atom);
+    if (effects == MCompAtoms::NoEffect || !prop_caches.contains(e->window))
         return;
     pc = prop_caches.value(e->window);
+    // the current application turning is animated by us
+    bool rotate = rotation_mode && e->window == current_app
+                  && e->atom == ATOM(_MEEGOTOUCH_ORIENTATION_ANGLE);
+    unsigned old_angle = rotate ? pc->orientationAngle() : 0;
+    pc->propertyEvent(e);
+    if (!pc->isMapped())
+        return;
+    if (rotate)
+        rotateOutput(pc, old_angle);
 
-    if (pc->propertyEvent(e) && pc->isMapped()) {
+    if (effects & MCompAtoms::Stacking) {
         changed_properties = true; // property change can affect stacking order
         if (pc->isDecorator())
             // in case decorator's transiency changes, make us update the value
             pc->transientFor();
-        dirtyStacking(false, e->time);
-        MCompositeWindow *cw = COMPOSITE_WINDOW(e->window);
-        if (cw && !cw->isNewlyMapped()) {
-            checkStacking(false, e->time);
-            // window on top could have changed
-            if (!possiblyUnredirectTopmostWindow())
-                enableCompositing(false);
-        }
     }
-
-    // global alpha events here. TODO: property cache class could handle this
-    // but it is straightforward to manipulate it from here
-    if (pc->isMapped() && (e->atom == ATOM(_MEEGOTOUCH_GLOBAL_ALPHA) ||
-        e->atom == ATOM(_MEEGOTOUCH_VIDEO_ALPHA)))
-        dirtyStacking(true, e->time);
+    // Rather than checking the stacking right away, which is expensive
+    // when a client changes its properties in a rapid succession, do it
+    // once for all the events we got.  stackingTimeout() will also see
+    // whether the window on top has changed.
+    if (effects & (MCompAtoms::Stacking | MCompAtoms::Visibility))
+        dirtyStacking(effects & MCompAtoms::Visibility, e->time);
 }
 
 Window MCompositeManagerPrivate::getLastVisibleParent(MWindowPropertyCache *pc)
@@ -1084,43 +1006,101 @@ bool MCompositeManagerPrivate::haveMappedWindow() const
     return false;
 }
 
+// Returns the windows to show directly on @output if the window at
+// @win_i of the stacking list is: it and any docks and OR windows above
+// it on @output.
+QList<Window> MCompositeManagerPrivate::scanOutWindows(int win_i,
+                                               const QRect &output) const
+{
+    MCompositeWindow *top_cw = COMPOSITE_WINDOW(stacking_list.at(win_i));
+    QList<Window> ret;
+    // TODO: what else should be unredirected?
+    for (int i = win_i; i < stacking_list.size(); ++i) {
+        Window w = stacking_list.at(i);
+        MCompositeWindow *cw = COMPOSITE_WINDOW(w);
+        if (!cw || (cw != top_cw
+                    && !(cw->isMapped()
+                         && (cw->propertyCache()->windowTypeAtom()
+                                 == ATOM(_NET_WM_WINDOW_TYPE_DOCK)
+                             || cw->propertyCache()->isOverrideRedirect())
+                         && screen_shape(cw->propertyCache())
+                                                .intersects(output))))
+            continue;
+        ret.append(w);
+    }
+    return ret;
+}
+
+// Unredirects the windows scanOutWindows() returns for @win_i and
+// @output, and adds them to @direct.
+void MCompositeManagerPrivate::scanOut(int win_i, const QRect &output,
+                                       QList<Window> *direct)
+{
+    MCompositeWindow *top_cw = COMPOSITE_WINDOW(stacking_list.at(win_i));
+    foreach (Window w, scanOutWindows(win_i, output)) {
+        MCompositeWindow *cw = COMPOSITE_WINDOW(w);
+        if (!((MTexturePixmapItem *)cw)->isDirectRendered()) {
+            ((MTexturePixmapItem *)cw)->enableDirectFbRendering();
+            setWindowDebugProperties(w);
+        }
+        direct->append(w);
+    }
+    // allow input method window to composite its client window
+    Window parent;
+    MCompositeWindow *p_cw;
+    if (top_cw->propertyCache()->windowTypeAtom() ==
+                                   ATOM(_NET_WM_WINDOW_TYPE_INPUT) &&
+        (parent = top_cw->propertyCache()->transientFor()) &&
+        (p_cw = COMPOSITE_WINDOW(parent)) && p_cw->isMapped()) {
+        if (((MTexturePixmapItem*)p_cw)->isDirectRendered()) {
+            ((MTexturePixmapItem*)p_cw)->enableRedirectedRendering();
+            setWindowDebugProperties(parent);
+        }
+        direct->removeAll(parent);
+    }
+}
+
 // TODO: merge this with disableCompositing() so that in the end we have
 // stacking order sensitive logic
+// Decides for each output whether its topmost window can be shown
+// directly.  If it can on all outputs, compositing is turned off.
+// If only on some, the overlay window is cut out of those.  Returns
+// whether any window was unredirected.
 bool MCompositeManagerPrivate::possiblyUnredirectTopmostWindow()
 {
-    static const QRegion fs_r(0, 0,
-                    ScreenOfDisplay(QX11Info::display(),
-                        DefaultScreen(QX11Info::display()))->width,
-                    ScreenOfDisplay(QX11Info::display(),
-                        DefaultScreen(QX11Info::display()))->height);
-    bool ret = false;
-    Window top = 0;
-    int win_i = -1;
-    MCompositeWindow *cw = 0;
-    for (int i = stacking_list.size() - 1; i >= 0; --i) {
+    const QList<MScreenLayout::Output> &outputs = screen_layout->outputs();
+    // the stacking index of the window to show directly on each output,
+    // or -1 to composite it
+    QVector<int> top_i(outputs.size(), -1);
+    QVector<bool> decided(outputs.size(), false);
+    int n_undecided = outputs.size();
+    for (int i = stacking_list.size() - 1; i >= 0 && n_undecided; --i) {
         Window w = stacking_list.at(i);
-        if (!(cw = COMPOSITE_WINDOW(w)) || cw->propertyCache()->isInputOnly())
+        MCompositeWindow *cw = COMPOSITE_WINDOW(w);
+        if (!cw || cw->propertyCache()->isInputOnly())
             continue;
-        if (w == stack[DESKTOP_LAYER]) {
-            top = w;
-            win_i = i;
-            break;
-        }
-        if (cw->isClosing())
-            // this window is unmapped and has unmap animation going on
-            return false;
-        if (cw->isMapped() && (cw->propertyCache()->hasAlpha()
-                               || cw->needDecoration()
-                               || cw->propertyCache()->isDecorator()
-            // FIXME: implement direct rendering for shaped windows
-            || !fs_r.subtracted(cw->propertyCache()->shapeRegion()).isEmpty()))
-            // this window prevents direct rendering
-            return false;
-        // it is a fullscreen, non-transparent window of any type
-        if (cw->isMapped()) {
-            top = w;
-            win_i = i;
-            break;
+        bool desktop = w == stack[DESKTOP_LAYER];
+        // a closing window is unmapped and has unmap animation going on
+        if (!desktop && !cw->isMapped() && !cw->isClosing())
+            continue;
+        MWindowPropertyCache *pc = cw->propertyCache();
+        QRegion shape = screen_shape(pc);
+        for (int o = 0; o < outputs.size(); ++o) {
+            if (decided[o] || !(desktop || shape.intersects(outputs[o].geometry)))
+                continue;
+            decided[o] = true;
+            n_undecided--;
+            if (desktop)
+                top_i[o] = i;
+            else if (cw->isClosing() || pc->hasAlpha()
+                     || cw->needDecoration() || pc->isDecorator()
+                     // FIXME: implement direct rendering for shaped windows
+                     || !QRegion(outputs[o].geometry).subtracted(shape).isEmpty())
+                // this window prevents direct rendering
+                continue;
+            else
+                // it covers the output and is non-transparent
+                top_i[o] = i;
         }
     }
 
@@ -1138,52 +1118,81 @@ bool MCompositeManagerPrivate::possiblyUnredirectTopmostWindow()
         return true;
     }
 
-    if (top && cw && !MCompositeWindow::hasTransitioningWindow()) {
+    // A window shown directly must not reach an output we composite,
+    // its part there would be a hole under the overlay.  Composite the
+    // outputs of such windows as well until none is left.
+    QRegion screen;
+    for (int o = 0; o < outputs.size(); ++o)
+        screen += outputs[o].geometry;
+    for (bool changed = true; changed; ) {
+        QRegion scanout;
+        for (int o = 0; o < outputs.size(); ++o)
+            if (top_i[o] >= 0)
+                scanout += outputs[o].geometry;
+        changed = false;
+        for (int o = 0; o < outputs.size(); ++o) {
+            if (top_i[o] < 0)
+                continue;
+            foreach (Window w, scanOutWindows(top_i[o], outputs[o].geometry))
+                if (!screen_shape(COMPOSITE_WINDOW(w)->propertyCache())
+                     .intersected(screen).subtracted(scanout).isEmpty()) {
+                    top_i[o] = -1;
+                    changed = true;
+                    break;
+                }
+        }
+    }
+
+    int n_direct = outputs.size() - top_i.count(-1);
+    if (!n_direct || MCompositeWindow::hasTransitioningWindow()
+        || watch->screenRotation() || pending_rotation.window)
+        return false;
+
+    QList<Window> direct;
+    if (n_direct == outputs.size()) {
+        // nothing to composite
 #ifdef GLES2_VERSION
         if (compositing) {
             showOverlayWindow(false);
             compositing = false;
         }
 #endif
-        // unredirect the chosen window and any docks and OR windows above it
-        // TODO: what else should be unredirected?
-        if (!((MTexturePixmapItem *)cw)->isDirectRendered()) {
-            ((MTexturePixmapItem *)cw)->enableDirectFbRendering();
-            setWindowDebugProperties(top);
-        }
-        MCompositeWindow *top_cw = cw;
-        for (int i = win_i + 1; i < stacking_list.size(); ++i) {
-            Window w = stacking_list.at(i);
-            if ((cw = COMPOSITE_WINDOW(w)) && cw->isMapped() &&
-                (cw->propertyCache()->windowTypeAtom()
-                                   == ATOM(_NET_WM_WINDOW_TYPE_DOCK)
-                 || cw->propertyCache()->isOverrideRedirect())) {
-                if (!((MTexturePixmapItem *)cw)->isDirectRendered()) {
-                    ((MTexturePixmapItem *)cw)->enableDirectFbRendering();
-                    setWindowDebugProperties(w);
-                }
-            }
-        }
-        // allow input method window to composite its client window
-        Window parent;
-        MCompositeWindow *p_cw;
-        if (top_cw->propertyCache()->windowTypeAtom() ==
-                                       ATOM(_NET_WM_WINDOW_TYPE_INPUT) &&
-            (parent = top_cw->propertyCache()->transientFor()) &&
-            (p_cw = COMPOSITE_WINDOW(parent)) && p_cw->isMapped())
-            if (((MTexturePixmapItem*)p_cw)->isDirectRendered()) {
-                ((MTexturePixmapItem*)p_cw)->enableRedirectedRendering();
-                setWindowDebugProperties(parent);
-            }
+        for (int o = 0; o < outputs.size(); ++o)
+            scanOut(top_i[o], outputs[o].geometry, &direct);
 #ifndef GLES2_VERSION
         if (compositing) {
             showOverlayWindow(false);
             compositing = false;
         }
 #endif
-        ret = true;
+        scanout_region = QRegion();
+        return true;
     }
-    return ret;
+
+    // Composite the rest of the outputs.  The windows shown directly
+    // on them until now are redirected, except the ones which remain.
+    if (!compositing || !overlay_mapped)
+        enableCompositing(true);
+    QRegion scanout;
+    for (int o = 0; o < outputs.size(); ++o)
+        if (top_i[o] >= 0) {
+            scanOut(top_i[o], outputs[o].geometry, &direct);
+            scanout += outputs[o].geometry;
+        }
+    for (int i = 0; i < stacking_list.size(); ++i) {
+        MCompositeWindow *cw = COMPOSITE_WINDOW(stacking_list.at(i));
+        if (cw && cw->isDirectRendered() && cw->isMapped()
+            && !direct.contains(cw->window())) {
+            ((MTexturePixmapItem *)cw)->enableRedirectedRendering();
+            setWindowDebugProperties(cw->window());
+        }
+    }
+    if (scanout != scanout_region) {
+        scanout_region = scanout;
+        shapeOverlayWindow();
+        glwidget->update();
+    }
+    return true;
 }
 
 void MCompositeManagerPrivate::unmapEvent(XUnmapEvent *e)
@@ -1372,7 +1381,7 @@ void MCompositeManagerPrivate::configureWindow(MCompositeWindow *cw,
                 dirtyStacking(false);
             }
         } else {
-            Window parent = transient_for(e->window);
+            Window parent = cw->propertyCache()->transientFor();
             if (parent)
                 positionWindow(parent, true);
             else
@@ -1397,7 +1406,7 @@ void MCompositeManagerPrivate::configureWindow(MCompositeWindow *cw,
                 dirtyStacking(false);
             }
         } else {
-            Window parent = transient_for(e->window);
+            Window parent = cw->propertyCache()->transientFor();
             if (parent) {
                 setWindowState(parent, IconicState);
                 positionWindow(parent, false);
@@ -1430,12 +1439,22 @@ void MCompositeManagerPrivate::configureRequestEvent(XConfigureRequestEvent *e)
     if (e->parent != RootWindow(QX11Info::display(), 0))
         return;
 
-    MWindowPropertyCache *pc = 0;
+    MWindowPropertyCache *pc;
     if (prop_caches.contains(e->window))
         pc = prop_caches.value(e->window);
+    else {
+        // The requests it makes will be reused when the window is mapped.
+        pc = new MWindowPropertyCache(e->window);
+        if (!pc->is_valid) {
+            delete pc;
+            return;
+        }
+        prop_caches[e->window] = pc;
+        pc->setParentWindow(e->parent);
+    }
 
     // sandbox these windows. we own them
-    if ((pc && pc->isDecorator()) || (!pc && atom->isDecorator(e->window)))
+    if (pc->isDecorator())
         return;
 
     /*qDebug() << __func__ << "CONFIGURE REQUEST FOR:" << e->window
@@ -1511,8 +1530,9 @@ void MCompositeManagerPrivate::mapRequestEvent(XMapRequestEvent *e)
 
     MCompAtoms::Type wtype = pc->windowType();
     QRect a = pc->realGeometry();
-    int xres = ScreenOfDisplay(dpy, DefaultScreen(dpy))->width;
-    int yres = ScreenOfDisplay(dpy, DefaultScreen(dpy))->height;
+    const QRect &output = screen_layout->outputAt(a).geometry;
+    int xres = output.width();
+    int yres = output.height();
 
     if (wtype == MCompAtoms::FRAMELESS || wtype == MCompAtoms::DESKTOP
         || wtype == MCompAtoms::INPUT) {
@@ -1559,7 +1579,7 @@ void MCompositeManagerPrivate::mapRequestEvent(XMapRequestEvent *e)
         setWindowState(e->window, IconicState);
     else
         setWindowState(e->window, NormalState);
-    if (needDecoration(e->window, pc)) {
+    if (needDecoration(pc)) {
         if (MDecoratorFrame::instance()->decoratorItem()) {
             // initially visualize decorator item so selective compositing
             // checks won't disable compositing
@@ -1578,7 +1598,7 @@ void MCompositeManagerPrivate::mapRequestEvent(XMapRequestEvent *e)
             frame = f.frame;
             if (!frame) {
                 frame = new MSimpleWindowFrame(e->window);
-                Window trans = transient_for(e->window);
+                Window trans = pc->transientFor();
                 if (trans)
                     frame->setDialogDecoration(true);
 
@@ -2184,33 +2204,45 @@ void MCompositeManagerPrivate::checkStacking(bool force_visibility_check,
         checkInputFocus(timestamp);
     }
     if (order_changed || force_visibility_check) {
-        static int xres = ScreenOfDisplay(QX11Info::display(),
-                                   DefaultScreen(QX11Info::display()))->width;
-        static int yres = ScreenOfDisplay(QX11Info::display(),
-                                   DefaultScreen(QX11Info::display()))->height;
-        int covering_i = 0;
-        static const QRegion fs_r(0, 0, xres, yres);
-        for (int i = stacking_list.size() - 1; i >= 0; --i) {
+        // Find the topmost window covering each output.  Windows below
+        // it are obscured on that output.
+        const QList<MScreenLayout::Output> &outputs = screen_layout->outputs();
+        QVector<int> covering_i(outputs.size(), 0);
+        int n_uncovered = outputs.size();
+        for (int i = stacking_list.size() - 1; i >= 0 && n_uncovered; --i) {
              Window w = stacking_list.at(i);
              if (w == stack[DESKTOP_LAYER]) {
-                 covering_i = i;
+                 for (int o = 0; o < outputs.size(); ++o)
+                     if (!covering_i[o])
+                         covering_i[o] = i;
                  break;
              }
              MCompositeWindow *cw = COMPOSITE_WINDOW(w);
              MWindowPropertyCache *pc = 0;
              if (cw && cw->isMapped())
                  pc = cw->propertyCache();
-             if (cw && cw->isMapped() && !pc->hasAlpha() &&
-                 !pc->isDecorator() && !cw->hasTransitioningWindow() &&
-                 // allow input windows to composite their app, see NB#223280
-                 pc->windowTypeAtom() != ATOM(_NET_WM_WINDOW_TYPE_INPUT) &&
+             if (!(cw && cw->isMapped() && !pc->hasAlpha() &&
+                   !pc->isDecorator() && !cw->hasTransitioningWindow() &&
+                   // allow input windows to composite their app, see NB#223280
+                   pc->windowTypeAtom() != ATOM(_NET_WM_WINDOW_TYPE_INPUT)))
+                 continue;
+             for (int o = 0; o < outputs.size(); ++o) {
+                 if (covering_i[o])
+                     continue;
+                 const QRect &output = outputs[o].geometry;
                  /* FIXME: decorated window is assumed to be fullscreen */
-                 (cw->needDecoration() ||
-                  fs_r.subtracted(pc->shapeRegion()).isEmpty())) {
-                 covering_i = i;
-                 break;
+                 if ((cw->needDecoration() && screen_layout->outputAt(
+                                    pc->realGeometry()).geometry == output)
+                     || QRegion(output).subtracted(
+                                    screen_shape(pc)).isEmpty()) {
+                     covering_i[o] = i;
+                     n_uncovered--;
+                 }
              }
         }
+        int min_covering_i = covering_i[0];
+        for (int o = 1; o < outputs.size(); ++o)
+            min_covering_i = qMin(min_covering_i, covering_i[o]);
         MWindowPropertyCache *ga_pc = 0;
         /* Send synthetic visibility events for our babies */
         int home_i = stacking_list.indexOf(duihome);
@@ -2225,7 +2257,18 @@ void MCompositeManagerPrivate::checkStacking(bool force_visibility_check,
                     setWindowState(cw->window(), NormalState);
                 continue;
             }
-            if (i >= covering_i) {
+            // is it above the covering window of any output it's on?
+            QRegion shape = screen_shape(cw->propertyCache());
+            bool visible = false, on_output = false;
+            for (int o = 0; o < outputs.size() && !visible; ++o)
+                if (shape.intersects(outputs[o].geometry)) {
+                    on_output = true;
+                    visible = i >= covering_i[o];
+                }
+            if (!on_output)
+                // off the outputs, obscured only if all of them are covered
+                visible = i >= min_covering_i;
+            if (visible) {
                 cw->setWindowObscured(false);
                 cw->setVisible(true);
                 if (!ga_pc && (cw->propertyCache()->globalAlpha() < 255 ||
@@ -2248,9 +2291,10 @@ void MCompositeManagerPrivate::checkStacking(bool force_visibility_check,
                 setWindowState(cw->window(), NormalState);
         }
         if (ga_pc)
-            set_global_alpha(ga_pc->globalAlpha(), ga_pc->videoGlobalAlpha());
+            set_global_alpha(screen_layout, ga_pc->globalAlpha(),
+                             ga_pc->videoGlobalAlpha());
         else
-            reset_global_alpha();
+            reset_global_alpha(screen_layout);
     }
     // current app has different semantics from getTopmostApp and pure isAppWindow
     Window set_as_current_app = duihome;
@@ -2280,10 +2324,51 @@ void MCompositeManagerPrivate::stackingTimeout()
                   stacking_timeout_timestamp);
     stacking_timeout_check_visibility = false;
     stacking_timeout_timestamp = CurrentTime;
+    if (refresh_backing_stores && !device_state->displayOff()) {
+        // Only the windows which are visible now, the others catch up
+        // when they are shown.
+        for (QHash<Window, MCompositeWindow *>::iterator it = windows.begin();
+             it != windows.end(); ++it) {
+             MTexturePixmapItem *i = (MTexturePixmapItem *) it.value();
+             if (i->windowVisible())
+                 i->renderer()->refreshBackingStore();
+        }
+        refresh_backing_stores = false;
+    }
+    // windows may have become evictable
+    if (MResourceAccountant::instance()->overBudget())
+        enforceResourceBudget();
     if (!device_state->displayOff() && !possiblyUnredirectTopmostWindow())
         enableCompositing(true);
 }
 
+// Frees the pixmaps and textures of the windows nobody sees, starting from
+// the bottom of the stack, until the graphics memory is within the budget.
+// They are restored when the windows become visible again.
+void MCompositeManagerPrivate::enforceResourceBudget()
+{
+    static bool warned = false;
+    MResourceAccountant *ra = MResourceAccountant::instance();
+
+    for (int i = 0; i < stacking_list.size() && ra->overBudget(); ++i) {
+        MCompositeWindow *cw = COMPOSITE_WINDOW(stacking_list[i]);
+        if (!cw || !cw->isValid() || cw->windowVisible()
+            || cw->isWindowTransitioning())
+            continue;
+        ((MTexturePixmapItem *) cw)->evictBackingStore();
+    }
+
+    if (!ra->overBudget())
+        warned = false;
+    else if (!warned) {
+        // the visible windows alone are over budget
+        qWarning("%s: graphics memory over budget: %lld/%lld bytes",
+                 __func__, ra->total(), ra->budget());
+        warned = true;
+    }
+    ra->budgetEnforced();
+}
+
 // check if there is a categorically higher mapped window than pc
 bool MCompositeManagerPrivate::skipStartupAnim(MWindowPropertyCache *pc)
 {
@@ -2523,7 +2608,7 @@ void MCompositeManagerPrivate::rootMessageEvent(XClientMessageEvent *event)
 
         MWindowPropertyCache *pc = prop_caches.value(event->window, 0);
         if (pc && !skipStartupAnim(pc) &&
-            (!m_extensions.values(MapNotify).isEmpty() || !getTopmostApp())) {
+            (!x11_event_handlers[MapNotify].isEmpty() || !getTopmostApp())) {
             // Not necessary to animate if not in desktop view or we have a plugin.
             Window raise = event->window;
             MCompositeWindow *d_item = COMPOSITE_WINDOW(stack[DESKTOP_LAYER]);
@@ -2580,12 +2665,9 @@ void MCompositeManagerPrivate::rootMessageEvent(XClientMessageEvent *event)
         }
     } else if (event->message_type == ATOM(_NET_WM_STATE)) {
         if (event->data.l[1] == (long)  ATOM(_NET_WM_STATE_SKIP_TASKBAR)) {
-            skiptaskbar_wm_state(event->data.l[0], event->window);
-            if (i) {
-                QVector<Atom> states = atom->getAtomArray(event->window,
-                                                          ATOM(_NET_WM_STATE));
-                i->propertyCache()->setNetWmState(states.toList());
-            }
+            MWindowPropertyCache *pc = prop_caches.value(event->window, 0);
+            if (pc)
+                skiptaskbar_wm_state(event->data.l[0], pc);
         } else if (event->data.l[1] == (long) ATOM(_NET_WM_STATE_FULLSCREEN))
             fullscreen_wm_state(this, event->data.l[0], event->window);
     }
@@ -2693,7 +2775,7 @@ void MCompositeManagerPrivate::closeHandler(MCompositeWindow *window)
     }
 
     if ((!delete_sent || window->status() == MCompositeWindow::Hung)) {
-        kill_window(window->window());
+        kill_window(window);
         if (MDecoratorFrame::instance()->managedWindow() == window->window())
             MDecoratorFrame::instance()->hide();
     }
@@ -2824,6 +2906,11 @@ void MCompositeManagerPrivate::displayOff(bool display_off)
         if (!haveMappedWindow())
             enableCompositing(true);
         scene()->views()[0]->setUpdatesEnabled(false);
+        // Go idle: no timers and no damage objects until the display
+        // is on again, and no new ones either.
+        MWindowPropertyCache::setIdle(true);
+        foreach (MWindowPropertyCache *pc, prop_caches)
+            pc->suspendCollecting(true);
         /* stop pinging to save some battery */
         for (QHash<Window, MCompositeWindow *>::iterator it = windows.begin();
              it != windows.end(); ++it) {
@@ -2833,10 +2920,21 @@ void MCompositeManagerPrivate::displayOff(bool display_off)
              if (i->propertyCache())
                  i->propertyCache()->damageTracking(false);
         }
+        // no wakeups for pinging at all until the display is on again
+        MWindowPingScheduler::instance()->setSuspended(true);
+        if (xserver_pinger)
+            xserver_pinger->setSuspended(true);
+        refresh_backing_stores = false;
     } else {
+        MWindowPropertyCache::setIdle(false);
+        foreach (MWindowPropertyCache *pc, prop_caches)
+            pc->suspendCollecting(false);
         if (!possiblyUnredirectTopmostWindow())
             enableCompositing(false);
         /* start pinging again */
+        MWindowPingScheduler::instance()->setSuspended(false);
+        if (xserver_pinger)
+            xserver_pinger->setSuspended(false);
         pingTopmost();
         // restart damage tracking
         for (QHash<Window, MCompositeWindow *>::iterator it = windows.begin();
@@ -2846,8 +2944,12 @@ void MCompositeManagerPrivate::displayOff(bool display_off)
                                         i->propertyCache()->beingMapped()))
                  i->propertyCache()->damageTracking(true);
         }
+        // the windows' pixmaps are renamed when we know what is visible
+        refresh_backing_stores = true;
     }
-    dirtyStacking(true);  // VisibilityNotify generation
+    // VisibilityNotify generation, and the single restack replaying
+    // what happened while the display was off
+    dirtyStacking(true);
 }
 
 void MCompositeManagerPrivate::callOngoing(bool ongoing_call)
@@ -2959,6 +3061,10 @@ bool MCompositeManagerPrivate::x11EventFilter(XEvent *event)
         return true;
     }
 
+    if (screen_layout->x11Event(event))
+        // let Qt update QDesktopWidget as well
+        return false;
+
     if (event->type != MapRequest && event->type != ConfigureRequest
         && processX11EventFilters(event, false))
         return true;
@@ -3039,21 +3145,40 @@ bool MCompositeManagerPrivate::x11EventFilter(XEvent *event)
     return ret;
 }
 
+// Passes @event to the plugins listening to it.  Unless @after, the first
+// plugin whose x11Event() returns true consumes the event: the rest of
+// the plugins and the compositor don't see it.  Returns whether it was
+// consumed.
 bool MCompositeManagerPrivate::processX11EventFilters(XEvent *event, bool after)
 {
-    if (!m_extensions.contains(event->type))
+    if ((unsigned)event->type >= X11_EVENT_TYPES)
         return false;
 
-    QList<MCompositeManagerExtension*> evlist = m_extensions.values(event->type);
-    bool processed = false;
-    if (after)
-        for (int i = 0; i < evlist.size(); ++i)
-            evlist[i]->afterX11Event(event);
-    else
-        for (int i = 0; i < evlist.size(); ++i)
-            processed = evlist[i]->x11Event(event);
+    const QVector<X11EventHandler> &handlers = x11_event_handlers[event->type];
+    for (int i = 0; i < handlers.size(); ++i) {
+        const X11EventHandler &handler = handlers[i];
+        struct timespec t0, t1;
+        bool consumed = false;
 
-    return processed;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (after)
+            handler.extension->afterX11Event(event);
+        else
+            consumed = handler.extension->x11Event(event);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        quint64 usecs = (t1.tv_sec - t0.tv_sec) * 1000000
+                        + (t1.tv_nsec - t0.tv_nsec) / 1000;
+        handler.stats->events++;
+        handler.stats->usecs += usecs;
+        if (usecs > handler.stats->max_usecs)
+            handler.stats->max_usecs = usecs;
+        if (consumed) {
+            handler.stats->consumed++;
+            return true;
+        }
+    }
+    return false;
 }
 
 void MCompositeManagerPrivate::keyEvent(XKeyEvent* e)
@@ -3099,11 +3224,25 @@ QGraphicsScene *MCompositeManagerPrivate::scene()
     return watch;
 }
 
+// Returns the milliseconds elapsed since @since and resets it.
+static int lap(struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int ms = (now.tv_sec - since->tv_sec) * 1000
+             + (now.tv_nsec - since->tv_nsec) / 1000000;
+    *since = now;
+    return ms;
+}
+
 void MCompositeManagerPrivate::redirectWindows()
 {
     uint children = 0, i = 0;
     Window r, p, *kids = 0;
+    struct timespec t;
+    int t_query, t_caches, t_bind, t_overlay, nbound = 0;
 
+    clock_gettime(CLOCK_MONOTONIC, &t);
     XMapWindow(QX11Info::display(), xoverlay);
     QDesktopWidget *desk = QApplication::desktop();
 
@@ -3112,28 +3251,34 @@ void MCompositeManagerPrivate::redirectWindows()
         qCritical("XQueryTree failed");
         return;
     }
-    int xres = ScreenOfDisplay(QX11Info::display(),
-                               DefaultScreen(QX11Info::display()))->width;
-    int yres = ScreenOfDisplay(QX11Info::display(),
-                               DefaultScreen(QX11Info::display()))->height;
+
+    // Send all queries first, so that we wait for the X server once
+    // rather than twice for every window.
+    QVector<xcb_get_window_attributes_cookie_t> attr_cookies(children);
+    QVector<xcb_get_geometry_cookie_t> geom_cookies(children);
+    for (i = 0; i < children; ++i) {
+        attr_cookies[i] = xcb_get_window_attributes(xcb_conn, kids[i]);
+        geom_cookies[i] = xcb_get_geometry(xcb_conn, kids[i]);
+    }
+    t_query = lap(&t);
+
+    // Collect the replies and create the property caches, which send
+    // their own queries without waiting for the replies.
+    QVector<bool> viewable(children, false);
     for (i = 0; i < children; ++i)  {
         xcb_get_window_attributes_reply_t *attr;
-        attr = xcb_get_window_attributes_reply(xcb_conn,
-                     xcb_get_window_attributes(xcb_conn, kids[i]), 0);
-        if (!attr || attr->_class == XCB_WINDOW_CLASS_INPUT_ONLY) {
-            if (attr) free(attr);
-            continue;
-        }
         xcb_get_geometry_reply_t *geom;
-        geom = xcb_get_geometry_reply(xcb_conn,
-                        xcb_get_geometry(xcb_conn, kids[i]), 0);
-        if (!geom) {
-            free(attr);
+        attr = xcb_get_window_attributes_reply(xcb_conn, attr_cookies[i], 0);
+        geom = xcb_get_geometry_reply(xcb_conn, geom_cookies[i], 0);
+        if (!attr || !geom || attr->_class == XCB_WINDOW_CLASS_INPUT_ONLY) {
+            if (attr) free(attr);
+            if (geom) free(geom);
             continue;
         }
         // Pre-create MWindowPropertyCache for likely application windows
         if (localwin != kids[i] && (attr->map_state == XCB_MAP_STATE_VIEWABLE
-            || (geom->width == xres && geom->height == yres))
+            || screen_layout->coversOutput(QRect(geom->x, geom->y,
+                                                 geom->width, geom->height)))
             && !prop_caches.contains(kids[i])) {
             // attr and geom are freed later
             MWindowPropertyCache *p = new MWindowPropertyCache(kids[i],
@@ -3146,269 +3291,597 @@ void MCompositeManagerPrivate::redirectWindows()
             }
             prop_caches[kids[i]] = p;
             p->setParentWindow(RootWindow(QX11Info::display(), 0));
+            viewable[i] = attr->map_state == XCB_MAP_STATE_VIEWABLE
+                          && geom->width > 1 && geom->height > 1;
         } else {
-            free(attr); attr = 0;
-            free(geom); geom = 0;
+            free(attr);
+            free(geom);
         }
-        if (attr && attr->map_state == XCB_MAP_STATE_VIEWABLE &&
-            localwin != kids[i] && geom &&
-            (geom->width > 1 && geom->height > 1)) {
-            // TODO: remove this bindWindow call -- shouldn't be needed
-            MCompositeWindow* window = bindWindow(kids[i]);
-            if (window) {
-                window->setNewlyMapped(false);
-                window->setVisible(true);
-                // synthetise MapNotify, to use the usual code path for plugins
-                XMapEvent e;
-                e.type = MapNotify;
-                e.serial = 0;
-                e.send_event = True;
-                e.event = RootWindow(QX11Info::display(), 0);
-                e.window = kids[i];
-                e.override_redirect = False;
-                XSendEvent(QX11Info::display(),
-                           RootWindow(QX11Info::display(), 0),
-                           False, SubstructureNotifyMask, (XEvent*)&e);
-            }
+    }
+    t_caches = lap(&t);
+
+    // Bind the mapped windows from bottom to top, by now the replies
+    // to the caches' queries should be waiting for us.  The stacking
+    // list is sorted once they are all in.
+    for (i = 0; i < children; ++i)  {
+        if (!viewable[i])
+            continue;
+        // TODO: remove this bindWindow call -- shouldn't be needed
+        MCompositeWindow* window = bindWindow(kids[i], false);
+        if (window) {
+            nbound++;
+            window->setNewlyMapped(false);
+            window->setVisible(!handoff || !handoff->iconic.contains(kids[i]));
+            // synthetise MapNotify, to use the usual code path for plugins
+            XMapEvent e;
+            e.type = MapNotify;
+            e.serial = 0;
+            e.send_event = True;
+            e.event = RootWindow(QX11Info::display(), 0);
+            e.window = kids[i];
+            e.override_redirect = False;
+            XSendEvent(QX11Info::display(),
+                       RootWindow(QX11Info::display(), 0),
+                       False, SubstructureNotifyMask, (XEvent*)&e);
         }
     }
+    if (handoff) {
+        // Restore the order we had before the restart.  The windows we
+        // don't know about stay where XQueryTree() put them, after the
+        // ones we do.
+        QList<Window> known;
+        foreach (Window w, handoff->stacking_list)
+            if (stacking_list.contains(w))
+                known.append(w);
+        for (int j = 0; j < stacking_list.size(); ++j)
+            if (!known.contains(stacking_list[j]))
+                known.append(stacking_list[j]);
+        stacking_list = known;
+
+        MCompositeWindow *cw;
+        if (windows.contains(handoff->current_app))
+            current_app = handoff->current_app;
+        if ((cw = windows.value(handoff->decorated, 0)) != 0
+            && MDecoratorFrame::instance()->decoratorItem())
+            MDecoratorFrame::instance()->setManagedWindow(cw, true);
+    }
+    if (nbound)
+        roughSort();
     if (kids)
         XFree(kids);
-
-    // Wait for the MapNotify for the overlay (show() of the graphicsview
-    // in main() causes it even if we don't map it explicitly)
-    XEvent xevent;
-    XIfEvent(QX11Info::display(), &xevent, map_predicate, (XPointer)xoverlay);
-    showOverlayWindow(false);
+    t_bind = lap(&t);
+
+    if (!handoff) {
+        // Wait for the MapNotify for the overlay (show() of the
+        // graphicsview in main() causes it even if we don't map it
+        // explicitly)
+        XEvent xevent;
+        XIfEvent(QX11Info::display(), &xevent, map_predicate,
+                 (XPointer)xoverlay);
+        showOverlayWindow(false);
+    } else if (!handoff->compositing)
+        showOverlayWindow(false);
+    // else the overlay is mapped and showing the last frame of our
+    // predecessor, keep it so until we draw ours
     if (!possiblyUnredirectTopmostWindow())
         enableCompositing(true);
+    t_overlay = lap(&t);
+    delete handoff;
+    handoff = 0;
+
+    qDebug("startup scan: %u windows, %d bound; query %d ms, "
+           "caches %d ms, bind %d ms, overlay %d ms", children, nbound,
+           t_query, t_caches, t_bind, t_overlay);
+}
+
+// Appends @str to @json as a JSON string.
+static void jsonString(QByteArray &json, const QByteArray &str)
+{
+    json += '"';
+    for (int i = 0; i < str.size(); ++i) {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\') {
+            json += '\\';
+            json += c;
+        } else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%.4x", c);
+            json += esc;
+        } else
+            json += c;
+    }
+    json += '"';
 }
 
-bool MCompositeManagerPrivate::isRedirected(Window w)
+static void jsonRect(QByteArray &json, const QRect &r)
 {
-    return (COMPOSITE_WINDOW(w) != 0);
+    json += '[' + QByteArray::number(r.x()) + ','
+        + QByteArray::number(r.y()) + ','
+        + QByteArray::number(r.width()) + ','
+        + QByteArray::number(r.height()) + ']';
 }
 
-void MCompositeManagerPrivate::removeWindow(Window w)
+// {"pixmap":<bytes>,...} of @u.
+static void jsonUsage(QByteArray &json, const MResourceAccountant::Usage &u)
 {
-    // Item is already removed from scene when it is deleted
-    int removed = 0;
+    json += '{';
+    for (int i = 0; i < MResourceAccountant::KindCount; ++i) {
+        if (i)
+            json += ',';
+        json += '"';
+        json += MResourceAccountant::kindName((MResourceAccountant::Kind)i);
+        json += "\":" + QByteArray::number(u.bytes[i]);
+    }
+    json += '}';
+}
 
-    STACKING("remove 0x%lx from stack", w);
-    removed += windows_as_mapped.removeAll(w);
-    removed += windows.remove(w);
-    removed += stacking_list.removeAll(w);
+// Unlike dumpState() this is meant to be polled by monitoring tools,
+// so it's always available and it only uses what we have at hand,
+// without talking to the X server.  The damage rates are per second
+// since the previous export.
+QByteArray MCompositeManagerPrivate::exportState()
+{
+    static const char *wintypes[] = {
+        "INVALID", "DESKTOP", "NORMAL", "DIALOG", "NO_DECOR_DIALOG",
+        "FRAMELESS", "DOCK", "INPUT", "ABOVE", "NOTIFICATION",
+        "DECORATOR", "UNKNOWN",
+    };
+    static const char *tf[] = { "false", "true" };
+    QByteArray json;
+    struct timespec now;
+    double elapsed;
+    MResourceAccountant *ra = MResourceAccountant::instance();
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = last_export.tv_sec
+        ? (now.tv_sec - last_export.tv_sec)
+          + (now.tv_nsec - last_export.tv_nsec) / 1e9
+        : 0;
+    last_export = now;
+
+    json.reserve(256 + windows.count() * 320);
+    json += "{\"version\":1,\"time\":";
+    json += QByteArray::number((qlonglong)now.tv_sec * 1000
+                               + now.tv_nsec / 1000000);
+    json += ",\"display_off\":";
+    json += tf[device_state->displayOff()];
+    json += ",\"compositing\":";
+    json += tf[compositing];
+    json += ",\"overlay_mapped\":";
+    json += tf[overlay_mapped];
+    json += ",\"current_app\":" + QByteArray::number((qulonglong)current_app);
+    json += ",\"decorated\":" + QByteArray::number(
+               (qulonglong)MDecoratorFrame::instance()->managedWindow());
+
+    // Bottom to top.
+    json += ",\"stacking\":[";
+    for (int i = 0; i < stacking_list.size(); ++i) {
+        if (i)
+            json += ',';
+        json += QByteArray::number((qulonglong)stacking_list[i]);
+    }
 
-    for (int i = 0; i < TOTAL_LAYERS; ++i)
-        if (stack[i] == w) stack[i] = 0;
+    QHash<Window, unsigned> damage;
+    json += "],\"windows\":[";
+    for (QHash<Window, MCompositeWindow *>::const_iterator it =
+         windows.constBegin(); it != windows.constEnd(); ++it) {
+        MCompositeWindow *cw = it.value();
+        MWindowPropertyCache *pc = cw->propertyCache();
+        if (!pc || !cw->isValid())
+            continue;
 
-    if (removed > 0) updateWinList();
+        MResourceAccountant::Usage usage = ra->windowUsage(it.key());
+        unsigned ndamage = cw->damageCount();
+        double rate = elapsed > 0
+            ? (ndamage - exported_damage.value(it.key(), ndamage)) / elapsed
+            : 0;
+
+        if (!damage.isEmpty())
+            json += ',';
+        damage.insert(it.key(), ndamage);
+        json += "{\"id\":" + QByteArray::number((qulonglong)it.key());
+        json += ",\"name\":";
+        jsonString(json, pc->wmName().toUtf8());
+        json += ",\"type\":\"";
+        json += wintypes[pc->windowType()];
+        json += "\",\"geometry\":";
+        jsonRect(json, pc->realGeometry());
+        json += ",\"mapped\":";
+        json += tf[cw->isMapped()];
+        json += ",\"visible\":";
+        json += tf[cw->windowVisible()];
+        json += ",\"iconified\":";
+        json += tf[cw->isIconified()];
+        json += ",\"redirected\":";
+        json += tf[!cw->isDirectRendered()];
+        json += ",\"layer\":" + QByteArray::number(pc->meegoStackingLayer());
+        json += ",\"orientation\":"
+            + QByteArray::number(pc->orientationAngle());
+        json += ",\"texture_bytes\":" + QByteArray::number(
+                   usage.bytes[MResourceAccountant::Pixmap]
+                   + usage.bytes[MResourceAccountant::Texture]);
+        json += ",\"resources\":";
+        jsonUsage(json, usage);
+        json += ",\"damage\":" + QByteArray::number(ndamage);
+        json += ",\"damage_rate\":" + QByteArray::number(rate, 'f', 1);
+        json += '}';
+    }
+    exported_damage = damage;
+    json += "],\"texture_bytes\":" + QByteArray::number(
+               ra->total(MResourceAccountant::Pixmap)
+               + ra->total(MResourceAccountant::Texture));
+
+    // Graphics memory by kind, and of the plugins and effects.
+    json += ",\"resources\":{\"budget\":" + QByteArray::number(ra->budget());
+    json += ",\"total\":";
+    MResourceAccountant::Usage totals;
+    for (int i = 0; i < MResourceAccountant::KindCount; ++i)
+        totals.bytes[i] = ra->total((MResourceAccountant::Kind)i);
+    jsonUsage(json, totals);
+    json += ",\"components\":{";
+    for (QHash<QByteArray, MResourceAccountant::Usage>::const_iterator rit =
+         ra->componentUsages().constBegin();
+         rit != ra->componentUsages().constEnd(); ++rit) {
+        if (rit != ra->componentUsages().constBegin())
+            json += ',';
+        jsonString(json, rit.key());
+        json += ':';
+        jsonUsage(json, *rit);
+    }
+    json += "}}";
+
+    const MCompositeScene::FrameStats &stats = watch->frameStats();
+    json += ",\"frames\":{\"count\":" + QByteArray::number(stats.frames);
+    json += ",\"draw_calls\":" + QByteArray::number(stats.draw_calls);
+    json += ",\"total_usecs\":"
+        + QByteArray::number((qulonglong)stats.total_usecs);
+    json += ",\"max_usecs\":" + QByteArray::number(stats.max_usecs);
+    json += '}';
+
+    const MWindowPropertyCache::RequestStats &ps
+        = MWindowPropertyCache::requestStats();
+    json += ",\"properties\":{\"events\":"
+        + QByteArray::number(ps.property_events);
+    json += ",\"coalesced\":" + QByteArray::number(ps.coalesced);
+    json += ",\"requests\":" + QByteArray::number(ps.issued);
+    json += ",\"superseded\":" + QByteArray::number(ps.superseded);
+    json += ",\"cancelled\":" + QByteArray::number(ps.cancelled);
+    json += ",\"collected\":" + QByteArray::number(ps.collected);
+    json += ",\"collected_by_timer\":"
+        + QByteArray::number(ps.collected_by_timer);
+    json += ",\"timer_restarts\":" + QByteArray::number(ps.timer_restarts);
+    json += ",\"outstanding\":" + QByteArray::number(ps.outstanding);
+    json += ",\"outstanding_max\":" + QByteArray::number(ps.outstanding_max);
+    json += ",\"wait_usecs\":" + QByteArray::number(ps.wait_usecs);
+    json += ",\"wait_usecs_max\":" + QByteArray::number(ps.wait_usecs_max);
+    json += '}';
+
+    const QList<MScreenLayout::Output> &outputs = screen_layout->outputs();
+    json += ",\"outputs\":[";
+    for (int i = 0; i < outputs.size(); ++i) {
+        const MScreenLayout::Output &o = outputs[i];
+        if (i > 0)
+            json += ',';
+        json += "{\"name\":";
+        jsonString(json, o.name);
+        json += ",\"geometry\":";
+        jsonRect(json, o.geometry);
+        json += ",\"panel\":";
+        json += tf[o.panel];
+        json += ",\"scanout\":";
+        json += tf[!compositing || scanout_region.contains(o.geometry)];
+        json += '}';
+    }
+    json += ']';
+
+    json += ",\"rotation_mode\":";
+    json += tf[rotation_mode];
+    if (const MScreenRotation *rotation = watch->screenRotation()) {
+        json += ",\"rotation\":{\"output\":";
+        jsonRect(json, rotation->output());
+        json += ",\"degrees\":" + QByteArray::number(rotation->degrees());
+        json += ",\"window\":"
+            + QByteArray::number((qulonglong)rotation->window());
+        json += '}';
+    }
+
+    if (const MScreenCapture *capture = watch->screenCapture()) {
+        const MScreenCapture::Stats &cs = capture->stats();
+        json += ",\"capture\":{\"name\":";
+        jsonString(json, capture->name().toUtf8());
+        json += ",\"damage_only\":";
+        json += tf[capture->damageOnly()];
+        json += ",\"pixel_buffers\":";
+        json += tf[capture->usesPixelBuffers()];
+        json += ",\"frames\":" + QByteArray::number(cs.frames);
+        json += ",\"keyframes\":" + QByteArray::number(cs.keyframes);
+        json += ",\"skipped\":" + QByteArray::number(cs.skipped);
+        json += ",\"bytes\":" + QByteArray::number((qulonglong)cs.bytes);
+        json += ",\"total_usecs\":"
+            + QByteArray::number((qulonglong)cs.total_usecs);
+        json += ",\"max_usecs\":"
+            + QByteArray::number((qulonglong)cs.max_usecs);
+        json += '}';
+    }
+
+    if (xserver_pinger) {
+        XServerPinger::Stats xs = xserver_pinger->stats();
+        json += ",\"xserver\":{\"pings\":" + QByteArray::number(xs.pings);
+        json += ",\"timeouts\":" + QByteArray::number(xs.timeouts);
+        json += ",\"p50\":" + QByteArray::number(xs.p50);
+        json += ",\"p99\":" + QByteArray::number(xs.p99);
+        json += ",\"max\":" + QByteArray::number(xs.max);
+        json += ",\"interval\":" + QByteArray::number(xs.interval);
+        json += '}';
+    }
+    json += "}\n";
+    return json;
 }
 
-// Determine whether a decorator should be ordered above or below @win.
-// If the answer is definite it is stored in *@cmpp and NULL is returned.
-// Otherwise the decorator should be ordered exatly like the returned window,
-// the decorator's managed window.
+// Environment variable to tell the new instance of mcompositor where it
+// finds the state of the old one: "<state fd>,<X connection fd>".
+#define HANDOFF_ENV "MCOMPOSITOR_HANDOFF"
+#define HANDOFF_MAGIC 0x4d434831 // MCH1
+
+// Returns an anonymous file not closed across exec(), or -1.
+static int handoff_file()
+{
+    int fd;
+#ifdef __NR_memfd_create
+    if ((fd = syscall(__NR_memfd_create, "mcompositor-handoff", 0)) >= 0)
+        return fd;
+#endif
+    // memfd is not available, use an unlinked temporary file
+    char fname[] = "/tmp/mcompositor-handoff.XXXXXX";
+    if ((fd = mkstemp(fname)) >= 0)
+        unlink(fname);
+    return fd;
+}
+
+// Called before restarting to save what the new instance cannot find out
+// from the X server or only with many round trips: the stacking order,
+// the iconified windows, the current application, the window the
+// decorator is on, and whether we are compositing.  Our X connection is
+// inherited too, so that the overlay window stays mapped until the new
+// instance takes it over.
 //
-// Unused decorators should be below anything else.
-// The decorated window should be below the decorator.
-// Otherwise we don't know.
-static bool compareDecorator(MWindowPropertyCache *win)
-{
-    MDecoratorFrame *deco;
-    MCompositeWindow *man;
-    const QList<Window> &stack =
-        static_cast<MCompositeManager*>(qApp)->stackingList();
-
-    if (!(deco = MDecoratorFrame::instance()))
-        // the decorator is so unused that we don't even know about it
-        return true;
-    if (!(man = deco->managedClient()))
-        // the decorator is unused
-        return true;
-    if (man->propertyCache() == win)
-        // @win is the decorator's managed window, keep them together
+// The property caches are not handed over.  The property changes between
+// our last event and the new instance's XSelectInput() would be missed,
+// leaving the caches stale with nothing to correct them, and the new
+// instance queries the properties of all windows in parallel anyway.
+bool MCompositeManagerPrivate::saveHandoffState()
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    QList<quint32> stack, iconic;
+
+    foreach (Window w, stacking_list)
+        stack.append(w);
+    for (QHash<Window, MCompositeWindow *>::const_iterator it =
+         windows.constBegin(); it != windows.constEnd(); ++it) {
+        MWindowPropertyCache *pc = it.value()->propertyCache();
+        if (pc && pc->isMapped() && pc->windowState() == IconicState)
+            iconic.append(it.key());
+    }
+    out << (quint32)HANDOFF_MAGIC << (quint32)current_app
+        << (quint32)MDecoratorFrame::instance()->managedWindow()
+        << compositing << stack << iconic;
+
+    int fd = handoff_file();
+    if (fd < 0)
         return false;
-    if (compareWindows(man->window(), win->winId()))
-        return true;
-    if (compareWindows(win->winId(), man->window()))
+    if (::write(fd, data.constData(), data.size()) != data.size()
+        || lseek(fd, 0, SEEK_SET) < 0) {
+        ::close(fd);
         return false;
-    if (stack.indexOf(man->window()) < stack.indexOf(win->winId()))
-        return true;
-    else
+    }
+
+    // Keep the X connection open across exec().
+    int xfd = ConnectionNumber(QX11Info::display());
+    if (fcntl(xfd, F_SETFD, 0) < 0) {
+        ::close(fd);
         return false;
+    }
+    setenv(HANDOFF_ENV, QString("%1,%2").arg(fd).arg(xfd).toLatin1(), 1);
+    return true;
 }
 
-// Returns whether @pc in @layer of @type is special with regards to stacking.
-// Returns None for non-special cases, or NOTIFICATION, INPUT or DIALOG.
-// The returned Atom doesn't mean that @pc has that window type; it merely
-// indicates that it should be stacked like that.
-static Atom isSpecial(MWindowPropertyCache *pc, int layer, Atom type)
-{
-    if (layer < 6 && type == ATOM(_NET_WM_WINDOW_TYPE_NOTIFICATION))
-        /* @pc is maybe a notification */;
-    else if (layer < 5 &&
-        (type == ATOM(_NET_WM_WINDOW_TYPE_INPUT) ||
-         pc->isOverrideRedirect() ||
-         pc->netWmState().contains(ATOM(_NET_WM_STATE_ABOVE))))
-        // @pc is maybe input or keep-above window
-        type = ATOM(_NET_WM_WINDOW_TYPE_INPUT);
-    else if (layer == 0 &&
-             pc->netWmState().contains(ATOM(_NET_WM_STATE_MODAL)) &&
-             type == ATOM(_NET_WM_WINDOW_TYPE_DIALOG))
-        /* @pc is maybe a system-modal dialog */;
-    else
-        // Nothing special.
-        return None;
+// Reads the state saved by the previous instance if we've been restarted.
+void MCompositeManagerPrivate::loadHandoffState()
+{
+    const char *env = getenv(HANDOFF_ENV);
+    int fd;
+
+    if (!env || sscanf(env, "%d,%d", &fd, &handoff_xfd) != 2)
+        return;
+    unsetenv(HANDOFF_ENV);
+
+    QFile file;
+    if (!file.open(fd, QIODevice::ReadOnly)) {
+        ::close(fd);
+        return;
+    }
+    QDataStream in(&file);
+    quint32 magic, cur, deco;
+    QList<quint32> stack, iconic;
+    bool comp;
+    in >> magic >> cur >> deco >> comp >> stack >> iconic;
+    file.close();
+    ::close(fd);
+    if (in.status() != QDataStream::Ok || magic != HANDOFF_MAGIC) {
+        qWarning("%s: invalid state from the previous instance", __func__);
+        return;
+    }
 
-    // @pc deserves special handling only if it doesn't have
-    // a lastVisibleParent().
-    MCompositeManager *cmgr = (MCompositeManager*)qApp;
-    return cmgr->getLastVisibleParent(pc) ? None : type;
+    // The windows are validated when we actually find them.
+    handoff = new HandoffState;
+    handoff->current_app = cur;
+    handoff->decorated = deco;
+    handoff->compositing = comp;
+    foreach (quint32 w, stack)
+        handoff->stacking_list.append(w);
+    foreach (quint32 w, iconic)
+        handoff->iconic.append(w);
 }
 
-// Internal qStableSort() comparator.  The desired rough order of
-// @stacking_list roughly is:
-//
-// unused decorator (lowest), iconified/withdrawn windows possibly with
-// decorator on top, desktop, normal state windows with transients/decorator
-// on top, system-modal dialogs, input-type windows, notifications,
-// windows with stacking layers (highest).
-//
-// Returns true if @w_a should definitely be below @w_b, otherwise false.
-// This tells the sorting function that the sorting of @w_a is either
-// greater than or equal to @w_b's.  In other words, @w_a needn't be
-// below @w_a, but it could be, unless compareWindows(@w_b, @w_a) tells
-// explicitly otherwise (ie. that @w_a needs to be higher than @w_b).
-//
-// TODO: before this can replace checkStacking(), we need to handle at least
-// the decorator, possibly also window groups and dock windows.
-static bool compareWindows(Window w_a, Window w_b)
-{
-    int layer;
-    Atom type_a, type_b;
-
-    // qSort() should know better, but if it doesn't, tell it that
-    // no item is less than itself.
-    Q_ASSERT(w_a != w_b);
-    if (w_a == w_b)
-        SORTING(false);
-
-    MCompositeManager *cmgr = (MCompositeManager*)qApp;
-    // If we don't know about either of the windows let them in peace
-    // -- don't reason about what we don't know.
-    MWindowPropertyCache *pc_a = cmgr->propCaches().value(w_a, 0);
-    MWindowPropertyCache *pc_b = cmgr->propCaches().value(w_b, 0);
-    if (!pc_a || !pc_b)
-        SORTING(false);
-
-    // Mind decorators.  Lone decorators should go below everything else,
-    // otherwise it's sorted above its managed window.
-    if (pc_a->isDecorator())
-        // @pc_a is a lone decorator or @pc_b happens to be
-        // its managed window.
-        SORTING( compareDecorator(pc_b));
-    else if (pc_b->isDecorator())
-        // Likewise.
-        SORTING(!compareDecorator(pc_a));
-
-    // Iconic/withdrawn/unmanaged windows...
-    if (pc_a->windowState() != NormalState) {
-        if (pc_b->windowState() == NormalState)
-            // ...go below NormalState windows ...
-            SORTING(true);
-        else
-            // ... otherwise we don't care.
-            SORTING(false);
-    } else if (pc_b->windowState() != NormalState)
-        // @pc_a is NormalState, @pc_b is not.
-        SORTING(false);
-
-    // Both @pc_a and @pc_b are in NormalState.
-    // Sort the desktop below all NormalState windows.
-    // (Quiz: why do we check @pc_b before @pc_a?
-    //  Answer: to be consistent even if both windows are desktops.)
-    type_b = pc_b->windowTypeAtom();
-    if (type_b == ATOM(_NET_WM_WINDOW_TYPE_DESKTOP))
-        SORTING(false);
-    type_a = pc_a->windowTypeAtom();
-    if (type_a == ATOM(_NET_WM_WINDOW_TYPE_DESKTOP))
-        SORTING(true);
-
-    // Compare by stacking layers.
-    layer = pc_a->meegoStackingLayer();
-    int rel = layer - pc_b->meegoStackingLayer();
-    if (rel < 0)
-        // @pc_a has lower stacking layer
-        SORTING(true);
-    else if (rel > 0)
-        // @pc_a has greater stacking layer
-        SORTING(false);
-    // They're in the same layer.
-
-    // Order notifications, input windows and system-modal dialogs.
-    // We can skip it altogether if the windows' layer is too high,
-    // because for them isSpecial() will always be false.
-    if (layer < 6) {
-        type_a = isSpecial(pc_a, layer, type_a);
-        type_b = isSpecial(pc_b, layer, type_b);
-        // type_a, type_b == None || dialog || input || notification
-
-        // Skip to the next test if the windows are equally special
-        // or non-special.
-        if (type_a != type_b) {
-            if (type_b == ATOM(_NET_WM_WINDOW_TYPE_NOTIFICATION))
-                // type_a == None || dialog || input
-                SORTING(true);
-            if (type_a == ATOM(_NET_WM_WINDOW_TYPE_NOTIFICATION))
-                // type_b == None || dialog || input
-                SORTING(false);
-            if (type_b == ATOM(_NET_WM_WINDOW_TYPE_INPUT))
-                // type_a == None || dialog
-                SORTING(true);
-            if (type_a == ATOM(_NET_WM_WINDOW_TYPE_INPUT))
-                // type_b == None || dialog
-                SORTING(false);
-            if (type_b == ATOM(_NET_WM_WINDOW_TYPE_DIALOG))
-                // type_a == None
-                SORTING(true);
-            if (type_a == ATOM(_NET_WM_WINDOW_TYPE_DIALOG))
-                // type_b == None
-                SORTING(false);
+struct selection_notify_args {
+    int event_type;
+    Atom selection;
+};
+
+static Bool selection_notify_predicate(Display *display, XEvent *xevent,
+                                       XPointer arg)
+{
+    Q_UNUSED(display);
+    selection_notify_args *args = (selection_notify_args *)arg;
+    return xevent->type == args->event_type
+        && ((XFixesSelectionNotifyEvent *)xevent)->selection
+           == args->selection;
+}
+
+// Gets a reference to the overlay window before closing our predecessor's
+// X connection, so that it's not unmapped in between and the screen
+// keeps showing the last frame until we draw ours.
+void MCompositeManagerPrivate::takeOverOverlay()
+{
+    if (handoff_xfd < 0)
+        return;
+
+    Display *dpy = QX11Info::display();
+    Window root = RootWindow(dpy, 0);
+    selection_notify_args args;
+    int error_base;
+    args.selection = XInternAtom(dpy, "_NET_WM_CM_S0", False);
+    XFixesQueryExtension(dpy, &args.event_type, &error_base);
+    args.event_type += XFixesSelectionNotify;
+
+    // Ask to be told when the old connection loses the selection before
+    // closing it, so that the notification can't be missed.
+    XFixesSelectSelectionInput(dpy, root, args.selection,
+                               XFixesSetSelectionOwnerNotifyMask
+                               | XFixesSelectionClientCloseNotifyMask);
+    XCompositeGetOverlayWindow(dpy, root);
+    XSync(dpy, False);
+    ::close(handoff_xfd);
+    handoff_xfd = -1;
+
+    // Wait until the X server has noticed that the old connection is
+    // gone, otherwise it would look like another compositor is running.
+    struct pollfd pfd;
+    pfd.fd = ConnectionNumber(dpy);
+    pfd.events = POLLIN;
+    while (XGetSelectionOwner(dpy, args.selection) != None) {
+        XEvent xevent;
+        if (XCheckIfEvent(dpy, &xevent, selection_notify_predicate,
+                          (XPointer)&args))
+            continue;
+        if (poll(&pfd, 1, 1000) <= 0) {
+            qWarning("%s: the previous instance still owns the selection",
+                     __func__);
+            break;
         }
     }
+    XFixesSelectSelectionInput(dpy, root, args.selection, 0);
+}
+
+bool MCompositeManagerPrivate::isRedirected(Window w)
+{
+    return (COMPOSITE_WINDOW(w) != 0);
+}
+
+void MCompositeManagerPrivate::removeWindow(Window w)
+{
+    // Item is already removed from scene when it is deleted
+    int removed = 0;
+
+    STACKING("remove 0x%lx from stack", w);
+    removed += windows_as_mapped.removeAll(w);
+    removed += windows.remove(w);
+    removed += stacking_list.removeAll(w);
+
+    for (int i = 0; i < TOTAL_LAYERS; ++i)
+        if (stack[i] == w) stack[i] = 0;
 
-    // Order transient windows below what they are transient for.
-    // Since the sorting algorithm can infer that if trfor(@a) == @b
-    // and trfor(@b) == @c then @a is transient for @c it is not
-    // necessary for us to check if @pc_a is a grandparent of @pc_b
-    // or vice versa.  However, we *do* have to mind circular
-    // transiency between @pc_a and @pc_b otherwise we would
-    // return true for both compareWindows(@w_a, @w_b) and
-    // compareWindows(@w_b, @w_a), which would make the sorting
-    // undeterministic.
-    if (pc_b->transientFor() == w_a && pc_a->transientFor() != w_b)
-      // @pc_b is transient for @pc_a, so it must be above it.
-      SORTING(true);
+    if (removed > 0) updateWinList();
+}
 
-    // Either @pc_a is transient for @pc_b or they are transient
-    // for each other, or they are not in direct relationship,
-    // or they are not in any relationship at all.
-    SORTING(false);
+// Tells MStackingRules what the property caches know about the windows.
+class PropertyCacheSource: public MStackingRules::Source
+{
+public:
+    PropertyCacheSource(MCompositeManagerPrivate *d) : d(d) {}
+
+    bool isKnown(Window w) const
+        { return d->prop_caches.contains(w); }
+    bool isDecorator(Window w) const
+        { return pc(w)->isDecorator(); }
+    bool isOverrideRedirect(Window w) const
+        { return pc(w)->isOverrideRedirect(); }
+    int windowState(Window w) const
+        { return pc(w)->windowState(); }
+    Atom windowTypeAtom(Window w) const
+        { return pc(w)->windowTypeAtom(); }
+    unsigned meegoStackingLayer(Window w) const
+        { return pc(w)->meegoStackingLayer(); }
+    bool hasNetWmState(Window w, Atom state) const
+        { return pc(w)->netWmState().contains(state); }
+    Window transientFor(Window w) const
+        { return pc(w)->transientFor(); }
+    Window lastVisibleParent(Window w) const
+        { return d->getLastVisibleParent(pc(w)); }
+    Window decoratedWindow() const {
+        MCompositeWindow *man = MDecoratorFrame::instance()->managedClient();
+        return man ? man->window() : 0;
+    }
+
+private:
+    MWindowPropertyCache *pc(Window w) const
+        { return d->prop_caches.value(w); }
+
+    MCompositeManagerPrivate *d;
+};
+
+static const MStackingRules::Atoms &stacking_atoms()
+{
+    static const MStackingRules::Atoms atoms = {
+        ATOM(_NET_WM_WINDOW_TYPE_DESKTOP),
+        ATOM(_NET_WM_WINDOW_TYPE_NOTIFICATION),
+        ATOM(_NET_WM_WINDOW_TYPE_INPUT),
+        ATOM(_NET_WM_WINDOW_TYPE_DIALOG),
+        ATOM(_NET_WM_STATE_ABOVE),
+        ATOM(_NET_WM_STATE_MODAL),
+    };
+    return atoms;
 }
 
 void MCompositeManagerPrivate::roughSort()
 {
-    // Use a stable sorting algorithm to ensure roughSort() is invariant,
-    // ie. that it keeps the order unless it is necessary to change.
+    static PropertyCacheSource source(this);
+    MStackingRules rules(&source, stacking_atoms(), &stacking_list);
+
     STACKING("sorting stack [%s]",
              dumpWindows(stacking_list).toLatin1().constData());
-    qStableSort(stacking_list.begin(), stacking_list.end(), compareWindows);
+    if (stacking_trace) {
+        QList<Window> input = stacking_list;
+        rules.sort(stacking_list);
+        stacking_trace->sorted(&source, input, stacking_list);
+    } else
+        rules.sort(stacking_list);
     STACKING("resulting in: [%s]",
              dumpWindows(stacking_list).toLatin1().constData());
 }
 
-MCompositeWindow *MCompositeManagerPrivate::bindWindow(Window window)
+void MCompositeManagerPrivate::traceStacking(const QString &fname)
+{
+    delete stacking_trace;
+    stacking_trace = 0;
+    if (!fname.isEmpty())
+        stacking_trace = MStackingTrace::create(fname, stacking_atoms());
+}
+
+// If !@sort, the caller is responsible for roughSort()ing @stacking_list.
+MCompositeWindow *MCompositeManagerPrivate::bindWindow(Window window,
+                                                      bool sort)
 {
     Display *display = QX11Info::display();
 
@@ -3439,7 +3912,8 @@ MCompositeWindow *MCompositeManagerPrivate::bindWindow(Window window)
     windows[window] = item;
 
     const XWMHints &h = pc->getWMHints();
-    if ((h.flags & StateHint) && (h.initial_state == IconicState)) {
+    if (((h.flags & StateHint) && (h.initial_state == IconicState))
+        || (handoff && handoff->iconic.contains(window))) {
         setWindowState(window, IconicState);
         item->setZValue(-1);
     } else {
@@ -3452,16 +3926,14 @@ MCompositeWindow *MCompositeManagerPrivate::bindWindow(Window window)
     if (fs_i == -1) {
         pc->setRequestedGeometry(QRect(a.x(), a.y(), a.width(), a.height()));
     } else {
-        int xres = ScreenOfDisplay(display, DefaultScreen(display))->width;
-        int yres = ScreenOfDisplay(display, DefaultScreen(display))->height;
-        pc->setRequestedGeometry(QRect(0, 0, xres, yres));
+        pc->setRequestedGeometry(screen_layout->outputAt(a).geometry);
     }
 
     if (!pc->isDecorator() && !pc->isOverrideRedirect()
         && windows_as_mapped.indexOf(window) == -1)
         windows_as_mapped.append(window);
 
-    if (needDecoration(window, pc))
+    if (needDecoration(pc))
         item->setDecorated(true);
 
     item->updateWindowPixmap();
@@ -3474,7 +3946,8 @@ MCompositeWindow *MCompositeManagerPrivate::bindWindow(Window window)
         STACKING_MOVE(i, stacking_list.size()-1);
         safe_move(stacking_list, i, stacking_list.size() - 1);
     }
-    roughSort();
+    if (sort)
+        roughSort();
 
     addItem(item);
 
@@ -3614,24 +4087,158 @@ const QList<Window> &MCompositeManager::stackingList() const
 
 void MCompositeManagerPrivate::enableCompositing(bool forced)
 {
-    if (compositing && !forced)
+    if (compositing && !forced && scanout_region.isEmpty())
         return;
 
-    if (!overlay_mapped)
+    // composite the outputs showing a window directly as well
+    bool reshape = !scanout_region.isEmpty();
+    scanout_region = QRegion();
+    if (!overlay_mapped) {
         showOverlayWindow(true);
-    else
+    } else {
+        if (reshape)
+            shapeOverlayWindow();
         enableRedirection(true);
+    }
+}
+
+// Sets the bounding shape of @w to @r.
+static void shape_window(Window w, const QRegion &r)
+{
+    QVector<QRect> rects = r.rects();
+    QVector<XRectangle> xrects(rects.size());
+    for (int i = 0; i < rects.size(); ++i) {
+        xrects[i].x = rects[i].x();
+        xrects[i].y = rects[i].y();
+        xrects[i].width = rects[i].width();
+        xrects[i].height = rects[i].height();
+    }
+    XShapeCombineRectangles(QX11Info::display(), w, ShapeBounding, 0, 0,
+                            xrects.data(), xrects.size(), ShapeSet, Unsorted);
+}
+
+// Shapes the overlay window to cover the screen, except the outputs
+// showing a window directly.
+void MCompositeManagerPrivate::shapeOverlayWindow()
+{
+    // the view is at -2,-2, see main()
+    const QRect &screen = screen_layout->screen();
+    QRegion fs(0, 0, screen.width() + 2, screen.height() + 2);
+    shape_window(xoverlay, fs - scanout_region);
+    shape_window(localwin, fs - scanout_region.translated(2, 2));
+    // don't draw what's not shown
+    watch->setScanoutRegion(scanout_region);
+}
+
+// Called when the screen is resized or the outputs change.
+void MCompositeManagerPrivate::screenLayoutChanged()
+{
+    const QRect &screen = screen_layout->screen();
+    qDebug("screen is %dx%d on %d output(s)", screen.width(), screen.height(),
+           screen_layout->outputs().size());
+
+    // the view is 2 pixels larger on each side, see main()
+    watch->setSceneRect(screen);
+    scene()->views()[0]->setFixedSize(screen.width() + 2, screen.height() + 2);
+    glwidget->setFixedSize(screen.size());
+    glwidget->makeCurrent();
+    MTexturePixmapPrivate::updateProjection();
+
+    // the outputs showing a window directly may be gone
+    if (!scanout_region.isEmpty())
+        enableCompositing(true);
+    else if (overlay_mapped)
+        shapeOverlayWindow();
+
+    // refit the windows which fill their output
+    for (QHash<Window, MWindowPropertyCache*>::const_iterator it
+             = prop_caches.constBegin(); it != prop_caches.constEnd(); ++it) {
+        MWindowPropertyCache *pc = it.value();
+        if (!pc->is_valid || !pc->isMapped())
+            continue;
+        if (pc->netWmState().contains(ATOM(_NET_WM_STATE_FULLSCREEN))) {
+            fullscreen_wm_state(this, 1, it.key());
+            continue;
+        }
+        MCompAtoms::Type wtype = pc->windowType();
+        if (wtype == MCompAtoms::FRAMELESS || wtype == MCompAtoms::DESKTOP
+            || wtype == MCompAtoms::INPUT) {
+            QSize s = screen_layout->outputAt(pc->realGeometry())
+                                                        .geometry.size();
+            if (pc->realGeometry().size() != s) {
+                XResizeWindow(QX11Info::display(), it.key(),
+                              s.width(), s.height());
+                RESIZE(it.key(), s.width(), s.height());
+            }
+        }
+    }
+
+    dirtyStacking(true);
+    glwidget->update();
+}
+
+// Turns the output of the current application @pc from @old_angle to its
+// new orientation on the GPU.  The snapshot to turn is taken right away,
+// before the application has had the time to redraw itself.
+void MCompositeManagerPrivate::rotateOutput(MWindowPropertyCache *pc,
+                                            unsigned old_angle)
+{
+    unsigned angle = pc->orientationAngle();
+    if (angle == old_angle || device_state->displayOff())
+        return;
+
+    // the shorter way around, clockwise if it's half a turn
+    int degrees = ((int)angle - (int)old_angle) % 360;
+    if (degrees > 180)
+        degrees -= 360;
+    else if (degrees <= -180)
+        degrees += 360;
+
+    pending_rotation.window = pc->winId();
+    pending_rotation.output =
+        screen_layout->outputAt(pc->realGeometry()).geometry;
+    pending_rotation.degrees = degrees;
+    pending_rotation.size = pc->realGeometry().size();
+
+    // The window may be shown directly.  Then the snapshot can only be
+    // taken when its new pixmap has got its contents.
+    MCompositeWindow *cw = COMPOSITE_WINDOW(pc->winId());
+    bool direct = cw && cw->isDirectRendered();
+    if (!compositing || !scanout_region.isEmpty())
+        enableCompositing(true);
+    if (direct)
+        pending_rotation_timer.start();
+    else
+        startPendingRotation();
+}
+
+void MCompositeManagerPrivate::startPendingRotation()
+{
+    pending_rotation_timer.stop();
+    watch->startRotation(pending_rotation.output, pending_rotation.degrees,
+                         pending_rotation.window, pending_rotation.size);
+    pending_rotation.window = None;
+    glwidget->repaint();
+}
+
+// The window shown directly before the rotation didn't redraw itself,
+// don't animate with whatever its pixmap has.
+void MCompositeManagerPrivate::pendingRotationTimeout()
+{
+    pending_rotation.window = None;
+    dirtyStacking(false);
+}
+
+// The windows may be shown directly again.
+void MCompositeManagerPrivate::rotationFinished()
+{
+    dirtyStacking(false);
 }
 
 void MCompositeManagerPrivate::showOverlayWindow(bool show)
 {
     static bool first_call = true;
-    static XRectangle empty = {0, 0, 0, 0},
-                      fs = {0, 0,
-                            ScreenOfDisplay(QX11Info::display(),
-                                DefaultScreen(QX11Info::display()))->width + 2,
-                            ScreenOfDisplay(QX11Info::display(),
-                                DefaultScreen(QX11Info::display()))->height + 2};
+    static XRectangle empty = {0, 0, 0, 0};
     if (!show && (overlay_mapped || first_call)) {
         scene()->views()[0]->setUpdatesEnabled(false);
         XShapeCombineRectangles(QX11Info::display(), xoverlay,
@@ -3645,12 +4252,7 @@ void MCompositeManagerPrivate::showOverlayWindow(bool show)
 #ifdef GLES2_VERSION
         enableRedirection(false);
 #endif
-        XShapeCombineRectangles(QX11Info::display(), xoverlay,
-                                ShapeBounding, 0, 0, &fs, 1,
-                                ShapeSet, Unsorted);
-        XShapeCombineRectangles(QX11Info::display(), localwin,
-                                ShapeBounding, 0, 0, &fs, 1,
-                                ShapeSet, Unsorted);
+        shapeOverlayWindow();
         XserverRegion r = XFixesCreateRegion(QX11Info::display(), &empty, 1);
         XFixesSetWindowShapeRegion(QX11Info::display(), xoverlay,
                                    ShapeInput, 0, 0, r);
@@ -3789,7 +4391,25 @@ void MCompositeManagerPrivate::exposeSwitcher()
 void MCompositeManagerPrivate::installX11EventFilter(long xevent,
                                                      MCompositeManagerExtension* extension)
 {
-    m_extensions.insert(xevent, extension);
+    if (xevent < 0 || xevent >= X11_EVENT_TYPES) {
+        qWarning("%s: %s wants invalid event type %ld", __func__,
+                 extension->metaObject()->className(), xevent);
+        return;
+    }
+
+    ExtensionStats *stats = extension_stats.value(extension, 0);
+    if (!stats) {
+        stats = new ExtensionStats;
+        extension_stats.insert(extension, stats);
+        m_extensions.append(extension);
+    }
+
+    QVector<X11EventHandler> &handlers = x11_event_handlers[xevent];
+    for (int i = 0; i < handlers.size(); ++i)
+        if (handlers[i].extension == extension)
+            return;
+    X11EventHandler handler = { extension, stats };
+    handlers.append(handler);
 }
 
 void MCompositeManagerPrivate::showLaunchIndicator(int timeout)
@@ -3850,6 +4470,29 @@ void MCompositeManager::dumpState(const char *heading)
                d->device_state->displayOff() ? "off" : "on");
     qDebug(    "call state:       %s",
                d->device_state->ongoingCall() ? "ongoing" : "idle");
+    if (d->xserver_pinger) {
+        XServerPinger::Stats xs = d->xserver_pinger->stats();
+        qDebug("xserver latency:  p50 <%u us, p99 <%u us, max %u us "
+               "(%u pings, %u timeouts)", xs.p50, xs.p99, xs.max,
+               xs.pings, xs.timeouts);
+    }
+
+    // Graphics memory, in KiB.
+    MResourceAccountant *ra = MResourceAccountant::instance();
+    line.clear();
+    for (i = 0; i < MResourceAccountant::KindCount; ++i)
+        line += QString(" %1 %2")
+            .arg(MResourceAccountant::kindName((MResourceAccountant::Kind)i))
+            .arg(ra->total((MResourceAccountant::Kind)i) >> 10);
+    qDebug(    "graphics memory:  %lld KiB of %lld,%s",
+               ra->total() >> 10, ra->budget() >> 10, line.toLatin1().constData());
+    foreach (Window w, ra->topWindows(5))
+        qDebug("  0x%lx: %lld KiB", w, ra->windowUsage(w).total() >> 10);
+    for (QHash<QByteArray, MResourceAccountant::Usage>::const_iterator rit =
+         ra->componentUsages().constBegin();
+         rit != ra->componentUsages().constEnd(); ++rit)
+        qDebug("  %s: %lld KiB", rit.key().constData(),
+               rit->total() >> 10);
 
     qDebug(    "composition:      %s", isCompositing() ? "on"  : "off");
     qDebug(    "xoverlay:         0x%lx, %s", d->xoverlay,
@@ -3947,7 +4590,7 @@ void MCompositeManager::dumpState(const char *heading)
         // Get the PID and the command line of the process which created
         // the window.
         QByteArray cmdline;
-        int pid = MCompAtoms::instance()->getPid(cw->window());
+        int pid = cw->propertyCache()->pid();
         if (pid) {
             QFile f(QString().sprintf("/proc/%d/cmdline", pid));
             if (f.open(QIODevice::ReadOnly))
@@ -4072,6 +4715,13 @@ void MCompositeManager::dumpState(const char *heading)
     } else
         qDebug("configure_reqs: <None>");
 
+    const MCompositeScene::FrameStats &stats = d->watch->frameStats();
+    qDebug(    "frames:           %u, %.1f draw calls/frame, "
+               "%.2f ms/frame (max %.2f ms)", stats.frames,
+               stats.frames ? (double)stats.draw_calls / stats.frames : 0.0,
+               stats.frames ? stats.total_usecs / 1000.0 / stats.frames : 0.0,
+               stats.max_usecs / 1000.0);
+
     // Dump the scene items from top to bottom.
     qDebug("scene:");
     foreach (const QGraphicsItem *gi, d->watch->items()) {
@@ -4087,21 +4737,23 @@ void MCompositeManager::dumpState(const char *heading)
                   gi->isVisible() ? "visible" : "hidden");
     }
 
-    // Show the current state of extensions.
-    // @m_extenions is a QMultiHash of X events an extension reacts to
-    // pointing to the object.  Invert the hash so we can iterate over
-    // each extension once.
+    // Show the current state of extensions.  Invert the dispatch table
+    // so we can iterate over each extension once.
     qDebug("plugins:");
-    for (QHash<int, MCompositeManagerExtension*>::const_iterator exit = d->m_extensions.constBegin(); exit != d->m_extensions.constEnd(); ++exit)
-        extensions[*exit].append(exit.key());
-    for (QHash<const MCompositeManagerExtension*, QList<int> >::const_iterator exit = extensions.constBegin(); exit != extensions.constEnd(); ++exit) {
+    for (int type = 0; type < MCompositeManagerPrivate::X11_EVENT_TYPES; ++type)
+        foreach (const MCompositeManagerPrivate::X11EventHandler &h,
+                 d->x11_event_handlers[type])
+            extensions[h.extension].append(type);
+    foreach (const MCompositeManagerExtension *ext, d->m_extensions) {
+        const MCompositeManagerPrivate::ExtensionStats *stats
+            = d->extension_stats.value(ext);
         int event;
         bool first;
         QString events;
 
         // Print the extension's class name followed by its X events.
         first = true;
-        foreach (event, *exit) {
+        foreach (event, extensions.value(ext)) {
             if (first)
                 first = false;
             else
@@ -4122,25 +4774,191 @@ void MCompositeManager::dumpState(const char *heading)
             }
         }
         qDebug("-- %s for event(s) %s:",
-               exit.key()->metaObject()->className(),
+               ext->metaObject()->className(),
                events.toLatin1().constData());
-        exit.key()->dumpState();
+        qDebug("   %u events (%u consumed) in %.2f ms, "
+               "%.3f ms/event (max %.3f ms)", stats->events, stats->consumed,
+               stats->usecs / 1000.0,
+               stats->events ? stats->usecs / 1000.0 / stats->events : 0.0,
+               stats->max_usecs / 1000.0);
+        ext->dumpState();
     }
 }
 
-// Called when the remote control pipe has got input.
+void MCompositeManager::xtrace(const char *fun, const char *msg, int lmsg)
+{
+    MCompositeManager *p = static_cast<MCompositeManager *>(qApp);
+    char str[160];
+
+    // Normalize @fun and @msg so that @msg != NULL in the end,
+    // and turn synopsis [2] into MCompositor::xtrace(NULL, msg).
+    if (!msg) {
+        if (fun) {
+            msg = fun;
+            fun = NULL;
+        } else {
+            msg = "HERE";
+            lmsg = strlen("HERE");
+        }
+    }
+
+    // Fail if we don't have an X connection yet.
+    if (!p || !p->d || !p->d->xcb_conn) {
+        qWarning("cannot xtrace yet from %s", fun ? fun : msg);
+        return;
+    }
+
+    // Format @str to include both @fun and @msg if @fun was specified,
+    // and count the length of @str.
+    if (fun != NULL) {
+        lmsg = snprintf(str, sizeof(str), "%s from %s", msg, fun);
+        msg = str;
+    } else if (lmsg < 0)
+        lmsg = strlen(msg);
+
+    // Make @str visible in xtrace by sending it along with an innocent
+    // X request.  Unfortunately this makes this function a synchronisation
+    // point (it has to wait for the reply).  Use xcb rather than libx11
+    // because the latter maintains a hashtable of known Atom:s.
+    free(xcb_intern_atom_reply(p->d->xcb_conn,
+                               xcb_intern_atom(p->d->xcb_conn, False,
+                                               lmsg, msg),
+                               NULL));
+}
+
+void MCompositeManager::xtracef(const char *fun, const char *fmt, ...)
+{
+    va_list printf_args;
+    char msg[160];
+    int lmsg;
+
+    va_start(printf_args, fmt);
+    lmsg = vsnprintf(msg, sizeof(msg), fmt, printf_args);
+    va_end(printf_args);
+    xtrace(fun, msg, lmsg);
+}
+#endif // WINDOW_DEBUG
+
+#ifndef WINDOW_DEBUG
+// Returns the directory of the remote control pipe and the exported state,
+// $XDG_RUNTIME_DIR/mcompositor-<display> or /tmp/mcompositor-<uid>-<display>,
+// creating it if necessary, so that the compositors of other displays have
+// their own.  The display is without the screen number.  Returns an empty
+// string if it's not private to our user.
+static QByteArray runtime_dir()
+{
+    static QByteArray dir;
+    if (!dir.isEmpty())
+        return dir;
+
+    QByteArray display(DisplayString(QX11Info::display()));
+    int colon = display.lastIndexOf(':');
+    int dot = display.indexOf('.', colon < 0 ? 0 : colon);
+    if (dot >= 0)
+        display.truncate(dot);
+    display.replace('/', '_');
+
+    const char *xdg = getenv("XDG_RUNTIME_DIR");
+    QByteArray path = xdg && *xdg
+        ? QByteArray(xdg) + "/mcompositor-" + display
+        : "/tmp/mcompositor-" + QByteArray::number(getuid()) + '-' + display;
+    struct stat st;
+    mkdir(path.constData(), 0700);
+    if (lstat(path.constData(), &st) < 0 || !S_ISDIR(st.st_mode)
+        || st.st_uid != getuid() || (st.st_mode & 0077)) {
+        qWarning("%s is not private to us, no remote control",
+                 path.constData());
+        return QByteArray();
+    }
+    return dir = path;
+}
+#endif
+
+// Called when the remote control pipe has got input.  The commands
+// written one after the other may be read at once, run them one by one.
 void MCompositeManager::remoteControl(int cmdfd)
 {
     int lcmd;
-    char cmd[128];
+    char buf[256], *cmd, *nl;
 
-    if ((lcmd = ::read(cmdfd, cmd, sizeof(cmd)-1)) < 0)
+    if ((lcmd = ::read(cmdfd, buf, sizeof(buf)-1)) < 0)
         return;
-    if (lcmd > 0 && cmd[lcmd-1] == '\n')
-        lcmd--;
-    cmd[lcmd] = '\0';
+    buf[lcmd] = '\0';
+    for (cmd = buf; *cmd; cmd = nl + 1) {
+        if ((nl = strchr(cmd, '\n')) != NULL)
+            *nl = '\0';
+        runCommand(cmd);
+        if (!nl)
+            break;
+    }
+}
+
+void MCompositeManager::runCommand(char *cmd)
+{
+    if (!strcmp(cmd, "export")
+#ifdef WINDOW_DEBUG
+        || !strncmp(cmd, "export ", strlen("export "))
+#endif
+        ) {
+        // exportState() into a file, replacing it atomically so that
+        // the reader never sees it half-written.  Without WINDOW_DEBUG
+        // it can only go into our private directory.
+        QByteArray fname, json, tmp;
+        int fd;
 
-    if (!strcmp(cmd, "state")) {
+#ifdef WINDOW_DEBUG
+        const char *arg;
+        if ((arg = strchr(cmd, ' ')) != NULL)
+            arg += strspn(arg, " ");
+        fname = arg && *arg ? arg : "/tmp/mcompositor-state.json";
+#else
+        fname = runtime_dir() + "/state.json";
+#endif
+
+        json = d->exportState();
+        tmp = fname + ".XXXXXX";
+        if ((fd = mkstemp(tmp.data())) < 0) {
+            qWarning("couldn't create %s", tmp.constData());
+            return;
+        }
+        bool ok = ::write(fd, json.constData(), json.size()) == json.size();
+        if (::close(fd) < 0 || !ok || rename(tmp.constData(), fname) < 0) {
+            qWarning("couldn't export the state into %s", fname.constData());
+            unlink(tmp.constData());
+        }
+    } else if (!strncmp(cmd, "capture ", strlen("capture "))) {
+        // capture <name> [damage] [<fps>] | stop, also without
+        // WINDOW_DEBUG, for recording on devices
+        QStringList args = QString(&cmd[strlen("capture ")])
+                           .split(' ', QString::SkipEmptyParts);
+        bool damage_only = false;
+        unsigned fps = 0;
+        if (args.isEmpty()) {
+            qDebug("capture what?");
+        } else if (args[0] == "stop") {
+            d->watch->stopCapture();
+        } else {
+            for (int i = 1; i < args.count(); ++i)
+                if (args[i] == "damage")
+                    damage_only = true;
+                else
+                    fps = args[i].toUInt();
+            if (!d->watch->startCapture(args[0], damage_only, fps))
+                qWarning("couldn't start capturing into %s",
+                         args[0].toLatin1().constData());
+        }
+    } else if (!strcmp(cmd, "stats reset")) {
+        // lets benchmarks measure the maxima of their own runs
+        d->watch->resetFrameStats();
+        MWindowPropertyCache::resetRequestStats();
+        if (d->xserver_pinger)
+            d->xserver_pinger->resetStats();
+#ifdef WINDOW_DEBUG
+    } else if (!strncmp(cmd, "trace ", strlen("trace "))) {
+        const char *fname = &cmd[strlen("trace")];
+        fname += strspn(fname, " ");
+        d->traceStacking(strcmp(fname, "stop") ? fname : "");
+    } else if (!strcmp(cmd, "state")) {
         dumpState();
     } else if (!strncmp(cmd, "state ", strlen("state "))) {
         const char *space = &cmd[strlen("state")];
@@ -4183,20 +5001,29 @@ void MCompositeManager::remoteControl(int cmdfd)
 
         fclose(out);
         qDebug("state dumped into %s", fname.toLatin1().constData());
+    } else if (!strcmp(cmd, "display on") || !strcmp(cmd, "display off")) {
+        // pretend the display state has changed
+        d->device_state->fakeDisplayState(!strcmp(cmd, "display off"));
     } else if (!strcmp(cmd, "restart")) {
         QString me = qApp->applicationFilePath();
         QStringList args = qApp->arguments();
+        QList<QByteArray> args8;
         const char **argv;
         unsigned i;
 
+        // Let the new instance continue where we leave off.
+        if (!d->saveHandoffState())
+            qWarning("restarting without handing over the state");
         delete d;
         XFlush(QX11Info::display());
 
         // Convert the QStringList of args into a char *[].
         i = 0;
         argv = new const char *[args.count()+1];
-        foreach (const QString &arg, args)
-            argv[i] = arg.toLatin1().constData();
+        foreach (const QString &arg, args) {
+            args8.append(arg.toLatin1());
+            argv[i++] = args8.last().constData();
+        }
         argv[i] = NULL;
 
         // Restart ourselves.
@@ -4208,71 +5035,36 @@ void MCompositeManager::remoteControl(int cmdfd)
         delete d;
         XFlush(QX11Info::display());
         _exit(0);
+#endif
     } else if (!strcmp(cmd, "help")) {
         qDebug("Commands i understand:");
+#ifdef WINDOW_DEBUG
+        qDebug("  export [<fname>] save the state as JSON into <fname>");
+        qDebug("                  (/tmp/mcompositor-state.json)");
+        qDebug("  trace <fname>   record the X events and the stacking");
+        qDebug("                  decisions into <fname>");
+        qDebug("  trace stop      stop recording");
         qDebug("  state [<tag>]   dump MCompositeManager, MCompositeWindow:s ");
         qDebug("                  and QGraphicsScene state information");
         qDebug("  save [<fname>]  dump it into <fname>");
+        qDebug("  display on|off  act as if the display was turned on/off");
         qDebug("  exit, quit      geez");
         qDebug("  restart         re-execute mcompositor");
+#else
+        qDebug("  export          save the state as JSON into %s/state.json",
+               runtime_dir().constData());
+#endif
+        qDebug("  capture <name> [damage] [<fps>]");
+        qDebug("                  capture the frames into the shared");
+        qDebug("                  memory ring <name>, only the changes");
+        qDebug("                  between keyframes, at most <fps>");
+        qDebug("  capture stop    stop capturing");
+        qDebug("  stats reset     start collecting frame, X and property");
+        qDebug("                  request statistics anew");
     } else
         qDebug("%s: unknown command", cmd);
 }
 
-void MCompositeManager::xtrace(const char *fun, const char *msg, int lmsg)
-{
-    MCompositeManager *p = static_cast<MCompositeManager *>(qApp);
-    char str[160];
-
-    // Normalize @fun and @msg so that @msg != NULL in the end,
-    // and turn synopsis [2] into MCompositor::xtrace(NULL, msg).
-    if (!msg) {
-        if (fun) {
-            msg = fun;
-            fun = NULL;
-        } else {
-            msg = "HERE";
-            lmsg = strlen("HERE");
-        }
-    }
-
-    // Fail if we don't have an X connection yet.
-    if (!p || !p->d || !p->d->xcb_conn) {
-        qWarning("cannot xtrace yet from %s", fun ? fun : msg);
-        return;
-    }
-
-    // Format @str to include both @fun and @msg if @fun was specified,
-    // and count the length of @str.
-    if (fun != NULL) {
-        lmsg = snprintf(str, sizeof(str), "%s from %s", msg, fun);
-        msg = str;
-    } else if (lmsg < 0)
-        lmsg = strlen(msg);
-
-    // Make @str visible in xtrace by sending it along with an innocent
-    // X request.  Unfortunately this makes this function a synchronisation
-    // point (it has to wait for the reply).  Use xcb rather than libx11
-    // because the latter maintains a hashtable of known Atom:s.
-    free(xcb_intern_atom_reply(p->d->xcb_conn,
-                               xcb_intern_atom(p->d->xcb_conn, False,
-                                               lmsg, msg),
-                               NULL));
-}
-
-void MCompositeManager::xtracef(const char *fun, const char *fmt, ...)
-{
-    va_list printf_args;
-    char msg[160];
-    int lmsg;
-
-    va_start(printf_args, fmt);
-    lmsg = vsnprintf(msg, sizeof(msg), fmt, printf_args);
-    va_end(printf_args);
-    xtrace(fun, msg, lmsg);
-}
-#endif // WINDOW_DEBUG
-
 MCompositeManager::MCompositeManager(int &argc, char **argv)
     : QApplication(argc, argv)
 {
@@ -4281,15 +5073,60 @@ MCompositeManager::MCompositeManager(int &argc, char **argv)
     s->exportObject(this);
 
     d->mayShowApplicationHungDialog = !arguments().contains("-nohung");
+    // -rotate animates the orientation changes of the applications here
+    d->rotation_mode = arguments().contains("-rotate");
+    // -budget=<MB> limits the graphics memory of the windows,
+    // -trace=<file> records the stacking decisions from the start
+    foreach (const QString &arg, arguments()) {
+        if (arg.startsWith("-budget="))
+            MResourceAccountant::instance()->setBudget(
+                                    arg.mid(8).toLongLong() << 20);
+        else if (arg.startsWith("-trace="))
+            d->traceStacking(arg.mid(7));
+    }
+    d->loadHandoffState();
+
+    // Measure the X server's latency in the background, rarely enough
+    // not to cost anything unless -xping asks for more samples.
+#ifndef WINDOW_DEBUG_ALOT
+    if (!arguments().contains("-xping"))
+        d->xserver_pinger = new XServerPinger(10000, d);
+    else
+#endif
+        d->xserver_pinger = new XServerPinger(2500, d);
+    d->xserver_pinger->start(QThread::LowPriority);
 
 #ifdef WINDOW_DEBUG
     signal(SIGUSR1, sigusr1_handler);
+#endif
 
-    // Open the remote control interface.
+    // Open the remote control interface.  Without WINDOW_DEBUG it can
+    // only export the state, and only for our own user: the pipe must be
+    // in our private directory and nobody else may be able to write it.
+#ifdef WINDOW_DEBUG
     mknod("/tmp/mrc", S_IFIFO | 0666, 0);
-    connect(new QSocketNotifier(open("/tmp/mrc", O_RDWR), QSocketNotifier::Read),
-            SIGNAL(activated(int)), SLOT(remoteControl(int)));
+    int rcfd = open("/tmp/mrc", O_RDWR);
+#else
+    int rcfd = -1;
+    QByteArray dir = runtime_dir();
+    if (!dir.isEmpty()) {
+        QByteArray mrc = dir + "/mrc";
+        struct stat st;
+        mknod(mrc.constData(), S_IFIFO | 0600, 0);
+        rcfd = open(mrc.constData(), O_RDWR | O_NOFOLLOW);
+        if (rcfd >= 0 && (fstat(rcfd, &st) < 0 || !S_ISFIFO(st.st_mode)
+                          || st.st_uid != getuid()
+                          || (st.st_mode & 0777) != 0600)) {
+            qWarning("%s is not our private pipe, ignoring it",
+                     mrc.constData());
+            ::close(rcfd);
+            rcfd = -1;
+        }
+    }
 #endif
+    if (rcfd >= 0)
+        connect(new QSocketNotifier(rcfd, QSocketNotifier::Read),
+                SIGNAL(activated(int)), SLOT(remoteControl(int)));
 }
 
 MCompositeManager::~MCompositeManager()
@@ -4320,6 +5157,7 @@ QGraphicsScene *MCompositeManager::scene()
 
 void MCompositeManager::prepareEvents()
 {
+    d->takeOverOverlay();
     if (QX11Info::isCompositingManagerRunning()) {
         qCritical("Compositing manager already running.");
         ::exit(0);
@@ -4343,7 +5181,37 @@ void MCompositeManager::loadPlugins(const QString &overridePluginPath,
 
 bool MCompositeManager::x11EventFilter(XEvent *event)
 {
-    return d->x11EventFilter(event);
+    if (!d->stacking_trace)
+        return d->x11EventFilter(event);
+
+    // Record the event and how long it took to process.
+    struct timespec t0, t1;
+    unsigned long detail = 0;
+    Window window = event->xany.window;
+    switch (event->type) {
+    case MapNotify:        window = event->xmap.window; break;
+    case UnmapNotify:      window = event->xunmap.window; break;
+    case DestroyNotify:    window = event->xdestroywindow.window; break;
+    case CreateNotify:     window = event->xcreatewindow.window; break;
+    case ConfigureNotify:  window = event->xconfigure.window; break;
+    case ReparentNotify:   window = event->xreparent.window; break;
+    case MapRequest:       window = event->xmaprequest.window; break;
+    case ConfigureRequest: window = event->xconfigurerequest.window; break;
+    case PropertyNotify:   detail = event->xproperty.atom; break;
+    case ClientMessage:    detail = event->xclient.message_type; break;
+    }
+    d->stacking_trace->beginEvent(event->type, window,
+                                  event->xany.serial, detail);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    bool ret = d->x11EventFilter(event);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    // stopped in the meantime?
+    if (d->stacking_trace)
+        d->stacking_trace->endEvent((t1.tv_sec - t0.tv_sec) * 1000000
+                                    + (t1.tv_nsec - t0.tv_nsec) / 1000,
+                                    d->stacking_list);
+    return ret;
 }
 
 void MCompositeManager::setSurfaceWindow(Qt::HANDLE window)
@@ -194,14 +194,15 @@ public slots:
      */
     const QRect &availableRect() const;
 
-#ifdef WINDOW_DEBUG
+    // Executes a command written to the remote control pipe.
     void remoteControl(int fd);
-#endif
      
 signals:
     void decoratorRectChanged(const QRect& rect);
 
 private:
+    void runCommand(char *cmd);
+
     MCompositeManagerPrivate *d;
 
     friend class MCompositeWindow;
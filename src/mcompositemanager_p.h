@@ -25,6 +25,8 @@
 #include <QPixmap>
 #include <QTimer>
 #include <QDir>
+#include <QRegion>
+#include <time.h>
 
 #include <X11/Xutil.h>
 #include <X11/Xlib.h>
@@ -41,6 +43,9 @@ class MCompositeWindow;
 class MDeviceState;
 class MWindowPropertyCache;
 class MCompositeManagerExtension;
+class XServerPinger;
+class MStackingTrace;
+class MScreenLayout;
 
 enum {
     INPUT_LAYER = 0,
@@ -68,7 +73,7 @@ public:
     ~MCompositeManagerPrivate();
 
     static Window parentWindow(Window child);
-    MCompositeWindow *bindWindow(Window w);
+    MCompositeWindow *bindWindow(Window w, bool sort = true);
     QGraphicsScene *scene();
 
     void prepare();
@@ -98,6 +103,15 @@ public:
     void installX11EventFilter(long xevent, MCompositeManagerExtension* extension);
     
     void redirectWindows();
+
+    // Restarting with handing over our state to the new instance.
+    bool saveHandoffState();
+    void loadHandoffState();
+    void takeOverOverlay();
+
+    // Returns the state of the compositor as a JSON document.
+    QByteArray exportState();
+
     void showOverlayWindow(bool show);
     void enableRedirection(bool emit_signal);
     void setExposeDesktop(bool exposed);
@@ -112,16 +126,21 @@ public:
     Window getLastVisibleParent(MWindowPropertyCache *pc);
 
     bool possiblyUnredirectTopmostWindow();
+    QList<Window> scanOutWindows(int win_i, const QRect &output) const;
+    void scanOut(int win_i, const QRect &output, QList<Window> *direct);
+    void shapeOverlayWindow();
     bool haveMappedWindow() const;
     bool isRedirected(Window window);
     bool x11EventFilter(XEvent *event);
     bool processX11EventFilters(XEvent *event, bool after);
     void removeWindow(Window w);
-    bool needDecoration(Window w, MWindowPropertyCache *pc = 0);
+    bool needDecoration(MWindowPropertyCache *pc);
     bool skipStartupAnim(MWindowPropertyCache *pc);
     MCompositeWindow *getHighestDecorated(int *index = 0);
     
     void roughSort();
+    // Starts recording a stacking trace into @fname, or stops if empty.
+    void traceStacking(const QString &fname);
     void setCurrentApp(Window w, bool stacking_order_changed);
     bool raiseWithTransients(MWindowPropertyCache *pc,
                            int parent_idx, QList<int> *anewpos = NULL);
@@ -151,11 +170,37 @@ public:
     QHash<Window, FrameData> framed_windows;
     QHash<Window, QList<XConfigureRequestEvent> > configure_reqs;
     QHash<Window, MWindowPropertyCache*> prop_caches;
-    QMultiHash<int, MCompositeManagerExtension* > m_extensions;
+
+    // Time the plugins spent handling X events.
+    struct ExtensionStats {
+        ExtensionStats(): events(0), consumed(0), usecs(0), max_usecs(0) {}
+        //! Number of events the plugin was given and how many it consumed.
+        unsigned events, consumed;
+        //! Total and longest time it took to handle one, in microseconds.
+        quint64 usecs, max_usecs;
+    };
+    struct X11EventHandler {
+        MCompositeManagerExtension *extension;
+        ExtensionStats *stats;
+    };
+    // @x11_event_handlers[XEvent type] are the plugins which want that
+    // type of event, in the order they called listenXEventType().
+    // Xlib event types are below 128.  Built by installX11EventFilter()
+    // so dispatching the events allocates nothing.
+    enum { X11_EVENT_TYPES = 128 };
+    QVector<X11EventHandler> x11_event_handlers[X11_EVENT_TYPES];
+    // The plugins in the order they registered and their @stats.
+    QList<MCompositeManagerExtension *> m_extensions;
+    QHash<const MCompositeManagerExtension *, ExtensionStats *> extension_stats;
 
     int damage_event;
     int damage_error;
 
+    // The RandR outputs showing the screen, and the part of the screen
+    // whose outputs show a window directly while the rest is composited.
+    MScreenLayout *screen_layout;
+    QRegion scanout_region;
+
     bool compositing;
     bool overlay_mapped;
     bool changed_properties;
@@ -169,12 +214,53 @@ public:
     // was disabled by a command line switch.
     bool mayShowApplicationHungDialog;
 
+    // What the previous instance of mcompositor told us if it was
+    // restarted, otherwise NULL.  @handoff_xfd is its X connection,
+    // kept open by it until we have got hold of the overlay window.
+    struct HandoffState {
+        Window current_app, decorated;
+        bool compositing;
+        QList<Window> stacking_list, iconic;
+    } *handoff;
+    int handoff_xfd;
+
+    // The damage counts of the windows and the time of the last
+    // exportState(), to tell the damage rates.
+    QHash<Window, unsigned> exported_damage;
+    struct timespec last_export;
+
+    // Where the events and the decisions of the stacking rules are
+    // recorded if enabled by -trace=<file> or the "trace" command.
+    MStackingTrace *stacking_trace;
+
+    // Set by -rotate to animate the orientation changes of the current
+    // application ourselves, see rotateOutput().
+    bool rotation_mode;
+    void rotateOutput(MWindowPropertyCache *pc, unsigned old_angle);
+    void startPendingRotation();
+    // The rotation of a window which was shown directly waits for its
+    // first damage after redirection in @pending_rotation, the contents
+    // of its pixmap until then are undefined.
+    struct PendingRotation {
+        Window window;
+        QRect output;
+        int degrees;
+        QSize size;
+    } pending_rotation;
+    QTimer pending_rotation_timer;
+
+    // Measures the X server's latency, more often with -xping.
+    XServerPinger *xserver_pinger;
+
     xcb_connection_t *xcb_conn;
 
     // mechanism for lazy stacking
     QTimer stacking_timer;
     bool stacking_timeout_check_visibility;
     Time stacking_timeout_timestamp;
+    // set when the display is turned on, to refresh the visible windows'
+    // backing stores after the next restack
+    bool refresh_backing_stores;
     void dirtyStacking(bool force_visibility_check, Time t = CurrentTime);
     void pingTopmost();
 
@@ -187,6 +273,9 @@ public slots:
     void gotHungWindow(MCompositeWindow *window, bool is_hung);
     void enableCompositing(bool forced = false);
     void disableCompositing(ForcingLevel forced = NO_FORCED);
+    void screenLayoutChanged();
+    void rotationFinished();
+    void pendingRotationTimeout();
     void showLaunchIndicator(int timeout);
     void hideLaunchIndicator();
 
@@ -201,6 +290,7 @@ public slots:
     void callOngoing(bool call_ongoing);
     void stackingTimeout();
     void setupButtonWindows(Window topmost);
+    void enforceResourceBudget();
 };
 
 #endif
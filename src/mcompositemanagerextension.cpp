@@ -20,6 +20,8 @@
 #include "mcompositemanager.h"
 #include "mcompositemanager_p.h"
 #include "mcompositemanagerextension.h"
+#include "mcompositescene.h"
+#include "mtexturepixmapitem_p.h"
 
 MCompositeManagerExtension::MCompositeManagerExtension(QObject *parent)
     :QObject(parent)
@@ -30,6 +32,10 @@ MCompositeManagerExtension::MCompositeManagerExtension(QObject *parent)
 
 MCompositeManagerExtension::~MCompositeManagerExtension()
 {
+    // we may outlive the compositor
+    MCompositeManager *p = (MCompositeManager *) qApp;
+    if (p && p->d && p->d->watch)
+        p->d->watch->removeExtension(this);
 }
 
 void MCompositeManagerExtension::q_currentAppChanged(Window window)
@@ -43,6 +49,51 @@ void MCompositeManagerExtension::listenXEventType(long XEventType)
     p->d->installX11EventFilter(XEventType, this);
 }
 
+void MCompositeManagerExtension::listenFrames()
+{
+    MCompositeManager *p = (MCompositeManager *) qApp;
+    p->d->watch->addFrameListener(this);
+}
+
+void MCompositeManagerExtension::addRenderPass()
+{
+    MCompositeManager *p = (MCompositeManager *) qApp;
+    p->d->watch->addRenderPass(this);
+}
+
+void MCompositeManagerExtension::removeRenderPass()
+{
+    MCompositeManager *p = (MCompositeManager *) qApp;
+    p->d->watch->removeRenderPass(this);
+}
+
+void MCompositeManagerExtension::requestFrame()
+{
+    MCompositeManager *p = (MCompositeManager *) qApp;
+    p->d->glwidget->update();
+}
+
+bool MCompositeManagerExtension::startCapture(const QString &name,
+                                              bool damage_only,
+                                              unsigned fps)
+{
+    MCompositeManager *p = (MCompositeManager *) qApp;
+    return p->d->watch->startCapture(name, damage_only, fps);
+}
+
+void MCompositeManagerExtension::stopCapture()
+{
+    MCompositeManager *p = (MCompositeManager *) qApp;
+    p->d->watch->stopCapture();
+}
+
+void MCompositeManagerExtension::drawOverlay(unsigned texture,
+                                             const QRectF &rect,
+                                             qreal opacity)
+{
+    MTexturePixmapPrivate::queueOverlayQuad(texture, rect, opacity);
+}
+
 void MCompositeManagerExtension::dumpState() const
 {
     /* NOP */
@@ -91,3 +142,23 @@ bool MCompositeManagerExtension::windowClosed(MCompositeWindow* window)
 
     return false;
 }
+
+void MCompositeManagerExtension::beforeFrame(const QRegion &damage)
+{
+    Q_UNUSED(damage)
+}
+
+void MCompositeManagerExtension::afterFrame(const MCompositeScene::FrameStats &frame)
+{
+    Q_UNUSED(frame)
+}
+
+void MCompositeManagerExtension::frameCaptured(const mcapture_slot *frame)
+{
+    Q_UNUSED(frame)
+}
+
+void MCompositeManagerExtension::renderPass(QPainter *painter)
+{
+    Q_UNUSED(painter)
+}
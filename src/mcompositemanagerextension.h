@@ -21,8 +21,12 @@
 #define MCOMPOSITEMANAGEREXTENSION_H
 
 #include <QObject>
+#include <QRegion>
 #include <X11/Xlib.h>
+#include "mcompositescene.h"
+#include "mcapturering.h"
 
+class QPainter;
 class MCompositeManagerPrivate;
 class MCompositeWindow;
 
@@ -60,6 +64,50 @@ class MCompositeManagerExtension: public QObject
      */
     void listenXEventType(long XEventType);
 
+    /*!
+     * Subscribes this extension to beforeFrame() and afterFrame().
+     * Extensions which don't call this cost nothing per frame.
+     */
+    void listenFrames();
+
+    /*!
+     * Makes the compositor call renderPass() in every frame, after all
+     * windows are drawn.  Passes of different extensions are drawn in
+     * the order they were added.
+     */
+    void addRenderPass();
+
+    /*!
+     * Stops calling renderPass().  Request a frame afterwards to get rid
+     * of what the pass has drawn.
+     */
+    void removeRenderPass();
+
+    /*!
+     * Schedules a new frame to be drawn.  Repeated requests before the
+     * frame is drawn are merged into one.  Use this rather than updating
+     * the compositor's widget directly, and only when the contents of a
+     * render pass change: damage of the windows schedules frames anyway,
+     * and beforeFrame() is the place to update what a pass draws.
+     */
+    void requestFrame();
+
+    /*!
+     * Starts capturing the composited frames into the shared memory ring
+     * \a name (see mcapturering.h), replacing any capture in progress.
+     * If \a damage_only only the changed parts of the screen are read
+     * back, except in keyframes.  If \a fps is not 0 at most that many
+     * frames are captured a second.  Returns false if the ring cannot be
+     * created.
+     */
+    bool startCapture(const QString &name, bool damage_only = false,
+                      unsigned fps = 0);
+
+    /*!
+     * Stops capturing and removes the ring.
+     */
+    void stopCapture();
+
     //! qDebug() any state information indented by three spaces you want
     //! to be included in MCompositeManager::dumpState()'s output.
     virtual void dumpState() const;
@@ -70,16 +118,16 @@ class MCompositeManagerExtension: public QObject
  protected:
     /*!
      * Special event handler to receive native X11 events passed in the event
-     * parameter. Return true to stop the composite manager from handling
-     * the event, otherwise return false to try forwarding the native event to 
-     * the composite manager. 
+     * parameter. Return true to consume the event, otherwise return false
+     * to forward the native event to the next extension and eventually to
+     * the composite manager.
      * 
-     * If there are other extensions that are subscribed to the same event and 
-     * this function returns true, the event will still be blocked from 
-     * propagating to the composite manager even if this function 
-     * returns false. Be careful when returning true when there are other 
-     * extensions around and only use as a last resort to reimplement core 
-     * functionality.
+     * Extensions subscribed to the same event type are called in the order
+     * they called listenXEventType().  When one of them returns true the
+     * event is consumed: neither the extensions after it nor the composite
+     * manager will see it, and afterX11Event() is not called for it.
+     * Be careful when returning true when there are other extensions around
+     * and only use as a last resort to reimplement core functionality.
      */
     virtual bool x11Event(XEvent *event) = 0;
 
@@ -93,12 +141,54 @@ class MCompositeManagerExtension: public QObject
     virtual bool windowShown(MCompositeWindow* window);
     virtual bool windowClosed(MCompositeWindow* window);
 
+    /*!
+     * Called before each frame is drawn if listenFrames() was called.
+     * \a damage is the part of the screen the windows have changed since
+     * the last frame, in screen coordinates.  It may be empty if the frame
+     * was scheduled for other reasons, like an animation.
+     */
+    virtual void beforeFrame(const QRegion &damage);
+
+    /*!
+     * Called after each frame is drawn if listenFrames() was called, with
+     * the statistics of that frame alone.  The frame is not necessarily on
+     * the screen yet.
+     */
+    virtual void afterFrame(const MCompositeScene::FrameStats &frame);
+
+    /*!
+     * Called for each frame which made it into the capture ring if
+     * listenFrames() was called, before afterFrame().  The pixels follow
+     * \a frame in the ring, valid until the ring wraps around.
+     * Frames read back asynchronously arrive a few frames late.
+     */
+    virtual void frameCaptured(const mcapture_slot *frame);
+
+    /*!
+     * Called after the windows are drawn if addRenderPass() was called.
+     * \a painter paints in screen coordinates on top of the windows; raw
+     * GL calls are fine too, but they must leave the state as they found
+     * it.  drawOverlay() is the cheapest way to draw textures.
+     */
+    virtual void renderPass(QPainter *painter);
+
+    /*!
+     * Draws the whole GL \a texture stretched to \a rect of the screen
+     * with \a opacity and blending, batched with the other overlays.
+     * The texture is expected bottom-up, as QGLContext::bindTexture()
+     * uploads it.  Only valid within renderPass(); the quads are drawn
+     * when it returns, on top of whatever was painted with the painter.
+     */
+    void drawOverlay(unsigned texture, const QRectF &rect,
+                     qreal opacity = 1.0);
+
  private slots:
     void q_currentAppChanged(Window window);
 
  private:
     friend class MCompositeManagerPrivate;
     friend class MCompositeWindow;
+    friend class MCompositeScene;
 };
 
 #endif
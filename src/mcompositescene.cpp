@@ -27,7 +27,11 @@
 
 #include "mcompositewindow.h"
 #include "mcompositescene.h"
+#include "mcompositemanagerextension.h"
 #include "mcompositewindowgroup.h"
+#include "mtexturepixmapitem_p.h"
+#include "mscreencapture.h"
+#include "mscreenrotation.h"
 
 #include <X11/extensions/Xfixes.h>
 #ifdef HAVE_SHAPECONST
@@ -37,6 +41,8 @@
 #endif
 #include <X11/extensions/Xcomposite.h>
 
+#include <time.h>
+
 static int error_handler(Display * , XErrorEvent *error)
 {
     if (error->resourceid == QX11Info::appRootWindow() && error->error_code == BadAccess) {
@@ -50,7 +56,7 @@ static int error_handler(Display * , XErrorEvent *error)
 }
 
 MCompositeScene::MCompositeScene(QObject *p)
-    : QGraphicsScene(p)
+    : QGraphicsScene(p), capture(0), rotation(0)
 {
     setBackgroundBrush(Qt::NoBrush);
     setForegroundBrush(Qt::NoBrush);
@@ -58,6 +64,7 @@ MCompositeScene::MCompositeScene(QObject *p)
                        QApplication::desktop()->width(),
                        QApplication::desktop()->height()));
     installEventFilter(this);
+    resetFrameStats();
 }
 
 void MCompositeScene::prepareRoot()
@@ -78,9 +85,96 @@ void MCompositeScene::prepareRoot()
     XSetErrorHandler(error_handler);
 }
 
+void MCompositeScene::resetFrameStats()
+{
+    stats = FrameStats();
+}
+
+void MCompositeScene::addFrameListener(MCompositeManagerExtension *ext)
+{
+    if (!frame_listeners.contains(ext))
+        frame_listeners.append(ext);
+}
+
+void MCompositeScene::addRenderPass(MCompositeManagerExtension *ext)
+{
+    if (!render_passes.contains(ext))
+        render_passes.append(ext);
+}
+
+void MCompositeScene::removeRenderPass(MCompositeManagerExtension *ext)
+{
+    render_passes.removeAll(ext);
+}
+
+void MCompositeScene::removeExtension(MCompositeManagerExtension *ext)
+{
+    frame_listeners.removeAll(ext);
+    render_passes.removeAll(ext);
+    if (frame_listeners.isEmpty())
+        frame_damage = QRegion();
+}
+
+bool MCompositeScene::startCapture(const QString &name, bool damage_only,
+                                   unsigned fps)
+{
+    stopCapture();
+    QSize size = sceneRect().size().toSize();
+    if (!(capture = MScreenCapture::create(name, size, damage_only, fps)))
+        return false;
+    capture->setParent(this);
+    return true;
+}
+
+void MCompositeScene::stopCapture()
+{
+    delete capture;
+    capture = 0;
+    painted_layout.clear();
+    if (frame_listeners.isEmpty())
+        frame_damage = QRegion();
+}
+
+void MCompositeScene::startRotation(const QRect &output, int degrees,
+                                    Window window, const QSize &size)
+{
+    delete rotation;
+    rotation = new MScreenRotation(output, degrees, window, size);
+    rotation->setParent(this);
+}
+
+void MCompositeScene::rotationDamage(Window window, const QRect &r)
+{
+    if (rotation && rotation->window() == window)
+        rotation->windowDamaged(r);
+}
+
 void MCompositeScene::drawItems(QPainter *painter, int numItems, QGraphicsItem *items[], const QStyleOptionGraphicsItem options[], QWidget *widget)
 {
+    struct timespec start, end;
+    unsigned draw_calls = MTexturePixmapPrivate::draw_calls;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    QRegion damage;
+    if (hasFrameListeners()) {
+        damage = frame_damage;
+        frame_damage = QRegion();
+        foreach (MCompositeManagerExtension *ext, frame_listeners)
+            ext->beforeFrame(damage);
+    }
+    // Layout of the painted windows, if capturing.  Transitions
+    // can change anything without damage.
+    QVector<qreal> layout;
+    bool transitioning = false;
+
     QRegion visible(sceneRect().toRect());
+    if (!scanout_region.isEmpty())
+        visible -= scanout_region;
+    if (rotation) {
+        rotation->beginFrame();
+        // the rotated snapshot stands in for the windows
+        visible -= rotation->hiddenRegion();
+    }
     QVector<int> to_paint(10);
     int size = 0;
     bool desktop_painted = false;
@@ -143,6 +237,12 @@ void MCompositeScene::drawItems(QPainter *painter, int numItems, QGraphicsItem *
         for (int i = size - 1; i >= 0; --i) {
             int item_i = to_paint[i];
             MCompositeWindow *cw = (MCompositeWindow*)items[item_i];
+            if (capture) {
+                QRectF r = cw->sceneBoundingRect();
+                layout << cw->window() << r.x() << r.y()
+                       << r.width() << r.height() << cw->opacity();
+                transitioning |= cw->isWindowTransitioning();
+            }
             painter->save();
             if (!desktop_painted) {
                 if (cw->hasTransitioningWindow()) {
@@ -164,5 +264,48 @@ void MCompositeScene::drawItems(QPainter *painter, int numItems, QGraphicsItem *
             cw->paint(painter, &options[item_i], widget);
             painter->restore();
         }
+        // the windows leave their vertex buffers bound between each other
+        MTexturePixmapPrivate::restoreGLState();
+    }
+    if (rotation) {
+        bool running = rotation->drawFrame();
+        MTexturePixmapPrivate::restoreGLState();
+        if (!running) {
+            delete rotation;
+            rotation = 0;
+            emit rotationFinished();
+        }
+        transitioning = true;
     }
+    foreach (MCompositeManagerExtension *ext, render_passes) {
+        ext->renderPass(painter);
+        // draw the overlays queued by the pass before the next one
+        MTexturePixmapPrivate::restoreGLState();
+    }
+    if (capture) {
+        // the render passes may draw anything anywhere
+        bool full = transitioning || !render_passes.isEmpty()
+                    || layout != painted_layout;
+        painted_layout = layout;
+        const mcapture_slot *captured = capture->frameDrawn(damage, full);
+        if (captured)
+            foreach (MCompositeManagerExtension *ext, frame_listeners)
+                ext->frameCaptured(captured);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    FrameStats frame;
+    frame.frames = 1;
+    frame.draw_calls = MTexturePixmapPrivate::draw_calls - draw_calls;
+    frame.total_usecs = frame.max_usecs
+        = (end.tv_sec - start.tv_sec) * 1000000
+          + (end.tv_nsec - start.tv_nsec) / 1000;
+    stats.frames++;
+    stats.draw_calls += frame.draw_calls;
+    stats.total_usecs += frame.total_usecs;
+    if (frame.max_usecs > stats.max_usecs)
+        stats.max_usecs = frame.max_usecs;
+
+    foreach (MCompositeManagerExtension *ext, frame_listeners)
+        ext->afterFrame(frame);
 }
@@ -22,10 +22,15 @@
 
 #include <QGraphicsScene>
 #include <QGraphicsItem>
+#include <QRegion>
+#include <QVector>
 #include <X11/Xlib.h>
 #include <map>
 
 class QMouseEvent;
+class MCompositeManagerExtension;
+class MScreenCapture;
+class MScreenRotation;
 
 /*!
  * The QGraphicsScene used by MCompositor to render the MGLXTexturePixmap
@@ -52,6 +57,97 @@ public:
      */
     void prepareRoot();
 
+    /*!
+     * Statistics about the frames drawn since the last resetFrameStats().
+     */
+    struct FrameStats {
+        //! Number of frames drawn.
+        unsigned frames;
+        //! Number of GL draw calls issued for the windows.
+        unsigned draw_calls;
+        //! Total and longest time spent drawing a frame, in microseconds.
+        quint64 total_usecs, max_usecs;
+    };
+
+    /*!
+     * Returns the frame statistics collected so far.
+     */
+    const FrameStats &frameStats() const { return stats; }
+
+    /*!
+     * Starts collecting frame statistics anew.
+     */
+    void resetFrameStats();
+
+    /*!
+     * Registers \a ext to have its beforeFrame() and afterFrame() called
+     * around each frame.
+     */
+    void addFrameListener(MCompositeManagerExtension *ext);
+
+    /*!
+     * Registers \a ext to have its renderPass() called after the windows
+     * are drawn.  Passes are drawn in the order they were added.
+     */
+    void addRenderPass(MCompositeManagerExtension *ext);
+    void removeRenderPass(MCompositeManagerExtension *ext);
+
+    /*!
+     * Forgets about \a ext entirely.
+     */
+    void removeExtension(MCompositeManagerExtension *ext);
+
+    /*!
+     * Sets the part of the screen which is not composited because its
+     * outputs show a window directly.  It's not drawn.
+     */
+    void setScanoutRegion(const QRegion &r) { scanout_region = r; }
+
+    /*!
+     * Starts capturing the frames into the shared memory ring \a name,
+     * replacing the current capture.  See MScreenCapture::create().
+     */
+    bool startCapture(const QString &name, bool damage_only, unsigned fps);
+    void stopCapture();
+
+    /*!
+     * Returns the current capture or 0.
+     */
+    const MScreenCapture *screenCapture() const { return capture; }
+
+    /*!
+     * Starts turning the contents of \a output by \a degrees clockwise,
+     * replacing the current rotation.  The snapshot to turn is taken
+     * from the next frame.  The transition waits for \a window of
+     * \a size to redraw itself.
+     */
+    void startRotation(const QRect &output, int degrees,
+                       Window window, const QSize &size);
+
+    /*!
+     * Returns the current rotation or 0.
+     */
+    const MScreenRotation *screenRotation() const { return rotation; }
+
+    /*!
+     * Notes that \a r of \a window has been redrawn, which the rotation
+     * may be waiting for.
+     */
+    void rotationDamage(Window window, const QRect &r);
+
+    /*!
+     * Returns whether anyone is interested in addDamage().
+     */
+    bool hasFrameListeners() const
+    {
+        return !frame_listeners.isEmpty() || capture;
+    }
+
+    /*!
+     * Notes that \a r of the screen has changed since the last frame.
+     */
+    void addDamage(const QRegion &r) { frame_damage += r; }
+
 protected:
     void drawItems(QPainter *painter, int numItems, QGraphicsItem *items[], const QStyleOptionGraphicsItem options[], QWidget *widget);
 
@@ -59,10 +155,26 @@ private:
 
     Window root;
     bool drawActive;
+    FrameStats stats;
+
+    // Extensions to be notified about frames and to draw extra passes,
+    // and the damage accumulated for the next beforeFrame().
+    QList<MCompositeManagerExtension *> frame_listeners, render_passes;
+    QRegion frame_damage;
+
+    QRegion scanout_region;
+
+    MScreenCapture *capture;
+    // What was painted where in the last captured frame,
+    // to tell whether the damage covers all the changes.
+    QVector<qreal> painted_layout;
+
+    MScreenRotation *rotation;
 
 signals:
 
     void switchWindow();
+    void rotationFinished();
 };
 
 #endif
@@ -25,6 +25,7 @@
 #include "mdecoratorframe.h"
 #include "mcompositemanagerextension.h"
 #include "mcompositewindowgroup.h"
+#include "mwindowpingscheduler.h"
 
 #include <QX11Info>
 #include <QGraphicsScene>
@@ -57,6 +58,8 @@ MCompositeWindow::MCompositeWindow(Qt::HANDLE window,
       is_transitioning(false),
       dimmed_effect(false),
       waiting_for_damage(0),
+      damage_count(0),
+      damage_timer(0),
       win_id(window)
 {
     thumb_mode = false;
@@ -64,7 +67,6 @@ MCompositeWindow::MCompositeWindow(Qt::HANDLE window,
         is_valid = false;
         anim = 0;
         newly_mapped = false;
-        t_ping = t_reappear = damage_timer = 0;
         window_visible = false;
         return;
     } else
@@ -75,20 +77,6 @@ MCompositeWindow::MCompositeWindow(Qt::HANDLE window,
     connect(mpc, SIGNAL(iconGeometryUpdated()), SLOT(updateIconGeometry()));
     setAcceptHoverEvents(true);
 
-    // this could be configurable. But will do for now. Most WMs use 5s delay
-    t_ping = new QTimer(this);
-    t_ping->setInterval(5000);
-    connect(t_ping, SIGNAL(timeout()), SLOT(pingTimeout()));
-    t_reappear = new QTimer(this);
-    t_reappear->setSingleShot(true);
-    t_reappear->setInterval(30 * 1000);
-    connect(t_reappear, SIGNAL(timeout()), SLOT(reappearTimeout()));
-
-    damage_timer = new QTimer(this);
-    damage_timer->setSingleShot(true);
-    damage_timer->setInterval(500);
-    connect(damage_timer, SIGNAL(timeout()), SLOT(damageTimeout()));
-
     // Newly-mapped non-decorated application windows are not initially 
     // visible to prevent flickering when animation is started.
     // We initially prevent item visibility from compositor itself
@@ -115,10 +103,8 @@ MCompositeWindow::~MCompositeWindow()
 {
     MCompositeManager *p = (MCompositeManager *) qApp;
 
-    if (window()) {
+    if (window())
         stopPing();
-        t_ping = t_reappear = 0;
-    }
     endAnimation();
     
     anim = 0;
@@ -179,9 +165,10 @@ void MCompositeWindow::iconify(const QRectF &icongeometry, bool defer)
     
     // Custom iconify handler
     MCompositeManager *p = (MCompositeManager *) qApp;
-    QList<MCompositeManagerExtension*> evlist = p->d->m_extensions.values(MapNotify);
+    const QVector<MCompositeManagerPrivate::X11EventHandler> &evlist
+        = p->d->x11_event_handlers[MapNotify];
     for (int i = 0; i < evlist.size(); ++i) { 
-        if (evlist[i]->windowIconified(this, defer)) {
+        if (evlist[i].extension->windowIconified(this, defer)) {
             iconified = true;
             window_status = Normal;
             return;
@@ -303,9 +290,10 @@ void MCompositeWindow::restore(const QRectF &icongeometry, bool defer)
 {
      // Custom restore handler
     MCompositeManager *p = (MCompositeManager *) qApp;
-    QList<MCompositeManagerExtension*> evlist = p->d->m_extensions.values(MapNotify);
+    const QVector<MCompositeManagerPrivate::X11EventHandler> &evlist
+        = p->d->x11_event_handlers[MapNotify];
     for (int i = 0; i < evlist.size(); ++i) { 
-        if (evlist[i]->windowRestored(this, defer)) {
+        if (evlist[i].extension->windowRestored(this, defer)) {
             iconified = false;
             return;
         }
@@ -347,6 +335,12 @@ bool MCompositeWindow::showWindow()
         // Meegotouch apps draw their window or the default background with
         // the first damage
         waiting_for_damage = 1;
+        if (!damage_timer) {
+            damage_timer = new QTimer(this);
+            damage_timer->setSingleShot(true);
+            damage_timer->setInterval(500);
+            connect(damage_timer, SIGNAL(timeout()), SLOT(damageTimeout()));
+        }
         damage_timer->start();
     } else
         q_fadeIn();
@@ -361,7 +355,8 @@ void MCompositeWindow::damageTimeout()
 void MCompositeWindow::damageReceived(bool timeout)
 {
     if (timeout || (waiting_for_damage > 0 && !--waiting_for_damage)) {
-        damage_timer->stop();
+        if (damage_timer)
+            damage_timer->stop();
         waiting_for_damage = 0;
         q_fadeIn();
     }
@@ -380,9 +375,10 @@ void MCompositeWindow::q_fadeIn()
     
     // Custom fade-in handler
     MCompositeManager *p = (MCompositeManager *) qApp;
-    QList<MCompositeManagerExtension*> evlist = p->d->m_extensions.values(MapNotify);
+    const QVector<MCompositeManagerPrivate::X11EventHandler> &evlist
+        = p->d->x11_event_handlers[MapNotify];
     for (int i = 0; i < evlist.size(); ++i) { 
-        if (evlist[i]->windowShown(this)) 
+        if (evlist[i].extension->windowShown(this)) 
             return;
     }
     
@@ -428,9 +424,10 @@ void MCompositeWindow::closeWindowAnimation()
     origPosition = pos();
     
     // Custom close window animation handler    
-    QList<MCompositeManagerExtension*> evlist = p->d->m_extensions.values(MapNotify);
+    const QVector<MCompositeManagerPrivate::X11EventHandler> &evlist
+        = p->d->x11_event_handlers[MapNotify];
     for (int i = 0; i < evlist.size(); ++i) { 
-        if (evlist[i]->windowClosed(this)) {
+        if (evlist[i].extension->windowClosed(this)) {
             window_status = Normal; // can't guarantee that Closing is cleared
             return;
         }
@@ -531,6 +528,8 @@ void MCompositeWindow::setVisible(bool visible)
     QGraphicsItem::setVisible(visible);
     MCompositeManager *p = (MCompositeManager *) qApp;
     p->d->setWindowDebugProperties(window());
+    if (visible)
+        renderer()->refreshBackingStore();
 
     QGraphicsScene* sc = scene();    
     if (sc && !visible && sc->items().count() == 1)
@@ -539,25 +538,30 @@ void MCompositeWindow::setVisible(bool visible)
 
 void MCompositeWindow::startPing()
 {
-    if (t_ping->isActive())
+    MWindowPingScheduler *s = MWindowPingScheduler::instance();
+    if (s->isScheduled(this, MWindowPingScheduler::PingTimeout))
         // this function can be called repeatedly without extending the timeout
         return;
     // startup: send ping now, otherwise it is sent after timeout
     pingWindow();
-    t_ping->start();
+    s->schedule(this, MWindowPingScheduler::PingTimeout,
+                MWindowPingScheduler::PingMsecs);
 }
 
 void MCompositeWindow::stopPing()
 {
-    t_ping->stop();
-    t_reappear->stop();
+    MWindowPingScheduler *s = MWindowPingScheduler::instance();
+    s->cancel(this, MWindowPingScheduler::PingTimeout);
+    s->cancel(this, MWindowPingScheduler::ReappearTimeout);
 }
 
 void MCompositeWindow::startDialogReappearTimer()
 {
     if (window_status != Hung)
         return;
-    t_reappear->start();
+    MWindowPingScheduler::instance()->schedule(this,
+                                    MWindowPingScheduler::ReappearTimeout,
+                                    MWindowPingScheduler::ReappearMsecs);
 }
 
 void MCompositeWindow::reappearTimeout()
@@ -577,7 +581,8 @@ void MCompositeWindow::receivedPing(ulong serverTimeStamp)
     }
     if (blurred())
         setBlurred(false);
-    t_reappear->stop();
+    MWindowPingScheduler::instance()->cancel(this,
+                                    MWindowPingScheduler::ReappearTimeout);
 }
 
 void MCompositeWindow::pingTimeout()
@@ -588,8 +593,9 @@ void MCompositeWindow::pingTimeout()
         window_status = Hung;
         emit windowHung(this, true);
     }
-    if (t_ping->isActive())
-        // interval timer is still active
+    if (MWindowPingScheduler::instance()->isScheduled(this,
+                                       MWindowPingScheduler::PingTimeout))
+        // still being pinged
         pingWindow();
 }
 
@@ -174,6 +174,12 @@ public:
      */
     bool waitingForDamage() const { return waiting_for_damage > 0; }
 
+    /*!
+     * Returns the number of damage events received for this window.
+     */
+    unsigned damageCount() const { return damage_count; }
+    void countDamage() { damage_count++; }
+
     /*!
      * Returns how this window was iconified.
      */
@@ -418,6 +424,7 @@ private:
     bool is_transitioning;
     bool dimmed_effect;
     char waiting_for_damage;
+    unsigned damage_count;
 
     static int window_transitioning;
 
@@ -425,13 +432,13 @@ private:
     QRectF iconGeometry;
     QPointF origPosition;
 
-    // Main ping timer
-    QTimer *t_ping, *t_reappear;
+    // created on demand, the pings are timed by MWindowPingScheduler
     QTimer *damage_timer;
     Qt::HANDLE win_id;
 
     friend class MTexturePixmapPrivate;
     friend class MCompositeWindowShaderEffect;
+    friend class MWindowPingScheduler;
 };
 
 #endif
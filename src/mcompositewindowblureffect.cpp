@@ -0,0 +1,378 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+/*!
+  \class MCompositeWindowBlurEffect
+  \brief MCompositeWindowBlurEffect renders a window with a Gaussian blur.
+
+  The source texture is first copied into a chain of successively halved
+  off-screen buffers, letting bilinear filtering do the downsampling. The
+  smallest copy is then blurred with two separable Gaussian passes and the
+  result is scaled back up when the window is painted. The blurred texture
+  is kept until the window is damaged, resized or the radius changes, so a
+  static window behind a dialog or the switcher is blurred only once.
+
+  The radius is given in pixels of the window and is taken to be three
+  standard deviations of the Gaussian. The blur reuses the active shader
+  fragment of the effect for the final upscale so subclasses can still
+  tint the output with setActiveShaderFragment().
+
+  Implementation relies on framebuffer objects, like MCompositeWindowGroup.
+*/
+
+#include <QtOpenGL>
+#include <math.h>
+#include <mcompositewindowblureffect.h>
+
+#include <mcompositewindow.h>
+#include "mtexturepixmapitem_p.h"
+#include "mresourceaccountant.h"
+
+// Number of bilinear taps on either side of the center texel.  Each tap
+// covers two texels of the discrete kernel, so the kernel reaches
+// 2 * BLUR_TAPS texels with 2 * BLUR_TAPS + 1 fetches per pass.
+// The array sizes in blur_frag must be BLUR_TAPS + 1.
+#define BLUR_TAPS  4
+// Maximum number of halvings of the source.
+#define MAX_LEVELS 3
+
+static const char blur_frag[] = "\
+    uniform mediump vec2 blurDirection;\n\
+    uniform mediump float blurOffsets[5];\n\
+    uniform mediump float blurWeights[5];\n\
+    lowp vec4 customShader(lowp sampler2D imageTexture, highp vec2 textureCoords) {\n\
+        lowp vec4 color = texture2D(imageTexture, textureCoords) * blurWeights[0];\n\
+        for (int i = 1; i < 5; ++i) {\n\
+            highp vec2 o = blurDirection * blurOffsets[i];\n\
+            color += texture2D(imageTexture, textureCoords + o) * blurWeights[i];\n\
+            color += texture2D(imageTexture, textureCoords - o) * blurWeights[i];\n\
+        }\n\
+        return color;\n\
+    }\n";
+
+class MCompositeWindowBlurEffectPrivate
+{
+public:
+    struct Target {
+        GLuint texture;
+        GLuint fbo;
+        int width, height;
+    };
+
+    MCompositeWindowBlurEffectPrivate()
+        :radius(8),
+         levels(1),
+         copy_fragment(0),
+         blur_fragment(0),
+         source(0),
+         source_serial(0),
+         valid(false)
+    {
+        direction[0] = direction[1] = 0;
+        computeKernel();
+    }
+
+    void computeKernel();
+    bool setupTargets(const QSize &size);
+    void freeTargets();
+
+    qreal radius;
+    int levels;
+    GLfloat offsets[BLUR_TAPS + 1];
+    GLfloat weights[BLUR_TAPS + 1];
+    GLfloat direction[2];
+    GLuint copy_fragment;
+    GLuint blur_fragment;
+
+    // chain[0..levels-1] are the halved copies of the source, the last one
+    // holds the blurred result.  chain[levels] is the same size as that
+    // and is the scratch buffer of the horizontal pass.
+    QVector<Target> chain;
+    QSize source_size;
+
+    // What the blurred texture in the chain was made from.
+    GLuint source;
+    unsigned source_serial;
+    bool valid;
+};
+
+// Chooses the number of downsampling levels for @radius and precomputes
+// the offsets and weights of the linearly sampled Gaussian kernel.
+void MCompositeWindowBlurEffectPrivate::computeKernel()
+{
+    const qreal max_sigma = 2 * BLUR_TAPS / 3.0;
+    qreal sigma = radius / 3.0;
+
+    levels = 1;
+    while (levels < MAX_LEVELS && sigma / (1 << levels) > max_sigma)
+        ++levels;
+    sigma = qBound(qreal(0.1), sigma / (1 << levels), max_sigma);
+
+    GLfloat w[2 * BLUR_TAPS + 1];
+    GLfloat sum = 0;
+    for (int i = 0; i <= 2 * BLUR_TAPS; ++i) {
+        w[i] = exp(-(i * i) / (2 * sigma * sigma));
+        sum += i ? 2 * w[i] : w[i];
+    }
+
+    // Sampling between texels i and i+1 at the offset weighted by their
+    // kernel values makes the texture unit fetch both for the price of one.
+    offsets[0] = 0;
+    weights[0] = w[0] / sum;
+    for (int k = 1; k <= BLUR_TAPS; ++k) {
+        int i = 2 * k - 1, j = 2 * k;
+        GLfloat wt = w[i] + w[j];
+        weights[k] = wt / sum;
+        offsets[k] = wt > 0 ? (i * w[i] + j * w[j]) / wt : i;
+    }
+}
+
+// (Re)creates the buffer chain for a source of @size if necessary.
+// Leaves an arbitrary framebuffer bound.
+bool MCompositeWindowBlurEffectPrivate::setupTargets(const QSize &size)
+{
+    if (size == source_size && chain.size() == levels + 1)
+        return true;
+    if (size == source_size && chain.isEmpty())
+        // failed before, don't retry and warn on every frame
+        return false;
+
+    freeTargets();
+    source_size = size;
+
+    chain.resize(levels + 1);
+    for (int i = 0; i <= levels; ++i) {
+        Target &t = chain[i];
+        int shift = qMin(i + 1, levels);
+        t.width = qMax(size.width() >> shift, 1);
+        t.height = qMax(size.height() >> shift, 1);
+
+        glGenTextures(1, &t.texture);
+        glBindTexture(GL_TEXTURE_2D, t.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, t.width, t.height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        MResourceAccountant::instance()->charge("MCompositeWindowBlurEffect",
+                MResourceAccountant::Framebuffer, t.width * t.height * 4);
+
+        glGenFramebuffers(1, &t.fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, t.fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, t.texture, 0);
+        GLenum ret = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (ret != GL_FRAMEBUFFER_COMPLETE) {
+            qWarning("MCompositeWindowBlurEffect::%s(): incomplete FBO "
+                     "attachment 0x%x", __func__, ret);
+            chain.resize(i + 1);
+            freeTargets();
+            source_size = size;
+            return false;
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return true;
+}
+
+void MCompositeWindowBlurEffectPrivate::freeTargets()
+{
+    for (int i = 0; i < chain.size(); ++i) {
+        glDeleteFramebuffers(1, &chain[i].fbo);
+        glDeleteTextures(1, &chain[i].texture);
+        MResourceAccountant::instance()->charge("MCompositeWindowBlurEffect",
+                MResourceAccountant::Framebuffer,
+                -chain[i].width * chain[i].height * 4);
+    }
+    chain.clear();
+    source_size = QSize();
+    valid = false;
+}
+
+/*!
+  Creates a blur effect object with the default radius of 8 pixels.
+ */
+MCompositeWindowBlurEffect::MCompositeWindowBlurEffect(QObject* parent)
+    :MCompositeWindowShaderEffect(parent),
+     d_ptr(new MCompositeWindowBlurEffectPrivate)
+{
+    Q_D(MCompositeWindowBlurEffect);
+    d->copy_fragment = activeShaderFragment();
+    d->blur_fragment = installShaderFragment(QByteArray(blur_frag));
+}
+
+/*!
+  Destroys the blur effect and frees its off-screen buffers.
+ */
+MCompositeWindowBlurEffect::~MCompositeWindowBlurEffect()
+{
+    Q_D(MCompositeWindowBlurEffect);
+
+    if (!QGLContext::currentContext()) {
+        qWarning("MCompositeWindowBlurEffect::%s(): no current GL context",
+                 __func__);
+        return;
+    }
+    d->freeTargets();
+}
+
+/*!
+  \return The blur radius in pixels.
+ */
+qreal MCompositeWindowBlurEffect::radius() const
+{
+    Q_D(const MCompositeWindowBlurEffect);
+    return d->radius;
+}
+
+/*!
+  Sets the blur radius to \a radius pixels. Large radii are cheap because
+  they are applied on smaller copies of the window.
+ */
+void MCompositeWindowBlurEffect::setRadius(qreal radius)
+{
+    Q_D(MCompositeWindowBlurEffect);
+    radius = qMax(radius, qreal(0));
+    if (radius == d->radius)
+        return;
+    d->radius = radius;
+    d->computeKernel();
+    invalidate();
+}
+
+/*!
+  Discards the cached blurred texture so that it's rendered again from
+  the window at the next paint. The window's damage does this implicitly.
+ */
+void MCompositeWindowBlurEffect::invalidate()
+{
+    Q_D(MCompositeWindowBlurEffect);
+    d->valid = false;
+    MCompositeWindow::update();
+}
+
+// Renders @texture into the @target buffer of the chain with the active
+// shader fragment.
+void MCompositeWindowBlurEffect::renderPass(GLuint texture, int target)
+{
+    Q_D(MCompositeWindowBlurEffect);
+    const MCompositeWindowBlurEffectPrivate::Target &t = d->chain[target];
+    QGLWidget *w = MTexturePixmapPrivate::glwidget;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, t.fbo);
+    glViewport(0, 0, t.width, t.height);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    // the projection covers the GL widget, which the viewport maps
+    // onto the whole buffer
+    drawSource(QTransform::fromScale(w->width(), w->height()),
+               QRectF(0, 0, 1, 1), 1.0);
+}
+
+void MCompositeWindowBlurEffect::drawTexture(const QTransform &transform,
+                                             const QRectF &drawRect,
+                                             qreal opacity)
+{
+    Q_D(MCompositeWindowBlurEffect);
+    GLuint source = texture();
+    QSize size = drawRect.size().toSize();
+
+    if (!source || size.isEmpty() || !d->blur_fragment) {
+        drawSource(transform, drawRect, opacity);
+        return;
+    }
+
+    if (!d->valid || source != d->source || size != d->source_size
+        || sourceSerial() != d->source_serial) {
+        GLint fbo, viewport[4];
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+
+        if (!d->setupTargets(size)) {
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glBindTexture(GL_TEXTURE_2D, source);
+            drawSource(transform, drawRect, opacity);
+            return;
+        }
+
+        GLboolean blend = glIsEnabled(GL_BLEND);
+        GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+        glDisable(GL_BLEND);
+        glDisable(GL_SCISSOR_TEST);
+
+        // Copy without flipping so the intermediates keep the
+        // orientation of the source.
+        bool inverted = MTexturePixmapPrivate::inverted_texture;
+        MTexturePixmapPrivate::inverted_texture = false;
+        GLuint active = activeShaderFragment();
+
+        setActiveShaderFragment(d->copy_fragment);
+        GLuint from = source;
+        for (int i = 0; i < d->levels; ++i) {
+            renderPass(from, i);
+            from = d->chain[i].texture;
+        }
+
+        const MCompositeWindowBlurEffectPrivate::Target &last
+            = d->chain[d->levels - 1];
+        setActiveShaderFragment(d->blur_fragment);
+        d->direction[0] = 1.0 / last.width;
+        d->direction[1] = 0;
+        renderPass(last.texture, d->levels);
+        d->direction[0] = 0;
+        d->direction[1] = 1.0 / last.height;
+        renderPass(d->chain[d->levels].texture, d->levels - 1);
+
+        setActiveShaderFragment(active);
+        MTexturePixmapPrivate::inverted_texture = inverted;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        if (blend)
+            glEnable(GL_BLEND);
+        if (scissor)
+            glEnable(GL_SCISSOR_TEST);
+
+        d->source = source;
+        d->source_serial = sourceSerial();
+        d->valid = true;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, d->chain[d->levels - 1].texture);
+    drawSource(transform, drawRect, opacity);
+    // shaped windows are drawn rect by rect with the source bound once
+    glBindTexture(GL_TEXTURE_2D, source);
+}
+
+/*!
+  \reimp
+  Sets the kernel of the pass being rendered. Subclasses overriding this
+  must call the base implementation.
+ */
+void MCompositeWindowBlurEffect::setUniforms(QGLShaderProgram* program)
+{
+    Q_D(MCompositeWindowBlurEffect);
+    if (program->programId() != d->blur_fragment)
+        return;
+    program->setUniformValue("blurDirection", d->direction[0],
+                             d->direction[1]);
+    program->setUniformValueArray("blurOffsets", d->offsets,
+                                  BLUR_TAPS + 1, 1);
+    program->setUniformValueArray("blurWeights", d->weights,
+                                  BLUR_TAPS + 1, 1);
+}
@@ -0,0 +1,54 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef MCOMPOSITEWINDOWBLUREFFECT_H
+#define MCOMPOSITEWINDOWBLUREFFECT_H
+
+#include <mcompositewindowshadereffect.h>
+
+class MCompositeWindowBlurEffectPrivate;
+
+class MCompositeWindowBlurEffect: public MCompositeWindowShaderEffect
+{
+    Q_OBJECT
+ public:
+    MCompositeWindowBlurEffect(QObject* parent = 0);
+    virtual ~MCompositeWindowBlurEffect();
+
+    qreal radius() const;
+
+ public slots:
+    void setRadius(qreal radius);
+    void invalidate();
+
+ protected:
+    //! \reimp
+    virtual void drawTexture(const QTransform &transform,
+                             const QRectF &drawRect, qreal opacity);
+    virtual void setUniforms(QGLShaderProgram* program);
+    //! \reimp_end
+
+ private:
+    Q_DECLARE_PRIVATE(MCompositeWindowBlurEffect)
+    void renderPass(GLuint texture, int target);
+
+    QScopedPointer<MCompositeWindowBlurEffectPrivate> d_ptr;
+};
+
+#endif // MCOMPOSITEWINDOWBLUREFFECT_H
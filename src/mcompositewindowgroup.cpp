@@ -46,6 +46,7 @@
 #include <mtexturepixmapitem.h>
 #include <mcompositemanager.h>
 #include <mcompositemanager_p.h>
+#include "mresourceaccountant.h"
 
 #ifdef GLES2_VERSION
 #define FORMAT GL_RGBA
@@ -63,6 +64,7 @@ public:
          texture(0),
          fbo(0),
          depth_buffer(0),
+         fbo_owner(0),
          valid(false),
          renderer(new MTexturePixmapPrivate(0, mainWindow))            
     {       
@@ -71,6 +73,9 @@ public:
     GLuint texture;
     GLuint fbo;
     GLuint depth_buffer;
+    // The window the off-screen buffer is accounted to.  The main window
+    // may be gone by the time the group is destroyed.
+    Window fbo_owner;
     
     bool valid;
     QList<MTexturePixmapItem*> item_list;
@@ -103,6 +108,9 @@ MCompositeWindowGroup::~MCompositeWindowGroup()
 {
     Q_D(MCompositeWindowGroup);
     
+    if (d->fbo_owner)
+        MResourceAccountant::instance()->setWindowUsage(d->fbo_owner,
+                                        MResourceAccountant::Framebuffer, 0);
     if (!QGLContext::currentContext()) {
         qWarning("MCompositeWindowGroup::%s(): no current GL context",
                  __func__);
@@ -165,6 +173,12 @@ void MCompositeWindowGroup::init()
                  d->main_window->boundingRect().width(), 
                  d->main_window->boundingRect().height(), 0,
                  GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    // colour and 16-bit depth
+    d->fbo_owner = d->main_window->window();
+    MResourceAccountant::instance()->setWindowUsage(d->fbo_owner,
+            MResourceAccountant::Framebuffer,
+            (qint64)d->main_window->boundingRect().width()
+            * d->main_window->boundingRect().height() * 6);
     
     GLenum ret = glCheckFramebufferStatus(GL_FRAMEBUFFER);
     if (ret == GL_FRAMEBUFFER_COMPLETE)
@@ -307,7 +321,10 @@ void MCompositeWindowGroup::updateWindowPixmap(XRectangle *rects, int num,
         item->renderTexture(item->sceneTransform());
         item->d->inverted_texture = orig_value;
     }
+    // draws the windows still batched from the texture atlas
+    MTexturePixmapPrivate::restoreGLState();
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    ++d->renderer->damage_serial;
 }
 
 // internal re-implementation from MCompositeWindow
@@ -36,6 +36,7 @@
 #include "mcompositewindowshadereffect.h"
 #include "mtexturepixmapitem_p.h"
 #include "mcompositewindowgroup.h"
+#include "mresourceaccountant.h"
 #include <QByteArray>
 
 static const char default_frag[] = "\
@@ -46,7 +47,15 @@ static const char default_frag[] = "\
 MCompositeWindowShaderEffectPrivate::MCompositeWindowShaderEffectPrivate(MCompositeWindowShaderEffect* e)
     :effect(e),
      priv_render(0),
-     active_fragment(0)
+     active_fragment(0),
+     cached_output(false),
+     drawing_cached(false),
+     cache_valid(false),
+     cache_texture(0),
+     cache_fbo(0),
+     cache_source(0),
+     cache_serial(0),
+     shader_bytes(0)
 {
 }
 
@@ -56,10 +65,143 @@ void MCompositeWindowShaderEffectPrivate::drawTexture(MTexturePixmapPrivate* ren
                                                       qreal opacity)
 {
     priv_render = render;
-    effect->drawTexture(transform, drawRect, opacity);
+    if (!cached_output || !drawCached(render, transform, drawRect, opacity))
+        effect->drawTexture(transform, drawRect, opacity);
     enabled = false;
 }
 
+// Draws the output of the effect from the cache, rendering it first
+// if the source has changed since.  Returns false if the cache cannot
+// be used and the effect should be drawn directly.
+bool MCompositeWindowShaderEffectPrivate::drawCached(MTexturePixmapPrivate* render,
+                                                     const QTransform &transform,
+                                                     const QRectF &drawRect,
+                                                     qreal opacity)
+{
+#ifdef GLES2_VERSION
+    GLuint source = effect->texture();
+    QSize size = drawRect.size().toSize();
+    if (!source || size.isEmpty())
+        return false;
+
+    if (!cache_valid || source != cache_source || size != cache_size
+        || render->damage_serial != cache_serial) {
+        if (!renderCache(source, size))
+            return false;
+        cache_serial = render->damage_serial;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, cache_texture);
+    drawing_cached = true;
+    render->q_drawTexture(transform, drawRect, opacity);
+    drawing_cached = false;
+    // shaped windows are drawn rect by rect with the source bound once
+    glBindTexture(GL_TEXTURE_2D, source);
+    return true;
+#else
+    Q_UNUSED(render)
+    Q_UNUSED(transform)
+    Q_UNUSED(drawRect)
+    Q_UNUSED(opacity)
+    return false;
+#endif
+}
+
+// Renders the effect on @source of @size into @cache_texture.
+bool MCompositeWindowShaderEffectPrivate::renderCache(GLuint source,
+                                                      const QSize &size)
+{
+#ifdef GLES2_VERSION
+    GLint fbo, viewport[4];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    if (size != cache_size || !cache_fbo) {
+        freeCache();
+        cache_size = size;
+        glGenTextures(1, &cache_texture);
+        glBindTexture(GL_TEXTURE_2D, cache_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.width(), size.height(),
+                     0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        if (owner.isEmpty())
+            owner = effect->metaObject()->className();
+        MResourceAccountant::instance()->charge(owner.constData(),
+                MResourceAccountant::Framebuffer,
+                (qint64)size.width() * size.height() * 4);
+
+        glGenFramebuffers(1, &cache_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, cache_fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, cache_texture, 0);
+        GLenum ret = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (ret != GL_FRAMEBUFFER_COMPLETE) {
+            qWarning("MCompositeWindowShaderEffect::%s(): incomplete FBO "
+                     "attachment 0x%x", __func__, ret);
+            freeCache();
+            // don't try again until the effect is reconfigured
+            cached_output = false;
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glBindTexture(GL_TEXTURE_2D, source);
+            return false;
+        }
+    } else
+        glBindFramebuffer(GL_FRAMEBUFFER, cache_fbo);
+
+    GLboolean blend = glIsEnabled(GL_BLEND);
+    GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+    glDisable(GL_BLEND);
+    glDisable(GL_SCISSOR_TEST);
+    glViewport(0, 0, size.width(), size.height());
+    glBindTexture(GL_TEXTURE_2D, source);
+
+    // Render unflipped and opaque, the transformation and opacity
+    // are applied when the cache is drawn.  The projection covers the
+    // GL widget, which the viewport maps onto the whole buffer.
+    bool inverted = MTexturePixmapPrivate::inverted_texture;
+    MTexturePixmapPrivate::inverted_texture = false;
+    QGLWidget *w = MTexturePixmapPrivate::glwidget;
+    effect->drawTexture(QTransform::fromScale(w->width(), w->height()),
+                        QRectF(0, 0, 1, 1), 1.0);
+    MTexturePixmapPrivate::inverted_texture = inverted;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (blend)
+        glEnable(GL_BLEND);
+    if (scissor)
+        glEnable(GL_SCISSOR_TEST);
+
+    cache_source = source;
+    cache_valid = true;
+    return true;
+#else
+    Q_UNUSED(source)
+    Q_UNUSED(size)
+    return false;
+#endif
+}
+
+void MCompositeWindowShaderEffectPrivate::freeCache()
+{
+#ifdef GLES2_VERSION
+    if (cache_fbo)
+        glDeleteFramebuffers(1, &cache_fbo);
+    if (cache_texture) {
+        glDeleteTextures(1, &cache_texture);
+        MResourceAccountant::instance()->charge(owner.constData(),
+                MResourceAccountant::Framebuffer,
+                -(qint64)cache_size.width() * cache_size.height() * 4);
+    }
+#endif
+    cache_fbo = cache_texture = 0;
+    cache_size = QSize();
+    cache_valid = false;
+}
+
 /*!
  * Creates a window effect object
  */
@@ -79,6 +221,11 @@ MCompositeWindowShaderEffect::MCompositeWindowShaderEffect(QObject* parent)
 */
 MCompositeWindowShaderEffect::~MCompositeWindowShaderEffect()
 {
+    if (d->cache_fbo && QGLContext::currentContext())
+        d->freeCache();
+    if (d->shader_bytes)
+        MResourceAccountant::instance()->charge(d->owner.constData(),
+                MResourceAccountant::Shader, -d->shader_bytes);
 }
 
 /*!
@@ -106,6 +253,13 @@ GLuint MCompositeWindowShaderEffect::installShaderFragment(const QByteArray& cod
 {
     GLuint id = MTexturePixmapPrivate::installPixelShader(code);
     d->pixfrag_ids.push_back(id);
+    if (id) {
+        if (d->owner.isEmpty())
+            d->owner = metaObject()->className();
+        d->shader_bytes += code.size();
+        MResourceAccountant::instance()->charge(d->owner.constData(),
+                MResourceAccountant::Shader, code.size());
+    }
     return id;
 }
 
@@ -128,6 +282,16 @@ GLuint MCompositeWindowShaderEffect::texture() const
     return 0;
 }
 
+/*!
+  \return A counter that changes whenever the contents of texture() may
+  have changed, e.g. because the window was damaged. Effects keeping
+  intermediate results can compare it to decide whether to re-render them.
+*/
+unsigned MCompositeWindowShaderEffect::sourceSerial() const
+{
+    return d->priv_render ? d->priv_render->damage_serial : 0;
+}
+
 const QVector<GLuint>& MCompositeWindowShaderEffect::fragmentIds() const
 {
     return d->pixfrag_ids;
@@ -227,9 +391,55 @@ bool MCompositeWindowShaderEffect::enabled() const
 void MCompositeWindowShaderEffect::setEnabled(bool enabled)
 {
     d->enabled = enabled;
+    d->cache_valid = false;
     emit enabledChanged(enabled);
 }
 
+/*!
+  Declares whether the output of this effect depends only on the window
+  contents and the uniforms, so it can be rendered off-screen once and
+  reused until the window is damaged, invalidateCache() is called or the
+  effect is enabled or disabled. Set \a cached for effects like dimming
+  or desaturation of static windows to save fill rate on every repaint.
+
+  A cached effect's drawTexture() is called with the geometry of the
+  off-screen buffer, so it must draw the whole source, without
+  \c texcoords_from_rect. The transformation and opacity the window is
+  painted with are applied when the cached output is drawn.
+
+  Output caching is only available with the GLES2 backend and is a no-op
+  otherwise.
+*/
+void MCompositeWindowShaderEffect::setCachedOutput(bool cached)
+{
+    if (cached == d->cached_output)
+        return;
+    d->cached_output = cached;
+    if (!cached && QGLContext::currentContext())
+        d->freeCache();
+    d->cache_valid = false;
+}
+
+/*!
+  \return Whether the output of this effect is cached
+*/
+bool MCompositeWindowShaderEffect::cachedOutput() const
+{
+    return d->cached_output;
+}
+
+/*!
+  Discards the cached output of this effect and schedules a repaint.
+  Call this when the values set in setUniforms() change.
+*/
+void MCompositeWindowShaderEffect::invalidateCache()
+{
+    if (!d->cache_valid)
+        return;
+    d->cache_valid = false;
+    MCompositeWindow::update();
+}
+
 /*!
   Set the uniform values on the currently active shader \a program.
   Default implementation does nothing. Reimplement this function to
@@ -22,6 +22,7 @@
 
 #include <QObject>
 #include <QVector>
+#include <QSize>
 #include <QGLShaderProgram>
 
 class QTransform;
@@ -47,8 +48,12 @@ class MCompositeWindowShaderEffect: public QObject
     void removeEffect(MCompositeWindow* window);
     bool enabled() const;
 
+    void setCachedOutput(bool cached);
+    bool cachedOutput() const;
+
  public slots:
     void setEnabled(bool enabled);
+    void invalidateCache();
 
  signals:
     void enabledChanged( bool enabled);
@@ -61,6 +66,7 @@ class MCompositeWindowShaderEffect: public QObject
     virtual void drawTexture(const QTransform &transform,
                              const QRectF &drawRect, qreal opacity) = 0;
     virtual void setUniforms(QGLShaderProgram* program);
+    unsigned sourceSerial() const;
 
  private:    
     /* \cond */
@@ -85,6 +91,11 @@ class MCompositeWindowShaderEffectPrivate
 
  private:
     explicit MCompositeWindowShaderEffectPrivate(MCompositeWindowShaderEffect*);
+    bool drawCached(MTexturePixmapPrivate* render,
+                    const QTransform &transform,
+                    const QRectF &drawRect, qreal opacity);
+    bool renderCache(GLuint source, const QSize &size);
+    void freeCache();
     
     MCompositeWindowShaderEffect* effect;
     MTexturePixmapPrivate* priv_render;
@@ -94,7 +105,26 @@ class MCompositeWindowShaderEffectPrivate
     
     bool enabled;
 
+    // Output cache of effects that declared setCachedOutput(true).
+    // @cache_texture holds the output of the effect for @cache_source
+    // as of @cache_serial.  @drawing_cached tells q_drawTexture() to
+    // draw the cache with the normal shader.
+    bool cached_output;
+    bool drawing_cached;
+    bool cache_valid;
+    GLuint cache_texture;
+    GLuint cache_fbo;
+    GLuint cache_source;
+    unsigned cache_serial;
+    QSize cache_size;
+
+    // The class name the memory of the effect is accounted to,
+    // and the size of its shader sources.
+    QByteArray owner;
+    qint64 shader_bytes;
+
     friend class MCompositeWindowShaderEffect;
+    friend class MTexturePixmapPrivate;
 };
 
 /* \endcond */
@@ -55,6 +55,30 @@ MDecoratorFrame::MDecoratorFrame(QObject *p)
      */
 
     remote_decorator = new MRmiClient(".mabstractdecorator", this);
+
+    memset(&state, 0, sizeof(state));
+    channel = new MDecoratorChannel(MDecoratorChannel::CompositorSide, this);
+    if (channel->isValid()) {
+        connect(channel, SIGNAL(changed()), SLOT(decoratorChannelChanged()));
+        channel->start();
+    }
+}
+
+// Tells the decorator our current @state through the shared memory
+// channel.  Returns false if it has to be told with RMI too, because
+// it hasn't announced that it follows the channel.
+bool MDecoratorFrame::publish()
+{
+    if (!channel->isValid())
+        return false;
+    channel->publish(state);
+    return channel->peerAttached();
+}
+
+void MDecoratorFrame::decoratorChannelChanged()
+{
+    setDecoratorAvailableRect(
+            MDecoratorChannel::toRect(channel->peerState().available_rect));
 }
 
 Qt::HANDLE MDecoratorFrame::managedWindow() const
@@ -82,6 +106,16 @@ void MDecoratorFrame::show()
 void MDecoratorFrame::sendManagedWindowId()
 {
     qulonglong winid = client ? client->window() : 0;
+
+    state.managed_window = winid;
+    state.managed_serial++;
+    if (client)
+        MDecoratorChannel::fromRect(state.client_geometry,
+                                client->propertyCache()->requestedGeometry());
+    state.auto_rotation = false;
+    if (publish())
+        return;
+
     if(client)
         remote_decorator->invoke("MAbstractDecorator",
                                  "RemoteSetClientGeometry",
@@ -173,14 +207,18 @@ void MDecoratorFrame::setDecoratorAvailableRect(const QRect& r)
 
 void MDecoratorFrame::setAutoRotation(bool mode)
 {
-    remote_decorator->invoke("MAbstractDecorator",
-                             "RemoteSetAutoRotation", mode);
+    state.auto_rotation = mode;
+    if (!publish())
+        remote_decorator->invoke("MAbstractDecorator",
+                                 "RemoteSetAutoRotation", mode);
 }
 
 void MDecoratorFrame::setOnlyStatusbar(bool mode)
 {
-    remote_decorator->invoke("MAbstractDecorator",
-                             "RemoteSetOnlyStatusbar", mode);
+    state.only_statusbar = mode;
+    if (!publish())
+        remote_decorator->invoke("MAbstractDecorator",
+                                 "RemoteSetOnlyStatusbar", mode);
 }
 
 void MDecoratorFrame::showQueryDialog(bool visible)
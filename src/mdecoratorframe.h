@@ -22,6 +22,7 @@
 
 #include <QObject>
 #include <QRect>
+#include <mdecoratorchannel.h>
 
 class MCompositeWindow;
 class MRmiClient;
@@ -100,16 +101,23 @@ private slots:
     void destroyDecorator();
     void destroyClient();
     void visualizeDecorator(bool visible);
+    void decoratorChannelChanged();
 
 private:
     explicit MDecoratorFrame(QObject *object = 0);
     void sendManagedWindowId();
+    bool publish();
     static MDecoratorFrame *d;
 
     MCompositeWindow *client;
     Qt::HANDLE decorator_window;
     MCompositeWindow *decorator_item;
     MRmiClient *remote_decorator;
+    // The geometry and modes always go through @channel if it's valid,
+    // with @state being what we've published there, and with RMI unless
+    // the decorator has attached to the channel.
+    MDecoratorChannel *channel;
+    MDecoratorChannel::State state;
     int top_offset;
     bool no_resize;
     QRect available_rect;
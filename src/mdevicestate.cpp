@@ -38,6 +38,14 @@ void MDeviceState::mceDisplayStatusIndSignal(QString mode)
 }
 #endif
 
+void MDeviceState::fakeDisplayState(bool off)
+{
+    if (off == display_off)
+        return;
+    display_off = off;
+    emit displayStateChange(off);
+}
+
 void MDeviceState::callPropChanged()
 {
     QString val = call_prop->value().toString();
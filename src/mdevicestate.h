@@ -42,6 +42,12 @@ public:
     bool displayOff() const { return display_off; }
     bool ongoingCall() const { return ongoing_call; }
 
+    /*!
+     * Overrides the display state until the next real change, and
+     * emits displayStateChange() if it's different.  For testing.
+     */
+    void fakeDisplayState(bool display_off);
+
 signals:
 
     void callStateChange(bool call_ongoing);
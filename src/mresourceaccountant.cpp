@@ -0,0 +1,145 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "mresourceaccountant.h"
+
+#include <QPair>
+#include <QtAlgorithms>
+
+MResourceAccountant *MResourceAccountant::d = 0;
+
+qint64 MResourceAccountant::Usage::total() const
+{
+    qint64 sum = 0;
+    for (int i = 0; i < KindCount; ++i)
+        if (i != Temporary)
+            sum += bytes[i];
+    return sum;
+}
+
+MResourceAccountant *MResourceAccountant::instance()
+{
+    if (!d)
+        d = new MResourceAccountant();
+    return d;
+}
+
+MResourceAccountant::MResourceAccountant()
+    : max_bytes(0),
+      notified(false)
+{
+}
+
+const char *MResourceAccountant::kindName(Kind kind)
+{
+    static const char *names[] = {
+        "pixmap", "texture", "framebuffer", "shader", "temporary"
+    };
+    return kind < KindCount ? names[kind] : "unknown";
+}
+
+void MResourceAccountant::setWindowUsage(Window window, Kind kind,
+                                         qint64 bytes)
+{
+    QHash<Window, Usage>::iterator it = windows.find(window);
+    if (it == windows.end()) {
+        if (!bytes)
+            return;
+        it = windows.insert(window, Usage());
+    }
+
+    qint64 delta = bytes - it->bytes[kind];
+    it->bytes[kind] = bytes;
+    if (!bytes) {
+        // don't keep empty records of windows around
+        bool empty = true;
+        for (int i = 0; i < KindCount && empty; ++i)
+            empty = !it->bytes[i];
+        if (empty)
+            windows.erase(it);
+    }
+    account(kind, delta);
+}
+
+void MResourceAccountant::raiseWindowUsage(Window window, Kind kind,
+                                           qint64 bytes)
+{
+    if (bytes > windows.value(window).bytes[kind])
+        setWindowUsage(window, kind, bytes);
+}
+
+void MResourceAccountant::forgetWindow(Window window)
+{
+    QHash<Window, Usage>::iterator it = windows.find(window);
+    if (it == windows.end())
+        return;
+    Usage u = *it;
+    windows.erase(it);
+    for (int i = 0; i < KindCount; ++i)
+        if (u.bytes[i])
+            account((Kind)i, -u.bytes[i]);
+}
+
+void MResourceAccountant::charge(const char *component, Kind kind,
+                                 qint64 delta)
+{
+    if (!delta)
+        return;
+    Usage &u = components[component];
+    u.bytes[kind] += delta;
+    account(kind, delta);
+}
+
+void MResourceAccountant::account(Kind kind, qint64 delta)
+{
+    totals.bytes[kind] += delta;
+    if (delta > 0 && kind != Temporary && !notified && overBudget()) {
+        notified = true;
+        emit budgetExceeded();
+    }
+}
+
+static bool larger_usage(const QPair<qint64, Window> &a,
+                         const QPair<qint64, Window> &b)
+{
+    return a.first > b.first;
+}
+
+QList<Window> MResourceAccountant::topWindows(int n) const
+{
+    QList<QPair<qint64, Window> > all;
+    for (QHash<Window, Usage>::const_iterator it = windows.constBegin();
+         it != windows.constEnd(); ++it)
+        all.append(qMakePair(it->total(), it.key()));
+    qSort(all.begin(), all.end(), larger_usage);
+
+    QList<Window> top;
+    for (int i = 0; i < all.size() && i < n; ++i)
+        top.append(all[i].second);
+    return top;
+}
+
+void MResourceAccountant::setBudget(qint64 bytes)
+{
+    max_bytes = bytes > 0 ? bytes : 0;
+    if (!notified && overBudget()) {
+        notified = true;
+        emit budgetExceeded();
+    }
+}
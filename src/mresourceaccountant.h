@@ -0,0 +1,117 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef MRESOURCEACCOUNTANT_H
+#define MRESOURCEACCOUNTANT_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QByteArray>
+#include <X11/Xlib.h>
+
+/*!
+ * Keeps track of the graphics memory the compositor holds on behalf of
+ * the windows it composites and of its own components (shader effects,
+ * the texture atlas).  The figures are estimates computed from the sizes
+ * and formats of the buffers, drivers may need more.
+ *
+ * An optional budget can be set; overBudget() is emitted when the
+ * persistent usage exceeds it.
+ */
+class MResourceAccountant: public QObject
+{
+    Q_OBJECT
+public:
+    enum Kind {
+        //! X pixmaps named for the windows, and textures bound to them
+        Pixmap,
+        //! textures with storage of their own (copies, atlas areas)
+        Texture,
+        //! off-screen render targets and their depth buffers
+        Framebuffer,
+        //! shader sources, standing in for the size of the programs
+        Shader,
+        //! the largest transient buffer used to upload the contents
+        Temporary,
+        KindCount
+    };
+
+    struct Usage {
+        Usage() { for (int i = 0; i < KindCount; ++i) bytes[i] = 0; }
+        //! Everything but the Temporary bytes.
+        qint64 total() const;
+        qint64 bytes[KindCount];
+    };
+
+    static MResourceAccountant *instance();
+
+    //! Sets the @kind usage of @window to @bytes.
+    void setWindowUsage(Window window, Kind kind, qint64 bytes);
+    //! Raises the @kind usage of @window to @bytes if it's less.
+    void raiseWindowUsage(Window window, Kind kind, qint64 bytes);
+    //! Drops all records of @window.
+    void forgetWindow(Window window);
+    /*!
+     * Adds @delta bytes (which may be negative) to the @kind usage of
+     * @component, typically the class name of a plugin or effect.
+     */
+    void charge(const char *component, Kind kind, qint64 delta);
+
+    Usage windowUsage(Window window) const
+        { return windows.value(window); }
+    const QHash<Window, Usage> &windowUsages() const { return windows; }
+    const QHash<QByteArray, Usage> &componentUsages() const
+        { return components; }
+    qint64 total(Kind kind) const { return totals.bytes[kind]; }
+    qint64 total() const { return totals.total(); }
+    //! Returns the @n windows using the most memory, the largest first.
+    QList<Window> topWindows(int n) const;
+
+    static const char *kindName(Kind kind);
+
+    //! Sets the budget in bytes, 0 meaning unlimited.
+    void setBudget(qint64 bytes);
+    qint64 budget() const { return max_bytes; }
+    bool overBudget() const { return max_bytes && total() > max_bytes; }
+    /*!
+     * Called when the receiver of budgetExceeded() has done what it
+     * could, so that the signal is emitted again the next time the
+     * usage grows over the budget.
+     */
+    void budgetEnforced() { notified = false; }
+
+signals:
+    void budgetExceeded();
+
+private:
+    MResourceAccountant();
+    void account(Kind kind, qint64 delta);
+
+    static MResourceAccountant *d;
+
+    QHash<Window, Usage> windows;
+    QHash<QByteArray, Usage> components;
+    Usage totals;
+    qint64 max_bytes;
+    // Whether budgetExceeded() is pending or being handled.
+    bool notified;
+};
+
+#endif // MRESOURCEACCOUNTANT_H
@@ -0,0 +1,258 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifdef DESKTOP_VERSION
+#define GL_GLEXT_PROTOTYPES 1
+#endif
+#include <QGLWidget>
+#include "mscreencapture.h"
+#include "mtexturepixmapitem_p.h"
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+// Returns CLOCK_MONOTONIC in microseconds.
+static quint64 now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (quint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+MScreenCapture *MScreenCapture::create(const QString &name,
+                                       const QSize &size,
+                                       bool damage_only, unsigned fps)
+{
+    MScreenCapture *capture = new MScreenCapture(name, size,
+                                                 damage_only, fps);
+    if (!capture->ring) {
+        delete capture;
+        return 0;
+    }
+    return capture;
+}
+
+MScreenCapture::MScreenCapture(const QString &name, const QSize &size,
+                               bool damage_only, unsigned fps)
+    : size(size), damage_only(damage_only), use_pbo(false),
+      interval(fps ? 1000000 / fps : 0), last_capture(0),
+      ring(0), ring_size(0), pending_full(true),
+      sequence(0), last_keyframe(0)
+{
+    for (unsigned i = 0; i < Depth; ++i)
+        readbacks[i].pbo = readbacks[i].sequence = 0;
+    memset(&stat, 0, sizeof(stat));
+    idle_timer.setSingleShot(true);
+    idle_timer.setInterval(interval ? interval / 1000 : 100);
+    connect(&idle_timer, SIGNAL(timeout()), SLOT(idle()));
+
+    // shm_open() wants a leading slash and nothing else
+    shm_name = name.startsWith('/') ? name : QLatin1Char('/') + name;
+    QByteArray fname = shm_name.toLocal8Bit();
+    unsigned slot_size = sizeof(mcapture_slot)
+                         + size.width() * size.height() * 4;
+    ring_size = sizeof(mcapture_header) + Slots * slot_size;
+    // Always create a new ring readable only by our user.  A reader
+    // of a previous one can finish with it.
+    shm_unlink(fname.constData());
+    int fd = shm_open(fname.constData(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        qWarning("couldn't create %s", fname.constData());
+        return;
+    }
+    void *mem = MAP_FAILED;
+    if (ftruncate(fd, ring_size) == 0)
+        mem = mmap(0, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        qWarning("couldn't map %u bytes of %s", (unsigned)ring_size,
+                 fname.constData());
+        shm_unlink(fname.constData());
+        return;
+    }
+
+    // the pages are zeroed, so no frame is valid yet
+    ring = (mcapture_header *)mem;
+    ring->magic = MCAPTURE_MAGIC;
+    ring->version = MCAPTURE_VERSION;
+    ring->width = size.width();
+    ring->height = size.height();
+    ring->nslots = Slots;
+    ring->slot_size = slot_size;
+
+#ifdef GL_PIXEL_PACK_BUFFER
+    const char *exts = (const char *)glGetString(GL_EXTENSIONS);
+    use_pbo = exts && strstr(exts, "GL_ARB_pixel_buffer_object");
+    if (use_pbo)
+        for (unsigned i = 0; i < Depth; ++i)
+            glGenBuffers(1, &readbacks[i].pbo);
+#endif
+}
+
+MScreenCapture::~MScreenCapture()
+{
+    if (!ring)
+        return;
+#ifdef GL_PIXEL_PACK_BUFFER
+    // drop the frames in flight, the recorder is not interested anymore
+    for (unsigned i = 0; i < Depth; ++i)
+        if (readbacks[i].pbo)
+            glDeleteBuffers(1, &readbacks[i].pbo);
+#endif
+    munmap(ring, ring_size);
+    // readers which have it mapped can still finish
+    shm_unlink(shm_name.toLocal8Bit().constData());
+}
+
+// Prepares the slot of frame @seq for writing.
+mcapture_slot *MScreenCapture::beginSlot(quint32 seq, bool keyframe,
+                                         const QRect &rect, quint64 usecs)
+{
+    mcapture_slot *slot = mcapture_get_slot(ring, seq);
+    slot->sequence = 0;
+    __sync_synchronize();
+    slot->keyframe = keyframe;
+    slot->x = rect.x();
+    slot->y = rect.y();
+    slot->width = rect.width();
+    slot->height = rect.height();
+    slot->usecs = usecs;
+    return slot;
+}
+
+// Makes frame @seq in @slot visible to the readers.
+void MScreenCapture::publish(mcapture_slot *slot, quint32 seq)
+{
+    __sync_synchronize();
+    slot->sequence = seq;
+    ring->sequence = seq;
+    stat.bytes += slot->width * slot->height * 4;
+}
+
+// Copies the pixels of @rb into the ring, then frees it for reuse.
+const mcapture_slot *MScreenCapture::finish(Readback &rb)
+{
+    mcapture_slot *slot = 0;
+#ifdef GL_PIXEL_PACK_BUFFER
+    slot = beginSlot(rb.sequence, rb.keyframe, rb.rect, rb.usecs);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+    const void *pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (pixels) {
+        memcpy(slot + 1, pixels, rb.rect.width() * rb.rect.height() * 4);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        publish(slot, rb.sequence);
+    } else {
+        qWarning("couldn't map the pixels of frame %u", rb.sequence);
+        slot = 0;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+#endif
+    rb.sequence = 0;
+    return slot;
+}
+
+const mcapture_slot *MScreenCapture::frameDrawn(const QRegion &damage,
+                                                bool full)
+{
+    quint64 start = now();
+    QRect screen(QPoint(0, 0), size);
+    pending += damage;
+    pending_full = pending_full || full;
+    if (!pending_full && !pending.intersects(screen)) {
+        // nothing visible has changed since the last frame
+        pending = QRegion();
+        return 0;
+    }
+    if (interval && start - last_capture < interval) {
+        stat.skipped++;
+        idle_timer.start();
+        return 0;
+    }
+    last_capture = start;
+
+    // keep a keyframe in every Slots consecutive frames
+    // zero is not a valid sequence number, skip it when wrapping around
+    if (!++sequence)
+        ++sequence;
+    quint32 seq = sequence;
+    bool keyframe = !damage_only || pending_full
+                    || seq - last_keyframe >= Slots;
+    QRect rect = keyframe ? screen : pending.boundingRect() & screen;
+    pending = QRegion();
+    pending_full = false;
+    if (keyframe)
+        last_keyframe = seq;
+
+    // GL counts the rows from the bottom
+    int gl_y = size.height() - rect.y() - rect.height();
+    const mcapture_slot *done = 0;
+    if (use_pbo) {
+#ifdef GL_PIXEL_PACK_BUFFER
+        Readback &rb = readbacks[seq % Depth];
+        if (rb.sequence)
+            done = finish(rb);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+        // orphan the previous storage, it's been copied out already
+        glBufferData(GL_PIXEL_PACK_BUFFER, rect.width() * rect.height() * 4,
+                     0, GL_STREAM_READ);
+        glReadPixels(rect.x(), gl_y, rect.width(), rect.height(),
+                     GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        rb.sequence = seq;
+        rb.keyframe = keyframe;
+        rb.rect = rect;
+        rb.usecs = start;
+#endif
+    } else {
+        mcapture_slot *slot = beginSlot(seq, keyframe, rect, start);
+        glReadPixels(rect.x(), gl_y, rect.width(), rect.height(),
+                     GL_RGBA, GL_UNSIGNED_BYTE, slot + 1);
+        publish(slot, seq);
+        done = slot;
+    }
+    idle_timer.start();
+
+    stat.frames++;
+    if (keyframe)
+        stat.keyframes++;
+    quint64 usecs = now() - start;
+    stat.total_usecs += usecs;
+    if (usecs > stat.max_usecs)
+        stat.max_usecs = usecs;
+    return done;
+}
+
+// Nothing has been drawn for a while.
+void MScreenCapture::idle()
+{
+    // publish what's left in the pixel buffers, oldest first;
+    // a zero sequence marks a free one
+    for (quint32 seq = sequence - Depth + 1;
+         use_pbo && seq != sequence + 1; ++seq) {
+        Readback &rb = readbacks[seq % Depth];
+        if (seq && rb.sequence == seq)
+            finish(rb);
+    }
+    if (pending_full || !pending.isEmpty())
+        // the last changes were skipped, make up for them
+        MTexturePixmapPrivate::glwidget->update();
+}
@@ -0,0 +1,128 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef MSCREENCAPTURE_H
+#define MSCREENCAPTURE_H
+
+#include <QObject>
+#include <QString>
+#include <QRegion>
+#include <QTimer>
+#ifdef GLES2_VERSION
+#include <GLES2/gl2.h>
+#elif DESKTOP_VERSION
+#include <GL/gl.h>
+#endif
+#include "mcapturering.h"
+
+/*!
+ * Internal class reading back the composited frames into a shared memory
+ * ring for screen recording.  See mcapturering.h for the layout of the
+ * ring.
+ *
+ * Where pixel buffer objects are available the readback is asynchronous:
+ * the pixels are copied into the ring a couple of captured frames later,
+ * when the GPU has surely finished with them, so capturing doesn't stall
+ * the rendering.  Otherwise the pixels are read straight into the ring.
+ */
+class MScreenCapture: public QObject
+{
+    Q_OBJECT
+public:
+    //! Number of frames in the ring.
+    static const unsigned Slots = 4;
+    //! Number of pixel buffer objects in flight.
+    static const unsigned Depth = 2;
+
+    struct Stats {
+        //! Number of frames captured, of them keyframes and the frames
+        //! not captured because of the frame rate limit.
+        unsigned frames, keyframes, skipped;
+        //! Pixel bytes copied into the ring.
+        quint64 bytes;
+        //! Total and longest time spent capturing a frame, in microseconds.
+        quint64 total_usecs, max_usecs;
+    };
+
+    /*!
+     * Starts capturing frames of \a size into the shared memory object
+     * \a name.  If \a damage_only only the changed parts of the screen
+     * are read back, except in keyframes.  If \a fps is not 0 at most
+     * that many frames are captured a second.  Returns NULL if the ring
+     * cannot be created.
+     */
+    static MScreenCapture *create(const QString &name, const QSize &size,
+                                  bool damage_only, unsigned fps);
+    ~MScreenCapture();
+
+    const QString &name() const { return shm_name; }
+    bool damageOnly() const { return damage_only; }
+    bool usesPixelBuffers() const { return use_pbo; }
+    const Stats &stats() const { return stat; }
+
+    /*!
+     * Called after a frame is drawn, before it's swapped.  \a damage is
+     * what changed since the previous frame; if \a full, the whole
+     * screen may have.  Returns the frame which has made it into the
+     * ring in the meantime, or NULL.
+     */
+    const mcapture_slot *frameDrawn(const QRegion &damage, bool full);
+
+private slots:
+    void idle();
+
+private:
+    // A frame being read back into a pixel buffer object.
+    struct Readback {
+        GLuint pbo;
+        quint32 sequence;
+        bool keyframe;
+        QRect rect;
+        quint64 usecs;
+    };
+
+    MScreenCapture(const QString &name, const QSize &size,
+                   bool damage_only, unsigned fps);
+    mcapture_slot *beginSlot(quint32 seq, bool keyframe,
+                             const QRect &rect, quint64 usecs);
+    void publish(mcapture_slot *slot, quint32 seq);
+    const mcapture_slot *finish(Readback &rb);
+
+    QString shm_name;
+    QSize size;
+    bool damage_only, use_pbo;
+    quint64 interval, last_capture;
+
+    mcapture_header *ring;
+    size_t ring_size;
+
+    // The damage since the last captured frame.
+    QRegion pending;
+    bool pending_full;
+    // Sequence number of the last captured frame and the last keyframe.
+    quint32 sequence, last_keyframe;
+
+    Readback readbacks[Depth];
+    // Publishes the frames left in the pixel buffers when no more frames
+    // are drawn, and makes up for the frames skipped last.
+    QTimer idle_timer;
+    Stats stat;
+};
+
+#endif
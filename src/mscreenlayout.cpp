@@ -0,0 +1,201 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include <QX11Info>
+#include "mscreenlayout.h"
+#include "mcompatoms_p.h"
+
+#include <X11/Xatom.h>
+
+// Returns the atom value of @output's @property or None.
+static Atom output_atom(Display *dpy, RROutput output, Atom property)
+{
+    Atom t, value = None;
+    int fmt;
+    unsigned char *data;
+    unsigned long nitems, rem;
+
+    if (XRRGetOutputProperty(dpy, output, property, 0, 1, False, False,
+                             AnyPropertyType, &t, &fmt, &nitems, &rem,
+                             &data) != Success)
+        return None;
+    if (t == XA_ATOM && fmt == 32 && nitems == 1)
+        value = *(Atom *)data;
+    XFree(data);
+    return value;
+}
+
+// Returns whether @output has an integer @property.
+static bool has_output_integer(Display *dpy, RROutput output, Atom property)
+{
+    Atom t;
+    int fmt;
+    unsigned char *data;
+    unsigned long nitems, rem;
+    bool ret;
+
+    if (XRRGetOutputProperty(dpy, output, property, 0, 1, False, False,
+                             AnyPropertyType, &t, &fmt, &nitems, &rem,
+                             &data) != Success)
+        return false;
+    ret = t == XA_INTEGER && fmt == 32 && nitems == 1;
+    XFree(data);
+    return ret;
+}
+
+static bool left_to_right(const MScreenLayout::Output &a,
+                          const MScreenLayout::Output &b)
+{
+    return a.geometry.x() < b.geometry.x()
+        || (a.geometry.x() == b.geometry.x()
+            && a.geometry.y() < b.geometry.y());
+}
+
+MScreenLayout::MScreenLayout(QObject *parent)
+    : QObject(parent), rr_event_base(0)
+{
+    Display *dpy = QX11Info::display();
+    int major, minor, error_base;
+
+    refresh_timer.setSingleShot(true);
+    connect(&refresh_timer, SIGNAL(timeout()), SLOT(refresh()));
+
+    // Check RandR, who knows what kind of X server we ride.
+    if (XRRQueryExtension(dpy, &rr_event_base, &error_base)
+        && XRRQueryVersion(dpy, &major, &minor)
+        && (major > 1 || (major == 1 && minor >= 2)))
+        XRRSelectInput(dpy, QX11Info::appRootWindow(),
+                       RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask
+                       | RROutputChangeNotifyMask);
+    else
+        rr_event_base = 0;
+    refresh();
+}
+
+bool MScreenLayout::x11Event(XEvent *event)
+{
+    if (!rr_event_base)
+        return false;
+    if (event->type == rr_event_base + RRScreenChangeNotify) {
+        // updates the screen size Xlib knows about
+        XRRUpdateConfiguration(event);
+        refresh_timer.start();
+        return true;
+    } else if (event->type == rr_event_base + RRNotify) {
+        refresh_timer.start();
+        return true;
+    }
+    return false;
+}
+
+// Fills @output_list from RandR, returns false if it's not available.
+bool MScreenLayout::queryOutputs()
+{
+    Display *dpy = QX11Info::display();
+    XRRScreenResources *scres;
+
+    if (!rr_event_base
+        || !(scres = XRRGetScreenResources(dpy, QX11Info::appRootWindow())))
+        return false;
+    for (int i = 0; i < scres->noutput; ++i) {
+        XRROutputInfo *oinfo;
+        XRRCrtcInfo *cinfo;
+
+        if (!(oinfo = XRRGetOutputInfo(dpy, scres, scres->outputs[i])))
+            continue;
+        if (oinfo->connection == RR_Connected && oinfo->crtc
+            && (cinfo = XRRGetCrtcInfo(dpy, scres, oinfo->crtc)) != 0) {
+            if (cinfo->mode && cinfo->width && cinfo->height) {
+                Output o;
+                o.id = scres->outputs[i];
+                o.crtc = oinfo->crtc;
+                o.name = QByteArray(oinfo->name, oinfo->nameLen);
+                o.geometry = QRect(cinfo->x, cinfo->y,
+                                   cinfo->width, cinfo->height);
+                o.panel = output_atom(dpy, o.id, ATOM(RROUTPUT_CTYPE))
+                          == ATOM(RROUTPUT_PANEL);
+                o.alpha_mode = o.panel && has_output_integer(dpy, o.id,
+                                                ATOM(RROUTPUT_ALPHA_MODE));
+                output_list.append(o);
+            }
+            XRRFreeCrtcInfo(cinfo);
+        }
+        XRRFreeOutputInfo(oinfo);
+    }
+    XRRFreeScreenResources(scres);
+    qSort(output_list.begin(), output_list.end(), left_to_right);
+    return !output_list.isEmpty();
+}
+
+void MScreenLayout::refresh()
+{
+    Display *dpy = QX11Info::display();
+    QRect old_screen = screen_rect;
+    QList<Output> old_outputs = output_list;
+
+    screen_rect = QRect(0, 0,
+                        ScreenOfDisplay(dpy, DefaultScreen(dpy))->width,
+                        ScreenOfDisplay(dpy, DefaultScreen(dpy))->height);
+    output_list.clear();
+    if (!queryOutputs()) {
+        Output o;
+        o.id = None;
+        o.crtc = None;
+        o.geometry = screen_rect;
+        o.panel = o.alpha_mode = false;
+        output_list.append(o);
+    }
+
+    bool outputs_changed = old_outputs.size() != output_list.size();
+    for (int i = 0; !outputs_changed && i < output_list.size(); ++i)
+        outputs_changed = old_outputs[i].id != output_list[i].id
+            || old_outputs[i].geometry != output_list[i].geometry;
+    if (old_screen.isValid() && (outputs_changed || old_screen != screen_rect))
+        emit changed();
+}
+
+const MScreenLayout::Output *MScreenLayout::alphaPanel() const
+{
+    for (int i = 0; i < output_list.size(); ++i)
+        if (output_list[i].alpha_mode)
+            return &output_list[i];
+    return 0;
+}
+
+const MScreenLayout::Output &MScreenLayout::outputAt(const QRect &r) const
+{
+    int best = 0, best_area = 0;
+    for (int i = 0; i < output_list.size(); ++i) {
+        QRect common = output_list[i].geometry & r;
+        int area = common.width() * common.height();
+        if (area > best_area) {
+            best = i;
+            best_area = area;
+        }
+    }
+    return output_list[best];
+}
+
+bool MScreenLayout::coversOutput(const QRegion &region) const
+{
+    foreach (const Output &o, output_list)
+        if (QRegion(o.geometry).subtracted(region).isEmpty())
+            return true;
+    return false;
+}
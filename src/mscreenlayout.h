@@ -0,0 +1,104 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef MSCREENLAYOUT_H
+#define MSCREENLAYOUT_H
+
+#include <QObject>
+#include <QList>
+#include <QRect>
+#include <QRegion>
+#include <QTimer>
+#include <X11/Xlib.h>
+#include <X11/extensions/Xrandr.h>
+
+/*!
+ * Internal class keeping track of the RandR outputs showing the screen
+ * and where they show it.  Without RandR 1.2 the screen is assumed to be
+ * shown by a single output.
+ */
+class MScreenLayout: public QObject
+{
+    Q_OBJECT
+public:
+    struct Output {
+        //! None if RandR is not available.
+        RROutput id;
+        RRCrtc crtc;
+        QByteArray name;
+        //! The part of the screen the output shows.
+        QRect geometry;
+        //! Whether it's the built-in display, and whether it can blend
+        //! the graphics and video planes with alpha.
+        bool panel, alpha_mode;
+    };
+
+    MScreenLayout(QObject *parent = 0);
+
+    /*!
+     * Handles the RandR notifications, returns whether \a event was one.
+     */
+    bool x11Event(XEvent *event);
+
+    //! The size of the root window.
+    const QRect &screen() const { return screen_rect; }
+
+    /*!
+     * Returns the enabled outputs from left to right.  There is always
+     * at least one.
+     */
+    const QList<Output> &outputs() const { return output_list; }
+
+    /*!
+     * Returns the panel if it supports alpha blending, otherwise NULL.
+     */
+    const Output *alphaPanel() const;
+
+    /*!
+     * Returns the output \a r is mostly on, or the first output if it
+     * isn't on any.
+     */
+    const Output &outputAt(const QRect &r) const;
+
+    /*!
+     * Returns whether \a region covers an output completely.
+     */
+    bool coversOutput(const QRegion &region) const;
+
+signals:
+    /*!
+     * Emitted when the screen is resized or the outputs change.
+     */
+    void changed();
+
+private slots:
+    void refresh();
+
+private:
+    bool queryOutputs();
+
+    // RandR event base, or 0 if RandR 1.2 is not available.
+    int rr_event_base;
+    QRect screen_rect;
+    QList<Output> output_list;
+    // A mode change comes with a burst of notifications.
+    QTimer refresh_timer;
+};
+
+#endif
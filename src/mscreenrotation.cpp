@@ -0,0 +1,180 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifdef DESKTOP_VERSION
+#define GL_GLEXT_PROTOTYPES 1
+#endif
+#include <QGLWidget>
+#include <QTransform>
+#include <QEasingCurve>
+#include "mscreenrotation.h"
+#include "mtexturepixmapitem_p.h"
+#include "mresourceaccountant.h"
+
+#include <math.h>
+#include <time.h>
+
+// Returns CLOCK_MONOTONIC in microseconds.
+static quint64 now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (quint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+MScreenRotation::MScreenRotation(const QRect &output, int degrees,
+                                 Window window, const QSize &size)
+    : output_rect(output), delta(degrees), win(window),
+      win_rect(QPoint(0, 0), size), texture(0),
+      start(0), fade_start(0), frame_time(0), progress(0)
+{
+    frame_timer.setSingleShot(true);
+    frame_timer.setInterval(0);
+    connect(&frame_timer, SIGNAL(timeout()), SLOT(requestFrame()));
+    ready_timer.setSingleShot(true);
+    connect(&ready_timer, SIGNAL(timeout()), SLOT(requestFrame()));
+}
+
+MScreenRotation::~MScreenRotation()
+{
+    if (!texture)
+        return;
+    glDeleteTextures(1, &texture);
+    MResourceAccountant::instance()->charge("MScreenRotation",
+            MResourceAccountant::Texture,
+            -(qint64)output_rect.width() * output_rect.height() * 4);
+}
+
+void MScreenRotation::windowDamaged(const QRect &r)
+{
+    // damage before the snapshot is of the old layout
+    if (!start || fade_start)
+        return;
+    redrawn += r;
+    if (progress >= 1.0 && QRegion(win_rect).subtracted(redrawn).isEmpty())
+        // it was waited for
+        frame_timer.start();
+}
+
+void MScreenRotation::beginFrame()
+{
+    frame_time = now();
+    if (!start)
+        return;
+    progress = qMin((frame_time - start) / (Duration * 1000.0), 1.0);
+    if (fade_start || progress < 1.0)
+        return;
+
+    // the snapshot is in the new orientation, is the window ready too?
+    quint64 waited = frame_time - start - Duration * 1000;
+    if (QRegion(win_rect).subtracted(redrawn).isEmpty()
+        || waited >= (quint64)ReadyTimeout * 1000)
+        fade_start = frame_time;
+    else if (!ready_timer.isActive())
+        ready_timer.start(ReadyTimeout - waited / 1000);
+}
+
+QRegion MScreenRotation::hiddenRegion() const
+{
+    return start && !fade_start ? QRegion(output_rect) : QRegion();
+}
+
+bool MScreenRotation::drawFrame()
+{
+    if (!MTexturePixmapPrivate::glresource)
+        return false;
+    if (!start) {
+        takeSnapshot();
+        if (!texture)
+            return false;
+        // this frame looks the same as the snapshot would
+        start = frame_time;
+        frame_timer.start();
+        return true;
+    }
+
+    qreal opacity = 1.0;
+    if (fade_start) {
+        opacity -= (frame_time - fade_start) / (FadeDuration * 1000.0);
+        if (opacity <= 0)
+            return false;
+    } else {
+        // the windows weren't drawn under the snapshot, but those
+        // on the other outputs may have reached into it
+        int fb_height = MTexturePixmapPrivate::glwidget->height();
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(output_rect.x(), fb_height - output_rect.bottom() - 1,
+                  output_rect.width(), output_rect.height());
+        glClearColor(0, 0, 0, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDisable(GL_SCISSOR_TEST);
+    }
+
+    static const QEasingCurve curve(QEasingCurve::InOutCubic);
+    drawSnapshot(curve.valueForProgress(progress) * delta, opacity);
+    // until the window is waited for, its damage asks for the frames
+    if (progress < 1.0 || fade_start)
+        frame_timer.start();
+    return true;
+}
+
+void MScreenRotation::requestFrame()
+{
+    MTexturePixmapPrivate::glwidget->update();
+}
+
+// Copies the output from the frame just drawn into @texture.
+void MScreenRotation::takeSnapshot()
+{
+    // GL's origin is in the bottom left corner, so the texture is
+    // bottom-up, the way MTexturePixmapPrivate::queueQuad() can flip it
+    int fb_height = MTexturePixmapPrivate::glwidget->height();
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // no alpha, the framebuffer may not have it
+    glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, output_rect.x(),
+                     fb_height - output_rect.bottom() - 1,
+                     output_rect.width(), output_rect.height(), 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    MResourceAccountant::instance()->charge("MScreenRotation",
+            MResourceAccountant::Texture,
+            (qint64)output_rect.width() * output_rect.height() * 4);
+}
+
+// Queues the snapshot turned by @angle degrees around the center of the
+// output and scaled down to fit in it.
+void MScreenRotation::drawSnapshot(qreal angle, qreal opacity)
+{
+    qreal w = output_rect.width(), h = output_rect.height();
+    qreal c = qAbs(cos(angle * M_PI / 180)), s = qAbs(sin(angle * M_PI / 180));
+    qreal scale = qMin(w / (w * c + h * s), h / (w * s + h * c));
+
+    QPointF center = QRectF(output_rect).center();
+    QTransform t;
+    t.translate(center.x(), center.y());
+    t.rotate(angle);
+    t.scale(scale, scale);
+    t.translate(-center.x(), -center.y());
+    MTexturePixmapPrivate::queueQuad(texture, QRectF(0, 0, 1, 1), true, t,
+                                     output_rect, opacity, opacity < 1.0);
+}
@@ -0,0 +1,119 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef MSCREENROTATION_H
+#define MSCREENROTATION_H
+
+#include <QObject>
+#include <QRect>
+#include <QRegion>
+#include <QTimer>
+#include <X11/Xlib.h>
+#ifdef GLES2_VERSION
+#include <GLES2/gl2.h>
+#elif DESKTOP_VERSION
+#include <GL/gl.h>
+#endif
+
+/*!
+ * Internal class animating the change of the orientation of an output
+ * on the GPU, so that the applications can relayout behind it at their
+ * own pace rather than animating the rotation themselves.
+ *
+ * The first frame drawn after the rotation is started is copied into a
+ * texture, which is then turned to the new orientation over the output
+ * while the windows on it are not drawn.  When the window being rotated
+ * has redrawn itself completely, or it's given up on, the snapshot is
+ * faded out over the live windows.
+ */
+class MScreenRotation: public QObject
+{
+    Q_OBJECT
+public:
+    //! Length of the rotation, in milliseconds.
+    static const int Duration = 400;
+    //! Length of the fade to the relayouted windows.
+    static const int FadeDuration = 150;
+    //! How long to wait for the window after the rotation has finished.
+    static const int ReadyTimeout = 1000;
+
+    /*!
+     * Prepares to rotate the contents of \a output by \a degrees
+     * clockwise and to wait for the relayout of \a window of \a size.
+     */
+    MScreenRotation(const QRect &output, int degrees,
+                    Window window, const QSize &size);
+    ~MScreenRotation();
+
+    const QRect &output() const { return output_rect; }
+    int degrees() const { return delta; }
+    Window window() const { return win; }
+
+    /*!
+     * Notes that \a r of the window, in its own coordinates, has been
+     * redrawn.
+     */
+    void windowDamaged(const QRect &r);
+
+    /*!
+     * Advances the transition to the frame about to be drawn.
+     */
+    void beginFrame();
+
+    /*!
+     * Returns the part of the screen where the windows are covered by
+     * the snapshot in the current frame.
+     */
+    QRegion hiddenRegion() const;
+
+    /*!
+     * Called after the windows of the frame are drawn.  The first time
+     * it takes the snapshot, afterwards it draws it.  Returns false if
+     * the transition is over.
+     */
+    bool drawFrame();
+
+private slots:
+    void requestFrame();
+
+private:
+    void takeSnapshot();
+    void drawSnapshot(qreal angle, qreal opacity);
+
+    QRect output_rect;
+    int delta;
+    Window win;
+    // The window's rectangle in its own coordinates and what of it has
+    // been redrawn since the start.
+    QRect win_rect;
+    QRegion redrawn;
+
+    GLuint texture;
+    // When the snapshot was taken, when the fade started, and the time
+    // of the current frame, all in microseconds.
+    quint64 start, fade_start, frame_time;
+    // The progress of the rotation in the current frame, from 0 to 1.
+    qreal progress;
+
+    // The transition is driven by the frames: each one asks for the
+    // next until it's over.
+    QTimer frame_timer, ready_timer;
+};
+
+#endif
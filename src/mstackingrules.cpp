@@ -0,0 +1,229 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "mstackingrules.h"
+
+#include <QtAlgorithms>
+#include <QtDebug>
+#include <X11/Xutil.h>
+
+// Enable to see the decisions of lessThan().
+#if 0
+# define SORTING(isLess)                            \
+    do {                                            \
+        qDebug("0x%lx %s 0x%lx",                    \
+               w_a, isLess ? "<" : "\\<", w_b);     \
+        return isLess;                              \
+    } while (0)
+#else
+# define SORTING(isLess)                            return isLess
+#endif
+
+// Determine whether a decorator should be ordered above or below @w.
+//
+// Unused decorators should be below anything else.
+// The decorated window should be below the decorator.
+// Otherwise the decorator should be ordered exactly like its managed window.
+bool MStackingRules::compareDecorator(Window w) const
+{
+    Window man;
+
+    if (!(man = source->decoratedWindow()))
+        // the decorator is unused
+        return true;
+    if (man == w)
+        // @w is the decorator's managed window, keep them together
+        return false;
+    if (lessThan(man, w))
+        return true;
+    if (lessThan(w, man))
+        return false;
+    if (stack->indexOf(man) < stack->indexOf(w))
+        return true;
+    else
+        return false;
+}
+
+// Returns whether @w in @layer of @type is special with regards to stacking.
+// Returns None for non-special cases, or NOTIFICATION, INPUT or DIALOG.
+// The returned Atom doesn't mean that @w has that window type; it merely
+// indicates that it should be stacked like that.
+Atom MStackingRules::isSpecial(Window w, int layer, Atom type) const
+{
+    if (layer < 6 && type == atoms.notification)
+        /* @w is maybe a notification */;
+    else if (layer < 5 &&
+        (type == atoms.input ||
+         source->isOverrideRedirect(w) ||
+         source->hasNetWmState(w, atoms.state_above)))
+        // @w is maybe input or keep-above window
+        type = atoms.input;
+    else if (layer == 0 &&
+             source->hasNetWmState(w, atoms.state_modal) &&
+             type == atoms.dialog)
+        /* @w is maybe a system-modal dialog */;
+    else
+        // Nothing special.
+        return None;
+
+    // @w deserves special handling only if it doesn't have
+    // a lastVisibleParent().
+    return source->lastVisibleParent(w) ? None : type;
+}
+
+// The desired rough order of the stacking list roughly is:
+//
+// unused decorator (lowest), iconified/withdrawn windows possibly with
+// decorator on top, desktop, normal state windows with transients/decorator
+// on top, system-modal dialogs, input-type windows, notifications,
+// windows with stacking layers (highest).
+//
+// Returning false tells the sorting function that the sorting of @w_a
+// is either greater than or equal to @w_b's.  In other words, @w_a needn't
+// be below @w_b, but it could be, unless lessThan(@w_b, @w_a) tells
+// explicitly otherwise (ie. that @w_a needs to be higher than @w_b).
+//
+// TODO: before this can replace checkStacking(), we need to handle at least
+// the decorator, possibly also window groups and dock windows.
+bool MStackingRules::lessThan(Window w_a, Window w_b) const
+{
+    int layer;
+    Atom type_a, type_b;
+
+    // qSort() should know better, but if it doesn't, tell it that
+    // no item is less than itself.
+    Q_ASSERT(w_a != w_b);
+    if (w_a == w_b)
+        SORTING(false);
+
+    // If we don't know about either of the windows let them in peace
+    // -- don't reason about what we don't know.
+    if (!source->isKnown(w_a) || !source->isKnown(w_b))
+        SORTING(false);
+
+    // Mind decorators.  Lone decorators should go below everything else,
+    // otherwise it's sorted above its managed window.
+    if (source->isDecorator(w_a))
+        // @w_a is a lone decorator or @w_b happens to be
+        // its managed window.
+        SORTING( compareDecorator(w_b));
+    else if (source->isDecorator(w_b))
+        // Likewise.
+        SORTING(!compareDecorator(w_a));
+
+    // Iconic/withdrawn/unmanaged windows...
+    if (source->windowState(w_a) != NormalState) {
+        if (source->windowState(w_b) == NormalState)
+            // ...go below NormalState windows ...
+            SORTING(true);
+        else
+            // ... otherwise we don't care.
+            SORTING(false);
+    } else if (source->windowState(w_b) != NormalState)
+        // @w_a is NormalState, @w_b is not.
+        SORTING(false);
+
+    // Both @w_a and @w_b are in NormalState.
+    // Sort the desktop below all NormalState windows.
+    // (Quiz: why do we check @w_b before @w_a?
+    //  Answer: to be consistent even if both windows are desktops.)
+    type_b = source->windowTypeAtom(w_b);
+    if (type_b == atoms.desktop)
+        SORTING(false);
+    type_a = source->windowTypeAtom(w_a);
+    if (type_a == atoms.desktop)
+        SORTING(true);
+
+    // Compare by stacking layers.
+    layer = source->meegoStackingLayer(w_a);
+    int rel = layer - (int)source->meegoStackingLayer(w_b);
+    if (rel < 0)
+        // @w_a has lower stacking layer
+        SORTING(true);
+    else if (rel > 0)
+        // @w_a has greater stacking layer
+        SORTING(false);
+    // They're in the same layer.
+
+    // Order notifications, input windows and system-modal dialogs.
+    // We can skip it altogether if the windows' layer is too high,
+    // because for them isSpecial() will always be false.
+    if (layer < 6) {
+        type_a = isSpecial(w_a, layer, type_a);
+        type_b = isSpecial(w_b, layer, type_b);
+        // type_a, type_b == None || dialog || input || notification
+
+        // Skip to the next test if the windows are equally special
+        // or non-special.
+        if (type_a != type_b) {
+            if (type_b == atoms.notification)
+                // type_a == None || dialog || input
+                SORTING(true);
+            if (type_a == atoms.notification)
+                // type_b == None || dialog || input
+                SORTING(false);
+            if (type_b == atoms.input)
+                // type_a == None || dialog
+                SORTING(true);
+            if (type_a == atoms.input)
+                // type_b == None || dialog
+                SORTING(false);
+            if (type_b == atoms.dialog)
+                // type_a == None
+                SORTING(true);
+            if (type_a == atoms.dialog)
+                // type_b == None
+                SORTING(false);
+        }
+    }
+
+    // Order transient windows below what they are transient for.
+    // Since the sorting algorithm can infer that if trfor(@a) == @b
+    // and trfor(@b) == @c then @a is transient for @c it is not
+    // necessary for us to check if @w_a is a grandparent of @w_b
+    // or vice versa.  However, we *do* have to mind circular
+    // transiency between @w_a and @w_b otherwise we would
+    // return true for both lessThan(@w_a, @w_b) and
+    // lessThan(@w_b, @w_a), which would make the sorting
+    // undeterministic.
+    if (source->transientFor(w_b) == w_a && source->transientFor(w_a) != w_b)
+      // @w_b is transient for @w_a, so it must be above it.
+      SORTING(true);
+
+    // Either @w_a is transient for @w_b or they are transient
+    // for each other, or they are not in direct relationship,
+    // or they are not in any relationship at all.
+    SORTING(false);
+}
+
+// qStableSort() wants a copiable comparator.
+struct StackingLessThan
+{
+    StackingLessThan(const MStackingRules *rules) : rules(rules) {}
+    bool operator()(Window a, Window b) const
+        { return rules->lessThan(a, b); }
+    const MStackingRules *rules;
+};
+
+void MStackingRules::sort(QList<Window> &list) const
+{
+    // Use a stable sorting algorithm to ensure sort() is invariant,
+    // ie. that it keeps the order unless it is necessary to change.
+    qStableSort(list.begin(), list.end(), StackingLessThan(this));
+}
@@ -0,0 +1,87 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef MSTACKINGRULES_H
+#define MSTACKINGRULES_H
+
+#include <QList>
+#include <X11/Xlib.h>
+
+/*!
+ * The rules roughSort() orders the stacking list by.  They only depend on
+ * the properties of the windows provided by a Source, so they can be run
+ * without an X server, eg. to replay recorded stacking traces.
+ */
+class MStackingRules
+{
+public:
+    /*!
+     * Provides what the rules need to know about the windows.
+     */
+    class Source
+    {
+    public:
+        virtual ~Source() {}
+        //! Whether anything is known about @w.
+        virtual bool isKnown(Window w) const = 0;
+        virtual bool isDecorator(Window w) const = 0;
+        virtual bool isOverrideRedirect(Window w) const = 0;
+        virtual int windowState(Window w) const = 0;
+        virtual Atom windowTypeAtom(Window w) const = 0;
+        virtual unsigned meegoStackingLayer(Window w) const = 0;
+        virtual bool hasNetWmState(Window w, Atom state) const = 0;
+        virtual Window transientFor(Window w) const = 0;
+        virtual Window lastVisibleParent(Window w) const = 0;
+        //! The window the decorator decorates, or 0 if it's unused.
+        virtual Window decoratedWindow() const = 0;
+    };
+
+    //! The atoms the rules refer to.
+    struct Atoms {
+        Atom desktop, notification, input, dialog;
+        Atom state_above, state_modal;
+    };
+
+    /*!
+     * Creates the rules to sort windows described by @source.
+     * @stack is the current stacking order, which decides when the
+     * rules have no opinion.
+     */
+    MStackingRules(const Source *source, const Atoms &atoms,
+                   const QList<Window> *stack)
+        : source(source), atoms(atoms), stack(stack) {}
+
+    /*!
+     * Returns true if @w_a should definitely be below @w_b.
+     */
+    bool lessThan(Window w_a, Window w_b) const;
+
+    //! Sorts @list stably.
+    void sort(QList<Window> &list) const;
+
+private:
+    bool compareDecorator(Window w) const;
+    Atom isSpecial(Window w, int layer, Atom type) const;
+
+    const Source *source;
+    Atoms atoms;
+    const QList<Window> *stack;
+};
+
+#endif // MSTACKINGRULES_H
@@ -0,0 +1,113 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "mstackingtrace.h"
+
+static QList<quint32> window_ids(const QList<Window> &windows)
+{
+    QList<quint32> ids;
+    for (int i = 0; i < windows.size(); ++i)
+        ids.append(windows[i]);
+    return ids;
+}
+
+MStackingTrace::MStackingTrace(const MStackingRules::Atoms &atoms)
+    : atoms(atoms)
+{
+}
+
+MStackingTrace *MStackingTrace::create(const QString &fname,
+                                       const MStackingRules::Atoms &atoms)
+{
+    MStackingTrace *trace = new MStackingTrace(atoms);
+    trace->file.setFileName(fname);
+    if (!trace->file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning("MStackingTrace: %s: %s", fname.toLocal8Bit().constData(),
+                 trace->file.errorString().toLocal8Bit().constData());
+        delete trace;
+        return 0;
+    }
+
+    QDataStream &out = trace->out;
+    out.setDevice(&trace->file);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << (quint32)Magic << (quint32)Version;
+    out << (quint32)atoms.desktop << (quint32)atoms.notification
+        << (quint32)atoms.input << (quint32)atoms.dialog
+        << (quint32)atoms.state_above << (quint32)atoms.state_modal;
+    return trace;
+}
+
+MStackingTrace::~MStackingTrace()
+{
+    file.close();
+}
+
+void MStackingTrace::beginEvent(int type, Window window,
+                                unsigned long serial, unsigned long detail)
+{
+    out << (quint8)Event << (quint8)type << (quint32)window
+        << (quint32)serial << (quint32)detail;
+}
+
+void MStackingTrace::endEvent(unsigned usecs, const QList<Window> &stack)
+{
+    out << (quint8)EventDone << (quint32)usecs;
+    if (stack != last_stack) {
+        out << window_ids(stack);
+        last_stack = stack;
+    } else
+        out << QList<quint32>();
+}
+
+void MStackingTrace::sorted(const MStackingRules::Source *source,
+                            const QList<Window> &input,
+                            const QList<Window> &output)
+{
+    // Record what changed about the windows since the last time.
+    for (int i = 0; i < input.size(); ++i) {
+        Window w = input[i];
+        WindowState s;
+        if (source->isKnown(w)) {
+            s.flags = WindowState::Known;
+            if (source->isDecorator(w))
+                s.flags |= WindowState::Decorator;
+            if (source->isOverrideRedirect(w))
+                s.flags |= WindowState::OverrideRedirect;
+            if (source->hasNetWmState(w, atoms.state_above))
+                s.flags |= WindowState::StateAbove;
+            if (source->hasNetWmState(w, atoms.state_modal))
+                s.flags |= WindowState::StateModal;
+            s.wm_state = source->windowState(w);
+            s.type = source->windowTypeAtom(w);
+            s.layer = source->meegoStackingLayer(w);
+            s.transient_for = source->transientFor(w);
+            s.last_visible_parent = source->lastVisibleParent(w);
+        }
+
+        QHash<Window, WindowState>::iterator it = states.find(w);
+        if (it == states.end() || *it != s) {
+            states.insert(w, s);
+            out << (quint8)Snapshot << (quint32)w << s;
+        }
+    }
+
+    out << (quint8)Sort << (quint32)source->decoratedWindow()
+        << window_ids(input) << window_ids(output);
+}
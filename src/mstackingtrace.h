@@ -0,0 +1,117 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef MSTACKINGTRACE_H
+#define MSTACKINGTRACE_H
+
+#include <QFile>
+#include <QDataStream>
+#include <QHash>
+#include <QList>
+#include "mstackingrules.h"
+
+/*!
+ * Records the X events the compositor processes, what the stacking rules
+ * knew about the windows and how they sorted the stacking list, into a
+ * binary trace which can be replayed without an X server.
+ *
+ * The trace is a QDataStream of a header
+ *
+ *   quint32 Magic, quint32 Version, the MStackingRules::Atoms,
+ *
+ * followed by records starting with their quint8 Record type:
+ *
+ *   Event      quint8 X event type, quint32 window, quint32 serial,
+ *              quint32 detail (atom of PropertyNotify, message type of
+ *              ClientMessage)
+ *   EventDone  quint32 microseconds the event took to process,
+ *              QList<quint32> stacking list if it changed or empty
+ *   Snapshot   quint32 window, WindowState, when it changed
+ *   Sort       quint32 decorated window, QList<quint32> input and output
+ *
+ * Sorts outside Event and EventDone happened on a timer.
+ */
+class MStackingTrace
+{
+public:
+    enum { Magic = 0x4d535431, Version = 1 };
+    enum Record { Event = 1, EventDone, Snapshot, Sort };
+
+    //! What the stacking rules knew about a window.
+    struct WindowState {
+        enum Flags {
+            Known = 1, Decorator = 2, OverrideRedirect = 4,
+            StateAbove = 8, StateModal = 16
+        };
+        WindowState()
+            : flags(0), wm_state(0), type(0), layer(0),
+              transient_for(0), last_visible_parent(0) {}
+        bool operator==(const WindowState &o) const {
+            return flags == o.flags && wm_state == o.wm_state
+                && type == o.type && layer == o.layer
+                && transient_for == o.transient_for
+                && last_visible_parent == o.last_visible_parent;
+        }
+        bool operator!=(const WindowState &o) const { return !(*this == o); }
+
+        quint8 flags;
+        qint32 wm_state;
+        quint32 type, layer, transient_for, last_visible_parent;
+    };
+
+    /*!
+     * Starts writing a trace into @fname.  Returns NULL if it cannot
+     * be opened.
+     */
+    static MStackingTrace *create(const QString &fname,
+                                  const MStackingRules::Atoms &atoms);
+    ~MStackingTrace();
+
+    void beginEvent(int type, Window window, unsigned long serial,
+                    unsigned long detail);
+    void endEvent(unsigned usecs, const QList<Window> &stack);
+    void sorted(const MStackingRules::Source *source,
+                const QList<Window> &input, const QList<Window> &output);
+
+private:
+    MStackingTrace(const MStackingRules::Atoms &atoms);
+
+    QFile file;
+    QDataStream out;
+    MStackingRules::Atoms atoms;
+    // What has been recorded about the windows so far.
+    QHash<Window, WindowState> states;
+    QList<Window> last_stack;
+};
+
+inline QDataStream &operator<<(QDataStream &out,
+                               const MStackingTrace::WindowState &s)
+{
+    return out << s.flags << s.wm_state << s.type << s.layer
+               << s.transient_for << s.last_visible_parent;
+}
+
+inline QDataStream &operator>>(QDataStream &in,
+                               MStackingTrace::WindowState &s)
+{
+    return in >> s.flags >> s.wm_state >> s.type >> s.layer
+              >> s.transient_for >> s.last_visible_parent;
+}
+
+#endif // MSTACKINGTRACE_H
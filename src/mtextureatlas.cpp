@@ -0,0 +1,192 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include <QApplication>
+#include <QStringList>
+#include <QByteArray>
+#include "mtextureatlas.h"
+
+// Transparent border around each area, so that bilinear filtering at the
+// edges of a window doesn't pick up its neighbours.
+#define PADDING 1
+
+MTextureAtlas *MTextureAtlas::atlas = 0;
+
+MTextureAtlas *MTextureAtlas::instance()
+{
+    static bool enabled = qApp->arguments().contains("-atlas");
+    if (enabled && !atlas)
+        atlas = new MTextureAtlas();
+    return atlas;
+}
+
+bool MTextureAtlas::fits(const QSize &size)
+{
+    return size.width() > 0 && size.height() > 0
+        && size.width() <= MaxItemSize && size.height() <= MaxItemSize;
+}
+
+MTextureAtlas::MTextureAtlas()
+{
+}
+
+GLuint MTextureAtlas::newPage()
+{
+    GLuint texture;
+    // start with transparent pixels because the padding is not cleared
+    // when an area is first allocated
+    QByteArray zeros(PageSize * PageSize * 4, 0);
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, PageSize, PageSize, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, zeros.constData());
+    return texture;
+}
+
+// Tries to find room for @size on @page: in a hole left by a released
+// area first, then at the end of a shelf of similar height, finally on
+// a new shelf.
+bool MTextureAtlas::allocateOnPage(Page &page, const QSize &size, QRect *area)
+{
+    int w = size.width() + 2 * PADDING;
+    int h = size.height() + 2 * PADDING;
+
+    for (int i = 0; i < page.shelves.size(); ++i) {
+        Shelf &s = page.shelves[i];
+        if (s.height < h)
+            continue;
+        for (int j = 0; j < s.holes.size(); ++j) {
+            QRect &hole = s.holes[j];
+            if (hole.width() < w)
+                continue;
+            *area = QRect(hole.x() + PADDING, s.y + PADDING,
+                          size.width(), size.height());
+            if (hole.width() > w)
+                hole.setLeft(hole.x() + w);
+            else
+                s.holes.removeAt(j);
+            return true;
+        }
+    }
+
+    for (int i = 0; i < page.shelves.size(); ++i) {
+        Shelf &s = page.shelves[i];
+        // don't waste more than half of the shelf's height
+        if (s.height < h || s.height > 2 * h || PageSize - s.x < w)
+            continue;
+        *area = QRect(s.x + PADDING, s.y + PADDING,
+                      size.width(), size.height());
+        s.x += w;
+        return true;
+    }
+
+    int y = page.shelves.isEmpty() ? 0
+        : page.shelves.last().y + page.shelves.last().height;
+    if (PageSize - y < h)
+        return false;
+    Shelf s;
+    s.y = y;
+    s.height = h;
+    s.x = w;
+    page.shelves.append(s);
+    *area = QRect(PADDING, y + PADDING, size.width(), size.height());
+    return true;
+}
+
+GLuint MTextureAtlas::allocate(const QSize &size, QRect *area)
+{
+    if (!fits(size))
+        return 0;
+
+    int i;
+    for (i = 0; i < pages.size(); ++i)
+        if (allocateOnPage(pages[i], size, area))
+            break;
+    if (i == pages.size()) {
+        Page page;
+        page.texture = newPage();
+        page.allocated = 0;
+        pages.append(page);
+        if (!allocateOnPage(pages[i], size, area))
+            return 0;
+    }
+    Page &page = pages[i];
+    ++page.allocated;
+
+    // clear the padding, previous users of the area may have left
+    // something there
+    QRect padded = area->adjusted(-PADDING, -PADDING, PADDING, PADDING);
+    QByteArray zeros(padded.width() * padded.height() * 4, 0);
+    glBindTexture(GL_TEXTURE_2D, page.texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, padded.x(), padded.y(),
+                    padded.width(), padded.height(),
+                    GL_RGBA, GL_UNSIGNED_BYTE, zeros.constData());
+    return page.texture;
+}
+
+void MTextureAtlas::release(GLuint texture, const QRect &area)
+{
+    int i;
+    for (i = 0; i < pages.size(); ++i)
+        if (pages[i].texture == texture)
+            break;
+    if (i == pages.size())
+        return;
+
+    Page &page = pages[i];
+    if (--page.allocated <= 0) {
+        if (pages.size() > 1) {
+            // keep one page around for the next small window
+            glDeleteTextures(1, &page.texture);
+            pages.removeAt(i);
+        } else
+            page.shelves.clear();
+        return;
+    }
+
+    for (int j = 0; j < page.shelves.size(); ++j) {
+        Shelf &s = page.shelves[j];
+        if (area.y() < s.y || area.y() >= s.y + s.height)
+            continue;
+
+        // Add the area to the holes of the shelf, merging neighbours and
+        // giving it back to the unused part if it was the last one.
+        QRect hole(area.x() - PADDING, s.y,
+                   area.width() + 2 * PADDING, s.height);
+        for (int k = 0; k < s.holes.size(); ) {
+            const QRect &other = s.holes.at(k);
+            if (other.right() + 1 == hole.left()
+                || hole.right() + 1 == other.left()) {
+                hole |= other;
+                s.holes.removeAt(k);
+            } else
+                ++k;
+        }
+        if (hole.right() + 1 == s.x)
+            s.x = hole.left();
+        else
+            s.holes.append(hole);
+        break;
+    }
+}
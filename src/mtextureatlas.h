@@ -0,0 +1,85 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef MTEXTUREATLAS_H
+#define MTEXTUREATLAS_H
+
+#include <QList>
+#include <QRect>
+#include <GLES2/gl2.h>
+
+/*!
+ * Internal class packing the textures of small windows into shared
+ * pages, so they don't need a texture and an EGLImage of their own and
+ * can be drawn in batches.  Only used if mcompositor is started with
+ * the -atlas option.
+ */
+class MTextureAtlas
+{
+public:
+    //! Size of the square pages in pixels.
+    static const int PageSize = 1024;
+    //! Windows larger than this in either dimension are not packed.
+    static const int MaxItemSize = 256;
+
+    /*!
+     * Returns the atlas or 0 if the atlas mode is not enabled.
+     */
+    static MTextureAtlas *instance();
+
+    /*!
+     * Returns whether a window of \a size would be packed.
+     */
+    static bool fits(const QSize &size);
+
+    /*!
+     * Reserves an area of \a size and returns the texture of its page,
+     * or 0 on failure.  The area is returned in \a area.
+     */
+    GLuint allocate(const QSize &size, QRect *area);
+
+    /*!
+     * Gives back an \a area of \a page reserved by allocate().
+     */
+    void release(GLuint page, const QRect &area);
+
+private:
+    // The pages are filled with shelves of rows of areas.
+    struct Shelf {
+        int y, height;
+        // X coordinate of the unused part
+        int x;
+        // previously released areas on this shelf
+        QList<QRect> holes;
+    };
+    struct Page {
+        GLuint texture;
+        int allocated;
+        QList<Shelf> shelves;
+    };
+
+    MTextureAtlas();
+    bool allocateOnPage(Page &page, const QSize &size, QRect *area);
+    GLuint newPage();
+
+    QList<Page> pages;
+    static MTextureAtlas *atlas;
+};
+
+#endif // MTEXTUREATLAS_H
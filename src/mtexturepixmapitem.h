@@ -107,6 +107,7 @@ private:
     void cleanup();
     void rebindPixmap();
     void doTFP();
+    void evictBackingStore();
     void renderTexture(const QTransform& transform);
 
     MTexturePixmapPrivate *const d;
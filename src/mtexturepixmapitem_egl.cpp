@@ -20,6 +20,8 @@
 #include "mtexturepixmapitem.h"
 #include "mtexturepixmapitem_p.h"
 #include "mcompositewindowgroup.h"
+#include "mtextureatlas.h"
+#include "mresourceaccountant.h"
 
 #include <QPainterPath>
 #include <QRect>
@@ -28,9 +30,13 @@
 #include <vector>
 
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
 #include <X11/extensions/Xcomposite.h>
 #include <X11/extensions/Xrender.h>
 #include <X11/extensions/Xfixes.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 
 //#define GL_GLEXT_PROTOTYPES
 
@@ -120,6 +126,184 @@ EGLConfig EglResourceManager::config = 0;
 EGLConfig EglResourceManager::configAlpha = 0;
 EGLDisplay EglResourceManager::dpy = 0;
 
+// Returns whether the window should be kept in the texture atlas
+// rather than in a texture of its own.
+static bool wantsAtlas(MTexturePixmapPrivate *d)
+{
+    return !d->custom_tfp && !d->prev_effect && MTextureAtlas::instance()
+           && MTextureAtlas::fits(d->brect.size().toSize());
+}
+
+// Moves the window out of the atlas into a texture of its own.
+static void useOwnTexture(MTexturePixmapPrivate *d)
+{
+    if (d->atlas_page) {
+        MTextureAtlas::instance()->release(d->atlas_page, d->atlas_area);
+        d->atlas_page = d->textureId = 0;
+    }
+    if (d->textureId)
+        return;
+
+    d->textureId = d->eglresource->texman->getTexture();
+    glBindTexture(GL_TEXTURE_2D, d->textureId);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+// Reserves an area of the atlas for the current size of the window,
+// and gives up its own texture.  Returns false if the atlas is full.
+static bool useAtlas(MTexturePixmapPrivate *d)
+{
+    MTextureAtlas *atlas = MTextureAtlas::instance();
+    QSize size = d->brect.size().toSize();
+    if (d->atlas_page) {
+        if (d->atlas_area.size() == size)
+            return true;
+        atlas->release(d->atlas_page, d->atlas_area);
+        d->atlas_page = d->textureId = 0;
+    }
+
+    GLuint page = atlas->allocate(size, &d->atlas_area);
+    if (!page)
+        return false;
+    if (d->textureId)
+        d->eglresource->texman->closeTexture(d->textureId);
+    d->atlas_page = d->textureId = page;
+    const qreal s = MTextureAtlas::PageSize;
+    d->atlas_rect = QRectF(d->atlas_area.x() / s, d->atlas_area.y() / s,
+                           d->atlas_area.width() / s,
+                           d->atlas_area.height() / s);
+    return true;
+}
+
+// XSetErrorHandler() function, used exclusively to catch errors
+// with XShmAttach().
+static bool xshmattach_error;
+static int xshmattach_error_handler(Display *dpy, XErrorEvent *err)
+{
+    Q_UNUSED(dpy);
+    Q_UNUSED(err);
+    xshmattach_error = true;
+    return 0;
+}
+
+// Returns the shared memory image to read the pixels of windows with or
+// without @alpha into for the atlas, or 0 if XShm can't be used, eg.
+// because the X server is remote.  Both images are in the same segment,
+// which is big enough for the largest window in the atlas and is kept
+// until we exit.
+static XImage *shmImage(bool alpha)
+{
+    static XShmSegmentInfo info;
+    static XImage *images[2];
+    static bool initialized = false;
+
+    if (initialized)
+        return images[alpha];
+    initialized = true;
+
+    Display *dpy = QX11Info::display();
+    const int max = MTextureAtlas::MaxItemSize;
+    if (!XShmQueryExtension(dpy))
+        return 0;
+    info.shmid = shmget(IPC_PRIVATE, max * max * 4, IPC_CREAT | 0600);
+    if (info.shmid < 0)
+        return 0;
+    info.shmaddr = (char *)shmat(info.shmid, 0, 0);
+    info.readOnly = False;
+    if (info.shmaddr == (char *)-1) {
+        shmctl(info.shmid, IPC_RMID, 0);
+        return 0;
+    }
+
+    // The segment is destroyed as soon as both we and X have detached.
+    XSync(dpy, False);
+    int (*xerr)(Display *dpy, XErrorEvent *);
+    xshmattach_error = false;
+    xerr = XSetErrorHandler(xshmattach_error_handler);
+    XShmAttach(dpy, &info);
+    XSync(dpy, False);
+    XSetErrorHandler(xerr);
+    shmctl(info.shmid, IPC_RMID, 0);
+    if (xshmattach_error) {
+        shmdt(info.shmaddr);
+        return 0;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        XImage *img = XShmCreateImage(dpy, DefaultVisual(dpy, 0),
+                                      i ? 32 : 24, ZPixmap, info.shmaddr,
+                                      &info, max, max);
+        if (img && (img->bits_per_pixel != 32
+                    || img->byte_order != LSBFirst)) {
+            // the segment is not the image's to free
+            img->data = 0;
+            XDestroyImage(img);
+            img = 0;
+        }
+        images[i] = img;
+    }
+    return images[alpha];
+}
+
+// Copies @rect of the window pixmap to its area in the atlas.
+// Returns false if it could not be done.
+static bool uploadToAtlas(MTexturePixmapPrivate *d, const QRect &rect)
+{
+    QRect r = rect & QRect(QPoint(0, 0), d->atlas_area.size());
+    if (r.isEmpty())
+        return true;
+
+    // Have X write the pixels right into our shared memory if possible,
+    // otherwise they come through the connection into a new image.
+    Display *dpy = QX11Info::display();
+    const bool has_alpha = d->item->propertyCache()->hasAlpha();
+    XImage *img = shmImage(has_alpha);
+    bool shm = false;
+    if (img) {
+        img->width = r.width();
+        img->height = r.height();
+        img->bytes_per_line = r.width() * 4;
+        shm = XShmGetImage(dpy, d->windowp, img, r.x(), r.y(), AllPlanes);
+    }
+    if (!shm) {
+        img = XGetImage(dpy, d->windowp, r.x(), r.y(), r.width(), r.height(),
+                        AllPlanes, ZPixmap);
+        if (!img)
+            // the window has been unmapped
+            return false;
+        if (img->bits_per_pixel != 32 || img->byte_order != LSBFirst
+            || img->bytes_per_line != r.width() * 4) {
+            qWarning("%s: unsupported pixmap format", __func__);
+            XDestroyImage(img);
+            return false;
+        }
+        MResourceAccountant::instance()->raiseWindowUsage(d->window,
+                MResourceAccountant::Temporary, img->bytes_per_line * r.height());
+    }
+
+    // BGRA -> RGBA in place, and make the pixels opaque if the window
+    // has no alpha
+    const quint32 alpha = has_alpha ? 0 : 0xff000000;
+    quint32 *pixels = (quint32 *)img->data;
+    for (int i = r.width() * r.height(); i > 0; --i, ++pixels) {
+        quint32 p = *pixels;
+        *pixels = (p & 0xff00ff00) | ((p >> 16) & 0xff)
+                  | ((p & 0xff) << 16) | alpha;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, d->atlas_page);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, d->atlas_area.x() + r.x(),
+                    d->atlas_area.y() + r.y(), r.width(), r.height(),
+                    GL_RGBA, GL_UNSIGNED_BYTE, img->data);
+    if (!shm)
+        XDestroyImage(img);
+    return true;
+}
+
 void MTexturePixmapItem::init()
 {
     if (!isValid() || propertyCache()->isInputOnly())
@@ -129,18 +313,14 @@ void MTexturePixmapItem::init()
         d->eglresource = new EglResourceManager();
 
     d->custom_tfp = !d->eglresource->texturePixmapSupport();
-    d->textureId = d->eglresource->texman->getTexture();
     glEnable(GL_TEXTURE_2D);
     
     if (d->custom_tfp)
         d->inverted_texture = false;
     
-    glBindTexture(GL_TEXTURE_2D, d->textureId);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // small windows get their texture when the pixmap is bound
+    if (!wantsAtlas(d))
+        useOwnTexture(d);
     
     d->saveBackingStore();
 }
@@ -201,6 +381,7 @@ void MTexturePixmapItem::enableDirectFbRendering()
         XFreePixmap(QX11Info::display(), d->windowp);
         d->windowp = 0;
     }
+    d->account();
     XCompositeUnredirectWindow(QX11Info::display(), window(),
                                CompositeRedirectManual);
 }
@@ -240,12 +421,40 @@ void MTexturePixmapItem::initCustomTfp()
 void MTexturePixmapItem::cleanup()
 {
     freeEglImage(d);
-    d->eglresource->texman->closeTexture(d->textureId);
+    if (d->atlas_page) {
+        MTextureAtlas::instance()->release(d->atlas_page, d->atlas_area);
+        d->atlas_page = d->textureId = 0;
+    } else if (d->textureId)
+        d->eglresource->texman->closeTexture(d->textureId);
+
+    if (d->windowp) {
+        XFreePixmap(QX11Info::display(), d->windowp);
+        d->windowp = 0;
+    }
+    d->account();
+}
 
+// Frees the pixmap and the texture of the window until it's shown again.
+void MTexturePixmapItem::evictBackingStore()
+{
+    if (d->direct_fb_render || (!d->windowp && !d->atlas_page))
+        return;
+
+    freeEglImage(d);
+    if (d->atlas_page) {
+        MTextureAtlas::instance()->release(d->atlas_page, d->atlas_area);
+        d->atlas_page = d->textureId = 0;
+    } else if (d->custom_tfp) {
+        glBindTexture(GL_TEXTURE_2D, d->textureId);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 0, 0, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, 0);
+    }
     if (d->windowp) {
         XFreePixmap(QX11Info::display(), d->windowp);
         d->windowp = 0;
     }
+    d->stale_backing_store = true;
+    d->account();
 }
 
 void MTexturePixmapItem::updateWindowPixmap(XRectangle *rects, int num,
@@ -300,15 +509,26 @@ void MTexturePixmapItem::updateWindowPixmap(XRectangle *rects, int num,
         QPixmap qp = QPixmap::fromX11Pixmap(d->windowp);
         
         QImage img = d->glwidget->convertToGLFormat(qp.toImage());
+        MResourceAccountant::instance()->raiseWindowUsage(d->window,
+                MResourceAccountant::Temporary, img.byteCount() * 2);
         glBindTexture(GL_TEXTURE_2D, d->textureId);
         glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, img.width(), 
                         img.height(), GL_RGBA, GL_UNSIGNED_BYTE, img.bits());
         new_image = true;
+    } else if (d->atlas_page) {
+        // copy only the damaged part, with one request since the
+        // windows in the atlas are small anyway
+        if (!d->windowp
+            || !uploadToAtlas(d, d->damageRegion.boundingRect())) {
+            saveBackingStore();
+            new_image = true;
+        }
     } else if (d->egl_image == EGL_NO_IMAGE_KHR) {
         saveBackingStore();
         new_image = true;
     }    
     if (new_image || !d->damageRegion.isEmpty()) {
+        ++d->damage_serial;
         if (!d->current_window_group) 
             d->glwidget->update();
         else
@@ -340,49 +560,36 @@ void MTexturePixmapItem::paint(QPainter *painter,
 
 void MTexturePixmapItem::renderTexture(const QTransform& transform)
 {    
-    if (propertyCache()->hasAlpha() || (opacity() < 1.0f && !dimmedEffect()) ) {
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    }
-    glBindTexture(GL_TEXTURE_2D, d->textureId);
-
+    bool blend = propertyCache()->hasAlpha()
+                 || (opacity() < 1.0f && !dimmedEffect());
     const QRegion &shape = propertyCache()->shapeRegion();
     // FIXME: not optimal. probably would be better to replace with 
     // eglSwapBuffersRegionNOK()
 
     bool shape_on = !QRegion(boundingRect().toRect()).subtracted(shape).isEmpty();
-    bool scissor_on = d->damageRegion.numRects() > 1 || shape_on;
-    
-    if (scissor_on)
-        glEnable(GL_SCISSOR_TEST);
     
+    if (d->atlas_page && !d->current_effect && !shape_on
+        && d->damageRegion.numRects() <= 1 && transform.isAffine()
+        && !blurred()) {
+        // drawn together with the other windows in the atlas
+        d->queueAtlasQuad(transform, boundingRect(), opacity(), blend);
+        return;
+    }
+
+    d->flushAtlasBatch();
+    if (blend) {
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+    glBindTexture(GL_TEXTURE_2D, d->textureId);
+
     // Damage regions taking precedence over shape rects 
-    if (d->damageRegion.numRects() > 1) {
-        for (int i = 0; i < d->damageRegion.numRects(); ++i) {
-            glScissor(d->damageRegion.rects().at(i).x(),
-                      d->brect.height() -
-                      (d->damageRegion.rects().at(i).y() +
-                       d->damageRegion.rects().at(i).height()),
-                      d->damageRegion.rects().at(i).width(),
-                      d->damageRegion.rects().at(i).height());
-            d->drawTexture(transform, boundingRect(), opacity());        
-        }
-    } else if (shape_on) {
-        // draw a shaped window using glScissor
-        for (int i = 0; i < shape.numRects(); ++i) {
-            glScissor(shape.rects().at(i).x(),
-                      d->brect.height() -
-                      (shape.rects().at(i).y() +
-                       shape.rects().at(i).height()),
-                      shape.rects().at(i).width(),
-                      shape.rects().at(i).height());
-            d->drawTexture(transform, boundingRect(), opacity());
-        }
-    } else
+    if (d->damageRegion.numRects() > 1)
+        d->drawTexture(transform, boundingRect(), opacity(), d->damageRegion);
+    else if (shape_on)
+        d->drawTexture(transform, boundingRect(), opacity(), shape);
+    else
         d->drawTexture(transform, boundingRect(), opacity());
-    
-    if (scissor_on)
-        glDisable(GL_SCISSOR_TEST);
 
     // Explicitly disable blending. for some reason, the latest drivers
     // still has blending left-over even if we call glDisable(GL_BLEND)
@@ -407,9 +614,12 @@ QRectF MTexturePixmapItem::boundingRect() const
 
 void MTexturePixmapItem::clearTexture()
 {
-    glBindTexture(GL_TEXTURE_2D, d->textureId);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 0, 0, 0, GL_RGBA,
-                 GL_UNSIGNED_BYTE, 0);
+    // the atlas page is shared with other windows
+    if (!d->atlas_page) {
+        glBindTexture(GL_TEXTURE_2D, d->textureId);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 0, 0, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, 0);
+    }
 
     glClearColor(0.0, 0.0, 0.0, 0.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -427,6 +637,8 @@ void MTexturePixmapItem::doTFP()
 
         QT_TRY {
             QImage img = QGLWidget::convertToGLFormat(qp.toImage());
+            MResourceAccountant::instance()->raiseWindowUsage(d->window,
+                    MResourceAccountant::Temporary, img.byteCount() * 2);
             glBindTexture(GL_TEXTURE_2D, d->textureId);
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img.width(), img.height(), 0,
                          GL_RGBA, GL_UNSIGNED_BYTE, img.bits());
@@ -434,7 +646,13 @@ void MTexturePixmapItem::doTFP()
             /* XGetImage() failed, the window has been unmapped. */;
             qWarning("MTexturePixmapItem::%s(): std::bad_alloc e", __func__);
         }
+    } else if (wantsAtlas(d) && useAtlas(d)) {
+        // small window, copy the pixels to the atlas
+        if (!uploadToAtlas(d, QRect(QPoint(0, 0), d->atlas_area.size())))
+            // window is probably unmapped
+            useOwnTexture(d);
     } else { //use EGL extensions
+        useOwnTexture(d);
         d->egl_image = eglCreateImageKHR(d->eglresource->dpy, 0,
                                          EGL_NATIVE_PIXMAP_KHR,
                                          (EGLClientBuffer)d->windowp,
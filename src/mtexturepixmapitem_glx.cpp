@@ -22,6 +22,7 @@
 
 #include "mtexturepixmapitem.h"
 #include "mtexturepixmapitem_p.h"
+#include "mresourceaccountant.h"
 
 #include <QPainterPath>
 #include <QRect>
@@ -194,8 +195,10 @@ void MTexturePixmapItem::rebindPixmap()
 
     if (!d->custom_tfp && d->windowp) {
         Display *display = QX11Info::display();
-        glXReleaseTexImageEXT(display, d->glpixmap, GLX_FRONT_LEFT_EXT);
-        glXDestroyPixmap(display, d->glpixmap);
+        if (d->glpixmap) {
+            glXReleaseTexImageEXT(display, d->glpixmap, GLX_FRONT_LEFT_EXT);
+            glXDestroyPixmap(display, d->glpixmap);
+        }
         d->glpixmap = glXCreatePixmap(display, propertyCache()->hasAlpha() ?
                                                  configAlpha : config,
                                                  d->windowp, pixmapAttribs);
@@ -226,6 +229,7 @@ void MTexturePixmapItem::enableDirectFbRendering()
         XFreePixmap(QX11Info::display(), d->windowp);
         d->windowp = 0;
     }
+    d->account();
     XCompositeUnredirectWindow(QX11Info::display(), window(),
                                CompositeRedirectManual);
     XSync(QX11Info::display(), FALSE);
@@ -272,8 +276,11 @@ void MTexturePixmapItem::initCustomTfp()
 void MTexturePixmapItem::cleanup()
 {
     if (!d->custom_tfp) {
-        glXReleaseTexImageEXT(QX11Info::display(), d->glpixmap, GLX_FRONT_LEFT_EXT);
-        glXDestroyPixmap(QX11Info::display(), d->glpixmap);
+        if (d->glpixmap) {
+            glXReleaseTexImageEXT(QX11Info::display(), d->glpixmap,
+                                  GLX_FRONT_LEFT_EXT);
+            glXDestroyPixmap(QX11Info::display(), d->glpixmap);
+        }
         glDeleteTextures(1, &d->textureId);
     } else
         glDeleteTextures(1, &d->ctextureId);
@@ -282,6 +289,29 @@ void MTexturePixmapItem::cleanup()
         XFreePixmap(QX11Info::display(), d->windowp);
         d->windowp = 0;
     }
+    d->account();
+}
+
+// Frees the pixmap and the texture of the window until it's shown again.
+void MTexturePixmapItem::evictBackingStore()
+{
+    if (d->direct_fb_render || !d->windowp)
+        return;
+
+    if (!d->custom_tfp && d->glpixmap) {
+        glXReleaseTexImageEXT(QX11Info::display(), d->glpixmap,
+                              GLX_FRONT_LEFT_EXT);
+        glXDestroyPixmap(QX11Info::display(), d->glpixmap);
+        d->glpixmap = 0;
+    } else if (d->custom_tfp) {
+        glBindTexture(GL_TEXTURE_2D, d->ctextureId);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 0, 0, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, 0);
+    }
+    XFreePixmap(QX11Info::display(), d->windowp);
+    d->windowp = 0;
+    d->stale_backing_store = true;
+    d->account();
 }
 
 void MTexturePixmapItem::updateWindowPixmap(XRectangle *rects, int num,
@@ -301,6 +331,8 @@ void MTexturePixmapItem::updateWindowPixmap(XRectangle *rects, int num,
 
         QT_TRY {
             QImage img = d->glwidget->convertToGLFormat(qp.toImage());
+            MResourceAccountant::instance()->raiseWindowUsage(d->window,
+                    MResourceAccountant::Temporary, img.byteCount() * 2);
             glBindTexture(GL_TEXTURE_2D, d->ctextureId);
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img.width(), img.height(), 0,
                          GL_RGBA, GL_UNSIGNED_BYTE, img.bits());
@@ -309,6 +341,7 @@ void MTexturePixmapItem::updateWindowPixmap(XRectangle *rects, int num,
             qWarning("MTexturePixmapItem::%s(): std::bad_alloc e", __func__);
         }
     }
+    ++d->damage_serial;
     update();
 }
 
@@ -336,42 +369,20 @@ void MTexturePixmapItem::paint(QPainter *painter,
 
     const QRegion &shape = propertyCache()->shapeRegion();
     bool shape_on = !QRegion(boundingRect().toRect()).subtracted(shape).isEmpty();
-    bool scissor_on = d->damageRegion.numRects() > 1 || shape_on;
-    
-    if (scissor_on)
-        glEnable(GL_SCISSOR_TEST);
     
     // Damage regions taking precedence over shape rects 
-    if (d->damageRegion.numRects() > 1) {
-        for (int i = 0; i < d->damageRegion.numRects(); ++i) {
-            glScissor(d->damageRegion.rects().at(i).x(),
-                      d->brect.height() -
-                      (d->damageRegion.rects().at(i).y() +
-                       d->damageRegion.rects().at(i).height()),
-                      d->damageRegion.rects().at(i).width(),
-                      d->damageRegion.rects().at(i).height());
-            d->drawTexture(painter->combinedTransform(), boundingRect(), opacity());        
-        }
-    } else if (shape_on) {
-        // draw a shaped window using glScissor
-        for (int i = 0; i < shape.numRects(); ++i) {
-            glScissor(shape.rects().at(i).x(),
-                      d->brect.height() -
-                      (shape.rects().at(i).y() +
-                       shape.rects().at(i).height()),
-                      shape.rects().at(i).width(),
-                      shape.rects().at(i).height());
-            d->drawTexture(painter->combinedTransform(),
-                           boundingRect(), opacity());
-        }
-    } else
+    if (d->damageRegion.numRects() > 1)
+        d->drawTexture(painter->combinedTransform(), boundingRect(),
+                       opacity(), d->damageRegion);
+    else if (shape_on)
+        d->drawTexture(painter->combinedTransform(), boundingRect(),
+                       opacity(), shape);
+    else
         d->drawTexture(painter->combinedTransform(), boundingRect(), opacity());
-    
-    if (scissor_on)
-        glDisable(GL_SCISSOR_TEST);
 
     glDisable(GL_BLEND);
 
+    d->restoreGLState();
     painter->endNativePainting();
 }
 
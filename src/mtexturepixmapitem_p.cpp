@@ -24,6 +24,7 @@
 #include "texturepixmapshaders.h"
 #include "mcompositewindowshadereffect.h"
 #include "mcompositemanager.h"
+#include "mresourceaccountant.h"
 
 #include <QX11Info>
 #include <QRect>
@@ -43,6 +44,7 @@
 #include "mtexturepixmapitem_p.h"
 
 bool MTexturePixmapPrivate::inverted_texture = true;
+unsigned MTexturePixmapPrivate::draw_calls = 0;
 QGLWidget *MTexturePixmapPrivate::glwidget = 0;
 QGLContext *MTexturePixmapPrivate::ctx = 0;
 MGLResourceManager *MTexturePixmapPrivate::glresource = 0;
@@ -66,9 +68,9 @@ public:
         texture = -1;
         opacity = -1;
         blurstep = -1;
+        init = true;
     }
     void setWorldMatrix(GLfloat m[4][4]) {
-        static bool init = true;
         if (init || memcmp(m, worldMatrix, sizeof(worldMatrix))) {
             setUniformValue("matWorld", m);
             memcpy(worldMatrix, m, sizeof(worldMatrix));
@@ -76,6 +78,22 @@ public:
         }
     }
 
+    void setQuadRect(const QRectF &r) {
+        if (r != quadRect || quadRect.isNull()) {
+            setUniformValue("quadRect", (GLfloat) r.x(), (GLfloat) r.y(),
+                            (GLfloat) r.width(), (GLfloat) r.height());
+            quadRect = r;
+        }
+    }
+
+    void setTexRect(const QRectF &r) {
+        if (r != texRect || texRect.isNull()) {
+            setUniformValue("texRect", (GLfloat) r.x(), (GLfloat) r.y(),
+                            (GLfloat) r.width(), (GLfloat) r.height());
+            texRect = r;
+        }
+    }
+
     void setTexture(GLuint t) {
         if (t != texture) {
             setUniformValue("texture", t);
@@ -97,14 +115,14 @@ public:
     }
 
 private:
-    // static because this is set in the shared vertex shader
-    static GLfloat worldMatrix[4][4];
+    // uniforms of the shared vertex shader are still per program
+    GLfloat worldMatrix[4][4];
+    bool init;
+    QRectF quadRect, texRect;
     GLfloat opacity, blurstep;
     GLuint texture;
 };
 
-GLfloat MShaderProgram::worldMatrix[4][4];
-
 // OpenGL ES 2.0 / OpenGL 2.0 - compatible texture painter
 class MGLResourceManager: public QObject
 {
@@ -120,10 +138,24 @@ public:
         ShaderTotal
     };
 
+    // Where the texture coordinates of the next draw are taken from.
+    enum TexCoordSource {
+        NoTexCoords = 0,
+        NormalTexCoords,
+        InvertedTexCoords,
+        StreamedTexCoords
+    };
+
     MGLResourceManager(QGLWidget *glwidget)
         : QObject(glwidget),
           glcontext(glwidget->context()),
-          currentShader(0)
+          currentShader(0),
+          boundShader(0),
+          quadBuffer(0),
+          streamBuffer(0),
+          quadBound(false),
+          streamedPositions(false),
+          texCoordSource(NoTexCoords)
     {
         sharedVertexShader = new QGLShader(QGLShader::Vertex,
                 glwidget->context(), this);
@@ -189,6 +221,120 @@ public:
             shader[i]->bind();
             shader[i]->setUniformValue("matProj", projMatrix);
         }
+        // the effects' shaders when the widget is resized
+        foreach (MShaderProgram *p, customShaders) {
+            p->bind();
+            p->setUniformValue("matProj", projMatrix);
+        }
+        boundShader = 0;
+
+        // The unit quad in the same order as the texture coordinates,
+        // followed by both sets of texture coordinates.
+        static const GLfloat unitQuad[8] = {
+            0.0f, 0.0f,
+            0.0f, 1.0f,
+            1.0f, 1.0f,
+            1.0f, 0.0f
+        };
+        GLfloat quad[24];
+        memcpy(&quad[0], unitQuad, sizeof(unitQuad));
+        memcpy(&quad[8], texCoords, sizeof(texCoords));
+        memcpy(&quad[16], texCoordsInv, sizeof(texCoordsInv));
+        if (!quadBuffer)
+            glGenBuffers(1, &quadBuffer);
+        if (!streamBuffer)
+            glGenBuffers(1, &streamBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, quadBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Sets up the vertex attributes for drawing from the unit quad unless
+    // they are already set up.  They are left enabled and the buffer bound
+    // until releaseQuad().
+    void bindQuad()
+    {
+        if (!quadBound)
+            enableArrays();
+        else if (!streamedPositions)
+            return;
+        glBindBuffer(GL_ARRAY_BUFFER, quadBuffer);
+        glVertexAttribPointer(D_VERTEX_COORDS, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        streamedPositions = false;
+    }
+
+    // Uploads @n vertices of interleaved position and texture coordinate
+    // pairs to the streaming buffer and sources the next draw from there.
+    void streamMesh(const GLfloat *vertices, int n)
+    {
+        if (!quadBound)
+            enableArrays();
+        const GLsizei stride = 4 * sizeof(GLfloat);
+        glBindBuffer(GL_ARRAY_BUFFER, streamBuffer);
+        glBufferData(GL_ARRAY_BUFFER, n * stride, vertices, GL_STREAM_DRAW);
+        glVertexAttribPointer(D_VERTEX_COORDS, 2, GL_FLOAT, GL_FALSE,
+                              stride, 0);
+        glVertexAttribPointer(D_TEXTURE_COORDS, 2, GL_FLOAT, GL_FALSE,
+                              stride, (const GLvoid *) (2 * sizeof(GLfloat)));
+        streamedPositions = true;
+        texCoordSource = StreamedTexCoords;
+    }
+
+    void useTexCoords(bool inverted)
+    {
+        TexCoordSource source = inverted ? InvertedTexCoords : NormalTexCoords;
+        if (source == texCoordSource)
+            return;
+        glBindBuffer(GL_ARRAY_BUFFER, quadBuffer);
+        glVertexAttribPointer(D_TEXTURE_COORDS, 2, GL_FLOAT, GL_FALSE, 0,
+                              (const GLvoid *) ((inverted ? 16 : 8)
+                                                * sizeof(GLfloat)));
+        texCoordSource = source;
+    }
+
+    // Uploads @n texture coordinate pairs to the streaming buffer and
+    // sources the texture coordinates of the next draw from there.
+    void streamTexCoords(const GLfloat *coords, int n)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, streamBuffer);
+        // respecifying the whole buffer lets the driver orphan the
+        // previous contents instead of waiting for draws still using it
+        glBufferData(GL_ARRAY_BUFFER, n * 2 * sizeof(GLfloat), coords,
+                     GL_STREAM_DRAW);
+        glVertexAttribPointer(D_TEXTURE_COORDS, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        texCoordSource = StreamedTexCoords;
+    }
+
+    void enableArrays()
+    {
+        glEnableVertexAttribArray(D_VERTEX_COORDS);
+        glEnableVertexAttribArray(D_TEXTURE_COORDS);
+        texCoordSource = NoTexCoords;
+        streamedPositions = true;
+        quadBound = true;
+    }
+
+    // Undoes bindQuad() and forgets the bound shader program, so that
+    // Qt's paint engine finds the state it expects.
+    void releaseQuad()
+    {
+        boundShader = 0;
+        if (!quadBound)
+            return;
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glDisableVertexAttribArray(D_VERTEX_COORDS);
+        glDisableVertexAttribArray(D_TEXTURE_COORDS);
+        texCoordSource = NoTexCoords;
+        quadBound = false;
+    }
+
+    void bindShader()
+    {
+        if (currentShader == boundShader)
+            return;
+        if (!currentShader->bind())
+            qWarning() << __func__ << "failed to bind shader program";
+        boundShader = currentShader;
     }
 
     void updateVertices(const QTransform &t) 
@@ -210,8 +356,7 @@ public:
             currentShader = shader[type];
         
         updateVertices(t);
-        if (!currentShader->bind())
-            qWarning() << __func__ << "failed to bind shader program";
+        bindShader();
         currentShader->setWorldMatrix(worldMatrix);
     }
 
@@ -225,8 +370,7 @@ public:
             return;
         currentShader = frag;        
         updateVertices(t);
-        if (!currentShader->bind())
-            qWarning() << __func__ << "failed to bind shader program";
+        bindShader();
         currentShader->setWorldMatrix(worldMatrix);
     }
 
@@ -245,6 +389,9 @@ public:
 
         if (p->link()) {
             customShaders[p->programId()] = p;
+            p->bind();
+            p->setUniformValue("matProj", projMatrix);
+            boundShader = 0;
             return p->programId();
         } 
        
@@ -267,6 +414,15 @@ private:
     GLfloat texCoords[8];
     GLfloat texCoordsInv[8];
     MShaderProgram *currentShader;
+    MShaderProgram *boundShader;
+    // @quadBuffer holds the unit quad followed by texCoords and
+    // texCoordsInv, @streamBuffer is respecified for every draw which
+    // needs other texture coordinates.
+    GLuint quadBuffer;
+    GLuint streamBuffer;
+    bool quadBound;
+    bool streamedPositions;
+    TexCoordSource texCoordSource;
     int width;
     int height;
 
@@ -277,10 +433,18 @@ MShaderProgram *MGLResourceManager::shader[ShaderTotal];
 #endif
 
 
+// Returns the part of the bound texture holding the window's contents.
+// The texture coordinates select the orientation within it.
+static inline QRectF atlasTexRect(const MTexturePixmapPrivate *d)
+{
+    return d->atlas_page ? d->atlas_rect : QRectF(0, 0, 1, 1);
+}
+
 void MTexturePixmapPrivate::drawTexture(const QTransform &transform,
                                         const QRectF &drawRect,
                                         qreal opacity)
 {
+    flushAtlasBatch();
     if (current_effect) {
         current_effect->d->drawTexture(this, transform, drawRect, opacity);
     } else
@@ -292,21 +456,19 @@ void MTexturePixmapPrivate::q_drawTexture(const QTransform &transform,
                                           qreal opacity,
                                           bool texcoords_from_rect)
 {
-    if (current_effect)
+    // the cached output of an effect is drawn like a plain texture
+    bool effect_shader = current_effect && !current_effect->d->drawing_cached;
+    if (effect_shader)
         glresource->updateVertices(transform, current_effect->activeShaderFragment());
+    else if (current_effect)
+        glresource->updateVertices(transform, MGLResourceManager::NormalShader);
     else
         glresource->updateVertices(transform, item->blurred() ?
                                    MGLResourceManager::BlurShader :
                                    MGLResourceManager::NormalShader);
-    GLfloat vertexCoords[] = {
-        drawRect.left(),  drawRect.top(),
-        drawRect.left(),  drawRect.bottom(),
-        drawRect.right(), drawRect.bottom(),
-        drawRect.right(), drawRect.top()
-    };
-    glEnableVertexAttribArray(D_VERTEX_COORDS);
-    glEnableVertexAttribArray(D_TEXTURE_COORDS);
-    glVertexAttribPointer(D_VERTEX_COORDS, 2, GL_FLOAT, GL_FALSE, 0, vertexCoords);
+    glresource->bindQuad();
+    glresource->currentShader->setQuadRect(drawRect);
+    glresource->currentShader->setTexRect(atlasTexRect(this));
     if (texcoords_from_rect) {
         float w, h, x, y, cx, cy, cw, ch;
         w = item->boundingRect().width();
@@ -330,31 +492,233 @@ void MTexturePixmapPrivate::q_drawTexture(const QTransform &transform,
             texCoords[4] = cx + cw; texCoords[5] = cy;
             texCoords[6] = cx + cw; texCoords[7] = ch + cy;
         }
-        glVertexAttribPointer(D_TEXTURE_COORDS, 2, GL_FLOAT, GL_FALSE, 0,
-                              texCoords);
-    }
-    else if (inverted_texture)
-        glVertexAttribPointer(D_TEXTURE_COORDS, 2, GL_FLOAT, GL_FALSE, 0,
-                              glresource->texCoordsInv);
-    else
-        glVertexAttribPointer(D_TEXTURE_COORDS, 2, GL_FLOAT, GL_FALSE, 0,
-                              glresource->texCoords);
+        glresource->streamTexCoords(texCoords, 4);
+    } else
+        glresource->useTexCoords(inverted_texture);
     
-    if (current_effect)
+    if (effect_shader)
         current_effect->setUniforms(glresource->currentShader);
-    else if (item->blurred())
+    else if (!current_effect && item->blurred())
         glresource->currentShader->setBlurStep((GLfloat) 0.5);
     glresource->currentShader->setOpacity((GLfloat) opacity);
     glresource->currentShader->setTexture(0);
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    ++draw_calls;
+}
 
-    glDisableVertexAttribArray(D_VERTEX_COORDS);
-    glDisableVertexAttribArray(D_TEXTURE_COORDS);
+// Draws only the part of the texture within @region, given in the
+// coordinates of @drawRect.  Windows without effects are drawn as a
+// single mesh of the rectangles of @region.  Effects draw their own
+// geometry and projective transformations (like in the 3D switcher)
+// are rare, so for these the region is masked in the stencil buffer.
+void MTexturePixmapPrivate::drawTexture(const QTransform &transform,
+                                        const QRectF &drawRect,
+                                        qreal opacity,
+                                        const QRegion &region)
+{
+    flushAtlasBatch();
+    if (!current_effect && transform.isAffine()) {
+        q_drawRegion(transform, drawRect, opacity, region);
+        return;
+    }
 
+    // the current framebuffer may be a window group's without stencil
+    GLint stencil_bits = 0;
+    glGetIntegerv(GL_STENCIL_BITS, &stencil_bits);
+    if (stencil_bits > 0) {
+        glEnable(GL_STENCIL_TEST);
+        glClear(GL_STENCIL_BUFFER_BIT);
+        glStencilFunc(GL_ALWAYS, 1, 1);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        q_drawRegion(transform, drawRect, opacity, region);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glStencilFunc(GL_EQUAL, 1, 1);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        drawTexture(transform, drawRect, opacity);
+        glDisable(GL_STENCIL_TEST);
+        return;
+    }
+
+    // last resort: redraw the whole texture for each rectangle
+    const QVector<QRect> rects = region.rects();
+    glEnable(GL_SCISSOR_TEST);
+    for (int i = 0; i < rects.size(); ++i) {
+        const QRect &r = rects.at(i);
+        glScissor(r.x(), brect.height() - (r.y() + r.height()),
+                  r.width(), r.height());
+        drawTexture(transform, drawRect, opacity);
+    }
+    glDisable(GL_SCISSOR_TEST);
+}
+
+// Draws the rectangles of @region as triangles in one go, with the texture
+// coordinates of each vertex derived from its position within @drawRect.
+// Always uses the built-in shaders.
+void MTexturePixmapPrivate::q_drawRegion(const QTransform &transform,
+                                         const QRectF &drawRect,
+                                         qreal opacity,
+                                         const QRegion &region)
+{
+    const QVector<QRect> rects = region.intersected(drawRect.toAlignedRect())
+                                       .rects();
+    if (rects.isEmpty() || drawRect.isEmpty())
+        return;
+
+    glresource->updateVertices(transform, item->blurred() ?
+                               MGLResourceManager::BlurShader :
+                               MGLResourceManager::NormalShader);
+
+    // x, y, s, t of two triangles per rectangle
+    static QVector<GLfloat> mesh;
+    mesh.resize(rects.size() * 6 * 4);
+    GLfloat *v = mesh.data();
+    qreal x0 = drawRect.x(), y0 = drawRect.y();
+    qreal w = drawRect.width(), h = drawRect.height();
+    for (int i = 0; i < rects.size(); ++i) {
+        const QRect &r = rects.at(i);
+        GLfloat l = r.x(), t = r.y();
+        GLfloat rt = r.x() + r.width(), b = r.y() + r.height();
+        const GLfloat corners[12] = { l, t,  l, b,  rt, b,
+                                      l, t,  rt, b, rt, t };
+        for (int j = 0; j < 12; j += 2) {
+            GLfloat s = (corners[j] - x0) / w;
+            GLfloat tc = (corners[j + 1] - y0) / h;
+            *v++ = corners[j];
+            *v++ = corners[j + 1];
+            *v++ = s;
+            *v++ = inverted_texture ? tc : 1.0f - tc;
+        }
+    }
+
+    glresource->streamMesh(mesh.constData(), rects.size() * 6);
+    // the mesh is in item coordinates already
+    glresource->currentShader->setQuadRect(QRectF(0, 0, 1, 1));
+    glresource->currentShader->setTexRect(atlasTexRect(this));
+    if (item->blurred())
+        glresource->currentShader->setBlurStep((GLfloat) 0.5);
+    glresource->currentShader->setOpacity((GLfloat) opacity);
+    glresource->currentShader->setTexture(0);
+    glDrawArrays(GL_TRIANGLES, 0, rects.size() * 6);
+    ++draw_calls;
+}
+
+// Windows in the texture atlas and the overlays of the extensions' render
+// passes are collected here and drawn with a single draw call for each run
+// of quads on the same page with the same opacity and blending.  Any other
+// drawing flushes the batch first to keep the stacking order.
+static QVector<GLfloat> atlas_batch;
+static GLuint batch_page;
+static GLfloat batch_opacity;
+static bool batch_blend;
+
+// Queues @drawRect of the window for drawing from the atlas.
+void MTexturePixmapPrivate::queueAtlasQuad(const QTransform &transform,
+                                           const QRectF &drawRect,
+                                           qreal opacity, bool blend)
+{
+    // the atlas is stored top-down like the pixmaps
+    queueQuad(atlas_page, atlas_rect, !inverted_texture,
+              transform, drawRect, opacity, blend);
+}
+
+// Queues an overlay quad of a whole bottom-up @texture, the way
+// QGLContext::bindTexture() uploads images, covering @rect of the screen.
+void MTexturePixmapPrivate::queueOverlayQuad(GLuint texture,
+                                             const QRectF &rect,
+                                             qreal opacity)
+{
+    if (!glresource || !texture)
+        // nothing has been drawn yet, there's no one to flush the batch
+        return;
+    queueQuad(texture, QRectF(0, 0, 1, 1), true,
+              QTransform(), rect, opacity, true);
+}
+
+// Queues @texRect of the @page texture to be drawn to @drawRect.
+// If @flip the texture is upside down.  @transform must be affine.
+void MTexturePixmapPrivate::queueQuad(GLuint page, const QRectF &texRect,
+                                      bool flip, const QTransform &transform,
+                                      const QRectF &drawRect,
+                                      qreal opacity, bool blend)
+{
+    if (!atlas_batch.isEmpty()
+        && (page != batch_page || (GLfloat) opacity != batch_opacity
+            || blend != batch_blend))
+        flushAtlasBatch();
+    if (!atlas_batch.capacity())
+        // keep the buffer between frames
+        atlas_batch.reserve(32 * 6 * 4);
+    batch_page = page;
+    batch_opacity = opacity;
+    batch_blend = blend;
+
+    GLfloat s0 = texRect.left(), s1 = texRect.right();
+    GLfloat t0 = texRect.top(), t1 = texRect.bottom();
+    if (flip)
+        qSwap(t0, t1);
+    const QPointF tl = transform.map(drawRect.topLeft());
+    const QPointF bl = transform.map(drawRect.bottomLeft());
+    const QPointF br = transform.map(drawRect.bottomRight());
+    const QPointF tr = transform.map(drawRect.topRight());
+    const GLfloat quad[] = {
+        tl.x(), tl.y(), s0, t0,
+        bl.x(), bl.y(), s0, t1,
+        br.x(), br.y(), s1, t1,
+        tl.x(), tl.y(), s0, t0,
+        br.x(), br.y(), s1, t1,
+        tr.x(), tr.y(), s1, t0
+    };
+    for (unsigned i = 0; i < sizeof(quad) / sizeof(quad[0]); ++i)
+        atlas_batch.append(quad[i]);
+}
+
+void MTexturePixmapPrivate::flushAtlasBatch()
+{
+    if (atlas_batch.isEmpty())
+        return;
+
+    int n = atlas_batch.size() / 4;
+    // the vertices are transformed already
+    glresource->updateVertices(QTransform(), MGLResourceManager::NormalShader);
+    glresource->streamMesh(atlas_batch.constData(), n);
+    glresource->currentShader->setQuadRect(QRectF(0, 0, 1, 1));
+    glresource->currentShader->setTexRect(QRectF(0, 0, 1, 1));
+    glresource->currentShader->setOpacity(batch_opacity);
+    glresource->currentShader->setTexture(0);
+    if (batch_blend) {
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+    glBindTexture(GL_TEXTURE_2D, batch_page);
+    glDrawArrays(GL_TRIANGLES, 0, n);
+    ++draw_calls;
+    if (batch_blend) {
+        glBlendFunc(GL_ONE, GL_ZERO);
+        glDisable(GL_BLEND);
+    }
+    atlas_batch.resize(0);
+}
+
+// Called after a batch of q_drawTexture()s, typically at the end of a frame,
+// to hand the GL state back to Qt's paint engine.
+void MTexturePixmapPrivate::restoreGLState()
+{
+    if (!glresource)
+        return;
+    flushAtlasBatch();
+    glresource->releaseQuad();
     glwidget->paintEngine()->syncState();
     glActiveTexture(GL_TEXTURE0);
 }
 
+// Fits the projection and the viewport to the GL widget after it's resized.
+void MTexturePixmapPrivate::updateProjection()
+{
+    if (glresource)
+        glresource->initVertices(glwidget);
+}
+
 void MTexturePixmapPrivate::installEffect(MCompositeWindowShaderEffect* effect)
 {
     if (effect == prev_effect)
@@ -368,6 +732,9 @@ void MTexturePixmapPrivate::installEffect(MCompositeWindowShaderEffect* effect)
     }
     current_effect = effect;
     prev_effect = effect;
+    if (effect && atlas_page)
+        // effects sample the texture on their own, give the window one
+        saveBackingStore();
     if (effect) {
         connect(effect, SIGNAL(enabledChanged(bool)),
                 SLOT(activateEffect(bool)), Qt::UniqueConnection);
@@ -388,6 +755,7 @@ void MTexturePixmapPrivate::removeEffect()
             delete frag;
         glresource->customShaders.remove(id);
     }    
+    glresource->boundShader = 0;
 }
 
 GLuint MTexturePixmapPrivate::installPixelShader(const QByteArray& code)
@@ -441,8 +809,11 @@ MTexturePixmapPrivate::MTexturePixmapPrivate(Qt::HANDLE window,
 #endif
       textureId(0),
       ctextureId(0),
+      atlas_page(0),
       custom_tfp(false),
       direct_fb_render(false), // root's children start redirected
+      stale_backing_store(false),
+      damage_serial(0),
       angle(0),
       item(p),
       prev_effect(0),
@@ -454,6 +825,7 @@ MTexturePixmapPrivate::MTexturePixmapPrivate(Qt::HANDLE window,
     }
     if (!ctx)
         ctx = const_cast<QGLContext *>(glwidget->context());
+    // this is a no-op while the display is off
     if (item->propertyCache())
         item->propertyCache()->damageTracking(true);
     init();
@@ -466,6 +838,8 @@ MTexturePixmapPrivate::~MTexturePixmapPrivate()
 
     if (windowp)
         XFreePixmap(QX11Info::display(), windowp);
+    if (window)
+        MResourceAccountant::instance()->forgetWindow(window);
 
     if (pastDamages)
         delete pastDamages;
@@ -477,11 +851,50 @@ void MTexturePixmapPrivate::saveBackingStore()
         || item->propertyCache()->isInputOnly()
         || !window)
         return;
+    if (((MCompositeManager *) qApp)->displayOff()) {
+        // nobody sees it, do it when the window is visible again
+        stale_backing_store = true;
+        return;
+    }
+    if (stale_backing_store && !item->windowVisible())
+        // evicted, don't bring it back until it's visible
+        return;
 
     if (windowp)
         XFreePixmap(QX11Info::display(), windowp);
     windowp = XCompositeNameWindowPixmap(QX11Info::display(), item->window());
     item->rebindPixmap(); // windowp == 0 is also handled here
+    stale_backing_store = false;
+    ++damage_serial;
+    account();
+}
+
+// Updates the figures of the window's graphics memory with the accountant.
+// Textures bound to the pixmap are counted as part of it.
+void MTexturePixmapPrivate::account()
+{
+    if (!window)
+        return;
+
+    MResourceAccountant *ra = MResourceAccountant::instance();
+    qint64 size = (qint64)brect.width() * brect.height() * 4;
+    ra->setWindowUsage(window, MResourceAccountant::Pixmap,
+                       windowp ? size : 0);
+    if (atlas_page)
+        size = (qint64)atlas_area.width() * atlas_area.height() * 4;
+    else if (!custom_tfp || !windowp)
+        size = 0;
+    ra->setWindowUsage(window, MResourceAccountant::Texture, size);
+}
+
+// Catches up with the saveBackingStore()s skipped while the display was off
+// or after the backing store was evicted.
+void MTexturePixmapPrivate::refreshBackingStore()
+{
+    if (!stale_backing_store)
+        return;
+    item->saveBackingStore();
+    item->updateWindowPixmap();
 }
 
 void MTexturePixmapPrivate::resize(int w, int h)
@@ -489,10 +902,13 @@ void MTexturePixmapPrivate::resize(int w, int h)
     if (!window)
         return;
     
-    if (!brect.isEmpty() && !item->isDirectRendered() && (brect.width() != w || brect.height() != h)) {
+    bool changed = !brect.isEmpty() && !item->isDirectRendered()
+                   && (brect.width() != w || brect.height() != h);
+    // the backing store is sized according to the new geometry
+    brect.setWidth(w);
+    brect.setHeight(h);
+    if (changed) {
         item->saveBackingStore();
         item->updateWindowPixmap();
     }
-    brect.setWidth(w);
-    brect.setHeight(h);
 }
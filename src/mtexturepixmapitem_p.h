@@ -60,11 +60,27 @@ public:
     void clearTexture();
     bool isDirectRendered() const;
     void resize(int w, int h);
+    void refreshBackingStore();
+    void account();
     void drawTexture(const QTransform& transform, const QRectF& drawRect,
                      qreal opacity);
+    void drawTexture(const QTransform& transform, const QRectF& drawRect,
+                     qreal opacity, const QRegion& region);
     
     void q_drawTexture(const QTransform& transform, const QRectF& drawRect,
                        qreal opacity, bool texcoords_from_rect = false);
+    void q_drawRegion(const QTransform& transform, const QRectF& drawRect,
+                      qreal opacity, const QRegion& region);
+    void queueAtlasQuad(const QTransform& transform, const QRectF& drawRect,
+                        qreal opacity, bool blend);
+    static void queueOverlayQuad(GLuint texture, const QRectF& rect,
+                                 qreal opacity);
+    static void queueQuad(GLuint page, const QRectF& texRect, bool flip,
+                          const QTransform& transform, const QRectF& drawRect,
+                          qreal opacity, bool blend);
+    static void flushAtlasBatch();
+    static void restoreGLState();
+    static void updateProjection();
     void installEffect(MCompositeWindowShaderEffect* effect);
     static GLuint installPixelShader(const QByteArray& code);
                 
@@ -79,12 +95,25 @@ public:
 #endif
     GLuint textureId;
     GLuint ctextureId;
+    // If the window is in the texture atlas, @atlas_page is its page and
+    // the same as @textureId.  @atlas_area is in pixels, @atlas_rect is
+    // the same in texture coordinates.
+    GLuint atlas_page;
+    QRect atlas_area;
+    QRectF atlas_rect;
     static bool inverted_texture;
     bool custom_tfp;
     bool direct_fb_render;
+    // Set if saveBackingStore() was skipped because the display was off,
+    // or the backing store was evicted to stay within the memory budget.
+    bool stale_backing_store;
 
     QRect brect;
     QRegion damageRegion;
+    // Bumped whenever the contents of the texture may have changed,
+    // so that shader effects can tell whether their cached output
+    // is still valid.
+    unsigned damage_serial;
     qreal angle;
 
     MTexturePixmapItem *item;
@@ -104,6 +133,9 @@ public:
 #endif
     static MGLResourceManager* glresource;
 
+    // Number of draw calls issued, for statistics.
+    static unsigned draw_calls;
+
 private slots:
     void activateEffect(bool enabled);
     void removeEffect();
@@ -0,0 +1,173 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "mwindowpingscheduler.h"
+#include "mcompositewindow.h"
+
+#include <QApplication>
+#include <QX11Info>
+#include <X11/Xlib.h>
+#include <time.h>
+
+// Enough slots to hold the longest timeout.
+#define WHEEL_SIZE (MWindowPingScheduler::ReappearMsecs \
+                    / MWindowPingScheduler::TickMsecs + 2)
+
+MWindowPingScheduler *MWindowPingScheduler::scheduler = 0;
+
+MWindowPingScheduler *MWindowPingScheduler::instance()
+{
+    if (!scheduler)
+        scheduler = new MWindowPingScheduler(qApp);
+    return scheduler;
+}
+
+MWindowPingScheduler::MWindowPingScheduler(QObject *parent)
+    : QObject(parent),
+      wheel(WHEEL_SIZE),
+      scheduled(0),
+      suspended(false),
+      armed(0)
+{
+    timer.setSingleShot(true);
+    connect(&timer, SIGNAL(timeout()), SLOT(tick()));
+}
+
+qint64 MWindowPingScheduler::nowMsecs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void MWindowPingScheduler::schedule(MCompositeWindow *cw, Kind kind,
+                                    int msecs)
+{
+    cancel(cw, kind);
+
+    Timeout t;
+    t.cw = cw;
+    t.kind = kind;
+    t.deadline = (nowMsecs() + msecs + TickMsecs - 1) / TickMsecs;
+    wheel[t.deadline % wheel.size()].append(t);
+    scheduled++;
+    rearm();
+}
+
+void MWindowPingScheduler::cancel(MCompositeWindow *cw, Kind kind)
+{
+    Timeout t;
+    t.cw = cw;
+    t.kind = kind;
+    // @cw may be going away while its peers are being dispatched
+    expired.removeOne(t);
+    for (int i = 0; i < wheel.size(); ++i)
+        if (wheel[i].removeOne(t)) {
+            scheduled--;
+            // leave the timer running, it's cheaper than finding
+            // the next deadline
+            return;
+        }
+}
+
+bool MWindowPingScheduler::isScheduled(const MCompositeWindow *cw,
+                                       Kind kind) const
+{
+    for (int i = 0; i < wheel.size(); ++i)
+        for (int j = 0; j < wheel[i].size(); ++j)
+            if (wheel[i][j].cw == cw && wheel[i][j].kind == kind)
+                return true;
+    return false;
+}
+
+void MWindowPingScheduler::setSuspended(bool s)
+{
+    if (suspended == s)
+        return;
+    suspended = s;
+    if (suspended)
+        timer.stop();
+    else
+        // expire what passed while we were suspended
+        tick();
+}
+
+// Arms the timer for the nearest deadline unless it expires earlier
+// already.
+void MWindowPingScheduler::rearm()
+{
+    if (suspended || !scheduled) {
+        timer.stop();
+        return;
+    }
+
+    qint64 now = nowMsecs(), t = now / TickMsecs, next = -1;
+    for (int i = 0; i < wheel.size() && next < 0; ++i) {
+        const QList<Timeout> &slot = wheel[(t + i) % wheel.size()];
+        for (int j = 0; j < slot.size(); ++j)
+            if (next < 0 || slot[j].deadline < next)
+                next = slot[j].deadline;
+    }
+    if (next < 0 || (timer.isActive() && armed <= next))
+        return;
+
+    armed = next;
+    timer.start(qMax(next * TickMsecs - now, (qint64)0));
+}
+
+void MWindowPingScheduler::tick()
+{
+    qint64 t = nowMsecs() / TickMsecs;
+
+    // collect everything up to now
+    for (int i = 0; i < wheel.size(); ++i) {
+        QList<Timeout> &slot = wheel[i];
+        for (int j = 0; j < slot.size(); )
+            if (slot[j].deadline <= t) {
+                expired.append(slot.takeAt(j));
+                scheduled--;
+            } else
+                ++j;
+    }
+
+    // Pings are periodic.  Reschedule them before calling out,
+    // so they can be cancelled from there.
+    foreach (const Timeout &to, expired)
+        if (to.kind == PingTimeout) {
+            Timeout next = to;
+            next.deadline = t + PingMsecs / TickMsecs;
+            wheel[next.deadline % wheel.size()].append(next);
+            scheduled++;
+        }
+
+    bool sent = !expired.isEmpty();
+    while (!expired.isEmpty()) {
+        Timeout to = expired.takeFirst();
+        if (to.kind == PingTimeout)
+            to.cw->pingTimeout();
+        else
+            to.cw->reappearTimeout();
+    }
+    if (sent)
+        // send out all the new pings at once
+        XFlush(QX11Info::display());
+
+    timer.stop();
+    rearm();
+}
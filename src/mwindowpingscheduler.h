@@ -0,0 +1,113 @@
+/***************************************************************************
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** All rights reserved.
+** Contact: Nokia Corporation (directui@nokia.com)
+**
+** This file is part of mcompositor.
+**
+** If you have questions regarding the use of this file, please contact
+** Nokia at directui@nokia.com.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef MWINDOWPINGSCHEDULER_H
+#define MWINDOWPINGSCHEDULER_H
+
+#include <QObject>
+#include <QVector>
+#include <QList>
+#include <QTimer>
+
+class MCompositeWindow;
+
+/*!
+ * Internal class keeping the ping and the hung dialog reappearance
+ * timeouts of all windows in a single timer wheel, so that pinging
+ * costs at most one wakeup per tick no matter how many windows are
+ * pinged.  The pings which are due are sent together and flushed to
+ * the X server once.
+ */
+class MWindowPingScheduler: public QObject
+{
+    Q_OBJECT
+
+public:
+    //! What happens when a timeout expires.
+    enum Kind {
+        //! The window's ping is checked and a new one is sent.
+        PingTimeout = 0,
+        //! The hung dialog is shown again.
+        ReappearTimeout,
+        KindTotal
+    };
+
+    //! Resolution of the timeouts in milliseconds.
+    static const int TickMsecs = 1000;
+    //! Interval of the pings in milliseconds.
+    static const int PingMsecs = 5000;
+    //! Delay of the hung dialog's reappearance in milliseconds.
+    static const int ReappearMsecs = 30 * 1000;
+
+    static MWindowPingScheduler *instance();
+
+    /*!
+     * Schedules a timeout of \a kind for \a cw in \a msecs, rounded up
+     * to the next tick.  Any previous timeout of the same kind is
+     * cancelled.
+     */
+    void schedule(MCompositeWindow *cw, Kind kind, int msecs);
+
+    /*!
+     * Cancels the timeout of \a kind of \a cw.
+     */
+    void cancel(MCompositeWindow *cw, Kind kind);
+
+    /*!
+     * Returns whether \a cw has a timeout of \a kind scheduled.
+     */
+    bool isScheduled(const MCompositeWindow *cw, Kind kind) const;
+
+    /*!
+     * Stops or restarts the timer.  While suspended the timeouts don't
+     * expire, and those passed in the meantime expire upon resumption.
+     */
+    void setSuspended(bool suspended);
+
+private slots:
+    void tick();
+
+private:
+    struct Timeout {
+        MCompositeWindow *cw;
+        Kind kind;
+        qint64 deadline;
+        bool operator==(const Timeout &other) const
+            { return cw == other.cw && kind == other.kind; }
+    };
+
+    MWindowPingScheduler(QObject *parent);
+    static qint64 nowMsecs();
+    void rearm();
+
+    // The slots of the wheel, a timeout is in the one of its deadline
+    // tick modulo the size of the wheel.  All timeouts fit in one round.
+    QVector<QList<Timeout> > wheel;
+    int scheduled;
+    bool suspended;
+    QTimer timer;
+    // the tick @timer expires at
+    qint64 armed;
+    // the expired timeouts being dispatched by tick()
+    QList<Timeout> expired;
+
+    static MWindowPingScheduler *scheduler;
+};
+
+#endif
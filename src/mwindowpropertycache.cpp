@@ -19,6 +19,7 @@
 
 #include <QtGui>
 #include <stdlib.h>
+#include <time.h>
 #include <QX11Info>
 #include <QRect>
 #include <QDebug>
@@ -47,9 +48,39 @@ public:
     }
 };
 
+MWindowPropertyCache::RequestStats MWindowPropertyCache::stats;
 xcb_render_query_pict_formats_reply_t *MWindowPropertyCache::pict_formats_reply = 0;
 xcb_render_query_pict_formats_cookie_t MWindowPropertyCache::pict_formats_cookie = {0};
 
+// Returns the current time in microseconds.
+static qint64 now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void MWindowPropertyCache::resetRequestStats()
+{
+    unsigned outstanding = stats.outstanding;
+    stats = RequestStats();
+    stats.outstanding = stats.outstanding_max = outstanding;
+}
+
+// Forgets when addRequest() requested @collector's property and returns
+// how many microseconds ago it was, or -1 if there's no such request.
+qint64 MWindowPropertyCache::requestDone(const QLatin1String collector)
+{
+    QHash<const QLatin1String, qint64>::iterator it
+        = request_times.find(collector);
+    if (it == request_times.end())
+        return -1;
+    qint64 age = now() - *it;
+    request_times.erase(it);
+    stats.outstanding--;
+    return age;
+}
+
 // Returns whether the property of @collector does not need to be refreshed:
 // if it has been requested and it has been replied.
 bool MWindowPropertyCache::isUpdate(const QLatin1String collector)
@@ -72,11 +103,37 @@ void MWindowPropertyCache::addRequest(const QLatin1String collector,
 {
     unsigned prev_cookie = requests[collector];
     requests[collector] = cookie;
-    if (prev_cookie)
+    if (prev_cookie) {
         xcb_discard_reply(xcb_conn, prev_cookie);
-    else
+        stats.superseded++;
+    } else
         connect(collect_timer, SIGNAL(timeout()), this, collector.latin1());
-    collect_timer->start();
+    if (!idle) {
+        if (collect_timer->isActive())
+            stats.timer_restarts++;
+        collect_timer->start();
+    }
+
+    qint64 &issued = request_times[collector];
+    if (!issued && ++stats.outstanding > stats.outstanding_max)
+        stats.outstanding_max = stats.outstanding;
+    issued = now();
+    stats.issued++;
+}
+
+void MWindowPropertyCache::suspendCollecting(bool suspend)
+{
+    if (!collect_timer)
+        return;
+    if (suspend)
+        collect_timer->stop();
+    else
+        // restart if there's anything to collect
+        foreach (unsigned cookie, requests)
+            if (cookie) {
+                collect_timer->start();
+                break;
+            }
 }
 
 // Makes @collector's property considered isUpdate().
@@ -84,6 +141,17 @@ void MWindowPropertyCache::replyCollected(const QLatin1String collector)
 {
     requests[collector] = 0;
     collect_timer->disconnect(collector.latin1());
+
+    qint64 age = requestDone(collector);
+    if (age < 0)
+        return;
+    if (sender() == collect_timer)
+        stats.collected_by_timer++;
+    else
+        stats.collected++;
+    stats.wait_usecs += age;
+    if ((quint64)age > stats.wait_usecs_max)
+        stats.wait_usecs_max = age;
 }
 
 // If @collector has an ongoing query, cancels it.  @collector's property
@@ -92,6 +160,8 @@ void MWindowPropertyCache::cancelRequest(const QLatin1String collector)
 {
     if (requestPending(collector)) {
         xcb_discard_reply(xcb_conn, requests[collector]);
+        if (requestDone(collector) >= 0)
+            stats.cancelled++;
         replyCollected(collector);
     } else
         requests[collector] = 0;
@@ -107,6 +177,7 @@ unsigned MWindowPropertyCache::requestProperty(Atom prop, Atom type,
 }
 
 xcb_connection_t *MWindowPropertyCache::xcb_conn;
+bool MWindowPropertyCache::idle;
 
 void MWindowPropertyCache::init()
 {
@@ -124,6 +195,7 @@ void MWindowPropertyCache::init()
     always_mapped = 0;
     cannot_minimize = 0;
     desktop_view = -1;
+    wm_pid = 0;
     being_mapped = false;
     dont_iconify = false;
     orientation_angle = 0;
@@ -270,6 +342,8 @@ MWindowPropertyCache::~MWindowPropertyCache()
          i != requests.end(); ++i)
       if (i.value())
           xcb_discard_reply(xcb_conn, i.value());
+    stats.outstanding -= request_times.count();
+    stats.cancelled += request_times.count();
 
     if (attrs) {
         free(attrs);
@@ -491,6 +565,28 @@ int MWindowPropertyCache::desktopView()
     return desktop_view;
 }
 
+int MWindowPropertyCache::pid()
+{
+    QLatin1String me(SLOT(pid()));
+    if (is_valid && !requests.contains(me))
+        requests[me] = requestProperty(MCompAtoms::_NET_WM_PID,
+                                       XCB_ATOM_CARDINAL);
+    else if (!is_valid || !requests[me])
+        return wm_pid;
+
+    xcb_get_property_cookie_t c = { requests[me] };
+    xcb_get_property_reply_t *r;
+    r = xcb_get_property_reply(xcb_conn, c, 0);
+    replyCollected(me);
+    wm_pid = 0;
+    if (r) {
+        if (xcb_get_property_value_length(r) == sizeof(CARD32))
+            wm_pid = *((CARD32*)xcb_get_property_value(r));
+        free(r);
+    }
+    return wm_pid;
+}
+
 void MWindowPropertyCache::desktopView(bool request_only)
 {
     Q_UNUSED(request_only);
@@ -591,10 +687,30 @@ const XWMHints &MWindowPropertyCache::getWMHints()
     return *wmhints;
 }
 
-bool MWindowPropertyCache::propertyEvent(XPropertyEvent *e)
+// Requests the value of the property of @e anew for @collector unless
+// the reply of the ongoing request will have the changed value anyway.
+// Since the X server processes our requests in order, that's the case
+// if it hadn't processed the request yet when it generated @e.  This
+// way only one request per property is in flight however often the
+// client changes it.  Returns whether a new request was made.
+bool MWindowPropertyCache::refreshProperty(const char *collector,
+                                           XPropertyEvent *e,
+                                           Atom type, unsigned n)
 {
-    if (!is_valid)
+    unsigned cookie = requests.value(QLatin1String(collector));
+    if (cookie && (int)(cookie - (unsigned)e->serial) > 0) {
+        stats.coalesced++;
         return false;
+    }
+    addRequest(collector, requestProperty(e->atom, type, n));
+    return true;
+}
+
+void MWindowPropertyCache::propertyEvent(XPropertyEvent *e)
+{
+    if (!is_valid)
+        return;
+    stats.property_events++;
     if (e->atom == ATOM(WM_TRANSIENT_FOR)) {
         QLatin1String me(SLOT(transientFor()));
         if (isUpdate(me)) {
@@ -603,73 +719,54 @@ bool MWindowPropertyCache::propertyEvent(XPropertyEvent *e)
             MWindowPropertyCache *p = m->d->prop_caches.value(transient_for);
             if (p) p->transients.removeAll(window);
         }
-        addRequest(me, requestProperty(e->atom, XCB_ATOM_WINDOW));
-        return true;
+        refreshProperty(SLOT(transientFor()), e, XCB_ATOM_WINDOW);
     } else if (e->atom == ATOM(_MEEGOTOUCH_ALWAYS_MAPPED)) {
-        addRequest(SLOT(alwaysMapped()),
-                   requestProperty(e->atom, XCB_ATOM_CARDINAL));
-        emit alwaysMappedChanged(this);
+        if (refreshProperty(SLOT(alwaysMapped()), e, XCB_ATOM_CARDINAL))
+            emit alwaysMappedChanged(this);
     } else if (e->atom == ATOM(_MEEGOTOUCH_CANNOT_MINIMIZE)) {
-        addRequest(SLOT(cannotMinimize()),
-                   requestProperty(e->atom, XCB_ATOM_CARDINAL));
+        refreshProperty(SLOT(cannotMinimize()), e, XCB_ATOM_CARDINAL);
     } else if (e->atom == ATOM(_MEEGOTOUCH_DESKTOP_VIEW)) {
         emit desktopViewChanged(this);
     } else if (e->atom == ATOM(WM_HINTS)) {
-        addRequest(SLOT(getWMHints()),
-                   requestProperty(e->atom, XCB_ATOM_WM_HINTS, 10));
-        return true;
+        refreshProperty(SLOT(getWMHints()), e, XCB_ATOM_WM_HINTS, 10);
     } else if (e->atom == ATOM(_NET_WM_WINDOW_TYPE)) {
-        addRequest(SLOT(windowTypeAtom()),
-                   requestProperty(e->atom, XCB_ATOM_ATOM, MAX_TYPES));
+        refreshProperty(SLOT(windowTypeAtom()), e, XCB_ATOM_ATOM, MAX_TYPES);
         window_type = MCompAtoms::INVALID;
     } else if (e->atom == ATOM(_NET_WM_ICON_GEOMETRY)) {
-        addRequest(SLOT(iconGeometry()),
-                   requestProperty(e->atom, XCB_ATOM_CARDINAL, 4));
-        emit iconGeometryUpdated();
+        if (refreshProperty(SLOT(iconGeometry()), e, XCB_ATOM_CARDINAL, 4))
+            emit iconGeometryUpdated();
     } else if (e->atom == ATOM(_MEEGOTOUCH_GLOBAL_ALPHA)) {
-        addRequest(SLOT(globalAlpha()),
-                   requestProperty(e->atom, XCB_ATOM_CARDINAL));
+        refreshProperty(SLOT(globalAlpha()), e, XCB_ATOM_CARDINAL);
     } else if (e->atom == ATOM(_MEEGOTOUCH_VIDEO_ALPHA)) {
-        addRequest(SLOT(videoGlobalAlpha()),
-                   requestProperty(e->atom, XCB_ATOM_CARDINAL));
+        refreshProperty(SLOT(videoGlobalAlpha()), e, XCB_ATOM_CARDINAL);
     } else if (e->atom == ATOM(_MEEGOTOUCH_DECORATOR_BUTTONS)) {
-        addRequest(SLOT(buttonGeometryHelper()),
-                   requestProperty(e->atom, XCB_ATOM_CARDINAL, 8));
-        emit meegoDecoratorButtonsChanged(window);
+        if (refreshProperty(SLOT(buttonGeometryHelper()), e,
+                            XCB_ATOM_CARDINAL, 8))
+            emit meegoDecoratorButtonsChanged(window);
     } else if (e->atom == ATOM(_MEEGOTOUCH_ORIENTATION_ANGLE)) {
-        addRequest(SLOT(orientationAngle()),
-              requestProperty(MCompAtoms::_MEEGOTOUCH_ORIENTATION_ANGLE,
-                              XCB_ATOM_CARDINAL));
+        refreshProperty(SLOT(orientationAngle()), e, XCB_ATOM_CARDINAL);
     } else if (e->atom == ATOM(_MEEGOTOUCH_MSTATUSBAR_GEOMETRY)) {
-        addRequest(SLOT(statusbarGeometry()),
-            requestProperty(e->atom, XCB_ATOM_CARDINAL, 4));
+        refreshProperty(SLOT(statusbarGeometry()), e, XCB_ATOM_CARDINAL, 4);
     } else if (e->atom == ATOM(WM_PROTOCOLS)) {
-        addRequest(SLOT(supportedProtocols()),
-                   requestProperty(e->atom, XCB_ATOM_ATOM, 100));
+        refreshProperty(SLOT(supportedProtocols()), e, XCB_ATOM_ATOM, 100);
     } else if (e->atom == ATOM(_NET_WM_STATE)) {
-        addRequest(SLOT(netWmState()),
-                   requestProperty(e->atom, XCB_ATOM_ATOM, 100));
-        return false;
+        refreshProperty(SLOT(netWmState()), e, XCB_ATOM_ATOM, 100);
     } else if (e->atom == ATOM(WM_STATE)) {
-        addRequest(SLOT(windowState()),
-                        requestProperty(e->atom, ATOM(WM_STATE)));
-        return true;
+        refreshProperty(SLOT(windowState()), e, ATOM(WM_STATE));
     } else if (e->atom == ATOM(_MEEGO_STACKING_LAYER)) {
-        addRequest(SLOT(meegoStackingLayer()),
-                   requestProperty(e->atom, XCB_ATOM_CARDINAL));
-        if (window_state == NormalState) {
+        // Raising it again for every change of a storm would just
+        // redo roughSort() and _NET_CLIENT_LIST.
+        if (refreshProperty(SLOT(meegoStackingLayer()), e, XCB_ATOM_CARDINAL)
+            && window_state == NormalState) {
             // raise it so that it becomes on top of same-leveled windows
             MCompositeManager *m = (MCompositeManager*)qApp;
             m->d->positionWindow(window, true);
         }
-        return true;
     } else if (e->atom == ATOM(_MEEGOTOUCH_CUSTOM_REGION)) {
         emit customRegionChanged(this);
     } else if (e->atom == ATOM(WM_NAME)) {
-        addRequest(SLOT(wmName()),
-                   requestProperty(MCompAtoms::WM_NAME, XCB_ATOM_STRING, 100));
+        refreshProperty(SLOT(wmName()), e, XCB_ATOM_STRING, 100);
     }
-    return false;
 }
 
 int MWindowPropertyCache::windowState()
@@ -187,12 +187,17 @@ public slots:
     // WM_NAME
     const QString &wmName();
 
+    //! Returns _NET_WM_PID or 0.  It's only queried when first needed.
+    int pid();
+
 public:
     /*!
-     * Called on PropertyNotify for this window.
-     * Returns true if we should re-check stacking order.
+     * Called on PropertyNotify for this window.  Changes of a property
+     * which the X server makes before it answers our ongoing query about
+     * it are coalesced into that query.  Whether the stacking order needs
+     * to be checked is up to MCompAtoms::propertyEffects().
      */
-    bool propertyEvent(XPropertyEvent *e);
+    void propertyEvent(XPropertyEvent *e);
 
     bool is_valid;
 
@@ -200,9 +205,54 @@ public:
         MWindowPropertyCache::xcb_conn = c;
     }
 
+    /*!
+     * Sets whether the compositor is idle.  While idle no damage objects
+     * are created and no timers are started to collect property replies.
+     */
+    static void setIdle(bool idle) {
+        MWindowPropertyCache::idle = idle;
+    }
+
+    /*!
+     * Stops or restarts collecting the replies of the ongoing queries
+     * in the background according to idle mode.
+     */
+    void suspendCollecting(bool suspend);
+
+    /*!
+     * Statistics of the property requests of all windows, to tell how
+     * much a storm of property changes costs us.
+     */
+    struct RequestStats {
+        //! Number of PropertyNotifys handled, and how many of them
+        //! didn't need a new request because an ongoing one covered them.
+        unsigned property_events, coalesced;
+        //! Number of requests made, and how many of them replaced an
+        //! ongoing one about the same property, whose reply was dropped.
+        unsigned issued, superseded;
+        //! Number of requests cancelled or dropped with their window.
+        unsigned cancelled;
+        //! Number of replies collected by the getters, and by
+        //! @collect_timer after it expired.
+        unsigned collected, collected_by_timer;
+        //! Number of times the expiry of @collect_timer was postponed
+        //! by a new request.
+        unsigned timer_restarts;
+        //! Number of requests whose reply is not collected yet,
+        //! and the highest it has been.
+        unsigned outstanding, outstanding_max;
+        //! Total and longest time between making a request and
+        //! collecting its reply, in microseconds.
+        quint64 wait_usecs, wait_usecs_max;
+    };
+
+    static const RequestStats &requestStats() { return stats; }
+    //! Clears the counters of requestStats() except @outstanding.
+    static void resetRequestStats();
+
     void damageTracking(bool enabled)
     {
-        if (!is_valid || (damage_object && enabled))
+        if (!is_valid || (damage_object && enabled) || (enabled && idle))
             return;
         if (damage_object && !enabled) {
             XDamageDestroy(QX11Info::display(), damage_object);
@@ -248,7 +298,7 @@ private:
     QVector<Atom> type_atoms;
     MCompAtoms::Type window_type;
     Window window, parent_window;
-    int always_mapped, cannot_minimize, desktop_view;
+    int always_mapped, cannot_minimize, desktop_view, wm_pid;
     bool being_mapped, dont_iconify;
     QRegion custom_region;
     unsigned orientation_angle;
@@ -284,6 +334,13 @@ private:
     void replyCollected(const QLatin1String collector);
     void cancelRequest(const QLatin1String collector);
     unsigned requestProperty(Atom prop, Atom type, unsigned n = 1);
+    bool refreshProperty(const char *collector, XPropertyEvent *e,
+                         Atom type, unsigned n = 1);
+
+    // When the requests made by addRequest() were made, for @stats.
+    QHash<const QLatin1String, qint64> request_times;
+    qint64 requestDone(const QLatin1String collector);
+    static RequestStats stats;
 
     // Overloads to make the routines above callable with other types.
     bool isUpdate(const char *collector)
@@ -302,6 +359,7 @@ private:
                                  type, n); }
 
     static xcb_connection_t *xcb_conn;
+    static bool idle;
     static xcb_render_query_pict_formats_reply_t *pict_formats_reply;
     static xcb_render_query_pict_formats_cookie_t pict_formats_cookie;
     Damage damage_object;
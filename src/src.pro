@@ -2,15 +2,19 @@ include(../meegotouch_config.pri)
 
 contains(QT_CONFIG, opengles2) {
      message("building Makefile for EGL/GLES2 version")
-     SOURCES += mtexturepixmapitem_egl.cpp mcompositewindowgroup.cpp
-     HEADERS += mcompositewindowgroup.h
-     publicHeaders.files +=  mcompositewindowgroup.h
+     SOURCES += mtexturepixmapitem_egl.cpp mcompositewindowgroup.cpp \
+                mcompositewindowblureffect.cpp mtextureatlas.cpp
+     HEADERS += mcompositewindowgroup.h mcompositewindowblureffect.h \
+                mtextureatlas.h
+     publicHeaders.files +=  mcompositewindowgroup.h \
+                             mcompositewindowblureffect.h
 } else {
      # Qt wasn't built with EGL/GLES2 support but EGL is present
      # ensure we still use the EGL back-end 
      exists($$QMAKE_INCDIR_OPENGL/EGL) {
          message("building Makefile for EGL/GLES2 version")
-         SOURCES += mtexturepixmapitem_egl.cpp
+         SOURCES += mtexturepixmapitem_egl.cpp mtextureatlas.cpp
+         HEADERS += mtextureatlas.h
          LIBS += -lEGL
      } 
      # Otherwise use GLX backend
@@ -42,7 +46,16 @@ HEADERS += \
     mdecoratorframe.h \
     mcompositemanagerextension.h \
     mcompositewindowshadereffect.h \
-    mcompmgrextensionfactory.h
+    mcompmgrextensionfactory.h \
+    mwindowpingscheduler.h \
+    mresourceaccountant.h \
+    mstackingrules.h \
+    mstackingtrace.h \
+    mscreencapture.h \
+    mscreenlayout.h \
+    mscreenrotation.h \
+    mcapturering.h \
+    xserverpinger.h
 
 SOURCES += \
     mtexturepixmapitem_p.cpp \
@@ -55,7 +68,15 @@ SOURCES += \
     mdevicestate.cpp \
     mdecoratorframe.cpp \
     mcompositemanagerextension.cpp \
-    mcompositewindowshadereffect.cpp
+    mcompositewindowshadereffect.cpp \
+    mwindowpingscheduler.cpp \
+    mresourceaccountant.cpp \
+    mstackingrules.cpp \
+    mstackingtrace.cpp \
+    mscreencapture.cpp \
+    mscreenlayout.cpp \
+    mscreenrotation.cpp \
+    xserverpinger.cpp
 
 RESOURCES = tools.qrc
 
@@ -68,6 +89,8 @@ publicHeaders.files += mcompositewindow.h \
                       mcompositemanager.h \
                       mcompositewindowshadereffect.h \
                       mcompositemanagerextension.h \
+                      mcompositescene.h \
+                      mcapturering.h \
                       mwindowpropertycache.h \
                       mcompatoms_p.h \
                       mcompmgrextensionfactory.h
@@ -77,8 +100,8 @@ INSTALLS += publicHeaders
 target.path += /usr/lib
 INSTALLS += target 
 
-LIBS += -lXdamage -lXcomposite -lXfixes -lX11-xcb -lxcb-render -lxcb-shape \
-        -lXrandr ../decorators/libdecorator/libdecorator.so
+LIBS += -lXdamage -lXcomposite -lXfixes -lXext -lX11-xcb -lxcb -lxcb-render -lxcb-shape \
+        -lXrandr -lrt ../decorators/libdecorator/libdecorator.so
 
 QMAKE_EXTRA_TARGETS += check
 check.depends = $$TARGET
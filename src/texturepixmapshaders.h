@@ -19,20 +19,28 @@
 #ifndef TEXTUREPIXMAPSHADERS_H
 #define TEXTUREPIXMAPSHADERS_H
 
+// inputVertex is scaled by the size and moved to the position given in
+// quadRect (x, y, width, height), so that a single unit quad can be used
+// for all windows.  textureCoord is mapped likewise into texRect, the part
+// of the texture holding the window (see MTextureAtlas).
 static const char* TexpVertShaderSource = "\
     attribute highp vec4 inputVertex; \
-    attribute lowp  vec2 textureCoord; \
+    attribute highp vec2 textureCoord; \
     uniform   highp mat4 matProj; \
     uniform   highp mat4 matWorld; \
-    varying   lowp  vec2 fragTexCoord; \
+    uniform   highp vec4 quadRect; \
+    uniform   highp vec4 texRect; \
+    varying   highp vec2 fragTexCoord; \
     void main(void) \
     {\
-            gl_Position = (matProj * matWorld) * inputVertex;\
-            fragTexCoord = textureCoord; \
+            highp vec4 v = vec4(quadRect.xy + inputVertex.xy * quadRect.zw,\
+                                0.0, 1.0);\
+            gl_Position = (matProj * matWorld) * v;\
+            fragTexCoord = texRect.xy + textureCoord * texRect.zw; \
     }";
 
 static const char* TexpFragShaderSource = "\
-    varying lowp vec2 fragTexCoord;\
+    varying highp vec2 fragTexCoord;\
     uniform sampler2D texture;\
     uniform lowp float opacity;\n\
     void main(void) \
@@ -52,7 +60,7 @@ static const char* TexpCustomShaderSource = "\
 
 #if 0
 static const char *AlphaTestFragShaderSource = "\
-    varying lowp vec2 fragTexCoord;\
+    varying highp vec2 fragTexCoord;\
     uniform sampler2D texture0;\
     void main(void) \
     {\
@@ -66,7 +74,7 @@ static const char *AlphaTestFragShaderSource = "\
 #endif
 
 static const char *blurshader = "\
-varying lowp vec2 fragTexCoord;\
+varying highp vec2 fragTexCoord;\
 uniform sampler2D texture0;\
 uniform mediump float blurstep;\
 void main(void)\
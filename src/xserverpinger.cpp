@@ -0,0 +1,219 @@
+// Instances of XServerPinger send some simple X requests periodically
+// and measure how long the replies take.  They warn if no reply arrives
+// until the next ping.
+#include "xserverpinger.h"
+
+#include <QMutexLocker>
+#include <QtDebug>
+
+#include <xcb/xcb.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// Returns the current time in microseconds.
+static qint64 now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Ping X in @pingInterval miliseconds.
+XServerPinger::XServerPinger(int pingInterval, QObject *parent)
+    : QThread(parent),
+      interval(pingInterval),
+      suspended(0),
+      quit(0)
+{
+    doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    resetStats();
+}
+
+XServerPinger::~XServerPinger()
+{
+    quit = 1;
+    wakeUp();
+    wait();
+    close(doorbell);
+}
+
+void XServerPinger::wakeUp()
+{
+    quint64 one = 1;
+    if (::write(doorbell, &one, sizeof(one)) < 0)
+        qWarning("XServerPinger: couldn't wake up the thread");
+}
+
+void XServerPinger::setSuspended(bool s)
+{
+    suspended = s;
+    wakeUp();
+}
+
+// Returns the index of the histogram bucket @usecs is counted in.
+int XServerPinger::bucket(unsigned usecs)
+{
+    int e;
+
+    if (usecs < (unsigned)SubBuckets)
+        return usecs;
+    // @e is the position of the highest bit, and the next @SubBits bits
+    // select the bucket within that power of two
+    for (e = SubBits; e < 31 && usecs >> (e + 1); e++)
+        ;
+    return (e - SubBits + 1) * SubBuckets
+        + ((usecs >> (e - SubBits)) & (SubBuckets - 1));
+}
+
+// Returns the smallest latency counted in @histogram[@i].
+unsigned XServerPinger::bucketStart(int i)
+{
+    if (i < 2 * SubBuckets)
+        return i;
+    int e = i / SubBuckets + SubBits - 1;
+    return (unsigned)(SubBuckets + i % SubBuckets) << (e - SubBits);
+}
+
+void XServerPinger::addSample(unsigned usecs)
+{
+    int i = bucket(usecs);
+
+    QMutexLocker locker(&lock);
+    histogram[i]++;
+    if (usecs > max_latency)
+        max_latency = usecs;
+}
+
+XServerPinger::Stats XServerPinger::stats()
+{
+    Stats ret;
+    unsigned sum, n50, n99;
+    int i;
+
+    QMutexLocker locker(&lock);
+    ret.pings = 0;
+    for (i = 0; i < HistogramSize; i++)
+        ret.pings += histogram[i];
+    ret.timeouts = timeouts;
+    ret.max = max_latency;
+    ret.interval = interval;
+
+    // Find the buckets of the percentiles and take their upper bounds,
+    // but nothing took longer than @max.
+    ret.p50 = ret.p99 = 0;
+    n50 = (ret.pings * 50 + 99) / 100;
+    n99 = (ret.pings * 99 + 99) / 100;
+    for (i = sum = 0; i < HistogramSize && sum < n99; i++) {
+        unsigned end = i < HistogramSize-1 ? bucketStart(i+1) : ret.max;
+
+        sum += histogram[i];
+        if (!ret.p50 && sum >= n50 && n50)
+            ret.p50 = qMin(end, ret.max);
+        if (sum >= n99)
+            ret.p99 = qMin(end, ret.max);
+    }
+    return ret;
+}
+
+void XServerPinger::resetStats()
+{
+    QMutexLocker locker(&lock);
+    memset(histogram, 0, sizeof(histogram));
+    timeouts = max_latency = 0;
+}
+
+void XServerPinger::run()
+{
+    xcb_connection_t *xcb;
+    xcb_get_input_focus_cookie_t request;
+    struct pollfd fds[2];
+    qint64 next, sent = 0;
+    bool pending, late;
+
+    // Open a separate connection to X.
+    xcb = xcb_connect(NULL, NULL);
+    if (xcb_connection_has_error(xcb)) {
+        qWarning("XServerPinger: couldn't connect to X");
+        xcb_disconnect(xcb);
+        return;
+    }
+
+    fds[0].fd = xcb_get_file_descriptor(xcb);
+    fds[0].events = POLLIN;
+    fds[1].fd = doorbell;
+    fds[1].events = POLLIN;
+
+    pending = late = false;
+    next = now();
+    while (!quit) {
+        qint64 t = now();
+        int timeout;
+
+        if (!pending && !suspended && t >= next) {
+            // XGetInputFocus() is our ping request.
+            request = xcb_get_input_focus(xcb);
+            xcb_flush(xcb);
+            sent = t;
+            next = t + interval * 1000;
+            pending = true;
+            late = false;
+        }
+
+        // Sleep until the next ping is due or the current one is late,
+        // or forever if there's nothing to do.
+        if (pending && late)
+            timeout = -1;
+        else if (pending)
+            timeout = qMax((sent + interval * 1000 - t + 999) / 1000, 0LL);
+        else if (suspended)
+            timeout = -1;
+        else
+            timeout = qMax((next - t + 999) / 1000, 0LL);
+        if (poll(fds, 2, timeout) < 0)
+            continue;
+
+        if (fds[1].revents) {
+            quint64 cnt;
+            if (::read(doorbell, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+                qWarning("XServerPinger: couldn't read the doorbell");
+        }
+
+        // X has sent us something, read it.
+        xcb_generic_event_t *event;
+        while ((event = xcb_poll_for_event(xcb)) != NULL)
+            // Some event, ignore it
+            free(event);
+        if (xcb_connection_has_error(xcb)) {
+            qWarning("XServerPinger: lost the connection to X");
+            break;
+        }
+
+        if (pending) {
+            void *reply;
+            xcb_generic_error_t *error;
+
+            if (xcb_poll_for_reply(xcb, request.sequence, &reply, &error)) {
+                addSample(now() - sent);
+                if (reply)
+                    free(reply);
+                else if (error)
+                    // Ignore
+                    free(error);
+                pending = false;
+            } else if (!late && now() - sent >= interval * 1000) {
+                // Ping timed out
+                qWarning("X is on holidays");
+                late = true;
+                QMutexLocker locker(&lock);
+                timeouts++;
+            }
+        }
+    }
+
+    xcb_disconnect(xcb);
+}
@@ -0,0 +1,77 @@
+#ifndef XSERVERPINGER_H
+#define XSERVERPINGER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QAtomicInt>
+
+#include <xcb/xcb.h>
+
+/*!
+ * Thread sending a simple request to the X server periodically on its
+ * own connection, and measuring how long the replies take to arrive.
+ * The round-trip latencies are collected in a histogram.
+ */
+class XServerPinger: public QThread
+{
+    Q_OBJECT
+
+public:
+    //! Latency statistics, in microseconds.
+    struct Stats {
+        //! Number of pings replied.
+        unsigned pings;
+        //! Number of pings not replied within the interval.
+        unsigned timeouts;
+        //! The latencies half and 99% of the pings were replied within.
+        //! These are rounded up by less than 1/8th.
+        unsigned p50, p99;
+        //! The longest latency.
+        unsigned max;
+        //! The time between the pings, in milliseconds.
+        unsigned interval;
+    };
+
+    /*!
+     * Prepares to ping X in \a pingInterval milliseconds.
+     * The thread needs to be start()ed.
+     */
+    XServerPinger(int pingInterval, QObject *parent = 0);
+    ~XServerPinger();
+
+    Stats stats();
+    void resetStats();
+
+    /*!
+     * Stops or resumes pinging.  The replies to the ongoing ping is
+     * still waited for.
+     */
+    void setSuspended(bool suspended);
+
+protected:
+    void run();
+
+private:
+    void wakeUp();
+    void addSample(unsigned usecs);
+    static int bucket(unsigned usecs);
+    static unsigned bucketStart(int i);
+
+    // Every power of two is split into SubBuckets linear buckets, so the
+    // latencies in [bucketStart(i), bucketStart(i+1)) microseconds are
+    // counted in @histogram[i].  Below 2*SubBuckets each bucket is 1 us.
+    static const int SubBits = 3;
+    static const int SubBuckets = 1 << SubBits;
+    static const int HistogramSize = (32 - SubBits + 1) * SubBuckets;
+
+    int interval;
+    // eventfd to wake up run() when @suspended or @quit changes
+    int doorbell;
+    QAtomicInt suspended, quit;
+
+    QMutex lock;
+    unsigned histogram[HistogramSize];
+    unsigned timeouts, max_latency;
+};
+
+#endif // ! XSERVERPINGER_H
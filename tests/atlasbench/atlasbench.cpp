@@ -0,0 +1,243 @@
+/* Benchmark of drawing many small windows, like notification bubbles
+ * and status indicators.  Maps 30 small override-redirect windows and
+ * repaints all of them at 30 Hz, then prints the frame statistics,
+ * including the draw calls, and the CPU time of mcompositor meanwhile.  Compare the results of
+ * "mcompositor" and "mcompositor -atlas" to see the effect of the
+ * texture atlas, including the cost of copying the pixels into it.
+ *
+ * The statistics are exported through the remote control interface,
+ * which is /tmp/mrc if mcompositor was built with WINDOW_DEBUG and is
+ * in its private runtime directory otherwise.
+ *
+ * Usage: atlasbench [<seconds>]
+ *
+ * Compiling standalone:
+ * g++ -lQtCore -lX11 -Wall -I/usr/include/qt4/QtCore/ -I/usr/include/qt4/ atlasbench.cpp -o atlasbench
+ *
+ * */
+
+#include <QtCore>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#define NWINDOWS  30
+#define WIN_W     64
+#define WIN_H     48
+#define FPS       30
+#define RC_PIPE   "/tmp/mrc"
+#define STATS_LOG "/tmp/atlasbench.json"
+
+/* The remote control pipe and the file mcompositor exports its state
+ * into, and the command to do so. */
+static QByteArray rc_pipe, state_file, export_cmd;
+
+/* Finds out which remote control interface mcompositor has.  The one
+ * of a release build is in a directory of our user and display. */
+static void find_remote_control (void)
+{
+  const char *xdg = getenv ("XDG_RUNTIME_DIR");
+  QByteArray display (getenv ("DISPLAY"));
+  int colon = display.lastIndexOf (':');
+  int dot = display.indexOf ('.', colon < 0 ? 0 : colon);
+
+  /* without the screen number */
+  if (dot >= 0)
+    display.truncate (dot);
+  display.replace ('/', '_');
+  QByteArray dir = xdg && *xdg
+    ? QByteArray (xdg) + "/mcompositor-" + display
+    : "/tmp/mcompositor-" + QByteArray::number (getuid ()) + '-' + display;
+
+  if (access ((dir + "/mrc").constData (), W_OK) == 0)
+    {
+      /* a release build only exports into its own directory */
+      rc_pipe = dir + "/mrc";
+      state_file = dir + "/state.json";
+      export_cmd = "export\n";
+    }
+  else
+    {
+      rc_pipe = RC_PIPE;
+      state_file = STATS_LOG;
+      export_cmd = "export " STATS_LOG "\n";
+    }
+}
+
+/* Sends @cmd to the remote control interface of mcompositor. */
+static bool remote_control (const char *cmd)
+{
+  int fd;
+  bool ret;
+
+  if ((fd = open (rc_pipe.constData (), O_WRONLY | O_NONBLOCK)) < 0)
+    {
+      perror (rc_pipe.constData ());
+      return false;
+    }
+  ret = write (fd, cmd, strlen (cmd)) == (ssize_t)strlen (cmd);
+  close (fd);
+  return ret;
+}
+
+/* Returns the number after "@key": in @json, or -1. */
+static qlonglong json_number (const QByteArray &json, const char *key)
+{
+  QByteArray pattern = QByteArray ("\"") + key + "\":";
+  int i = json.indexOf (pattern);
+  return i < 0 ? -1 : atoll (json.constData () + i + pattern.size ());
+}
+
+/* Asks mcompositor to export its state and returns the number of frames
+ * it has drawn, their draw calls and the time they took.  Returns false
+ * if it didn't answer in a second. */
+static bool compositor_frames (qlonglong *frames, qlonglong *draw_calls,
+                               qlonglong *usecs)
+{
+  QFile log (state_file);
+  QByteArray json;
+  int i;
+
+  log.remove ();
+  if (!remote_control (export_cmd.constData ()))
+    return false;
+  for (i = 0; i < 1000 && !log.open (QIODevice::ReadOnly); i++)
+    usleep (1000);
+  if (!log.isOpen ())
+    {
+      fprintf (stderr, "%s: mcompositor didn't export its state\n",
+               state_file.constData ());
+      return false;
+    }
+  json = log.readAll ();
+
+  /* the window list may contain anything, look after it */
+  if ((i = json.indexOf ("\"frames\":")) < 0)
+    return false;
+  json = json.mid (i);
+  *frames = json_number (json, "count");
+  *draw_calls = json_number (json, "draw_calls");
+  *usecs = json_number (json, "total_usecs");
+  return true;
+}
+
+/* Returns the user and system time mcompositor has used so far in
+ * microseconds, or 0 if it's not running. */
+static qlonglong compositor_cpu (void)
+{
+  char fname[300], buf[1024], *p;
+  unsigned long utime, stime;
+  qlonglong cpu = 0;
+  struct dirent *de;
+  DIR *dir;
+  FILE *f;
+
+  if (!(dir = opendir ("/proc")))
+    return 0;
+  while (!cpu && (de = readdir (dir)) != NULL)
+    {
+      if (!atoi (de->d_name))
+        continue;
+      snprintf (fname, sizeof (fname), "/proc/%s/comm", de->d_name);
+      if (!(f = fopen (fname, "r")))
+        continue;
+      p = fgets (buf, sizeof (buf), f);
+      fclose (f);
+      if (!p || strcmp (buf, "mcompositor\n"))
+        continue;
+
+      /* skip the pid and the command name, which may contain spaces */
+      snprintf (fname, sizeof (fname), "/proc/%s/stat", de->d_name);
+      if (!(f = fopen (fname, "r")))
+        continue;
+      if (fgets (buf, sizeof (buf), f) && (p = strrchr (buf, ')'))
+          && sscanf (p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                     "%lu %lu", &utime, &stime) == 2)
+        cpu = (utime + stime) * 1000000LL / sysconf (_SC_CLK_TCK);
+      fclose (f);
+    }
+  closedir (dir);
+  return cpu;
+}
+
+int main (int argc, char *argv[])
+{
+  Display *dpy;
+  Window wins[NWINDOWS];
+  XSetWindowAttributes attrs;
+  GC gc;
+  int seconds, frame, i;
+  qlonglong frames0, calls0, usecs0, cpu0, frames, calls, usecs, cpu;
+
+  seconds = argc > 1 ? atoi (argv[1]) : 10;
+  if (seconds <= 0)
+    {
+      fprintf (stderr, "usage: %s [<seconds>]\n", argv[0]);
+      return 1;
+    }
+
+  if (!(dpy = XOpenDisplay (NULL)))
+    {
+      fprintf (stderr, "couldn't open display\n");
+      return 1;
+    }
+
+  /* Lay out the windows in a grid, with gaps between them so that
+   * each of them is drawn separately. */
+  attrs.override_redirect = True;
+  attrs.background_pixel = BlackPixel (dpy, DefaultScreen (dpy));
+  for (i = 0; i < NWINDOWS; i++)
+    {
+      wins[i] = XCreateWindow (dpy, DefaultRootWindow (dpy),
+                               16 + (i % 6) * (WIN_W + 16),
+                               16 + (i / 6) * (WIN_H + 16),
+                               WIN_W, WIN_H, 0, CopyFromParent,
+                               InputOutput, CopyFromParent,
+                               CWOverrideRedirect | CWBackPixel, &attrs);
+      XMapWindow (dpy, wins[i]);
+    }
+  gc = XCreateGC (dpy, wins[0], 0, NULL);
+  XSync (dpy, False);
+
+  /* Let mcompositor settle down before measuring. */
+  sleep (1);
+  find_remote_control ();
+  if (!compositor_frames (&frames0, &calls0, &usecs0))
+    return 1;
+  cpu0 = compositor_cpu ();
+
+  for (frame = 0; frame < seconds * FPS; frame++)
+    {
+      for (i = 0; i < NWINDOWS; i++)
+        {
+          XSetForeground (dpy, gc, ((frame + i) * 0x010204) & 0xffffff);
+          XFillRectangle (dpy, wins[i], gc, 0, 0, WIN_W, WIN_H);
+        }
+      XSync (dpy, False);
+      usleep (1000000 / FPS);
+    }
+
+  if (!compositor_frames (&frames, &calls, &usecs))
+    return 1;
+  cpu = compositor_cpu () - cpu0;
+  frames -= frames0;
+  calls -= calls0;
+  usecs -= usecs0;
+  printf ("%d windows, %d s: %lld frames, %.1f draw calls/frame, "
+          "%lld us/frame, %lld us CPU/repaint\n", NWINDOWS, seconds, frames,
+          frames > 0 ? (double)calls / frames : 0,
+          frames > 0 ? usecs / frames : 0,
+          cpu / (seconds * FPS * NWINDOWS));
+
+  XFreeGC (dpy, gc);
+  for (i = 0; i < NWINDOWS; i++)
+    XDestroyWindow (dpy, wins[i]);
+  XCloseDisplay (dpy);
+  return 0;
+}
@@ -0,0 +1,18 @@
+TEMPLATE = app
+TARGET = atlasbench
+
+target.path=/usr/bin
+
+QMAKE_CXXFLAGS+= -Wall
+QMAKE_CFLAGS+= -Wall
+
+QT -= gui
+LIBS+=-lX11
+
+DEPENDPATH += .
+INCLUDEPATH += .  
+
+SOURCES += atlasbench.cpp
+
+INSTALLS +=  \
+        target
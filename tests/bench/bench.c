@@ -0,0 +1,814 @@
+/* Benchmark suite of mcompositor.  Drives scripted client workloads
+ * through XCB and reports how mcompositor coped with them, one JSON
+ * object per line per workload:
+ *
+ *   mapstorm    maps and unmaps 30 managed windows over and over
+ *   damage30,   repaints 10 small windows at a fixed rate
+ *   damage60,
+ *   damage120
+ *   properties  changes the names of 20 managed windows as fast as
+ *               the X server takes it
+ *   propstorm   changes WM_NAME, _NET_WM_STATE, the orientation angle
+ *               and the stacking layer of 10 managed windows as fast
+ *               as the X server takes it
+ *   titleclock  changes the WM_NAME of a managed window 10 times
+ *               a second, like a clock in the title would
+ *   switch      switches between 4 full-screen applications with
+ *               _NET_ACTIVE_WINDOW
+ *   shaped      repaints a mix of shaped and rectangular windows
+ *
+ * Every workload reports
+ *
+ *   events          the number of requests it made
+ *   frames          the number of frames mcompositor drew meanwhile,
+ *   frame_usecs     their average and
+ *   frame_usecs_max longest drawing time
+ *   latency_usecs   how long it took for a change to appear on the
+ *                   screen, measured by polling the pixels of the root
+ *                   window: after each repaint in the damage and shaped
+ *                   workloads, after each switch, and once at the end
+ *                   of the storms
+ *   cpu_usecs_per_event  the CPU time mcompositor used per event
+ *   rss_kb          the resident memory of mcompositor afterwards
+ *   properties      how mcompositor's property caches coped: the number
+ *                   of PropertyNotifys, how many of them an ongoing
+ *                   request covered, the number of requests, how many
+ *                   requests replaced an unanswered one, how many
+ *                   replies were collected by the getters and how many
+ *                   after the 5 s timeout, how many times that timeout
+ *                   was postponed, the most requests unanswered at once
+ *                   and the average and longest time a reply was
+ *                   waited for
+ *
+ * The frame statistics are read from the state exported through the
+ * remote control interface, /tmp/mrc if mcompositor was built with
+ * WINDOW_DEBUG and in its private runtime directory otherwise, where it
+ * also exports the state into.  mcompositor-bench-xvfb runs the
+ * suite on a private Xvfb server with Mesa's software renderer.
+ *
+ * Usage: mcompositor-bench [-t <seconds>] [-p <pid>] [<workload>...]
+ *
+ * Compiling standalone:
+ * gcc -Wall bench.c -o mcompositor-bench -lxcb -lxcb-shape
+ *
+ * */
+
+#include <xcb/xcb.h>
+#include <xcb/shape.h>
+#include <sys/types.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+
+#define RC_PIPE      "/tmp/mrc"
+#define STATE_FILE   "/tmp/mcompositor-bench.json"
+#define PROBE_SIZE   8
+/* Give up waiting for a change to appear on the screen after this. */
+#define LATENCY_TIMEOUT 1000000
+#define MAX_SAMPLES  8192
+#define MAX_WINDOWS  32
+
+/* The remote control pipe of mcompositor, the file it exports its
+ * state into and the command to do so. */
+static char rc_pipe[256], state_file[256], export_cmd[300];
+
+static xcb_connection_t *conn;
+static xcb_screen_t *screen;
+static xcb_gcontext_t gc;
+static pid_t compositor;
+static int seconds = 5;
+
+/* A small override-redirect window in the bottom right corner whose
+ * colour is changed to measure the latency of the compositor. */
+static xcb_window_t probe;
+static unsigned probe_color;
+
+static xcb_atom_t net_active_window, net_wm_name, utf8_string,
+  net_wm_window_type, net_wm_window_type_normal, net_wm_state,
+  net_wm_state_skip_taskbar, orientation_angle, stacking_layer;
+
+/* The request statistics of the property caches of mcompositor,
+ * from "properties" of the exported state. */
+struct properties
+{
+  long long events, coalesced, requests, superseded, collected, collected_by_timer,
+    timer_restarts, outstanding_max, wait_usecs, wait_usecs_max;
+};
+
+/* Measurements of the current workload. */
+static struct
+{
+  const char *name;
+  unsigned events;
+  long long start, cpu, frames, frame_usecs;
+  struct properties props;
+  unsigned latencies[MAX_SAMPLES];
+  unsigned nlatencies, timeouts;
+} result;
+
+static long long now_usecs (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static xcb_atom_t intern (const char *name)
+{
+  xcb_intern_atom_reply_t *reply;
+  xcb_atom_t atom;
+
+  reply = xcb_intern_atom_reply (conn,
+                                 xcb_intern_atom (conn, 0, strlen (name),
+                                                  name), NULL);
+  atom = reply ? reply->atom : XCB_ATOM_NONE;
+  free (reply);
+  return atom;
+}
+
+/* Makes sure the X server has processed everything we sent. */
+static void roundtrip (void)
+{
+  free (xcb_get_input_focus_reply (conn, xcb_get_input_focus (conn), NULL));
+}
+
+/* Finds out which remote control interface mcompositor has.  The one
+ * of a release build is in a directory of our user and display, like
+ * runtime_dir() of mcompositor names it. */
+static void find_remote_control (void)
+{
+  const char *xdg = getenv ("XDG_RUNTIME_DIR");
+  char dir[200], display[64], *p;
+
+  snprintf (display, sizeof (display), "%s",
+            getenv ("DISPLAY") ? getenv ("DISPLAY") : "");
+  /* without the screen number */
+  if ((p = strchr (strrchr (display, ':') ? strrchr (display, ':') : display,
+                   '.')))
+    *p = '\0';
+  while ((p = strchr (display, '/')))
+    *p = '_';
+
+  if (xdg && *xdg)
+    snprintf (dir, sizeof (dir), "%s/mcompositor-%s", xdg, display);
+  else
+    snprintf (dir, sizeof (dir), "/tmp/mcompositor-%u-%s",
+              (unsigned) getuid (), display);
+  snprintf (rc_pipe, sizeof (rc_pipe), "%s/mrc", dir);
+  if (access (rc_pipe, W_OK) == 0)
+    {
+      /* a release build only exports into its own directory */
+      snprintf (state_file, sizeof (state_file), "%s/state.json", dir);
+      strcpy (export_cmd, "export\n");
+    }
+  else
+    {
+      strcpy (rc_pipe, RC_PIPE);
+      strcpy (state_file, STATE_FILE);
+      snprintf (export_cmd, sizeof (export_cmd), "export %s\n", STATE_FILE);
+    }
+}
+
+/* Sends @cmd to the remote control interface of mcompositor. */
+static int remote_control (const char *cmd)
+{
+  int fd, ret;
+
+  if ((fd = open (rc_pipe, O_WRONLY | O_NONBLOCK)) < 0)
+    {
+      perror (rc_pipe);
+      return 0;
+    }
+  ret = write (fd, cmd, strlen (cmd)) == (ssize_t)strlen (cmd);
+  close (fd);
+  return ret;
+}
+
+/* Returns the number after "@key": in @json, or -1. */
+static long long json_number (const char *json, const char *key)
+{
+  char pattern[64];
+  const char *p;
+
+  snprintf (pattern, sizeof (pattern), "\"%s\":", key);
+  if (!(p = strstr (json, pattern)))
+    return -1;
+  return atoll (p + strlen (pattern));
+}
+
+/* Asks mcompositor to export its state and returns the frame and
+ * property request statistics from it.  Returns false if it didn't
+ * answer in a second. */
+static int compositor_frames (long long *frames, long long *usecs,
+                              long long *max_usecs, struct properties *props)
+{
+  char buf[65536], *p;
+  long long until;
+  ssize_t len;
+  int fd;
+
+  unlink (state_file);
+  if (!remote_control (export_cmd))
+    return 0;
+  for (until = now_usecs () + 1000000; (fd = open (state_file, O_RDONLY)) < 0; )
+    {
+      if (now_usecs () > until)
+        {
+          fprintf (stderr, "mcompositor didn't export its state\n");
+          return 0;
+        }
+      usleep (1000);
+    }
+  len = read (fd, buf, sizeof (buf) - 1);
+  close (fd);
+  buf[len > 0 ? len : 0] = '\0';
+
+  /* the window list may contain anything, look after it */
+  if (!(p = strstr (buf, "\"frames\":")))
+    return 0;
+  *frames = json_number (p, "count");
+  *usecs = json_number (p, "total_usecs");
+  *max_usecs = json_number (p, "max_usecs");
+
+  memset (props, 0, sizeof (*props));
+  if ((p = strstr (buf, "\"properties\":")))
+    {
+      props->events = json_number (p, "events");
+      props->coalesced = json_number (p, "coalesced");
+      props->requests = json_number (p, "requests");
+      props->superseded = json_number (p, "superseded");
+      props->collected = json_number (p, "collected");
+      props->collected_by_timer = json_number (p, "collected_by_timer");
+      props->timer_restarts = json_number (p, "timer_restarts");
+      props->outstanding_max = json_number (p, "outstanding_max");
+      props->wait_usecs = json_number (p, "wait_usecs");
+      props->wait_usecs_max = json_number (p, "wait_usecs_max");
+    }
+  return 1;
+}
+
+/* Returns the user and system time the compositor has used so far,
+ * in microseconds, and its resident set size in KiB. */
+static void compositor_usage (long long *cpu, long *rss)
+{
+  char fname[64], buf[1024], *p;
+  unsigned long utime, stime;
+  FILE *f;
+
+  *cpu = *rss = 0;
+  snprintf (fname, sizeof (fname), "/proc/%d/stat", compositor);
+  if ((f = fopen (fname, "r")) != NULL)
+    {
+      /* skip the pid and the command name, which may contain spaces */
+      if (fgets (buf, sizeof (buf), f) && (p = strrchr (buf, ')'))
+          && sscanf (p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                     "%lu %lu", &utime, &stime) == 2)
+        *cpu = (utime + stime) * 1000000LL / sysconf (_SC_CLK_TCK);
+      fclose (f);
+    }
+
+  snprintf (fname, sizeof (fname), "/proc/%d/status", compositor);
+  if ((f = fopen (fname, "r")) != NULL)
+    {
+      while (fgets (buf, sizeof (buf), f))
+        if (sscanf (buf, "VmRSS: %ld", rss) == 1)
+          break;
+      fclose (f);
+    }
+}
+
+/* Returns the pid of the running mcompositor, or 0. */
+static pid_t find_compositor (void)
+{
+  char fname[300], comm[64];
+  struct dirent *de;
+  pid_t pid = 0;
+  DIR *dir;
+  FILE *f;
+
+  if (!(dir = opendir ("/proc")))
+    return 0;
+  while (!pid && (de = readdir (dir)) != NULL)
+    {
+      if (!atoi (de->d_name))
+        continue;
+      snprintf (fname, sizeof (fname), "/proc/%s/comm", de->d_name);
+      if (!(f = fopen (fname, "r")))
+        continue;
+      if (fgets (comm, sizeof (comm), f) && !strcmp (comm, "mcompositor\n"))
+        pid = atoi (de->d_name);
+      fclose (f);
+    }
+  closedir (dir);
+  return pid;
+}
+
+static xcb_window_t create_window (int x, int y, int w, int h,
+                                   unsigned color, int override_redirect)
+{
+  uint32_t values[] = { color, override_redirect };
+  xcb_window_t win;
+
+  win = xcb_generate_id (conn);
+  xcb_create_window (conn, XCB_COPY_FROM_PARENT, win, screen->root,
+                     x, y, w, h, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
+                     XCB_COPY_FROM_PARENT,
+                     XCB_CW_BACK_PIXEL | XCB_CW_OVERRIDE_REDIRECT, values);
+  if (!override_redirect)
+    xcb_change_property (conn, XCB_PROP_MODE_REPLACE, win,
+                         net_wm_window_type, XCB_ATOM_ATOM, 32, 1,
+                         &net_wm_window_type_normal);
+  return win;
+}
+
+static void fill_window (xcb_window_t win, int w, int h, unsigned color)
+{
+  xcb_rectangle_t rect = { 0, 0, w, h };
+
+  xcb_change_gc (conn, gc, XCB_GC_FOREGROUND, &color);
+  xcb_poly_fill_rectangle (conn, win, gc, 1, &rect);
+}
+
+/* Waits until the pixel at @x, @y of the screen is @color.
+ * Returns how long it took in microseconds, or -1 on timeout. */
+static long wait_for_pixel (int x, int y, unsigned color, long long since)
+{
+  xcb_get_image_reply_t *img;
+  unsigned pixel;
+
+  for (;;)
+    {
+      img = xcb_get_image_reply (conn,
+                                 xcb_get_image (conn, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                                screen->root, x, y, 1, 1,
+                                                ~0), NULL);
+      pixel = 0;
+      if (img && xcb_get_image_data_length (img) >= 4)
+        memcpy (&pixel, xcb_get_image_data (img), 4);
+      free (img);
+      if ((pixel & 0xffffff) == color)
+        return now_usecs () - since;
+      if (now_usecs () - since > LATENCY_TIMEOUT)
+        return -1;
+      usleep (100);
+    }
+}
+
+static void add_latency (long usecs)
+{
+  if (usecs < 0)
+    result.timeouts++;
+  else if (result.nlatencies < MAX_SAMPLES)
+    result.latencies[result.nlatencies++] = usecs;
+}
+
+/* Changes the colour of the probe and waits until it's on the screen. */
+static void measure_latency (void)
+{
+  long long t0;
+
+  probe_color = probe_color == 0xff0000 ? 0x00ff00 : 0xff0000;
+  fill_window (probe, PROBE_SIZE, PROBE_SIZE, probe_color);
+  xcb_flush (conn);
+  t0 = now_usecs ();
+  add_latency (wait_for_pixel (screen->width_in_pixels - PROBE_SIZE / 2,
+                               screen->height_in_pixels - PROBE_SIZE / 2,
+                               probe_color, t0));
+}
+
+/* Brings the probe above the windows mapped by the workload. */
+static void raise_probe (void)
+{
+  uint32_t above = XCB_STACK_MODE_ABOVE;
+
+  xcb_configure_window (conn, probe, XCB_CONFIG_WINDOW_STACK_MODE, &above);
+  roundtrip ();
+}
+
+static void begin (const char *name)
+{
+  long long max_usecs;
+  long rss;
+
+  memset (&result, 0, sizeof (result));
+  result.name = name;
+
+  /* makes the maxima of this workload's own; the counters are
+   * differences from the baseline export below either way */
+  remote_control ("stats reset\n");
+  compositor_frames (&result.frames, &result.frame_usecs, &max_usecs,
+                     &result.props);
+  compositor_usage (&result.cpu, &rss);
+  result.start = now_usecs ();
+}
+
+static int cmp_unsigned (const void *a, const void *b)
+{
+  unsigned x = *(const unsigned *)a, y = *(const unsigned *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void end (void)
+{
+  long long frames, frame_usecs, max_usecs, cpu, usecs;
+  struct properties props;
+  unsigned n = result.nlatencies;
+  long rss;
+
+  usecs = now_usecs () - result.start;
+  compositor_usage (&cpu, &rss);
+  if (!compositor_frames (&frames, &frame_usecs, &max_usecs, &props))
+    {
+      frames = frame_usecs = max_usecs = result.frames = result.frame_usecs = 0;
+      memset (&props, 0, sizeof (props));
+      memset (&result.props, 0, sizeof (result.props));
+    }
+  frames -= result.frames;
+  frame_usecs -= result.frame_usecs;
+  cpu -= result.cpu;
+  props.events -= result.props.events;
+  props.coalesced -= result.props.coalesced;
+  props.requests -= result.props.requests;
+  props.superseded -= result.props.superseded;
+  props.collected -= result.props.collected;
+  props.collected_by_timer -= result.props.collected_by_timer;
+  props.timer_restarts -= result.props.timer_restarts;
+  props.wait_usecs -= result.props.wait_usecs;
+  qsort (result.latencies, n, sizeof (result.latencies[0]), cmp_unsigned);
+
+  printf ("{\"workload\":\"%s\",\"events\":%u,\"usecs\":%lld,"
+          "\"frames\":%lld,\"frame_usecs\":%lld,\"frame_usecs_max\":%lld,"
+          "\"latency_usecs\":{\"samples\":%u,\"timeouts\":%u,"
+          "\"p50\":%u,\"p99\":%u,\"max\":%u},"
+          "\"cpu_usecs_per_event\":%.1f,\"rss_kb\":%ld,"
+          "\"properties\":{\"events\":%lld,\"coalesced\":%lld,"
+          "\"requests\":%lld,"
+          "\"superseded\":%lld,\"collected\":%lld,"
+          "\"collected_by_timer\":%lld,\"timer_restarts\":%lld,"
+          "\"outstanding_max\":%lld,\"wait_usecs\":%lld,"
+          "\"wait_usecs_max\":%lld}}\n",
+          result.name, result.events, usecs,
+          frames, frames > 0 ? frame_usecs / frames : 0, max_usecs,
+          n, result.timeouts,
+          n ? result.latencies[n / 2] : 0,
+          n ? result.latencies[n * 99 / 100] : 0,
+          n ? result.latencies[n - 1] : 0,
+          result.events ? (double)cpu / result.events : 0, rss,
+          props.events, props.coalesced, props.requests, props.superseded, props.collected,
+          props.collected_by_timer, props.timer_restarts,
+          props.outstanding_max,
+          props.collected + props.collected_by_timer > 0
+            ? props.wait_usecs / (props.collected + props.collected_by_timer)
+            : 0,
+          props.wait_usecs_max);
+  fflush (stdout);
+}
+
+static void destroy_windows (xcb_window_t *wins, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    xcb_destroy_window (conn, wins[i]);
+  roundtrip ();
+  /* let mcompositor forget about them before the next workload */
+  sleep (1);
+}
+
+static void mapstorm (void)
+{
+  xcb_window_t wins[30];
+  long long until;
+  int i;
+
+  for (i = 0; i < 30; i++)
+    wins[i] = create_window ((i % 6) * 120, (i / 6) * 80, 160, 120,
+                             i * 0x080402, 0);
+  roundtrip ();
+
+  begin ("mapstorm");
+  for (until = now_usecs () + seconds * 1000000LL; now_usecs () < until; )
+    {
+      for (i = 0; i < 30; i++)
+        xcb_map_window (conn, wins[i]);
+      for (i = 0; i < 30; i++)
+        xcb_unmap_window (conn, wins[i]);
+      result.events += 60;
+      roundtrip ();
+    }
+  raise_probe ();
+  measure_latency ();
+  end ();
+
+  destroy_windows (wins, 30);
+}
+
+/* Repaints 10 windows and the probe @fps times a second.  If @shaped,
+ * every second window is cross-shaped. */
+static void damage (const char *name, int fps, int shaped)
+{
+  xcb_window_t wins[10];
+  long long until, next;
+  int i, frame;
+
+  for (i = 0; i < 10; i++)
+    {
+      wins[i] = create_window (16 + (i % 5) * 112, 16 + (i / 5) * 112,
+                               96, 96, 0, 1);
+      if (shaped && i % 2)
+        {
+          xcb_rectangle_t cross[] = { { 32, 0, 32, 96 }, { 0, 32, 96, 32 } };
+          xcb_shape_rectangles (conn, XCB_SHAPE_SO_SET, XCB_SHAPE_SK_BOUNDING,
+                                XCB_CLIP_ORDERING_UNSORTED, wins[i], 0, 0,
+                                2, cross);
+        }
+      xcb_map_window (conn, wins[i]);
+    }
+  raise_probe ();
+  sleep (1);
+
+  begin (name);
+  next = now_usecs ();
+  until = next + seconds * 1000000LL;
+  for (frame = 0; now_usecs () < until; frame++)
+    {
+      for (i = 0; i < 10; i++)
+        fill_window (wins[i], 96, 96, ((frame + i) * 0x010204) & 0xffffff);
+      result.events += 11;
+      measure_latency ();
+
+      next += 1000000 / fps;
+      if (next > now_usecs ())
+        usleep (next - now_usecs ());
+    }
+  end ();
+
+  destroy_windows (wins, 10);
+}
+
+static void properties (void)
+{
+  xcb_window_t wins[20];
+  long long until;
+  char name[32];
+  int i, len;
+
+  for (i = 0; i < 20; i++)
+    {
+      wins[i] = create_window ((i % 5) * 160, (i / 5) * 120, 160, 120,
+                               i * 0x0c0804, 0);
+      xcb_map_window (conn, wins[i]);
+    }
+  raise_probe ();
+  sleep (1);
+
+  begin ("properties");
+  for (until = now_usecs () + seconds * 1000000LL; now_usecs () < until; )
+    {
+      for (i = 0; i < 20; i++)
+        {
+          len = snprintf (name, sizeof (name), "bench %u", result.events);
+          xcb_change_property (conn, XCB_PROP_MODE_REPLACE, wins[i],
+                               XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8,
+                               len, name);
+          xcb_change_property (conn, XCB_PROP_MODE_REPLACE, wins[i],
+                               net_wm_name, utf8_string, 8, len, name);
+          result.events += 2;
+        }
+      roundtrip ();
+    }
+  measure_latency ();
+  end ();
+
+  destroy_windows (wins, 20);
+}
+
+static void propstorm (void)
+{
+  xcb_window_t wins[10];
+  long long until;
+  uint32_t value;
+  char name[32];
+  int i, len;
+
+  for (i = 0; i < 10; i++)
+    {
+      wins[i] = create_window ((i % 5) * 160, (i / 5) * 120, 160, 120,
+                               i * 0x140c08, 0);
+      xcb_map_window (conn, wins[i]);
+    }
+  raise_probe ();
+  sleep (1);
+
+  begin ("propstorm");
+  for (until = now_usecs () + seconds * 1000000LL; now_usecs () < until; )
+    {
+      for (i = 0; i < 10; i++)
+        {
+          len = snprintf (name, sizeof (name), "bench %u", result.events);
+          xcb_change_property (conn, XCB_PROP_MODE_REPLACE, wins[i],
+                               XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8,
+                               len, name);
+          xcb_change_property (conn, XCB_PROP_MODE_REPLACE, wins[i],
+                               net_wm_state, XCB_ATOM_ATOM, 32,
+                               result.events % 2, &net_wm_state_skip_taskbar);
+          value = (result.events / 4 % 4) * 90;
+          xcb_change_property (conn, XCB_PROP_MODE_REPLACE, wins[i],
+                               orientation_angle, XCB_ATOM_CARDINAL, 32,
+                               1, &value);
+          value = result.events % 2;
+          xcb_change_property (conn, XCB_PROP_MODE_REPLACE, wins[i],
+                               stacking_layer, XCB_ATOM_CARDINAL, 32,
+                               1, &value);
+          result.events += 4;
+        }
+      roundtrip ();
+    }
+  raise_probe ();
+  measure_latency ();
+  end ();
+
+  destroy_windows (wins, 10);
+}
+
+static void titleclock (void)
+{
+  xcb_window_t win;
+  long long until, next;
+  char name[32];
+  int len;
+
+  win = create_window (0, 0, 320, 240, 0x405060, 0);
+  xcb_map_window (conn, win);
+  raise_probe ();
+  sleep (1);
+
+  begin ("titleclock");
+  next = now_usecs ();
+  for (until = next + seconds * 1000000LL; now_usecs () < until; )
+    {
+      len = snprintf (name, sizeof (name), "clock %lld", next / 100000);
+      xcb_change_property (conn, XCB_PROP_MODE_REPLACE, win,
+                           XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, len, name);
+      xcb_flush (conn);
+      result.events++;
+
+      next += 100000;
+      if (next > now_usecs ())
+        usleep (next - now_usecs ());
+    }
+  measure_latency ();
+  end ();
+
+  destroy_windows (&win, 1);
+}
+
+static void activate (xcb_window_t win)
+{
+  xcb_client_message_event_t ev;
+
+  memset (&ev, 0, sizeof (ev));
+  ev.response_type = XCB_CLIENT_MESSAGE;
+  ev.format = 32;
+  ev.window = win;
+  ev.type = net_active_window;
+  ev.data.data32[0] = 2; /* from a pager */
+  ev.data.data32[1] = XCB_CURRENT_TIME;
+  xcb_send_event (conn, 0, screen->root,
+                  XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT
+                  | XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY, (const char *)&ev);
+  xcb_flush (conn);
+}
+
+static void switching (void)
+{
+  static const unsigned colors[] = { 0x0000ff, 0xffff00, 0xff00ff, 0x00ffff };
+  int cx = screen->width_in_pixels / 2, cy = screen->height_in_pixels / 2;
+  xcb_window_t wins[4];
+  long long until, t0;
+  int i;
+
+  for (i = 0; i < 4; i++)
+    {
+      wins[i] = create_window (0, 0, screen->width_in_pixels,
+                               screen->height_in_pixels, colors[i], 0);
+      xcb_map_window (conn, wins[i]);
+    }
+  xcb_flush (conn);
+  if (wait_for_pixel (cx, cy, colors[3], now_usecs ()) < 0)
+    fprintf (stderr, "switch: the applications didn't show up\n");
+  sleep (1);
+
+  begin ("switch");
+  until = now_usecs () + seconds * 1000000LL;
+  for (i = 0; now_usecs () < until; i = (i + 1) % 4)
+    {
+      t0 = now_usecs ();
+      activate (wins[i]);
+      result.events++;
+      add_latency (wait_for_pixel (cx, cy, colors[i], t0));
+    }
+  end ();
+
+  destroy_windows (wins, 4);
+}
+
+static int wanted (int argc, char *argv[], int first, const char *name)
+{
+  int i;
+
+  if (first >= argc)
+    return 1;
+  for (i = first; i < argc; i++)
+    if (!strcmp (argv[i], name))
+      return 1;
+  return 0;
+}
+
+int main (int argc, char *argv[])
+{
+  uint32_t value;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "t:p:")) != -1)
+    switch (opt)
+      {
+      case 't':
+        seconds = atoi (optarg);
+        break;
+      case 'p':
+        compositor = atoi (optarg);
+        break;
+      default:
+        seconds = 0;
+      }
+  if (seconds <= 0)
+    {
+      fprintf (stderr, "usage: %s [-t <seconds>] [-p <pid>] "
+               "[mapstorm|damage30|damage60|damage120|properties|"
+               "propstorm|titleclock|switch|shaped]...\n", argv[0]);
+      return 1;
+    }
+  if (!compositor && !(compositor = find_compositor ()))
+    {
+      fprintf (stderr, "mcompositor is not running\n");
+      return 1;
+    }
+  find_remote_control ();
+
+  conn = xcb_connect (NULL, NULL);
+  if (xcb_connection_has_error (conn))
+    {
+      fprintf (stderr, "couldn't open display\n");
+      return 1;
+    }
+  screen = xcb_setup_roots_iterator (xcb_get_setup (conn)).data;
+  net_active_window = intern ("_NET_ACTIVE_WINDOW");
+  net_wm_name = intern ("_NET_WM_NAME");
+  utf8_string = intern ("UTF8_STRING");
+  net_wm_window_type = intern ("_NET_WM_WINDOW_TYPE");
+  net_wm_window_type_normal = intern ("_NET_WM_WINDOW_TYPE_NORMAL");
+  net_wm_state = intern ("_NET_WM_STATE");
+  net_wm_state_skip_taskbar = intern ("_NET_WM_STATE_SKIP_TASKBAR");
+  orientation_angle = intern ("_MEEGOTOUCH_ORIENTATION_ANGLE");
+  stacking_layer = intern ("_MEEGO_STACKING_LAYER");
+
+  value = 0;
+  gc = xcb_generate_id (conn);
+  xcb_create_gc (conn, gc, screen->root, XCB_GC_FOREGROUND, &value);
+  probe = create_window (screen->width_in_pixels - PROBE_SIZE,
+                         screen->height_in_pixels - PROBE_SIZE,
+                         PROBE_SIZE, PROBE_SIZE, 0, 1);
+  xcb_map_window (conn, probe);
+  roundtrip ();
+  /* Let mcompositor settle down before measuring. */
+  sleep (1);
+
+  if (wanted (argc, argv, optind, "mapstorm"))
+    mapstorm ();
+  if (wanted (argc, argv, optind, "damage30"))
+    damage ("damage30", 30, 0);
+  if (wanted (argc, argv, optind, "damage60"))
+    damage ("damage60", 60, 0);
+  if (wanted (argc, argv, optind, "damage120"))
+    damage ("damage120", 120, 0);
+  if (wanted (argc, argv, optind, "properties"))
+    properties ();
+  if (wanted (argc, argv, optind, "propstorm"))
+    propstorm ();
+  if (wanted (argc, argv, optind, "titleclock"))
+    titleclock ();
+  if (wanted (argc, argv, optind, "switch"))
+    switching ();
+  if (wanted (argc, argv, optind, "shaped"))
+    damage ("shaped", 60, 1);
+
+  xcb_destroy_window (conn, probe);
+  xcb_disconnect (conn);
+  return 0;
+}
@@ -0,0 +1,23 @@
+TEMPLATE = app
+TARGET = mcompositor-bench
+
+target.path=/usr/bin
+
+QMAKE_CFLAGS+= -Wall
+
+LIBS+=-lxcb -lxcb-shape
+
+DEPENDPATH += .
+INCLUDEPATH += .  
+
+QT -= gui core
+
+SOURCES += bench.c
+
+# Runs the benchmarks on a private Xvfb.
+runner.files = mcompositor-bench-xvfb
+runner.path = /usr/bin
+
+INSTALLS +=  \
+        target \
+        runner
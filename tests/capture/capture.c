@@ -0,0 +1,169 @@
+/* Screen recorder of mcompositor.  Follows the shared memory ring the
+ * compositor captures its frames into (see mcapturering.h), puts the
+ * partial frames together and writes the complete frames to the
+ * standard output as raw top-down RGBA, ready to be piped into an
+ * encoder, eg.
+ *
+ *   echo capture /mcapture damage 15 > $XDG_RUNTIME_DIR/mcompositor-:0/mrc
+ *   mcompositor-capture /mcapture | ffmpeg -f rawvideo -pix_fmt rgba \
+ *       -s 864x480 -r 15 -i - out.mp4
+ *
+ * The remote control pipe is /tmp/mcompositor-<uid>-<display>/mrc
+ * without XDG_RUNTIME_DIR, and /tmp/mrc if the compositor was built with
+ * WINDOW_DEBUG.  The ring is only readable by the compositor's user.
+ *
+ * The size of the screen is printed to the standard error when the
+ * capture starts, and the number of frames lost when it ends, either
+ * after <frames> frames or when interrupted.
+ *
+ * Usage: mcompositor-capture <name> [<frames>]
+ *
+ * Compiling standalone:
+ * gcc -Wall -I../../src capture.c -o mcompositor-capture -lrt
+ *
+ * */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+
+#include "mcapturering.h"
+
+/* How often to look for new frames. */
+#define POLL_NSECS 5000000
+
+static volatile sig_atomic_t interrupted;
+
+static void interrupt(int sig)
+{
+    interrupted = 1;
+}
+
+/* Copies the pixels of frame @seq over @screen.  Returns whether
+ * the compositor has overwritten the frame meanwhile. */
+static int apply(struct mcapture_header *ring, uint32_t seq,
+                 unsigned char *screen)
+{
+    struct mcapture_slot *slot = mcapture_get_slot(ring, seq);
+    const unsigned char *pixels = (const unsigned char *) (slot + 1);
+    uint32_t x, y, w, h, row;
+
+    if (slot->sequence != seq)
+        return 0;
+    __sync_synchronize();
+    x = slot->x;
+    y = slot->y;
+    w = slot->width;
+    h = slot->height;
+    if (x + w > ring->width || y + h > ring->height)
+        return 0;
+
+    /* the rows in the ring are bottom-up */
+    for (row = 0; row < h; row++)
+        memcpy(&screen[((y + h - 1 - row) * ring->width + x) * 4],
+               &pixels[row * w * 4], w * 4);
+
+    __sync_synchronize();
+    return slot->sequence == seq;
+}
+
+int main(int argc, char *argv[])
+{
+    struct mcapture_header *ring;
+    struct timespec poll = { 0, POLL_NSECS };
+    struct stat st;
+    unsigned char *screen;
+    unsigned long frames, written, lost;
+    uint32_t seq, last;
+    size_t size;
+    int fd, synced;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <name> [<frames>]\n"
+                "start the capture first with \"capture <name>\" through "
+                "the remote control pipe of mcompositor,\n"
+                "$XDG_RUNTIME_DIR/mcompositor-<display>/mrc or "
+                "/tmp/mcompositor-<uid>-<display>/mrc\n", argv[0]);
+        return 1;
+    }
+    frames = argc > 2 ? strtoul(argv[2], NULL, 0) : 0;
+
+    if ((fd = shm_open(argv[1], O_RDONLY, 0)) < 0
+        || fstat(fd, &st) < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    ring = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    if ((size_t) st.st_size < sizeof(*ring)
+        || ring->magic != MCAPTURE_MAGIC
+        || ring->version != MCAPTURE_VERSION
+        || (size_t) st.st_size < sizeof(*ring)
+                                 + ring->nslots * ring->slot_size) {
+        fprintf(stderr, "%s: not a capture ring\n", argv[1]);
+        return 1;
+    }
+
+    size = ring->width * ring->height * 4;
+    if (!(screen = malloc(size))) {
+        perror("malloc");
+        return 1;
+    }
+    fprintf(stderr, "capturing %ux%u\n", ring->width, ring->height);
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+
+    /* Start from the last keyframe in the ring, and resynchronize
+     * on the next keyframe whenever we fall behind. */
+    written = lost = 0;
+    synced = 0;
+    last = 0;
+    while (!interrupted && (!frames || written < frames)) {
+        seq = ring->sequence;
+        if (seq == last) {
+            nanosleep(&poll, NULL);
+            continue;
+        }
+        if (!synced || seq - last > ring->nslots) {
+            /* find the newest keyframe still in the ring */
+            uint32_t key = seq;
+            while (key && seq - key < ring->nslots
+                   && !mcapture_get_slot(ring, key)->keyframe)
+                key--;
+            if (!key || seq - key >= ring->nslots) {
+                nanosleep(&poll, NULL);
+                continue;
+            }
+            if (last)
+                lost += key - last - 1;
+            last = key - 1;
+            synced = 1;
+        }
+        while (last != seq && (!frames || written < frames)) {
+            if (!apply(ring, ++last, screen)) {
+                /* overwritten, start over from a keyframe */
+                synced = 0;
+                nanosleep(&poll, NULL);
+                break;
+            }
+            if (fwrite(screen, size, 1, stdout) != 1) {
+                perror("fwrite");
+                return 1;
+            }
+            written++;
+        }
+    }
+
+    fprintf(stderr, "%lu frames written, %lu lost\n", written, lost);
+    return 0;
+}
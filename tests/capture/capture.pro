@@ -0,0 +1,18 @@
+TEMPLATE = app
+TARGET = mcompositor-capture
+
+target.path=/usr/bin
+
+QMAKE_CFLAGS+= -Wall
+
+LIBS+=-lrt
+
+DEPENDPATH += . ../../src
+INCLUDEPATH += . ../../src
+
+QT -= gui core
+
+SOURCES += capture.c
+
+INSTALLS +=  \
+        target
@@ -0,0 +1,83 @@
+#!/usr/bin/python
+
+# Check that mcompositor is idle while the display is off,
+# and it catches up when the display is turned on.
+
+#* Test steps
+#  * show an application window
+#  * turn the display off through the remote control interface
+#  * check that mcompositor doesn't wake up for 10 seconds
+#  * show another application window
+#  * turn the display on
+#* Post-conditions
+#  * the second application window is on top
+
+import os, re, sys, time
+
+if os.system('mcompositor-test-init.py'):
+  sys.exit(1)
+
+# Returns the number of times mcompositor has been scheduled.
+def wakeups(pid):
+  n = 0
+  for task in os.listdir('/proc/%s/task' % pid):
+    for l in open('/proc/%s/task/%s/status' % (pid, task)):
+      if l.startswith('voluntary_ctxt_switches') \
+         or l.startswith('nonvoluntary_ctxt_switches'):
+        n += int(l.split()[1])
+  return n
+
+# Fakes a display state change.
+def display(state):
+  fd = open('/tmp/mrc', 'w')
+  fd.write('display %s\n' % state)
+  fd.close()
+
+# faking the display state needs a WINDOW_DEBUG build
+if not os.path.exists('/tmp/mrc'):
+  print 'SKIP: /tmp/mrc is missing, mcompositor is not built with WINDOW_DEBUG'
+  sys.exit(0)
+
+pid = os.popen('pidof mcompositor').readline().split()[0]
+
+# create an application window
+fd = os.popen('windowctl kn')
+app1 = fd.readline().strip()
+time.sleep(2)
+
+display('off')
+time.sleep(2)
+
+ret = 0
+before = wakeups(pid)
+time.sleep(10)
+after = wakeups(pid)
+if after - before > 2:
+  print 'FAIL: mcompositor woke up %d times while idle' % (after - before)
+  ret = 1
+
+# create another application window while the display is off
+fd = os.popen('windowctl kn')
+app2 = fd.readline().strip()
+time.sleep(1)
+
+display('on')
+time.sleep(2)
+
+fd = os.popen('windowstack m')
+s = fd.read(5000)
+for l in s.splitlines():
+  if re.search('%s ' % app1, l.strip()):
+    print 'FAIL: second app is not on top after turning the display on'
+    print 'Failed stack:\n', s
+    ret = 1
+    break
+  elif re.search('%s ' % app2, l.strip()):
+    print app2, 'found'
+    break
+
+# cleanup
+os.popen('pkill windowctl')
+time.sleep(1)
+
+sys.exit(ret)
@@ -0,0 +1,94 @@
+#!/usr/bin/python
+
+# Check that the state exported through the remote control interface
+# is valid JSON and reflects the stacking order.
+
+#* Test steps
+#  * show an application window
+#  * export the state through the remote control interface
+#* Post-conditions
+#  * the export is valid JSON
+#  * the application window is in the window list and the stacking list
+#  * the export takes less than 50 ms
+
+import os, sys, time, json
+
+if os.system('mcompositor-test-init.py'):
+  sys.exit(1)
+
+# A WINDOW_DEBUG build listens on /tmp/mrc and exports where it's told,
+# a release build only into state.json of its private directory, which
+# is per user and display like runtime_dir() of mcompositor names it.
+if os.path.exists('/tmp/mrc'):
+  rc = '/tmp/mrc'
+  out = '/tmp/test24-state.json'
+  cmd = 'export %s\n' % out
+else:
+  display = os.environ.get('DISPLAY', '')
+  colon = display.rfind(':')
+  if '.' in display[colon:]:
+    display = display[:colon + display[colon:].index('.')]
+  display = display.replace('/', '_')
+  if os.environ.get('XDG_RUNTIME_DIR'):
+    rundir = '%s/mcompositor-%s' % (os.environ['XDG_RUNTIME_DIR'], display)
+  else:
+    rundir = '/tmp/mcompositor-%d-%s' % (os.getuid(), display)
+  rc = rundir + '/mrc'
+  out = rundir + '/state.json'
+  cmd = 'export\n'
+  if not os.path.exists(rc):
+    print 'FAIL: no remote control pipe in', rundir
+    sys.exit(1)
+
+# Exports the state into @out and returns it parsed.
+def export():
+  if os.path.exists(out):
+    os.unlink(out)
+  fd = open(rc, 'w')
+  fd.write(cmd)
+  fd.close()
+  for i in range(100):
+    if os.path.exists(out):
+      return json.load(open(out))
+    time.sleep(0.01)
+  return None
+
+# create an application window
+fd = os.popen('windowctl kn')
+app = int(fd.readline().strip(), 16)
+time.sleep(2)
+
+ret = 0
+t0 = time.time()
+state = export()
+t1 = time.time()
+if state is None:
+  print 'FAIL: no state was exported'
+  sys.exit(1)
+
+if app not in [w['id'] for w in state['windows']]:
+  print 'FAIL: app window 0x%x is not in the window list' % app
+  ret = 1
+if app not in state['stacking']:
+  print 'FAIL: app window 0x%x is not in the stacking list' % app
+  ret = 1
+for w in state['windows']:
+  if w['id'] == app and not w['resources']['pixmap']:
+    print 'FAIL: no graphics memory is accounted to 0x%x' % app
+    ret = 1
+if 'budget' not in state['resources']:
+  print 'FAIL: no graphics memory totals'
+  ret = 1
+if not state['properties']['requests']:
+  print 'FAIL: no property requests are counted'
+  ret = 1
+if t1 - t0 > 0.05:
+  print 'FAIL: exporting took %d ms' % ((t1 - t0) * 1000)
+  ret = 1
+
+# cleanup
+os.unlink(out)
+os.popen('pkill windowctl')
+time.sleep(1)
+
+sys.exit(ret)
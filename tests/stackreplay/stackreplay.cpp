@@ -0,0 +1,385 @@
+/* Replays the stacking traces recorded by mcompositor -trace=<file>
+ * (or the "trace <file>" remote control command) against the stacking
+ * rules, without an X server.  For each recorded event it prints the
+ * stacking order the rules produced and how long sorting took, and
+ * tells if it differs from what mcompositor did when it was recorded.
+ *
+ * With -fuzz <n> the input of every sort is shuffled <n> times and the
+ * results are checked for consistency: no window may be sorted below
+ * a window the rules say it should be above, and sorting the result
+ * again must not change it.  -synthetic <n> does the same with <n>
+ * random windows instead of a trace.
+ *
+ * Returns non-zero if the replay differed or the rules were found
+ * inconsistent, so it can be used as a regression test of changes of
+ * the stacking rules.
+ *
+ * Usage: stackreplay [-q] [-fuzz <n>] <trace>
+ *        stackreplay [-fuzz <n>] -synthetic <n>
+ *
+ * */
+
+#include <QtCore>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mstackingrules.h"
+#include "mstackingtrace.h"
+
+// What the trace says about the windows.
+class TraceSource: public MStackingRules::Source
+{
+public:
+    TraceSource(const MStackingRules::Atoms &atoms)
+        : atoms(atoms), decorated(0) {}
+
+    bool isKnown(Window w) const
+        { return state(w).flags & MStackingTrace::WindowState::Known; }
+    bool isDecorator(Window w) const
+        { return state(w).flags & MStackingTrace::WindowState::Decorator; }
+    bool isOverrideRedirect(Window w) const {
+        return state(w).flags
+            & MStackingTrace::WindowState::OverrideRedirect;
+    }
+    int windowState(Window w) const
+        { return state(w).wm_state; }
+    Atom windowTypeAtom(Window w) const
+        { return state(w).type; }
+    unsigned meegoStackingLayer(Window w) const
+        { return state(w).layer; }
+    bool hasNetWmState(Window w, Atom a) const {
+        if (a == atoms.state_above)
+            return state(w).flags & MStackingTrace::WindowState::StateAbove;
+        if (a == atoms.state_modal)
+            return state(w).flags & MStackingTrace::WindowState::StateModal;
+        return false;
+    }
+    Window transientFor(Window w) const
+        { return state(w).transient_for; }
+    Window lastVisibleParent(Window w) const
+        { return state(w).last_visible_parent; }
+    Window decoratedWindow() const
+        { return decorated; }
+
+    const MStackingTrace::WindowState &state(Window w) const {
+        static const MStackingTrace::WindowState unknown;
+        QHash<Window, MStackingTrace::WindowState>::const_iterator it =
+            states.find(w);
+        return it != states.end() ? *it : unknown;
+    }
+
+    MStackingRules::Atoms atoms;
+    QHash<Window, MStackingTrace::WindowState> states;
+    Window decorated;
+};
+
+static int fuzz_rounds;
+static unsigned fuzz_failures;
+
+static long long now_nsecs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static QString dump_windows(const QList<Window> &wins)
+{
+    QStringList strs;
+    for (int i = 0; i < wins.size(); ++i)
+        strs.append(QString().sprintf("0x%lx", wins[i]));
+    return strs.join(", ");
+}
+
+static const char *event_name(int type)
+{
+    static const char *names[] = {
+        "Error", "Reply", "KeyPress", "KeyRelease", "ButtonPress",
+        "ButtonRelease", "MotionNotify", "EnterNotify", "LeaveNotify",
+        "FocusIn", "FocusOut", "KeymapNotify", "Expose", "GraphicsExpose",
+        "NoExpose", "VisibilityNotify", "CreateNotify", "DestroyNotify",
+        "UnmapNotify", "MapNotify", "MapRequest", "ReparentNotify",
+        "ConfigureNotify", "ConfigureRequest", "GravityNotify",
+        "ResizeRequest", "CirculateNotify", "CirculateRequest",
+        "PropertyNotify", "SelectionClear", "SelectionRequest",
+        "SelectionNotify", "ColormapNotify", "ClientMessage",
+        "MappingNotify", "GenericEvent",
+    };
+    return type >= 0 && type < (int)(sizeof(names) / sizeof(names[0]))
+        ? names[type] : "extension event";
+}
+
+// Sorts @list with @source the way roughSort() does.
+// The rules refer to the list being sorted as the current stacking order.
+static void sort(const TraceSource &source, QList<Window> &list)
+{
+    MStackingRules(&source, source.atoms, &list).sort(list);
+}
+
+// Checks that @list is consistently sorted, complaining about the windows
+// which should be the other way round.
+static bool consistent(const TraceSource &source, const QList<Window> &list)
+{
+    MStackingRules rules(&source, source.atoms, &list);
+    bool ok = true;
+
+    for (int i = 0; i < list.size(); ++i)
+        for (int j = i + 1; j < list.size(); ++j)
+            if (rules.lessThan(list[j], list[i])) {
+                printf("  inconsistent: 0x%lx should be below 0x%lx in "
+                       "[%s]\n", list[j], list[i],
+                       dump_windows(list).toLatin1().constData());
+                ok = false;
+            }
+
+    QList<Window> again = list;
+    sort(source, again);
+    if (again != list) {
+        printf("  not invariant: [%s] -> [%s]\n",
+               dump_windows(list).toLatin1().constData(),
+               dump_windows(again).toLatin1().constData());
+        ok = false;
+    }
+    return ok;
+}
+
+// Sorts shuffled copies of @input and checks the results.
+static void fuzz(const TraceSource &source, const QList<Window> &input)
+{
+    for (int round = 0; round < fuzz_rounds; ++round) {
+        QList<Window> list = input;
+        for (int i = list.size() - 1; i > 0; --i)
+            list.swap(i, qrand() % (i + 1));
+        sort(source, list);
+        if (!consistent(source, list))
+            fuzz_failures++;
+    }
+}
+
+static int replay(const char *fname, bool quiet)
+{
+    QFile file(fname);
+    if (!file.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "%s: %s\n", fname,
+                file.errorString().toLocal8Bit().constData());
+        return 1;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_4_6);
+    quint32 magic, version, atoms[6];
+    in >> magic >> version;
+    if (magic != MStackingTrace::Magic
+        || version != MStackingTrace::Version) {
+        fprintf(stderr, "%s: not a stacking trace of version %d\n",
+                fname, MStackingTrace::Version);
+        return 1;
+    }
+    for (int i = 0; i < 6; ++i)
+        in >> atoms[i];
+    MStackingRules::Atoms a = {
+        atoms[0], atoms[1], atoms[2], atoms[3], atoms[4], atoms[5]
+    };
+    TraceSource source(a);
+
+    // Statistics of the events and of the current one.
+    unsigned nevents = 0, nsorts = 0, mismatches = 0;
+    long long recorded_usecs = 0, replayed_nsecs = 0, max_nsecs = 0;
+    bool in_event = false;
+    int ev_sorts = 0, ev_mismatches = 0;
+    long long ev_nsecs = 0;
+    QList<Window> ev_result;
+    quint8 ev_type = 0;
+    quint32 ev_window = 0, ev_serial = 0, ev_detail = 0;
+
+    while (!in.atEnd()) {
+        quint8 record;
+        in >> record;
+        if (in.status() != QDataStream::Ok)
+            break;
+
+        switch (record) {
+        case MStackingTrace::Event:
+            in >> ev_type >> ev_window >> ev_serial >> ev_detail;
+            in_event = true;
+            ev_sorts = ev_mismatches = 0;
+            ev_nsecs = 0;
+            ev_result.clear();
+            break;
+        case MStackingTrace::Snapshot: {
+            quint32 w;
+            MStackingTrace::WindowState state;
+            in >> w >> state;
+            source.states.insert(w, state);
+            break;
+        }
+        case MStackingTrace::Sort: {
+            quint32 decorated;
+            QList<quint32> input, output;
+            in >> decorated >> input >> output;
+            source.decorated = decorated;
+
+            QList<Window> list, expected;
+            foreach (quint32 w, input)
+                list.append(w);
+            foreach (quint32 w, output)
+                expected.append(w);
+            QList<Window> original = list;
+
+            long long t0 = now_nsecs();
+            sort(source, list);
+            long long t = now_nsecs() - t0;
+
+            nsorts++;
+            replayed_nsecs += t;
+            if (list != expected) {
+                mismatches++;
+                ev_mismatches++;
+                printf("  sort %u differs: [%s] -> [%s], recorded [%s]\n",
+                       nsorts, dump_windows(original).toLatin1().constData(),
+                       dump_windows(list).toLatin1().constData(),
+                       dump_windows(expected).toLatin1().constData());
+            }
+            if (fuzz_rounds)
+                fuzz(source, original);
+
+            if (in_event) {
+                ev_sorts++;
+                ev_nsecs += t;
+                ev_result = list;
+            } else if (!quiet)
+                printf("timer: sorted in %lld ns -> [%s]\n", t,
+                       dump_windows(list).toLatin1().constData());
+            max_nsecs = qMax(max_nsecs, t);
+            break;
+        }
+        case MStackingTrace::EventDone: {
+            quint32 usecs;
+            QList<quint32> stack;
+            in >> usecs >> stack;
+            nevents++;
+            recorded_usecs += usecs;
+            if (!quiet) {
+                printf("%u %s 0x%x", nevents, event_name(ev_type & 0x7f),
+                       ev_window);
+                if (ev_detail)
+                    printf(" (%u)", ev_detail);
+                printf(": %u us recorded", usecs);
+                if (ev_sorts)
+                    printf(", %d sort(s) in %lld ns -> [%s]%s", ev_sorts,
+                           ev_nsecs,
+                           dump_windows(ev_result).toLatin1().constData(),
+                           ev_mismatches ? " MISMATCH" : "");
+                printf("\n");
+                if (!stack.isEmpty()) {
+                    QList<Window> l;
+                    foreach (quint32 w, stack)
+                        l.append(w);
+                    printf("  stack: [%s]\n",
+                           dump_windows(l).toLatin1().constData());
+                }
+            }
+            in_event = false;
+            break;
+        }
+        default:
+            fprintf(stderr, "%s: corrupt trace, unknown record %d\n",
+                    fname, record);
+            return 1;
+        }
+    }
+
+    printf("%u events, %lld us processing recorded (%.1f us/event)\n",
+           nevents, recorded_usecs,
+           nevents ? (double)recorded_usecs / nevents : 0.0);
+    printf("%u sorts, %lld ns replayed (%.1f ns/sort, max %lld ns), "
+           "%u differ\n", nsorts, replayed_nsecs,
+           nsorts ? (double)replayed_nsecs / nsorts : 0.0, max_nsecs,
+           mismatches);
+    if (fuzz_rounds)
+        printf("%u inconsistent results in %u fuzzed sorts\n",
+               fuzz_failures, nsorts * fuzz_rounds);
+    return mismatches || fuzz_failures ? 1 : 0;
+}
+
+// Fuzzes the rules with @n random windows.
+static int synthetic(int n)
+{
+    MStackingRules::Atoms a = { 1, 2, 3, 4, 5, 6 };
+    // 0 stands for the normal window type
+    static const Atom types[] = { 0, 1, 2, 3, 4 };
+    TraceSource source(a);
+    QList<Window> list;
+
+    for (int i = 0; i < n; ++i) {
+        Window w = 0x100000 + i;
+        MStackingTrace::WindowState s;
+        s.flags = MStackingTrace::WindowState::Known;
+        if (qrand() % 8 == 0)
+            s.flags |= MStackingTrace::WindowState::OverrideRedirect;
+        if (qrand() % 8 == 0)
+            s.flags |= MStackingTrace::WindowState::StateAbove;
+        if (qrand() % 8 == 0)
+            s.flags |= MStackingTrace::WindowState::StateModal;
+        s.wm_state = qrand() % 4 ? NormalState : IconicState;
+        s.type = types[qrand() % 5];
+        s.layer = qrand() % 3 ? 0 : qrand() % 7;
+        if (i && qrand() % 4 == 0)
+            s.transient_for = 0x100000 + qrand() % i;
+        s.last_visible_parent = s.transient_for;
+        source.states.insert(w, s);
+        list.append(w);
+    }
+    // one of them is the decorator, decorating a random window
+    MStackingTrace::WindowState &deco = source.states[list.last()];
+    deco.flags |= MStackingTrace::WindowState::Decorator;
+    deco.transient_for = deco.last_visible_parent = 0;
+    source.decorated = list[qrand() % (n - 1)];
+
+    long long t0 = now_nsecs();
+    fuzz(source, list);
+    long long t = now_nsecs() - t0;
+    printf("%d windows: %u inconsistent results in %d fuzzed sorts "
+           "(%.1f us/sort)\n", n, fuzz_failures, fuzz_rounds,
+           fuzz_rounds ? t / 1000.0 / fuzz_rounds : 0.0);
+    return fuzz_failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *trace = 0;
+    bool quiet = false, usage = false;
+    int nsynthetic = 0;
+
+    qsrand(time(NULL));
+    for (int i = 1; i < argc && !usage; ++i) {
+        if (!strcmp(argv[i], "-q"))
+            quiet = true;
+        else if (!strcmp(argv[i], "-fuzz") && i + 1 < argc)
+            fuzz_rounds = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-synthetic") && i + 1 < argc)
+            nsynthetic = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && !trace)
+            trace = argv[i];
+        else
+            usage = true;
+    }
+
+    if (usage)
+        ;
+    else if (nsynthetic > 1) {
+        if (!fuzz_rounds)
+            fuzz_rounds = 100;
+        return synthetic(nsynthetic);
+    } else if (trace)
+        return replay(trace, quiet);
+
+    fprintf(stderr, "usage: %s [-q] [-fuzz <n>] <trace>\n"
+                    "       %s [-fuzz <n>] -synthetic <n>\n",
+            argv[0], argv[0]);
+    return 1;
+}
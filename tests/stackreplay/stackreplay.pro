@@ -0,0 +1,18 @@
+TEMPLATE = app
+TARGET = stackreplay
+
+target.path=/usr/bin
+
+QMAKE_CXXFLAGS+= -Wall
+
+QT -= gui
+
+# The stacking rules are compiled in from the compositor's sources.
+DEPENDPATH += . ../../src
+INCLUDEPATH += . ../../src
+
+HEADERS += ../../src/mstackingrules.h ../../src/mstackingtrace.h
+SOURCES += stackreplay.cpp ../../src/mstackingrules.cpp
+
+INSTALLS +=  \
+        target
@@ -2,6 +2,10 @@ TEMPLATE=subdirs
 
 SUBDIRS = windowctl \
           windowstack \
-          focus-tracker
+          focus-tracker \
+          atlasbench \
+          bench \
+          stackreplay \
+          capture
 #	  appinterface
 #          functional \